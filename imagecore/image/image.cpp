@@ -30,6 +30,7 @@
 #include "imagecore/image/grayscale.h"
 #include "imagecore/image/yuv.h"
 #include "internal/filters.h"
+#include "internal/workerpool.h"
 
 namespace imagecore {
 
@@ -345,26 +346,60 @@ IMAGEPLANE(void)::fillPadding(EEdgeMask edgeMask)
 	}
 }
 
-IMAGEPLANE(void)::reduceHalf(ImagePlane<Channels>* dest)
+IMAGEPLANE(void)::reduceHalf(ImagePlane<Channels>* dest, unsigned int threadCount)
 {
-	dest->setDimensions(m_Width / 2, m_Height / 2);
+	unsigned int destWidth = m_Width / 2;
+	dest->setDimensions(destWidth, m_Height / 2);
+	// Every output row only reads the two source rows below it, so stripes don't overlap.
+	const uint8_t* sourceBuffer = this->getBytes();
+	std::vector<unsigned int> stripes = WorkerPool::splitRows(m_Height / 2, threadCount);
+	std::vector<uint8_t*> destBuffers(stripes.size() - 1);
 	unsigned int destPitch = 0;
-	uint8_t* destBuffer = dest->lockRect(m_Width / 2, m_Height / 2, destPitch);
-	Filters<ComponentSIMD<Channels>>::reduceHalf(this->getBytes(), destBuffer, m_Width, m_Height, m_Pitch, destPitch, dest->getImageSize());
+	for( unsigned int i = 0; i < destBuffers.size(); i++ ) {
+		destBuffers[i] = dest->lockRect(0, stripes[i], destWidth, stripes[i + 1] - stripes[i], destPitch);
+	}
+	WorkerPool::getShared()->run(destBuffers.size(), threadCount, [&](unsigned int i) {
+		unsigned int rows = stripes[i + 1] - stripes[i];
+		Filters<ComponentSIMD<Channels>>::reduceHalf(sourceBuffer + SafeUMul(stripes[i] * 2, m_Pitch), destBuffers[i], m_Width, rows * 2, m_Pitch, destPitch, SafeUMul(destPitch, rows));
+	});
 	dest->unlockRect();
 }
 
-IMAGEPLANE(bool)::resize(ImagePlane<Channels>* dest, EResizeQuality quality)
+IMAGEPLANE(bool)::resize(ImagePlane<Channels>* dest, EResizeQuality quality, unsigned int threadCount)
+{
+	return resizeRotate(dest, quality, kImageOrientation_Up, threadCount);
+}
+
+IMAGEPLANE(bool)::resizeRotate(ImagePlane<Channels>* dest, EResizeQuality quality, EImageOrientation direction, unsigned int threadCount)
 {
-	if( dest->getWidth() == m_Width && dest->getHeight() == m_Height ) {
-		copy(dest);
+	// The destination has the final (rotated) dimensions, the resize itself happens in the source orientation.
+	bool transposed = direction == kImageOrientation_Left || direction == kImageOrientation_Right;
+	unsigned int destWidth = transposed ? dest->getHeight() : dest->getWidth();
+	unsigned int destHeight = transposed ? dest->getWidth() : dest->getHeight();
+	if( destWidth == m_Width && destHeight == m_Height ) {
+		if( direction == kImageOrientation_Up ) {
+			copy(dest);
+		} else {
+			rotate(dest, direction);
+		}
 		return true;
-	} else if( dest->getWidth() > m_Width || dest->getHeight() > m_Height ) {
+	} else if( destWidth > m_Width || destHeight > m_Height ) {
+		ImagePlane<Channels>* upsampled = dest;
+		if( direction != kImageOrientation_Up ) {
+			// The upsampler can't write rotated output.
+			upsampled = ImagePlane<Channels>::create(destWidth, destHeight, 0, 16);
+			if( upsampled == NULL ) {
+				return false;
+			}
+		}
 		ImagePlane<Channels>* workBuffer = NULL;
 		ImagePlane<Channels>* sourceImage = this;
 		if( m_Padding < 4 ) {
 			workBuffer = ImagePlane<Channels>::create(m_Width, m_Height, 4, 16);
 			if( workBuffer == NULL ) {
+				if( upsampled != dest ) {
+					delete upsampled;
+				}
 				return false;
 			}
 			copy(workBuffer);
@@ -372,10 +407,16 @@ IMAGEPLANE(bool)::resize(ImagePlane<Channels>* dest, EResizeQuality quality)
 		}
 		// Upsample.
 		EFilterType kernelType = Image::getUpsampleFilterKernelType(quality);
-		FilterKernelFixed filterKernelX(kernelType, this->getWidth(), dest->getWidth());
-		FilterKernelFixed filterKernelY(kernelType, this->getHeight(), dest->getHeight());
-		bool success = sourceImage->upsampleFilter4x4(dest, &filterKernelX, &filterKernelY);
+		FilterKernelFixed filterKernelX(kernelType, this->getWidth(), destWidth);
+		FilterKernelFixed filterKernelY(kernelType, this->getHeight(), destHeight);
+		bool success = sourceImage->upsampleFilter4x4(upsampled, &filterKernelX, &filterKernelY);
 		delete workBuffer;
+		if( upsampled != dest ) {
+			if( success ) {
+				upsampled->rotate(dest, direction);
+			}
+			delete upsampled;
+		}
 		return success;
 	} else {
 		// Downsample.
@@ -383,8 +424,6 @@ IMAGEPLANE(bool)::resize(ImagePlane<Channels>* dest, EResizeQuality quality)
 		EFilterType kernelType = Image::getDownsampleFilterKernelType(quality);
 		unsigned int kernelSize = Image::getDownsampleFilterKernelSize(quality);
 
-		unsigned int destWidth = dest->getWidth();
-		unsigned int destHeight = dest->getHeight();
 		ImagePlane<Channels>* workBuffer[2] = { NULL, NULL };
 		bool unpadded = false;
 		bool doneDownsampling = false;
@@ -405,10 +444,15 @@ IMAGEPLANE(bool)::resize(ImagePlane<Channels>* dest, EResizeQuality quality)
 			unsigned int whichWorkBuffer = 0;
 			while (!doneDownsampling && whichImage->getWidth() / 2 >= destWidth && whichImage->getHeight() / 2 >= destHeight) {
 				if ((whichImage->getWidth() / 2 == destWidth) && (whichImage->getHeight() / 2 == destHeight)) {
-					whichImage->reduceHalf(dest);
+					if( direction == kImageOrientation_Up ) {
+						whichImage->reduceHalf(dest, threadCount);
+					} else {
+						whichImage->reduceHalf(workBuffer[whichWorkBuffer], threadCount);
+						workBuffer[whichWorkBuffer]->rotate(dest, direction);
+					}
 					doneDownsampling = true; // for the case where reducehalf gets us the correct size
 				} else {
-					whichImage->reduceHalf(workBuffer[whichWorkBuffer]);
+					whichImage->reduceHalf(workBuffer[whichWorkBuffer], threadCount);
 					whichImage = workBuffer[whichWorkBuffer];
 					whichWorkBuffer ^= 1;
 				}
@@ -433,7 +477,21 @@ IMAGEPLANE(bool)::resize(ImagePlane<Channels>* dest, EResizeQuality quality)
 		} else {
 			FilterKernelAdaptive filterKernelX(kernelType, kernelSize, whichImage->getWidth(), destWidth);
 			FilterKernelAdaptive filterKernelY(kernelType, kernelSize, whichImage->getHeight(), destHeight);
-			success = whichImage->downsampleFilter(dest, &filterKernelX, &filterKernelY, unpadded);
+			if( direction == kImageOrientation_Up ) {
+				success = whichImage->downsampleFilter(dest, &filterKernelX, &filterKernelY, unpadded, threadCount);
+			} else if( kernelSize != 2 && kernelSize != 4 ) {
+				success = whichImage->downsampleFilterSeperableRotated(dest, &filterKernelX, &filterKernelY, unpadded, direction, threadCount);
+			} else {
+				// The 2x2 and 4x4 filters can't write rotated output.
+				ImagePlane<Channels>* downsampled = ImagePlane<Channels>::create(destWidth, destHeight, 0, 16);
+				if( downsampled != NULL ) {
+					success = whichImage->downsampleFilter(downsampled, &filterKernelX, &filterKernelY, unpadded, threadCount);
+					if( success ) {
+						downsampled->rotate(dest, direction);
+					}
+					delete downsampled;
+				}
+			}
 		}
 		// Only allocated if iterative reduction was performed.
 		delete workBuffer[0];
@@ -442,20 +500,40 @@ IMAGEPLANE(bool)::resize(ImagePlane<Channels>* dest, EResizeQuality quality)
 	}
 }
 
-IMAGEPLANE(bool)::downsampleFilter(ImagePlane<Channels> *dest, const FilterKernelAdaptive *filterKernelX, const FilterKernelAdaptive *filterKernelY, bool unpadded)
+IMAGEPLANE(bool)::downsampleFilter(ImagePlane<Channels> *dest, const FilterKernelAdaptive *filterKernelX, const FilterKernelAdaptive *filterKernelY, bool unpadded, unsigned int threadCount)
 {
 	if (filterKernelX->getKernelSize() == 2) {
 		// Special low quality but fast 2x2 bilinear filter, used for on device video transcoding
-		return downsampleFilter2x2(dest, filterKernelX, filterKernelY);
+		return downsampleFilter2x2(dest, filterKernelX, filterKernelY, threadCount);
 	} else if (filterKernelX->getKernelSize() == 4) {
 		// Special 4x4 non-seperable filter.
-		return downsampleFilter4x4(dest, filterKernelX, filterKernelY);
+		return downsampleFilter4x4(dest, filterKernelX, filterKernelY, threadCount);
 	} else {
-		return downsampleFilterSeperable(dest, filterKernelX, filterKernelY, unpadded);
+		return downsampleFilterSeperable(dest, filterKernelX, filterKernelY, unpadded, threadCount);
 	}
 }
 
-IMAGEPLANE(bool)::downsampleFilterSeperable(ImagePlane<Channels>* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY, bool unpadded)
+IMAGEPLANE(void)::adaptiveSeperable(ImagePlane<Channels>* dest, const FilterKernelAdaptive* filterKernel, bool unpadded, unsigned int threadCount)
+{
+	// The seperable filter writes its output transposed, each source row only feeds the destination column with
+	// the same index, so stripes of rows can be filtered independently, without any overlap.
+	const uint8_t* sourceBuffer = this->getBytes();
+	std::vector<unsigned int> stripes = WorkerPool::splitRows(m_Height, threadCount);
+	std::vector<uint8_t*> destBuffers(stripes.size() - 1);
+	unsigned int destPitch = 0;
+	unsigned int destHeight = dest->getHeight();
+	for( unsigned int i = 0; i < destBuffers.size(); i++ ) {
+		destBuffers[i] = dest->lockRect(stripes[i], 0, stripes[i + 1] - stripes[i], destHeight, destPitch);
+	}
+	WorkerPool::getShared()->run(destBuffers.size(), threadCount, [&](unsigned int i) {
+		unsigned int rows = stripes[i + 1] - stripes[i];
+		Filters<ComponentSIMD<Channels>>::adaptiveSeperable(filterKernel, sourceBuffer + SafeUMul(stripes[i], m_Pitch), m_Width, rows, m_Pitch,
+								   destBuffers[i], destHeight, rows, destPitch, SafeUMul(destPitch, destHeight), unpadded);
+	});
+	dest->unlockRect();
+}
+
+IMAGEPLANE(bool)::downsampleFilterSeperable(ImagePlane<Channels>* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY, bool unpadded, unsigned int threadCount)
 {
 	unsigned int padSize = max(filterKernelX->getKernelSize(), filterKernelY->getKernelSize());
 	SECURE_ASSERT((m_Padding >= padSize) || (unpadded));
@@ -463,49 +541,147 @@ IMAGEPLANE(bool)::downsampleFilterSeperable(ImagePlane<Channels>* dest, const Fi
 	if( temp == NULL ) {
 		return false;
 	}
-	unsigned int tempPitch = 0;
 	if( !unpadded ) {
 		fillPadding();
 	}
-	uint8_t* tempBuffer = temp->lockRect(temp->getWidth(), temp->getHeight(), tempPitch);
-	Filters<ComponentSIMD<Channels>>::adaptiveSeperable(filterKernelX, this->getBytes(), m_Width, m_Height, m_Pitch,
-							   tempBuffer, temp->getHeight(), temp->getWidth(), tempPitch, temp->getImageSize(), unpadded);
-	temp->unlockRect();
+	adaptiveSeperable(temp, filterKernelX, unpadded, threadCount);
 	if( !unpadded ) {
 		temp->fillPadding();
 	}
-	unsigned int destPitch = 0;
-	uint8_t* destBuffer = dest->lockRect(dest->getWidth(), dest->getHeight(), destPitch);
-	Filters<ComponentSIMD<Channels>>::adaptiveSeperable(filterKernelY, temp->getBytes(), temp->getWidth(), temp->getHeight(), temp->getPitch(),
-							   destBuffer, dest->getHeight(), dest->getWidth(), destPitch, dest->getImageSize(), unpadded);
-	dest->unlockRect();
+	temp->adaptiveSeperable(dest, filterKernelY, unpadded, threadCount);
 	delete temp;
 	return true;
 }
 
 
-IMAGEPLANE(bool)::downsampleFilter2x2(ImagePlane<Channels>* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY)
+IMAGEPLANE(bool)::downsampleFilterSeperableRotated(ImagePlane<Channels>* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY, bool unpadded, EImageOrientation direction, unsigned int threadCount)
 {
+	// Same two passes as downsampleFilterSeperable, except the vertical pass runs over narrow stripes of the
+	// intermediate image, and each stripe is rotated into the destination while it is still in cache.
+	static const unsigned int kStripeWidth = 16;
+	bool transposed = direction == kImageOrientation_Left || direction == kImageOrientation_Right;
+	unsigned int scaledWidth = transposed ? dest->getHeight() : dest->getWidth();
+	unsigned int scaledHeight = transposed ? dest->getWidth() : dest->getHeight();
+	unsigned int padSize = max(filterKernelX->getKernelSize(), filterKernelY->getKernelSize());
+	SECURE_ASSERT((m_Padding >= padSize) || (unpadded));
+	ImagePlane<Channels>* temp = ImagePlane<Channels>::create(m_Height, scaledWidth, padSize, 16U);
+	if( temp == NULL ) {
+		return false;
+	}
+	// Groups of narrow stripes are handed to the worker threads, each with its own stripe buffer.
+	std::vector<unsigned int> groups = WorkerPool::splitRows(scaledWidth, threadCount);
+	std::vector<ImagePlane<Channels>*> stripes(groups.size() - 1, NULL);
+	for( unsigned int i = 0; i < stripes.size(); i++ ) {
+		stripes[i] = ImagePlane<Channels>::create(kStripeWidth, scaledHeight, 0, 16U);
+		if( stripes[i] == NULL ) {
+			for( unsigned int j = 0; j < i; j++ ) {
+				delete stripes[j];
+			}
+			delete temp;
+			return false;
+		}
+	}
+	if( !unpadded ) {
+		fillPadding();
+	}
+	adaptiveSeperable(temp, filterKernelX, unpadded, threadCount);
+	if( !unpadded ) {
+		temp->fillPadding();
+	}
+	const uint8_t* tempBytes = temp->getBytes();
+	unsigned int tempPitch = temp->getPitch();
+	unsigned int tempWidth = temp->getWidth();
+	std::vector<uint8_t*> destBuffers;
 	unsigned int destPitch = 0;
+	for( unsigned int x = 0; x < scaledWidth; x += kStripeWidth ) {
+		unsigned int stripeWidth = min(kStripeWidth, scaledWidth - x);
+		if( direction == kImageOrientation_Right ) {
+			destBuffers.push_back(dest->lockRect(0, x, scaledHeight, stripeWidth, destPitch));
+		} else if( direction == kImageOrientation_Left ) {
+			destBuffers.push_back(dest->lockRect(0, scaledWidth - x - stripeWidth, scaledHeight, stripeWidth, destPitch));
+		} else {
+			destBuffers.push_back(dest->lockRect(scaledWidth - x - stripeWidth, 0, stripeWidth, scaledHeight, destPitch));
+		}
+	}
+	WorkerPool::getShared()->run(stripes.size(), threadCount, [&](unsigned int group) {
+		ImagePlane<Channels>* stripe = stripes[group];
+		for( unsigned int x = groups[group]; x < groups[group + 1]; x += kStripeWidth ) {
+			// Each row of the intermediate image is one column of the scaled image.
+			unsigned int stripeWidth = min(kStripeWidth, scaledWidth - x);
+			stripe->setDimensions(stripeWidth, scaledHeight);
+			unsigned int stripePitch = 0;
+			uint8_t* stripeBuffer = stripe->lockRect(stripeWidth, scaledHeight, stripePitch);
+			Filters<ComponentSIMD<Channels>>::adaptiveSeperable(filterKernelY, tempBytes + x * tempPitch, tempWidth, stripeWidth, tempPitch,
+									   stripeBuffer, scaledHeight, stripeWidth, stripePitch, stripe->getImageSize(), unpadded);
+			stripe->unlockRect();
+			uint8_t* destBuffer = destBuffers[x / kStripeWidth];
+			if( direction == kImageOrientation_Right ) {
+				Filters<ComponentSIMD<Channels>>::rotateRight(stripeBuffer, destBuffer, stripeWidth, scaledHeight, stripePitch, destPitch, SafeUMul(destPitch, stripeWidth));
+			} else if( direction == kImageOrientation_Left ) {
+				Filters<ComponentSIMD<Channels>>::rotateLeft(stripeBuffer, destBuffer, stripeWidth, scaledHeight, stripePitch, destPitch, SafeUMul(destPitch, stripeWidth));
+			} else {
+				Filters<ComponentSIMD<Channels>>::rotateUp(stripeBuffer, destBuffer, stripeWidth, scaledHeight, stripePitch, destPitch, SafeUMul(destPitch, scaledHeight));
+			}
+		}
+	});
+	dest->unlockRect();
+	for( unsigned int i = 0; i < stripes.size(); i++ ) {
+		delete stripes[i];
+	}
+	delete temp;
+	return true;
+}
+
+IMAGEPLANE(bool)::downsampleFilter2x2(ImagePlane<Channels>* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY, unsigned int threadCount)
+{
+	unsigned int destWidth = dest->getWidth();
 	fillPadding();
-	ImagePlane<Channels>* transposedDest = ImagePlane<Channels>::create(dest->getHeight(), dest->getWidth(), 0, 4);
-	uint8_t* destBuffer = transposedDest->lockRect(dest->getHeight(), dest->getWidth(), destPitch);
-	Filters<ComponentSIMD<Channels>>::adaptiveSeparable2x2(filterKernelX, filterKernelY, this->getBytes(), m_Width, m_Height, m_Pitch,
-												  destBuffer, dest->getWidth(), dest->getHeight(), destPitch, dest->getImageSize());
+	ImagePlane<Channels>* transposedDest = ImagePlane<Channels>::create(dest->getHeight(), destWidth, 0, 4);
+	const uint8_t* sourceBuffer = this->getBytes();
+	// Stripes of output rows, each transposed into the destination as soon as it is filtered. The source rows
+	// feeding neighbouring stripes overlap, which is fine since they are only read.
+	std::vector<unsigned int> stripes = WorkerPool::splitRows(dest->getHeight(), threadCount);
+	std::vector<uint8_t*> transposedBuffers(stripes.size() - 1);
+	std::vector<uint8_t*> destBuffers(stripes.size() - 1);
+	unsigned int transposedPitch = 0;
+	unsigned int destPitch = 0;
+	for( unsigned int i = 0; i < destBuffers.size(); i++ ) {
+		unsigned int rows = stripes[i + 1] - stripes[i];
+		transposedBuffers[i] = transposedDest->lockRect(stripes[i], 0, rows, destWidth, transposedPitch);
+		destBuffers[i] = dest->lockRect(0, stripes[i], destWidth, rows, destPitch);
+	}
+	SECURE_ASSERT((transposedPitch & 3) == 0); // multiple of 4 only
+	WorkerPool::getShared()->run(destBuffers.size(), threadCount, [&](unsigned int i) {
+		unsigned int rows = stripes[i + 1] - stripes[i];
+		FilterKernelAdaptive stripeKernelY(*filterKernelY, stripes[i]);
+		Filters<ComponentSIMD<Channels>>::adaptiveSeparable2x2(filterKernelX, &stripeKernelY, sourceBuffer, m_Width, m_Height, m_Pitch,
+													  transposedBuffers[i], destWidth, rows, transposedPitch, SafeUMul(transposedPitch, destWidth));
+		Filters<ComponentSIMD<Channels>>::transpose(transposedBuffers[i], destBuffers[i], rows, destWidth, transposedPitch, destPitch, SafeUMul(destPitch, rows));
+	});
 	transposedDest->unlockRect();
-	transposedDest->transpose(dest);
+	dest->unlockRect();
 	delete transposedDest;
 	return true;
 }
 
-IMAGEPLANE(bool)::downsampleFilter4x4(ImagePlane<Channels>* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY)
+IMAGEPLANE(bool)::downsampleFilter4x4(ImagePlane<Channels>* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY, unsigned int threadCount)
 {
 	SECURE_ASSERT(m_Padding >= 4);
-	unsigned int destPitch = 0;
+	unsigned int destWidth = dest->getWidth();
 	fillPadding();
-	uint8_t* destBuffer = dest->lockRect(dest->getWidth(), dest->getHeight(), destPitch);
-	Filters<ComponentSIMD<Channels>>::adaptive4x4(filterKernelX, filterKernelY, this->getBytes(), m_Width, m_Height, m_Pitch,
-						 destBuffer, dest->getWidth(), dest->getHeight(), destPitch, dest->getImageSize());
+	const uint8_t* sourceBuffer = this->getBytes();
+	std::vector<unsigned int> stripes = WorkerPool::splitRows(dest->getHeight(), threadCount);
+	std::vector<uint8_t*> destBuffers(stripes.size() - 1);
+	unsigned int destPitch = 0;
+	for( unsigned int i = 0; i < destBuffers.size(); i++ ) {
+		destBuffers[i] = dest->lockRect(0, stripes[i], destWidth, stripes[i + 1] - stripes[i], destPitch);
+	}
+	WorkerPool::getShared()->run(destBuffers.size(), threadCount, [&](unsigned int i) {
+		unsigned int rows = stripes[i + 1] - stripes[i];
+		FilterKernelAdaptive stripeKernelY(*filterKernelY, stripes[i]);
+		Filters<ComponentSIMD<Channels>>::adaptive4x4(filterKernelX, &stripeKernelY, sourceBuffer, m_Width, m_Height, m_Pitch,
+							 destBuffers[i], destWidth, rows, destPitch, SafeUMul(destPitch, rows));
+	});
 	dest->unlockRect();
 	return true;
 }
@@ -256,9 +256,13 @@ public:
 	void setPadding(unsigned int padding);
 	void setOffset(unsigned int offsetX, unsigned int offsetY);
 
-	bool resize(ImagePlane* dest, EResizeQuality quality);
-	void reduceHalf(ImagePlane* dest);
-	bool downsampleFilter(ImagePlane* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY, bool unpadded);
+	// With threadCount > 1, downsampling is split into stripes of rows that run on a shared pool of worker threads.
+	// The output is identical to the single threaded one. Upsampling always runs on the calling thread.
+	bool resize(ImagePlane* dest, EResizeQuality quality, unsigned int threadCount = 1);
+	// Resizes and rotates in one go, dest is expected to already have the rotated dimensions.
+	bool resizeRotate(ImagePlane* dest, EResizeQuality quality, EImageOrientation direction, unsigned int threadCount = 1);
+	void reduceHalf(ImagePlane* dest, unsigned int threadCount = 1);
+	bool downsampleFilter(ImagePlane* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY, bool unpadded, unsigned int threadCount = 1);
 	bool crop(const ImageRegion& boundingBox);
 	void rotate(ImagePlane* dest, EImageOrientation direction);
 	void transpose(ImagePlane* dest);
@@ -304,9 +308,11 @@ public:
 private:
 	ImagePlane(uint8_t* buffer, unsigned int capacity, bool ownsBuffer);
 	bool checkCapacity(unsigned int width, unsigned int height);
-	bool downsampleFilterSeperable(ImagePlane* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY, bool unpadded);
-	bool downsampleFilter4x4(ImagePlane* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY);
-	bool downsampleFilter2x2(ImagePlane* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY);
+	bool downsampleFilterSeperable(ImagePlane* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY, bool unpadded, unsigned int threadCount);
+	bool downsampleFilterSeperableRotated(ImagePlane* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY, bool unpadded, EImageOrientation direction, unsigned int threadCount);
+	bool downsampleFilter4x4(ImagePlane* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY, unsigned int threadCount);
+	bool downsampleFilter2x2(ImagePlane* dest, const FilterKernelAdaptive* filterKernelX, const FilterKernelAdaptive* filterKernelY, unsigned int threadCount);
+	void adaptiveSeperable(ImagePlane* dest, const FilterKernelAdaptive* filterKernel, bool unpadded, unsigned int threadCount);
 	bool upsampleFilter4x4(ImagePlane* dest, const FilterKernelFixed* filterKernelX, const FilterKernelFixed* filterKernelY);
 
 	static unsigned int paddingOffset(unsigned int pitch, unsigned int pad_amount);
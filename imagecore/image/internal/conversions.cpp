@@ -25,6 +25,7 @@
 #include "conversions.h"
 #include "platform_support.h"
 #include "imagecore/utils/mathtypes.h"
+#include "imagecore/utils/mathutils.h"
 
 bool ConversionsConfig::m_ScalarMode = false;
 
@@ -113,6 +114,61 @@ void Conversions<useIntrinsics>::rgba_to_yuv420(uint8_t* dstY, uint8_t* dstUV, c
 	}
 }
 
+// YUV to RGB in 6 bit fixed point, indexed by [matrix][fullRange]:
+//
+// R = yGain * (Y - yOffset)                 + rv * (V - 128)
+// G = yGain * (Y - yOffset) - gu * (U - 128) - gv * (V - 128)
+// B = yGain * (Y - yOffset) + bu * (U - 128)
+//
+// The intermediate sums fit in 16 bits except for the largest blue values, where the vector code saturates,
+// which still clamps to 255, so the vector and scalar paths produce identical output.
+struct YUVToRGBCoefficients
+{
+	int16_t yOffset;
+	int16_t yGain;
+	int16_t rv;
+	int16_t gu;
+	int16_t gv;
+	int16_t bu;
+};
+
+static const YUVToRGBCoefficients kYUVToRGBCoefficients[2][2] = {
+	{ { 16, 75, 102, 25, 52, 129 }, { 0, 64, 90, 22, 46, 113 } }, // BT.601
+	{ { 16, 75, 115, 14, 34, 135 }, { 0, 64, 101, 12, 30, 119 } }  // BT.709
+};
+
+static const YUVToRGBCoefficients& yuvToRGBCoefficients(imagecore::EYUVColorMatrix matrix, bool fullRange)
+{
+	return kYUVToRGBCoefficients[matrix == imagecore::kYUVColorMatrix_BT709 ? 1 : 0][fullRange ? 1 : 0];
+}
+
+static void yuv_to_rgb_row(uint8_t* dstRGB, const uint8_t* srcY, const uint8_t* srcU, const uint8_t* srcV, uint32_t startColumn, uint32_t endColumn, uint32_t uvStep, uint32_t uvShiftX, uint32_t components, const YUVToRGBCoefficients& c)
+{
+	for( uint32_t column = startColumn; column < endColumn; column++ ) {
+		uint32_t uvOffset = (column >> uvShiftX) * uvStep;
+		int32_t luma = (srcY[column] - c.yOffset) * c.yGain + 32;
+		int32_t u = srcU[uvOffset] - 128;
+		int32_t v = srcV[uvOffset] - 128;
+		uint8_t* output = dstRGB + column * components;
+		output[0] = (uint8_t)clamp(0, 255, (luma + c.rv * v) >> 6);
+		output[1] = (uint8_t)clamp(0, 255, (luma - c.gu * u - c.gv * v) >> 6);
+		output[2] = (uint8_t)clamp(0, 255, (luma + c.bu * u) >> 6);
+		if( components == 4 ) {
+			output[3] = 255;
+		}
+	}
+}
+
+template<bool useIntrinsics>
+void Conversions<useIntrinsics>::yuv_to_rgb(uint8_t* dstRGB, const uint8_t* srcY, const uint8_t* srcU, const uint8_t* srcV, uint32_t inputWidth, uint32_t inputHeight, uint32_t inputPitchY, uint32_t inputPitchUV, uint32_t uvStep, uint32_t uvShiftX, uint32_t uvShiftY, uint32_t outputPitch, uint32_t components, imagecore::EYUVColorMatrix matrix, bool fullRange)
+{
+	const YUVToRGBCoefficients& coefficients = yuvToRGBCoefficients(matrix, fullRange);
+	for( uint32_t row = 0; row < inputHeight; row++ ) {
+		uint32_t uvRow = row >> uvShiftY;
+		yuv_to_rgb_row(dstRGB + row * outputPitch, srcY + row * inputPitchY, srcU + uvRow * inputPitchUV, srcV + uvRow * inputPitchUV, 0, inputWidth, uvStep, uvShiftX, components, coefficients);
+	}
+}
+
 // forward template declarations
 template class Conversions<false>;
 template class Conversions<true>;
@@ -229,4 +285,68 @@ void Conversions<true>::rgba_to_yuv420(uint8_t* dstY, uint8_t* dstUV, const uint
 #endif
 	rgba_to_yuv420x4(dstY, dstUV, srcRGBA, inputWidth, inputHeight, inputPitch, outputPitchY, outputPitchUV);
 }
+// 8 pixels at a time, chroma subsampled horizontally by 2
+static void yuv_to_rgbx8(uint8_t* dstRGB, const uint8_t* srcY, const uint8_t* srcU, const uint8_t* srcV, uint32_t inputWidth, uint32_t inputHeight, uint32_t inputPitchY, uint32_t inputPitchUV, uint32_t uvStep, uint32_t uvShiftY, uint32_t outputPitch, uint32_t components, const YUVToRGBCoefficients& c)
+{
+	vSInt16 yOffset = v128_set_int16(c.yOffset);
+	vSInt16 yGain = v128_set_int16(c.yGain);
+	vSInt16 coeff_rv = v128_set_int16(c.rv);
+	vSInt16 coeff_gu = v128_set_int16(c.gu);
+	vSInt16 coeff_gv = v128_set_int16(c.gv);
+	vSInt16 coeff_bu = v128_set_int16(c.bu);
+	vSInt16 round = v128_set_int16(32);
+	vSInt16 uv_bias = v128_set_int16(128);
+	vSInt16 alpha = v128_set_int16(255);
+
+	uint32_t columns_processed = inputWidth & (~7);
+	for( uint32_t row = 0; row < inputHeight; row++ ) {
+		uint32_t uvRow = row >> uvShiftY;
+		uint8_t* outputRGB = dstRGB + row * outputPitch;
+		const uint8_t* inputY = srcY + row * inputPitchY;
+		const uint8_t* inputU = srcU + uvRow * inputPitchUV;
+		const uint8_t* inputV = srcV + uvRow * inputPitchUV;
+		for( uint32_t column = 0; column < columns_processed; column += 8 ) {
+			vSInt16 luma = v128_load_int8x8_to_int16(inputY + column);
+			luma = v128_add_saturate_int16(v128_mul_int16(v128_sub_int16(luma, yOffset), yGain), round);
+
+			vSInt16 u;
+			vSInt16 v;
+			if( uvStep == 2 ) {
+				vSInt16 u0v0u1v1u2v2u3v3 = v128_load_int8x8_to_int16(inputU + column);
+				u = v128_duplicate_even_int16(u0v0u1v1u2v2u3v3);
+				v = v128_duplicate_odd_int16(u0v0u1v1u2v2u3v3);
+			} else {
+				u = v128_duplicate_lo_int16(v128_load_int8x4_to_int16(inputU + column / 2));
+				v = v128_duplicate_lo_int16(v128_load_int8x4_to_int16(inputV + column / 2));
+			}
+			u = v128_sub_int16(u, uv_bias);
+			v = v128_sub_int16(v, uv_bias);
+
+			vSInt16 r = v128_shift_right_signed_int16<6>(v128_add_saturate_int16(luma, v128_mul_int16(v, coeff_rv)));
+			vSInt16 g = v128_shift_right_signed_int16<6>(v128_sub_int16(v128_sub_int16(luma, v128_mul_int16(u, coeff_gu)), v128_mul_int16(v, coeff_gv)));
+			vSInt16 b = v128_shift_right_signed_int16<6>(v128_add_saturate_int16(luma, v128_mul_int16(u, coeff_bu)));
+
+			if( components == 4 ) {
+				v128_store_interleaved_int16x4(outputRGB + column * 4, r, g, b, alpha);
+			} else {
+				v128_store_interleaved_int16x3(outputRGB + column * 3, r, g, b);
+			}
+		}
+		yuv_to_rgb_row(outputRGB, inputY, inputU, inputV, columns_processed, inputWidth, uvStep, 1, components, c);
+	}
+}
+
+template<>
+void Conversions<true>::yuv_to_rgb(uint8_t* dstRGB, const uint8_t* srcY, const uint8_t* srcU, const uint8_t* srcV, uint32_t inputWidth, uint32_t inputHeight, uint32_t inputPitchY, uint32_t inputPitchUV, uint32_t uvStep, uint32_t uvShiftX, uint32_t uvShiftY, uint32_t outputPitch, uint32_t components, imagecore::EYUVColorMatrix matrix, bool fullRange)
+{
+	bool scalar = ConversionsConfig::m_ScalarMode || uvShiftX != 1 || (components != 3 && components != 4);
+#if IMAGECORE_DETECT_SSE
+	scalar = scalar || !checkForCPUSupport(kCPUFeature_SSE4_1);
+#endif
+	if( scalar ) {
+		Conversions<false>::yuv_to_rgb(dstRGB, srcY, srcU, srcV, inputWidth, inputHeight, inputPitchY, inputPitchUV, uvStep, uvShiftX, uvShiftY, outputPitch, components, matrix, fullRange);
+		return;
+	}
+	yuv_to_rgbx8(dstRGB, srcY, srcU, srcV, inputWidth, inputHeight, inputPitchY, inputPitchUV, uvStep, uvShiftY, outputPitch, components, yuvToRGBCoefficients(matrix, fullRange));
+}
 #endif
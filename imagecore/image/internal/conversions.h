@@ -27,6 +27,7 @@
 #include "imagecore/imagecore.h"
 #include "imagecore/image/kernel.h"
 #include "imagecore/image/image.h"
+#include "imagecore/image/yuv.h"
 
 template<bool useIntrinsics>
 class Conversions
@@ -38,6 +39,10 @@ class Conversions
 		// converts a single rgb value to yuv
 		static void rgb_to_yuv(int16_t& y, int16_t& u, int16_t& v, uint8_t r, uint8_t g, uint8_t b);
 
+		// converts yuv to packed rgb (components == 3) or rgba (components == 4, opaque), chroma is upsampled by replication;
+		// uvStep is 1 for planar chroma and 2 for semiplanar (srcV == srcU + 1), uvShiftX / uvShiftY are the chroma subsampling shifts
+		static void yuv_to_rgb(uint8_t* dstRGB, const uint8_t* srcY, const uint8_t* srcU, const uint8_t* srcV, uint32_t inputWidth, uint32_t inputHeight, uint32_t inputPitchY, uint32_t inputPitchUV, uint32_t uvStep, uint32_t uvShiftX, uint32_t uvShiftY, uint32_t outputPitch, uint32_t components, imagecore::EYUVColorMatrix matrix, bool fullRange);
+
 	private:
 		static const int16_t yr = 76;
 		static const int16_t yg = 150;
@@ -65,5 +70,6 @@ class ConversionsConfig
 
 // SIMD specializations.
 template<> void Conversions<true>::rgba_to_yuv420(uint8_t* dstY, uint8_t* dstUV, const uint8_t* srcRGBA, uint32_t inputWidth, uint32_t inputHeight, uint32_t inputPitch, uint32_t outputPitchY, uint32_t outputPitchUV);
+template<> void Conversions<true>::yuv_to_rgb(uint8_t* dstRGB, const uint8_t* srcY, const uint8_t* srcU, const uint8_t* srcV, uint32_t inputWidth, uint32_t inputHeight, uint32_t inputPitchY, uint32_t inputPitchUV, uint32_t uvStep, uint32_t uvShiftX, uint32_t uvShiftY, uint32_t outputPitch, uint32_t components, imagecore::EYUVColorMatrix matrix, bool fullRange);
 
 #endif
@@ -146,12 +146,47 @@ inline vUInt8x8 v64_load(vSInt32, const vSInt32* mem_addr)
 	return vld1_u8((uint8_t const *)mem_addr);
 }
 
+// zero extends 8 bytes to 8 x int16
+inline vSInt16 v128_load_int8x8_to_int16(const uint8_t* mem_addr)
+{
+	return vreinterpretq_s16_u16(vmovl_u8(vld1_u8(mem_addr)));
+}
+
+// zero extends 4 bytes to the low 4 x int16, the upper lanes are undefined
+inline vSInt16 v128_load_int8x4_to_int16(const uint8_t* mem_addr)
+{
+	uint32x2_t word = vdup_n_u32(0);
+	word = vld1_lane_u32((const uint32_t*)mem_addr, word, 0);
+	return vreinterpretq_s16_u16(vmovl_u8(vreinterpret_u8_u32(word)));
+}
+
 // store
 inline void v64_store(vSInt32* mem_addr, vUInt8x8 a)
 {
 	vst1_u8((uint8_t*)mem_addr, a);
 }
 
+// packs with unsigned saturation and stores 8 interleaved 4 byte pixels
+inline void v128_store_interleaved_int16x4(uint8_t* mem_addr, vSInt16 a, vSInt16 b, vSInt16 c, vSInt16 d)
+{
+	uint8x8x4_t pixels;
+	pixels.val[0] = vqmovun_s16(a);
+	pixels.val[1] = vqmovun_s16(b);
+	pixels.val[2] = vqmovun_s16(c);
+	pixels.val[3] = vqmovun_s16(d);
+	vst4_u8(mem_addr, pixels);
+}
+
+// packs with unsigned saturation and stores 8 interleaved 3 byte pixels
+inline void v128_store_interleaved_int16x3(uint8_t* mem_addr, vSInt16 a, vSInt16 b, vSInt16 c)
+{
+	uint8x8x3_t pixels;
+	pixels.val[0] = vqmovun_s16(a);
+	pixels.val[1] = vqmovun_s16(b);
+	pixels.val[2] = vqmovun_s16(c);
+	vst3_u8(mem_addr, pixels);
+}
+
 // conversions
 inline int32_t v128_convert_to_int32(vUInt8 a)
 {
@@ -185,6 +220,16 @@ inline vSInt16 v128_mul_int16(vSInt16 a, vSInt16 b)
 	return vmulq_s16(a, b);
 }
 
+inline vSInt16 v128_add_saturate_int16(vSInt16 a, vSInt16 b)
+{
+	return vqaddq_s16(a, b);
+}
+
+inline vSInt16 v128_sub_int16(vSInt16 a, vSInt16 b)
+{
+	return vsubq_s16(a, b);
+}
+
 inline vUInt8x8 v64_add_int16(vUInt8x8 a, vUInt8x8 b)
 {
 	return vadd_u16(a, b);
@@ -237,6 +282,12 @@ inline vUInt16 v128_shift_right_unsigned_int16(vUInt16 a)
 	return vshrq_n_u16(a, imm);
 }
 
+template<int imm>
+inline vSInt16 v128_shift_right_signed_int16(vSInt16 a)
+{
+	return vshrq_n_s16(a, imm);
+}
+
 template<int imm>
 inline vUInt8x8 v64_shift_right_unsigned_int16(vUInt8x8 a)
 {
@@ -257,6 +308,24 @@ inline vUInt8x8 v64_shuffle_int8(vUInt8x8 a, vUInt8x8 b)
 	return vtbl1_u8(a, b);
 }
 
+// a0 a0 a1 a1 a2 a2 a3 a3
+inline vSInt16 v128_duplicate_lo_int16(vSInt16 a)
+{
+	return vzipq_s16(a, a).val[0];
+}
+
+// a0 a0 a2 a2 a4 a4 a6 a6
+inline vSInt16 v128_duplicate_even_int16(vSInt16 a)
+{
+	return vtrnq_s16(a, a).val[0];
+}
+
+// a1 a1 a3 a3 a5 a5 a7 a7
+inline vSInt16 v128_duplicate_odd_int16(vSInt16 a)
+{
+	return vtrnq_s16(a, a).val[1];
+}
+
 // special case for compatibility with sse
 inline void v128_swizzleAndUnpack(vUInt16& a, vUInt16& b, vUInt8 c, vSInt32)
 {
@@ -158,6 +158,18 @@ inline v128i v128_load_unaligned(const vSInt32* mem_addr)
 	return _mm_lddqu_si128((const __m128i*)mem_addr);
 }
 
+// zero extends 8 bytes to 8 x int16
+inline v128i v128_load_int8x8_to_int16(const uint8_t* mem_addr)
+{
+	return _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)mem_addr));
+}
+
+// zero extends 4 bytes to the low 4 x int16, the upper lanes are undefined
+inline v128i v128_load_int8x4_to_int16(const uint8_t* mem_addr)
+{
+	return _mm_cvtepu8_epi16(_mm_cvtsi32_si128(*(const int32_t*)mem_addr));
+}
+
 // store
 inline void v64_store(vSInt32* mem_addr, v128i a)
 {
@@ -169,6 +181,27 @@ inline void v128_store_unaligned(vSInt32* mem_addr, v128i a)
 	_mm_storeu_si128 ((__m128i*) mem_addr, a);
 }
 
+// packs with unsigned saturation and stores 8 interleaved 4 byte pixels
+inline void v128_store_interleaved_int16x4(uint8_t* mem_addr, v128i a, v128i b, v128i c, v128i d)
+{
+	v128i ab = _mm_unpacklo_epi8(_mm_packus_epi16(a, a), _mm_packus_epi16(b, b));
+	v128i cd = _mm_unpacklo_epi8(_mm_packus_epi16(c, c), _mm_packus_epi16(d, d));
+	_mm_storeu_si128((__m128i*)mem_addr, _mm_unpacklo_epi16(ab, cd));
+	_mm_storeu_si128((__m128i*)(mem_addr + 16), _mm_unpackhi_epi16(ab, cd));
+}
+
+// packs with unsigned saturation and stores 8 interleaved 3 byte pixels
+inline void v128_store_interleaved_int16x3(uint8_t* mem_addr, v128i a, v128i b, v128i c)
+{
+	const v128i drop = _mm_set_epi8(ZMASK, ZMASK, ZMASK, ZMASK, 14, 13, 12, 10, 9, 8, 6, 5, 4, 2, 1, 0);
+	v128i ab = _mm_unpacklo_epi8(_mm_packus_epi16(a, a), _mm_packus_epi16(b, b));
+	v128i cc = _mm_unpacklo_epi8(_mm_packus_epi16(c, c), _mm_setzero_si128());
+	v128i lo = _mm_shuffle_epi8(_mm_unpacklo_epi16(ab, cc), drop);
+	v128i hi = _mm_shuffle_epi8(_mm_unpackhi_epi16(ab, cc), drop);
+	_mm_storeu_si128((__m128i*)mem_addr, _mm_or_si128(lo, _mm_slli_si128(hi, 12)));
+	_mm_storel_epi64((__m128i*)(mem_addr + 16), _mm_srli_si128(hi, 4));
+}
+
 // conversions
 inline int32_t v128_convert_to_int32(v128i a)
 {
@@ -212,6 +245,16 @@ inline v128i v128_add_int16(v128i a, v128i b)
 	return _mm_add_epi16(a, b);
 }
 
+inline v128i v128_add_saturate_int16(v128i a, v128i b)
+{
+	return _mm_adds_epi16(a, b);
+}
+
+inline v128i v128_sub_int16(v128i a, v128i b)
+{
+	return _mm_sub_epi16(a, b);
+}
+
 inline v128i v128_add_int32(v128i a, v128i b)
 {
 	return _mm_add_epi32(a, b);
@@ -286,6 +329,12 @@ inline v128i v128_shift_right_unsigned_int16(v128i a)
 	return _mm_srli_epi16(a, imm);
 }
 
+template<int imm>
+inline v128i v128_shift_right_signed_int16(v128i a)
+{
+	return _mm_srai_epi16(a, imm);
+}
+
 template<int imm8>
 inline v128i v128_shift_right_unsigned_vec128(v128i a)
 {
@@ -315,6 +364,24 @@ inline v128i v128_merge(v128i a, v128i b)
 	return _mm_shuffle_epi8(a, b);
 }
 
+// a0 a0 a1 a1 a2 a2 a3 a3
+inline v128i v128_duplicate_lo_int16(v128i a)
+{
+	return _mm_unpacklo_epi16(a, a);
+}
+
+// a0 a0 a2 a2 a4 a4 a6 a6
+inline v128i v128_duplicate_even_int16(v128i a)
+{
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, V128_SHUFFLE(2, 2, 0, 0)), V128_SHUFFLE(2, 2, 0, 0));
+}
+
+// a1 a1 a3 a3 a5 a5 a7 a7
+inline v128i v128_duplicate_odd_int16(v128i a)
+{
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, V128_SHUFFLE(3, 3, 1, 1)), V128_SHUFFLE(3, 3, 1, 1));
+}
+
 // special cases for cross platform compatibility
 inline void v128_swizzleAndUnpack(vUInt16& a, vUInt16& b, vUInt8 c, vSInt32 zero)
 {
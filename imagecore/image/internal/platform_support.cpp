@@ -24,7 +24,7 @@
 
 #include "platform_support.h"
 
-#if IMAGECORE_DETECT_SSE && __SSE4_1__
+#if defined(__i386__) || defined(__x86_64__)
 
 #include "cpuid.h"
 
@@ -53,16 +53,21 @@ static unsigned int checkCPUFeatures() {
 	if( (ecx & (1 << 20)) != 0 ) {
 		features |= kCPUFeature_SSE4_2;
 	}
-	/*
-	 // AVX currently unused.
-	 if( (ecx & (1 << 28)) != 0 && (ecx & (1 << 27)) != 0 && (ecx & (1 << 26)) != 0 ) {
-	 __asm__ __volatile__
-	 (".byte 0x0f, 0x01, 0xd0": "=a" (eax), "=d" (edx) : "c" (0) : "cc");
-	 if( (eax & 6) == 6 ) {
-	 features |= kCPUFeature_AVX;
-	 }
-	 }
-	 */
+	// AVX requires the OS to save the YMM state (OSXSAVE + XCR0 bits 1 and 2)
+	if( (ecx & (1 << 28)) != 0 && (ecx & (1 << 27)) != 0 ) {
+		unsigned int xcr0 = 0;
+		unsigned int xcr0_high = 0;
+		__asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0" : "=a" (xcr0), "=d" (xcr0_high) : "c" (0) : "cc");
+		if( (xcr0 & 6) == 6 ) {
+			features |= kCPUFeature_AVX;
+			if( __get_cpuid_max(0, 0) >= 7 ) {
+				__cpuid_count(7, 0, eax, ebx, ecx, edx);
+				if( (ebx & (1 << 5)) != 0 ) {
+					features |= kCPUFeature_AVX2;
+				}
+			}
+		}
+	}
 	return features;
 }
 
@@ -0,0 +1,152 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "imagecore/imagecore.h"
+#include "imagecore/utils/mathutils.h"
+#include "workerpool.h"
+
+namespace imagecore {
+
+WorkerPool* WorkerPool::getShared()
+{
+	static WorkerPool s_Pool;
+	return &s_Pool;
+}
+
+WorkerPool::WorkerPool()
+:	m_Exiting(false)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Exiting = true;
+	}
+	m_WorkAvailable.notify_all();
+	for( unsigned int i = 0; i < m_Threads.size(); i++ ) {
+		m_Threads[i].join();
+	}
+}
+
+WorkerPool::Batch* WorkerPool::findBatch()
+{
+	// Oldest batch first, skipping the ones that already have as many workers as their caller asked for.
+	for( unsigned int i = 0; i < m_Batches.size(); i++ ) {
+		Batch* batch = m_Batches[i];
+		if( batch->nextJob < batch->jobCount && batch->workers < batch->maxWorkers ) {
+			return batch;
+		}
+	}
+	return NULL;
+}
+
+void WorkerPool::workerMain()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while( true ) {
+		Batch* batch = findBatch();
+		if( batch == NULL ) {
+			if( m_Exiting ) {
+				return;
+			}
+			m_WorkAvailable.wait(lock);
+			continue;
+		}
+		batch->workers++;
+		while( batch->nextJob < batch->jobCount ) {
+			unsigned int jobIndex = batch->nextJob++;
+			lock.unlock();
+			(*batch->job)(jobIndex);
+			lock.lock();
+			batch->finishedJobs++;
+		}
+		batch->workers--;
+		if( batch->finishedJobs == batch->jobCount ) {
+			m_BatchFinished.notify_all();
+		}
+	}
+}
+
+void WorkerPool::run(unsigned int jobCount, unsigned int threadCount, const std::function<void(unsigned int)>& job)
+{
+	threadCount = min(min(threadCount, jobCount), kMaxThreads);
+	if( threadCount <= 1 ) {
+		for( unsigned int i = 0; i < jobCount; i++ ) {
+			job(i);
+		}
+		return;
+	}
+
+	Batch batch;
+	batch.job = &job;
+	batch.jobCount = jobCount;
+	batch.nextJob = 0;
+	batch.finishedJobs = 0;
+	batch.maxWorkers = threadCount - 1;
+	batch.workers = 0;
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while( m_Threads.size() < threadCount - 1 ) {
+		m_Threads.push_back(std::thread(&WorkerPool::workerMain, this));
+	}
+	m_Batches.push_back(&batch);
+	m_WorkAvailable.notify_all();
+
+	// The calling thread works on its own batch too, then waits for the jobs still running on the pool.
+	while( batch.nextJob < batch.jobCount ) {
+		unsigned int jobIndex = batch.nextJob++;
+		lock.unlock();
+		job(jobIndex);
+		lock.lock();
+		batch.finishedJobs++;
+	}
+	while( batch.finishedJobs < batch.jobCount ) {
+		m_BatchFinished.wait(lock);
+	}
+	for( unsigned int i = 0; i < m_Batches.size(); i++ ) {
+		if( m_Batches[i] == &batch ) {
+			m_Batches.erase(m_Batches.begin() + i);
+			break;
+		}
+	}
+}
+
+std::vector<unsigned int> WorkerPool::splitRows(unsigned int rowCount, unsigned int threadCount)
+{
+	unsigned int stripeCount = max(1U, min(min(threadCount, kMaxThreads), rowCount / kMinStripeRows));
+	unsigned int stripeRows = align((rowCount + stripeCount - 1) / stripeCount, kStripeAlignment);
+	std::vector<unsigned int> stripes;
+	for( unsigned int row = 0; row < rowCount; row += stripeRows ) {
+		stripes.push_back(row);
+	}
+	if( stripes.empty() ) {
+		stripes.push_back(0);
+	}
+	stripes.push_back(rowCount);
+	return stripes;
+}
+
+}
@@ -0,0 +1,78 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace imagecore {
+
+// Process wide pool of threads used to run stripes of a single image operation concurrently.
+class WorkerPool
+{
+public:
+	static WorkerPool* getShared();
+
+	~WorkerPool();
+
+	// Runs job(0) to job(jobCount - 1) on at most threadCount threads, the calling thread being one of them,
+	// and returns once all of them have finished.
+	void run(unsigned int jobCount, unsigned int threadCount, const std::function<void(unsigned int)>& job);
+
+	// Splits rowCount rows into at most threadCount stripes, all but the last one a multiple of kStripeAlignment rows,
+	// since the SIMD filters work on groups of up to 16 rows. Returns the first row of each stripe followed by rowCount.
+	static std::vector<unsigned int> splitRows(unsigned int rowCount, unsigned int threadCount);
+
+	static const unsigned int kStripeAlignment = 16;
+	static const unsigned int kMinStripeRows = 32;
+	static const unsigned int kMaxThreads = 64;
+
+private:
+	struct Batch
+	{
+		const std::function<void(unsigned int)>* job;
+		unsigned int jobCount;
+		unsigned int nextJob;
+		unsigned int finishedJobs;
+		unsigned int maxWorkers;
+		unsigned int workers;
+	};
+
+	WorkerPool();
+	void workerMain();
+	Batch* findBatch();
+
+	std::mutex m_Mutex;
+	std::condition_variable m_WorkAvailable;
+	std::condition_variable m_BatchFinished;
+	std::vector<Batch*> m_Batches;
+	std::vector<std::thread> m_Threads;
+	bool m_Exiting;
+};
+
+}
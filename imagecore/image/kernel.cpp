@@ -139,6 +139,7 @@ FilterFunction s_FilterFunctionsFixed[kFilterType_MAX] = { lanczos_fixed, lanczo
 
 FilterKernel::FilterKernel()
 {
+	m_OwnsTables = true;
 	m_InSampleOffset = 0;
 	m_OutSampleOffset = 0;
 	m_SampleRatio = 1.0f;
@@ -186,10 +187,12 @@ void FilterKernel::setSampleOffset(unsigned int inSampleOffset, unsigned int out
 
 FilterKernel::~FilterKernel()
 {
-	delete[] m_Table;
-	delete[] m_TableBilinear;
-	delete[] m_TableFixedPoint;
-	delete[] m_TableFixedPoint4;
+	if( m_OwnsTables ) {
+		delete[] m_Table;
+		delete[] m_TableBilinear;
+		delete[] m_TableFixedPoint;
+		delete[] m_TableFixedPoint4;
+	}
 }
 
 // Uses a dynamic number of taps per sample, based on on the filter window size and the scaling factor.
@@ -246,6 +249,24 @@ FilterKernelAdaptive::FilterKernelAdaptive(EFilterType type, unsigned int kernel
 	generateFixedPoint(type);
 }
 
+FilterKernelAdaptive::FilterKernelAdaptive(const FilterKernelAdaptive& kernel, unsigned int outSampleOffset)
+:	FilterKernel()
+{
+	m_OwnsTables = false;
+	m_InSampleOffset = kernel.m_InSampleOffset;
+	m_OutSampleOffset = SafeUAdd(kernel.m_OutSampleOffset, outSampleOffset);
+	SECURE_ASSERT(m_OutSampleOffset <= kernel.m_TableSize);
+	m_KernelSize = kernel.m_KernelSize;
+	m_TableSize = kernel.m_TableSize;
+	m_MaxSamples = kernel.m_MaxSamples;
+	m_WindowWidth = kernel.m_WindowWidth;
+	m_SampleRatio = kernel.m_SampleRatio;
+	m_Table = kernel.m_Table;
+	m_TableBilinear = kernel.m_TableBilinear;
+	m_TableFixedPoint = kernel.m_TableFixedPoint;
+	m_TableFixedPoint4 = kernel.m_TableFixedPoint4;
+}
+
 // Always takes 4 fixed samples, regardless of the scaling factor.
 FilterKernelFixed::FilterKernelFixed(EFilterType type, unsigned int inSize, unsigned int outSize)
 :	FilterKernel()
@@ -86,6 +86,7 @@ public:
 
 protected:
 	void generateFixedPoint(EFilterType type);
+	bool m_OwnsTables;
 	unsigned int m_InSampleOffset;
 	unsigned int m_OutSampleOffset;
 	unsigned int m_KernelSize;
@@ -103,6 +104,9 @@ class FilterKernelAdaptive : public FilterKernel
 {
 public:
 	FilterKernelAdaptive(EFilterType type, unsigned int kernelSize, unsigned int inSize, unsigned int outSize);
+	// Shares the tables of kernel, with outSampleOffset added to its output offset, so that stripes of one resize
+	// can be filtered concurrently without calling setSampleOffset on a shared kernel. kernel must outlive it.
+	FilterKernelAdaptive(const FilterKernelAdaptive& kernel, unsigned int outSampleOffset);
 
 	int computeSampleStart(int outPosition) const
 	{
@@ -110,12 +110,33 @@ void ImageYUV::setPadding(unsigned int padding)
 }
 
 bool ImageYUV::resize(Image* dest, EResizeQuality quality)
+{
+	return resize(dest, quality, 1);
+}
+
+bool ImageYUV::resize(Image* dest, EResizeQuality quality, unsigned int threadCount)
+{
+	ImageYUV* destYUV = dest->asYUV();
+	if( destYUV ) {
+		if( m_PlaneY->resize(destYUV->getPlaneY(), quality, threadCount) ) {
+			if( m_PlaneU->resize(destYUV->getPlaneU(), quality, threadCount) ) {
+				if( m_PlaneV->resize(destYUV->getPlaneV(), quality, threadCount) ) {
+					destYUV->setRange(m_Range);
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+bool ImageYUV::resizeRotate(Image* dest, EResizeQuality quality, EImageOrientation direction, unsigned int threadCount)
 {
 	ImageYUV* destYUV = dest->asYUV();
 	if( destYUV ) {
-		if( m_PlaneY->resize(destYUV->getPlaneY(), quality) ) {
-			if( m_PlaneU->resize(destYUV->getPlaneU(), quality) ) {
-				if( m_PlaneV->resize(destYUV->getPlaneV(), quality) ) {
+		if( m_PlaneY->resizeRotate(destYUV->getPlaneY(), quality, direction, threadCount) ) {
+			if( m_PlaneU->resizeRotate(destYUV->getPlaneU(), quality, direction, threadCount) ) {
+				if( m_PlaneV->resizeRotate(destYUV->getPlaneV(), quality, direction, threadCount) ) {
 					destYUV->setRange(m_Range);
 					return true;
 				}
@@ -299,6 +320,36 @@ void ImageYUV::setRange(EYUVRange range)
 	m_Range = range;
 }
 
+bool ImageYUV::convertToRGB(uint8_t* dest, unsigned int destPitch, unsigned int components, EYUVColorMatrix matrix)
+{
+	unsigned int width = m_PlaneY->getWidth();
+	unsigned int height = m_PlaneY->getHeight();
+	unsigned int uvWidth = m_PlaneU->getWidth();
+	unsigned int uvHeight = m_PlaneU->getHeight();
+	if( dest == NULL || (components != 3 && components != 4) || destPitch < width * components ) {
+		return false;
+	}
+	if( m_PlaneV->getWidth() != uvWidth || m_PlaneV->getHeight() != uvHeight ) {
+		return false;
+	}
+	unsigned int uvShiftX = (uvWidth == width) ? 0 : 1;
+	unsigned int uvShiftY = (uvHeight == height) ? 0 : 1;
+	if( (uvShiftX && uvWidth != computeSize(width)) || (uvShiftY && uvHeight != computeSize(height)) ) {
+		return false;
+	}
+	unsigned int pitchY;
+	unsigned int pitchU;
+	unsigned int pitchV;
+	const uint8_t* srcY = m_PlaneY->lockRect(width, height, pitchY);
+	const uint8_t* srcU = m_PlaneU->lockRect(uvWidth, uvHeight, pitchU);
+	const uint8_t* srcV = m_PlaneV->lockRect(uvWidth, uvHeight, pitchV);
+	if( pitchU != pitchV ) {
+		return false;
+	}
+	Conversions<true>::yuv_to_rgb(dest, srcY, srcU, srcV, width, height, pitchY, pitchU, 1, uvShiftX, uvShiftY, destPitch, components, matrix, m_Range == kYUVRange_Full);
+	return true;
+}
+
 unsigned int ImageYUV::getWidth() const
 {
 	return m_PlaneY->getWidth();
@@ -35,6 +35,12 @@ enum EYUVRange
 	kYUVRange_Unknown
 };
 
+enum EYUVColorMatrix
+{
+	kYUVColorMatrix_BT601,
+	kYUVColorMatrix_BT709
+};
+
 class ImageYUV : public Image
 {
 public:
@@ -49,6 +55,10 @@ public:
 	virtual void setPadding(unsigned int padding);
 
 	virtual bool resize(Image* dest, EResizeQuality quality);
+	// Downsamples each plane in stripes on up to threadCount threads, see ImagePlane::resize.
+	bool resize(Image* dest, EResizeQuality quality, unsigned int threadCount);
+	// Resize followed by a rotation without an intermediate image, dest must have the rotated dimensions.
+	bool resizeRotate(Image* dest, EResizeQuality quality, EImageOrientation direction, unsigned int threadCount = 1);
 	virtual void reduceHalf(Image* dest);
 	virtual bool crop(const ImageRegion& boundingBox);
 	virtual void rotate(Image* dest, EImageOrientation direction);
@@ -68,6 +78,8 @@ public:
 	virtual void compressRange(ImageYUV* destImage);
 	virtual EYUVRange getRange();
 	virtual void setRange(EYUVRange range);
+	// Converts to packed RGB (components == 3) or RGBA (components == 4), an unknown range is treated as compressed.
+	bool convertToRGB(uint8_t* dest, unsigned int destPitch, unsigned int components, EYUVColorMatrix matrix);
 
 	virtual ImageRGBA* asRGBA();
 	virtual ImageGrayscale* asGrayscale();
@@ -339,6 +339,26 @@ void ImageYUVSemiplanar::setRange(EYUVRange range)
 	m_Range = range;
 }
 
+bool ImageYUVSemiplanar::convertToRGB(uint8_t* dest, unsigned int destPitch, unsigned int components, EYUVColorMatrix matrix)
+{
+	unsigned int width = m_PlaneY->getWidth();
+	unsigned int height = m_PlaneY->getHeight();
+	unsigned int uvWidth = m_PlaneUV->getWidth();
+	unsigned int uvHeight = m_PlaneUV->getHeight();
+	if( dest == NULL || (components != 3 && components != 4) || destPitch < width * components ) {
+		return false;
+	}
+	if( uvWidth != computeSize(width) || uvHeight != computeSize(height) ) {
+		return false;
+	}
+	unsigned int pitchY;
+	unsigned int pitchUV;
+	const uint8_t* srcY = m_PlaneY->lockRect(width, height, pitchY);
+	const uint8_t* srcUV = m_PlaneUV->lockRect(uvWidth, uvHeight, pitchUV);
+	Conversions<true>::yuv_to_rgb(dest, srcY, srcUV, srcUV + 1, width, height, pitchY, pitchUV, 2, 1, 1, destPitch, components, matrix, m_Range == kYUVRange_Full);
+	return true;
+}
+
 unsigned int ImageYUVSemiplanar::getWidth() const
 {
 	return m_PlaneY->getWidth();
@@ -63,6 +63,8 @@ public:
 	virtual void compressRange(ImageYUVSemiplanar* destImage);
 	virtual EYUVRange getRange();
 	virtual void setRange(EYUVRange range);
+	// Converts to packed RGB (components == 3) or RGBA (components == 4), an unknown range is treated as compressed.
+	bool convertToRGB(uint8_t* dest, unsigned int destPitch, unsigned int components, EYUVColorMatrix matrix);
 
 	virtual ImageRGBA* asRGBA();
 	virtual ImageGrayscale* asGrayscale();
@@ -25,6 +25,6 @@ else ifeq ($(TARGET_ARCH_ABI),x86_64)
 endif
 LOCAL_C_INCLUDES += $(NDK_ROOT)/sources/android/support/include
 
-LOCAL_SRC_FILES := android/android.cpp android/util.cpp common/bitreader.cpp common/data.cpp common/editbox.cpp common/reader.cpp error/error.cpp header/header.cpp internal/decode/annexb.cpp internal/decode/avcc.cpp internal/decode/h264_bytestream.cpp internal/demux/mp4.cpp mux/mp4.cpp settings/settings.cpp transform/stitch.cpp transform/trim.cpp util/caption.cpp
+LOCAL_SRC_FILES := android/android.cpp android/util.cpp common/bitreader.cpp common/chain.cpp common/data.cpp common/editbox.cpp common/reader.cpp common/writer.cpp error/error.cpp header/header.cpp internal/decode/annexb.cpp internal/decode/avcc.cpp internal/decode/h264_bytestream.cpp internal/demux/mp4.cpp mux/mp4.cpp settings/settings.cpp transform/stitch.cpp transform/trim.cpp util/caption.cpp
 
 include $(BUILD_STATIC_LIBRARY)
@@ -0,0 +1,254 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+#include "vireo/base_cpp.h"
+#include "vireo/common/chain.h"
+#include "vireo/error/error.h"
+
+namespace vireo {
+namespace common {
+
+struct _Chain {
+  struct Segment {
+    std::shared_ptr<const common::Data32> data;  // in memory, or
+    int file_descriptor = -1;                    // file range
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    auto bytes() const -> const uint8_t* {
+      return data->data() + data->a();
+    }
+  };
+  vector<Segment> segments;
+  uint64_t count = 0;
+  auto append(const Segment& segment) -> void {
+    if (!segment.size) {
+      return;
+    }
+    count += segment.size;
+    if (!segments.empty() && segment.file_descriptor >= 0) {
+      Segment& last = segments.back();
+      if (last.file_descriptor == segment.file_descriptor && last.offset + last.size == segment.offset) {
+        last.size += segment.size;  // contiguous runs of a file are copied at once
+        return;
+      }
+    }
+    segments.push_back(segment);
+  }
+};
+
+static auto Read(const _Chain::Segment& segment, uint8_t* bytes) -> void {
+  uint64_t done = 0;
+  while (done < segment.size) {
+    const ssize_t result = pread(segment.file_descriptor, bytes + done, segment.size - done, (off_t)(segment.offset + done));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    THROW_IF(result <= 0, ReaderError);
+    done += result;
+  }
+}
+
+// Copies a file range to the current offset of file_descriptor: copy_file_range lets the file system share extents
+// (reflink) or copy them in the kernel, sendfile still avoids user space, pread / write is the portable fallback
+static auto Copy(const _Chain::Segment& segment, int file_descriptor) -> void {
+  const uint64_t kMaxCopySize = 1 << 30;
+  uint64_t done = 0;
+#ifdef __linux__
+#ifdef __NR_copy_file_range
+  bool copy_file_range_supported = true;
+#else
+  bool copy_file_range_supported = false;
+#endif
+  bool sendfile_supported = true;
+  while (done < segment.size && (copy_file_range_supported || sendfile_supported)) {
+    const size_t size = (size_t)min(segment.size - done, kMaxCopySize);
+    ssize_t result = -1;
+    if (copy_file_range_supported) {
+#ifdef __NR_copy_file_range
+      loff_t offset = (loff_t)(segment.offset + done);
+      result = syscall(__NR_copy_file_range, segment.file_descriptor, &offset, file_descriptor, nullptr, size, 0);
+#endif
+      if (result < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+        copy_file_range_supported = false;
+        continue;
+      }
+    } else {
+      off_t offset = (off_t)(segment.offset + done);
+      result = sendfile(file_descriptor, segment.file_descriptor, &offset, size);
+      if (result < 0 && (errno == ENOSYS || errno == EINVAL)) {
+        sendfile_supported = false;
+        continue;
+      }
+    }
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    THROW_IF(result <= 0, WriterError);
+    done += result;
+  }
+#endif
+  const uint64_t kBufferSize = 1 << 20;
+  unique_ptr<uint8_t[]> buffer;
+  while (done < segment.size) {
+    if (!buffer) {
+      buffer.reset(new uint8_t[kBufferSize]);
+    }
+    _Chain::Segment part = segment;
+    part.offset += done;
+    part.size = min(segment.size - done, kBufferSize);
+    Read(part, buffer.get());
+    uint64_t written = 0;
+    while (written < part.size) {
+      const ssize_t result = ::write(file_descriptor, buffer.get() + written, part.size - written);
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+      THROW_IF(result <= 0, WriterError);
+      written += result;
+    }
+    done += part.size;
+  }
+}
+
+Chain::Chain() : _this(make_shared<_Chain>()) {}
+
+Chain::Chain(const Chain& chain) : _this(chain._this) {}
+
+Chain::Chain(Chain&& chain) : _this(chain._this) {
+  chain._this = nullptr;
+}
+
+auto Chain::append(common::Data32&& data) -> void {
+  THROW_IF(data.count() && !data.data(), InvalidArguments);
+  _Chain::Segment segment;
+  segment.size = data.count();
+  segment.data = make_shared<const common::Data32>(move(data));
+  _this->append(segment);
+}
+
+auto Chain::append(int file_descriptor, uint64_t offset, uint64_t size) -> void {
+  THROW_IF(file_descriptor < 0, InvalidArguments);
+  _Chain::Segment segment;
+  segment.file_descriptor = file_descriptor;
+  segment.offset = offset;
+  segment.size = size;
+  _this->append(segment);
+}
+
+auto Chain::append(const Chain& chain) -> void {
+  THROW_IF(chain._this == _this, InvalidArguments);
+  for (const auto& segment: chain._this->segments) {
+    _this->append(segment);
+  }
+}
+
+auto Chain::count() const -> uint64_t {
+  return _this->count;
+}
+
+auto Chain::copy(uint8_t* bytes) const -> void {
+  THROW_IF(!bytes && _this->count, InvalidArguments);
+  for (const auto& segment: _this->segments) {
+    if (segment.data) {
+      memcpy(bytes, segment.bytes(), segment.size);
+    } else {
+      Read(segment, bytes);
+    }
+    bytes += segment.size;
+  }
+}
+
+auto Chain::data() const -> common::Data32 {
+  THROW_IF(_this->count > numeric_limits<uint32_t>::max(), Overflow);
+  const uint32_t size = (uint32_t)_this->count;
+  common::Data32 data(new uint8_t[size], size, [](uint8_t* p) { delete[] p; });
+  copy((uint8_t*)data.data());
+  return data;
+}
+
+#ifndef ANDROID
+auto Chain::data64() const -> common::Data64 {
+  THROW_IF(_this->count > numeric_limits<size_t>::max(), Overflow);
+  const size_t size = (size_t)_this->count;
+  common::Data64 data(new uint8_t[size], size, [](uint8_t* p) { delete[] p; });
+  copy((uint8_t*)data.data());
+  return data;
+}
+#endif
+
+auto Chain::write(int file_descriptor) const -> uint64_t {
+  THROW_IF(file_descriptor < 0, InvalidArguments);
+  const size_t kMaxSegmentsPerWrite = IOV_MAX;
+  vector<struct iovec> iov(min(_this->segments.size(), kMaxSegmentsPerWrite));
+  uint64_t written = 0;
+  size_t index = 0;
+  uint64_t offset = 0;  // bytes of segments[index] already written
+  while (index < _this->segments.size()) {
+    if (!_this->segments[index].data) {
+      Copy(_this->segments[index], file_descriptor);
+      written += _this->segments[index].size;
+      ++index;
+      continue;
+    }
+    // gather the in-memory segments up to the next file range
+    size_t iov_count = 0;
+    for (size_t i = index; i < _this->segments.size() && _this->segments[i].data && iov_count < iov.size(); ++i, ++iov_count) {
+      const auto& segment = _this->segments[i];
+      const uint64_t skip = (i == index) ? offset : 0;
+      iov[iov_count].iov_base = (void*)(segment.bytes() + skip);
+      iov[iov_count].iov_len = segment.size - skip;
+    }
+    const ssize_t result = writev(file_descriptor, iov.data(), (int)iov_count);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    THROW_IF(result <= 0, WriterError);
+    written += result;
+    // advance past fully written segments, partial writes resume from the middle of a segment
+    size_t remaining = (size_t)result;
+    while (remaining) {
+      const uint64_t left = _this->segments[index].size - offset;
+      if (remaining >= left) {
+        remaining -= left;
+        offset = 0;
+        ++index;
+      } else {
+        offset += remaining;
+        remaining = 0;
+      }
+    }
+  }
+  return written;
+}
+
+}}
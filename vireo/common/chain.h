@@ -0,0 +1,55 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "vireo/base_h.h"
+#include "vireo/common/data.h"
+
+namespace vireo {
+namespace common {
+
+// Scatter-gather output: an ordered chain of segments (e.g. a header followed by the sample payloads it describes)
+// that is consumed without ever being copied into one contiguous buffer. Segments are either in memory or byte ranges
+// of an open file, which are copied kernel-side when the chain is written into another file. Copies share segments.
+class PUBLIC Chain final {
+  std::shared_ptr<struct _Chain> _this = nullptr;
+public:
+  Chain();
+  Chain(const Chain& chain);
+  Chain(Chain&& chain);
+  DISALLOW_ASSIGN(Chain);
+  auto append(common::Data32&& data) -> void;
+  auto append(int file_descriptor, uint64_t offset, uint64_t size) -> void;  // file has to stay open while chain is used
+  auto append(const Chain& chain) -> void;
+  auto count() const -> uint64_t;  // sum of segment sizes
+  auto copy(uint8_t* bytes) const -> void;  // gathers all segments into bytes, which has to hold count() bytes
+  auto data() const -> common::Data32;  // gathered into a single contiguous buffer
+#ifndef ANDROID
+  auto data64() const -> common::Data64;  // same for chains of 4 GB and more
+#endif
+  auto write(int file_descriptor) const -> uint64_t;  // gathered writes, returns the number of bytes written
+};
+
+}}
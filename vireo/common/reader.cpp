@@ -42,7 +42,7 @@ struct _Reader {
   const void* opaque = (void*)this;
   int (*const read_callback)(void*, uint8_t*, int) = [](void* opaque, uint8_t* buffer, int size) -> int {
     _Reader& reader = *(_Reader*)opaque;
-    lock_guard<mutex>(reader.lock);
+    lock_guard<mutex> guard(reader.lock);
     if (reader.offset >= reader.size) {
       return 0;
     }
@@ -57,7 +57,7 @@ struct _Reader {
   };
   int64_t (*const seek_callback)(void*, int64_t, int) = [](void* opaque, int64_t offset, int whence) -> int64_t {
     _Reader& reader = *(_Reader*)opaque;
-    lock_guard<mutex>(reader.lock);
+    lock_guard<mutex> guard(reader.lock);
     if (whence == SEEK_SET) {
       CHECK(offset >= 0);
       reader.offset = (uint32_t)offset;
@@ -0,0 +1,156 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <unistd.h>
+
+#include "vireo/base_cpp.h"
+#include "vireo/common/writer.h"
+#include "vireo/error/error.h"
+
+namespace vireo {
+namespace common {
+
+static auto FileWriteFunc(int file_descriptor) -> std::function<void(const uint64_t offset, const common::Data32& data)> {
+  // offsets are relative to the position of the file descriptor when the writer is created; pipes, sockets and
+  // descriptors opened with O_APPEND cannot be written at an offset: they only take writes that continue the output
+  const off_t start = lseek(file_descriptor, 0, SEEK_CUR);
+  const int flags = fcntl(file_descriptor, F_GETFL);
+  THROW_IF(flags < 0, InvalidArguments);
+  const bool seekable = start >= 0 && !(flags & O_APPEND);
+  uint64_t end = 0;
+  return [file_descriptor, start, seekable, end](const uint64_t offset, const common::Data32& data) mutable {
+    THROW_IF(!seekable && offset != end, Unsupported, "output is not seekable, only sequential writes are supported");
+    const uint8_t* bytes = data.data() + data.a();
+    uint64_t written = 0;
+    while (written < data.count()) {
+      const ssize_t result = seekable ? pwrite(file_descriptor, bytes + written, data.count() - written, start + (off_t)(offset + written))
+                                      : ::write(file_descriptor, bytes + written, data.count() - written);
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+      THROW_IF(result <= 0, WriterError);
+      written += result;
+    }
+    end = max(end, offset + written);
+  };
+}
+
+struct _Writer {
+  std::mutex lock;
+  uint64_t offset = 0;
+  uint64_t size = 0;
+  std::function<void(const uint64_t offset, const common::Data32& data)> write_func;
+  std::function<void(void)> close_func;
+
+  // opaque, write_func, seek_func used to interface with l-smash and ffmpeg
+  const void* opaque = (void*)this;
+  int (*const write_callback)(void*, uint8_t*, int) = [](void* opaque, uint8_t* buffer, int size) -> int {
+    _Writer& writer = *(_Writer*)opaque;
+    std::lock_guard<std::mutex> guard(writer.lock);
+    if (size <= 0) {
+      return 0;
+    }
+    __try {  // exceptions must not unwind through the C frames of l-smash / ffmpeg
+      writer.write(writer.offset, common::Data32(buffer, (uint32_t)size, nullptr));
+    } __catch (...) {
+      return -1;
+    }
+    writer.offset += size;
+    return size;
+  };
+  int64_t (*const seek_callback)(void*, int64_t, int) = [](void* opaque, int64_t offset, int whence) -> int64_t {
+    _Writer& writer = *(_Writer*)opaque;
+    std::lock_guard<std::mutex> guard(writer.lock);
+    if (whence == SEEK_SET) {
+      CHECK(offset >= 0);
+      writer.offset = (uint64_t)offset;
+    } else if (whence == SEEK_CUR) {
+      CHECK((int64_t)writer.offset + offset >= 0);
+      writer.offset = (uint64_t)((int64_t)writer.offset + offset);
+    } else if (whence == SEEK_END) {
+      CHECK((int64_t)writer.size + offset >= 0);
+      writer.offset = (uint64_t)((int64_t)writer.size + offset);
+    }
+    return (int64_t)writer.offset;
+  };
+
+  auto write(uint64_t offset, const common::Data32& data) -> void {
+    write_func(offset, data);
+    size = max(size, offset + data.count());
+  }
+
+  _Writer(std::function<void(const uint64_t offset, const common::Data32& data)> write_func) : write_func(write_func) {}
+
+  _Writer(int file_descriptor, std::function<void(int file_descriptor)> deleter) : write_func(FileWriteFunc(file_descriptor)), close_func([file_descriptor, deleter]() {
+      if (deleter) {
+        deleter(file_descriptor);
+      }
+    }) {}
+
+  ~_Writer() {
+    if (close_func) {
+      close_func();
+    }
+  }
+};
+
+static auto Open(const std::string& path) -> int {
+  const int file_descriptor = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  THROW_IF(file_descriptor < 0, WriterError, "cannot open " << path);
+  return file_descriptor;
+}
+
+static auto Valid(int file_descriptor) -> int {
+  THROW_IF(file_descriptor < 0, InvalidArguments);
+  return file_descriptor;
+}
+
+Writer::Writer(int file_descriptor, std::function<void(int file_descriptor)> deleter)
+  : _this(make_shared<_Writer>(Valid(file_descriptor), deleter)), opaque(_this->opaque), write_callback(_this->write_callback), seek_callback(_this->seek_callback) {}
+
+Writer::Writer(const std::string& path) : Writer(Open(path), [](int file_descriptor) { close(file_descriptor); }) {}
+
+Writer::Writer(Writer&& writer) : _this(writer._this), opaque(_this->opaque), write_callback(_this->write_callback), seek_callback(_this->seek_callback) {
+  writer._this = nullptr;
+}
+
+Writer::Writer(std::function<void(const uint64_t offset, const common::Data32& data)> write_func)
+  : _this(make_shared<_Writer>(write_func)), opaque(_this->opaque), write_callback(_this->write_callback), seek_callback(_this->seek_callback) {
+  THROW_IF(!write_func, InvalidArguments);
+}
+
+auto Writer::write(uint64_t offset, const common::Data32& data) const -> void {
+  std::lock_guard<std::mutex> guard(_this->lock);
+  _this->write(offset, data);
+}
+
+auto Writer::size() const -> uint64_t {
+  std::lock_guard<std::mutex> guard(_this->lock);
+  return _this->size;
+}
+
+}}
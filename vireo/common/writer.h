@@ -0,0 +1,51 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "vireo/base_h.h"
+#include "vireo/common/data.h"
+
+namespace vireo {
+namespace common {
+
+// Destination of streamed output: writes are positioned, so that a header can be patched once its content is known.
+// Offsets into a file descriptor are relative to its position when the writer is created. One that cannot seek (pipe,
+// socket) or that was opened with O_APPEND only accepts writes at the end of the output written so far.
+class PUBLIC Writer final {
+  std::shared_ptr<struct _Writer> _this = nullptr;
+public:
+  Writer(int file_descriptor, std::function<void(int file_descriptor)> deleter = NULL);
+  Writer(const std::string& path);
+  Writer(Writer&& writer);
+  Writer(std::function<void(const uint64_t offset, const common::Data32& data)> write_func);
+  auto write(uint64_t offset, const common::Data32& data) const -> void;
+  auto size() const -> uint64_t;  // end of the furthest write so far
+  DISALLOW_COPY_AND_ASSIGN(Writer);
+  const void* opaque;
+  int(*const write_callback)(void*, uint8_t*, int);  // sequential writes from the current offset
+  int64_t(*const seek_callback)(void*, int64_t, int);
+};
+
+}}
@@ -25,6 +25,11 @@
 extern "C" {
 #include "libavformat/avformat.h"
 }
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 #include "fdk-aac/aacenc_lib.h"
 #include "fdk-aac/FDK_audio.h"
 #include "vireo/base_cpp.h"
@@ -38,7 +43,7 @@ extern "C" {
 namespace vireo {
 namespace encode {
 
-struct _AAC {
+struct Encoder {
   constexpr static const int32_t kMaxBufferSize = numeric_limits<uint16_t>::max();
   unique_ptr<AACENCODER, function<void(AACENCODER*)>> aacEncoder = { nullptr, [](AACENCODER* p) {
     if(p != nullptr) {
@@ -46,8 +51,7 @@ struct _AAC {
     }
   }};
   common::Data32 encoded_buffer = { (uint8_t*)calloc(kMaxBufferSize, sizeof(uint8_t)), kMaxBufferSize, [](uint8_t* p) { free(p); } };
-  functional::Audio<sound::Sound> sounds;
-  _AAC(uint32_t timescale, uint32_t sample_rate, uint8_t channels, uint32_t bitrate) {
+  Encoder(uint32_t sample_rate, uint8_t channels, uint32_t bitrate) {
     AACENCODER* encoder;
     THROW_IF(aacEncOpen(&encoder, 0, channels) != AACENC_OK, InvalidArguments);
     aacEncoder.reset(encoder);
@@ -60,13 +64,184 @@ struct _AAC {
     THROW_IF(aacEncoder_SetParam(aacEncoder.get(), AACENC_AOT, 2) != AACENC_OK, InvalidArguments);  // MPEG-4 AAC Low Complexity
     THROW_IF(aacEncEncode(aacEncoder.get(), nullptr, nullptr, nullptr, nullptr) != AACENC_OK, InvalidArguments);
   }
+  auto info() const -> AACENC_InfoStruct {
+    AACENC_InfoStruct info = { 0 };
+    THROW_IF(aacEncInfo(aacEncoder.get(), &info) != AACENC_OK, Invalid);
+    return info;
+  }
+  auto operator()(const sound::PCM& pcm) -> const common::Data32& {
+    const auto& buffer = pcm.samples();
+    CHECK(buffer.count() == pcm.channels() * pcm.size());
+
+    AACENC_BufDesc in_buffer_desc = { 0 };
+    in_buffer_desc.numBufs = 1;
+    in_buffer_desc.bufs = (void**)util::get_addr(buffer.data());
+    INT in_buffer_size = buffer.count() * sizeof(int16_t);
+    in_buffer_desc.bufSizes = &in_buffer_size;
+    INT in_element_size = sizeof(int16_t);
+    in_buffer_desc.bufElSizes = &in_element_size;
+    INT in_identifier = IN_AUDIO_DATA;
+    in_buffer_desc.bufferIdentifiers = &in_identifier;
+
+    AACENC_BufDesc out_buffer_desc = { 0 };
+    out_buffer_desc.numBufs = 1;
+    out_buffer_desc.bufs = (void**)util::get_addr(encoded_buffer.data());
+    INT out_buffer_size = encoded_buffer.capacity();
+    out_buffer_desc.bufSizes = &out_buffer_size;
+    INT out_element_size = sizeof(uint8_t);
+    out_buffer_desc.bufElSizes = &out_element_size;
+    int32_t out_identifier = OUT_BITSTREAM_DATA;
+    out_buffer_desc.bufferIdentifiers = &out_identifier;
+
+    AACENC_InArgs in_args = { 0 };
+    in_args.numInSamples = buffer.count();
+    AACENC_OutArgs out_args = { 0 };
+    CHECK(aacEncEncode(aacEncoder.get(), &in_buffer_desc, &out_buffer_desc, &in_args, &out_args) == AACENC_OK);
+
+    encoded_buffer.set_bounds(0, out_args.numOutBytes);
+    return encoded_buffer;
+  }
+};
+
+struct _AAC {
+  // fdk-aac emits one access unit per input frame, delayed by a fixed number of frames, so an encoder started
+  // kSegmentOverlap frames before a segment is in step with the sequential encoder by the time the segment begins:
+  // the overlap covers the encoder delay, the MDCT overlap with the previous frame and lets the psychoacoustic model settle.
+  constexpr static const uint32_t kSegmentSize = 1024;  // frames, ~23 s at 44.1 kHz
+  constexpr static const uint32_t kSegmentOverlap = 8;  // frames
+  functional::Audio<sound::Sound> sounds;
+  uint32_t sample_rate;
+  uint8_t channels;
+  uint32_t bitrate;
+  uint32_t thread_count;
+  unique_ptr<Encoder> encoder;
+  std::once_flag encoded;
+  vector<common::Data32> access_units;
+  _AAC(uint32_t sample_rate, uint8_t channels, uint32_t bitrate, uint32_t thread_count)
+    : sample_rate(sample_rate), channels(channels), bitrate(bitrate), thread_count(thread_count) {
+    if (thread_count <= 1) {
+      encoder.reset(new Encoder(sample_rate, channels, bitrate));
+    }
+  }
+  auto pcm(const sound::Sound& sound) const -> sound::PCM {
+    const auto pcm = sound.pcm();  // 'const' so don't move it
+    CHECK(pcm.channels() == 1 || pcm.channels() == 2);
+    THROW_IF(pcm.channels() < channels, Unsupported);
+    THROW_IF(pcm.size() != AUDIO_FRAME_SIZE, Unsupported);
+    if (pcm.channels() != channels) {  // Mismatch between MP4 and actual samples.
+      return pcm.mix(1);
+    } else {
+      return pcm;
+    }
+  }
+  auto encode_segments() -> void {
+    struct Segment {
+      uint32_t begin;  // first access unit kept, the frames before it only prime the encoder
+      uint32_t first;
+      vector<sound::PCM> pcms;
+    };
+    const uint32_t count = sounds.count();
+    access_units.resize(count);
+
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<unique_ptr<Segment>> pending;
+    bool done = false;
+    std::exception_ptr error;
+    auto fail = [&]() {
+      std::lock_guard<std::mutex> guard(lock);
+      if (!error) {
+        error = std::current_exception();
+      }
+      done = true;
+      pending.clear();
+    };
+
+    vector<std::thread> workers;
+    const uint32_t segment_count = (count + kSegmentSize - 1) / kSegmentSize;
+    for (uint32_t i = 0; i < min(thread_count, segment_count); ++i) {
+      workers.emplace_back([&]() {
+        while (true) {
+          unique_ptr<Segment> segment;
+          {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [&pending, &done]() { return !pending.empty() || done; });
+            if (pending.empty()) {
+              return;
+            }
+            segment = move(pending.front());
+            pending.pop_front();
+          }
+          ready.notify_all();
+          try {
+            Encoder encoder(sample_rate, channels, bitrate);
+            const auto info = encoder.info();
+            THROW_IF(info.frameLength != AUDIO_FRAME_SIZE, Unsupported, "segments are spliced at one access unit per frame");
+            THROW_IF(info.nDelay + info.frameLength > kSegmentOverlap * AUDIO_FRAME_SIZE, Unsupported, "encoder delay is longer than the segment overlap");
+            for (uint32_t j = 0; j < segment->pcms.size(); ++j) {
+              const auto& access_unit = encoder(segment->pcms[j]);
+              if (segment->first + j >= segment->begin) {
+                access_units[segment->first + j] = access_unit;
+              }
+            }
+          } catch (...) {
+            fail();
+            ready.notify_all();
+          }
+        }
+      });
+    }
+
+    // Pull the sounds once in order (decoders are sequential) and hand out segments, at most thread_count queued at a time
+    try {
+      std::deque<sound::PCM> tail;
+      unique_ptr<Segment> segment;
+      for (uint32_t index = 0; index < count; ++index) {
+        if (index % kSegmentSize == 0) {
+          segment.reset(new Segment{ index, index - (uint32_t)tail.size(), {} });
+          segment->pcms.reserve(tail.size() + min(count - index, (uint32_t)kSegmentSize));
+          for (const auto& pcm: tail) {
+            segment->pcms.push_back(pcm);
+          }
+        }
+        segment->pcms.push_back(pcm(sounds(index)));
+        tail.push_back(segment->pcms.back());
+        if (tail.size() > kSegmentOverlap) {
+          tail.pop_front();
+        }
+        if ((index + 1) % kSegmentSize == 0 || index + 1 == count) {
+          std::unique_lock<std::mutex> guard(lock);
+          ready.wait(guard, [&]() { return pending.size() < thread_count || done; });
+          if (done) {
+            break;
+          }
+          pending.push_back(move(segment));
+          ready.notify_all();
+        }
+      }
+    } catch (...) {
+      fail();
+    }
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      done = true;
+    }
+    ready.notify_all();
+    for (auto& worker: workers) {
+      worker.join();
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
 };
 
-AAC::AAC(const functional::Audio<sound::Sound>& sounds, uint8_t channels, uint32_t bitrate)
-  : functional::DirectAudio<AAC, Sample>(sounds.a(), sounds.b()), _this(new _AAC(sounds.settings().timescale, sounds.settings().sample_rate, channels, bitrate)) {
+AAC::AAC(const functional::Audio<sound::Sound>& sounds, uint8_t channels, uint32_t bitrate, uint32_t thread_count)
+  : functional::DirectAudio<AAC, Sample>(sounds.a(), sounds.b()), _this(new _AAC(sounds.settings().sample_rate, channels, bitrate, thread_count)) {
   THROW_IF(sounds.count() >= security::kMaxSampleCount, Unsafe);
   THROW_IF(channels != 1 && channels != 2, Unsupported);
   THROW_IF(find(kSampleRate.begin(), kSampleRate.end(), sounds.settings().sample_rate) == kSampleRate.end(), InvalidArguments);
+  THROW_IF(thread_count == 0, InvalidArguments);
   _this->sounds = sounds;
   _settings = sounds.settings();
   _settings.codec = settings::Audio::Codec::AAC_LC;
@@ -84,50 +259,14 @@ auto AAC::operator()(uint32_t index) const -> Sample {
 
   const sound::Sound& sound = _this->sounds(index);
 
-  auto pcm = [&]() {
-    const auto pcm = sound.pcm();  // 'const' so don't move it
-    CHECK(pcm.channels() == 1 || pcm.channels() == 2);
-    THROW_IF(pcm.channels() < _settings.channels, Unsupported);
-    if (pcm.channels() != _settings.channels) {  // Mismatch between MP4 and actual samples.
-      return pcm.mix(1);
-    } else {
-      return pcm;
-    }
-  }();
+  if (!_this->encoder) {
+    std::call_once(_this->encoded, [_this = _this]() { _this->encode_segments(); });
+    return Sample(sound.pts, sound.pts, true, vireo::SampleType::Audio, _this->access_units[index]);
+  }
 
+  const auto pcm = _this->pcm(sound);
   CHECK(pcm.channels() == _settings.channels);
-  THROW_IF(pcm.size() != AUDIO_FRAME_SIZE, Unsupported);
-
-  const auto& buffer = pcm.samples();
-  CHECK(buffer.count() == _settings.channels * pcm.size());
-
-  AACENC_BufDesc in_buffer_desc = { 0 };
-  in_buffer_desc.numBufs = 1;
-  in_buffer_desc.bufs = (void**)util::get_addr(buffer.data());
-  INT in_buffer_size = buffer.count() * sizeof(int16_t);
-  in_buffer_desc.bufSizes = &in_buffer_size;
-  INT in_element_size = sizeof(int16_t);
-  in_buffer_desc.bufElSizes = &in_element_size;
-  INT in_identifier = IN_AUDIO_DATA;
-  in_buffer_desc.bufferIdentifiers = &in_identifier;
-
-  AACENC_BufDesc out_buffer_desc = { 0 };
-  out_buffer_desc.numBufs = 1;
-  out_buffer_desc.bufs = (void**)util::get_addr(_this->encoded_buffer.data());
-  INT out_buffer_size = _this->encoded_buffer.capacity();
-  out_buffer_desc.bufSizes = &out_buffer_size;
-  INT out_element_size = sizeof(uint8_t);
-  out_buffer_desc.bufElSizes = &out_element_size;
-  int32_t out_identifier = OUT_BITSTREAM_DATA;
-  out_buffer_desc.bufferIdentifiers = &out_identifier;
-
-  AACENC_InArgs in_args = { 0 };
-  in_args.numInSamples = buffer.count();
-  AACENC_OutArgs out_args = { 0 };
-  CHECK(aacEncEncode(_this->aacEncoder.get(), &in_buffer_desc, &out_buffer_desc, &in_args, &out_args) == AACENC_OK);
-
-  _this->encoded_buffer.set_bounds(0, out_args.numOutBytes);
-  return Sample(sound.pts, sound.pts, true, vireo::SampleType::Audio, _this->encoded_buffer);
+  return Sample(sound.pts, sound.pts, true, vireo::SampleType::Audio, (*_this->encoder)(pcm));
 }
 
 }}
@@ -36,10 +36,13 @@
 namespace vireo {
 namespace encode {
 
+// With thread_count > 1 the sounds are split into segments that are encoded concurrently on separate encoders,
+// each primed with the tail of the previous segment so that the spliced access units decode seamlessly.
+// The sounds are then pulled once in order on the first request and the whole track is encoded up front.
 class PUBLIC AAC final : public functional::DirectAudio<AAC, Sample> {
   std::shared_ptr<struct _AAC> _this;
 public:
-  AAC(const functional::Audio<sound::Sound>& sounds, uint8_t channels, uint32_t bitrate);
+  AAC(const functional::Audio<sound::Sound>& sounds, uint8_t channels, uint32_t bitrate, uint32_t thread_count = 1);
   AAC(const AAC& aac);
   DISALLOW_ASSIGN(AAC);
   auto operator()(uint32_t sample) const -> Sample;
@@ -22,6 +22,11 @@
  * SOFTWARE.
  */
 
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
 #include "vireo/base_cpp.h"
 #include "vireo/common/security.h"
 #include "vireo/encode/h264.h"
@@ -52,12 +57,327 @@ using common::Data16;
 
 namespace encode {
 
+struct _H264Pool {
+  struct Configuration {
+    x264_param_t param;
+    vector<x264_t*> warm;
+    uint32_t opening = 0;
+    uint64_t last_used = 0;
+    bool failed = false;
+  };
+  const uint32_t spares;
+  const uint32_t max_configurations;
+  std::mutex lock;
+  std::condition_variable work_available;
+  map<string, Configuration> configurations;  // by the bytes of their params
+  vector<x264_t*> finished;
+  uint64_t requests = 0;
+  std::thread worker;
+  bool exiting = false;
+
+  _H264Pool(uint32_t spares, uint32_t max_configurations) : spares(spares), max_configurations(max_configurations) {
+    THROW_IF(max_configurations == 0, InvalidArguments);
+  }
+  ~_H264Pool() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      exiting = true;
+    }
+    work_available.notify_all();
+    if (worker.joinable()) {
+      worker.join();
+    }
+    for (auto& configuration: configurations) {
+      finished.insert(finished.end(), configuration.second.warm.begin(), configuration.second.warm.end());
+    }
+    for (auto encoder: finished) {
+      x264_encoder_close(encoder);
+    }
+  }
+  static auto Key(const x264_param_t& param) -> string {
+    // x264_param_default zeroes the whole struct, padding included, so identical settings have identical bytes
+    return string((const char*)&param, sizeof(x264_param_t));
+  }
+  auto to_open() -> map<string, Configuration>::iterator {
+    for (auto configuration = configurations.begin(); configuration != configurations.end(); ++configuration) {
+      if (!configuration->second.failed && configuration->second.warm.size() + configuration->second.opening < spares) {
+        return configuration;
+      }
+    }
+    return configurations.end();
+  }
+  auto worker_main() -> void {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+      work_available.wait(guard, [this] { return exiting || !finished.empty() || to_open() != configurations.end(); });
+      if (exiting) {
+        return;
+      }
+      if (!finished.empty()) {
+        x264_t* encoder = finished.back();
+        finished.pop_back();
+        guard.unlock();
+        x264_encoder_close(encoder);
+        guard.lock();
+      } else {
+        auto configuration = to_open();
+        const string key = configuration->first;
+        x264_param_t param = configuration->second.param;
+        configuration->second.opening++;
+        guard.unlock();
+        x264_t* encoder = x264_encoder_open(&param);
+        guard.lock();
+        configuration = configurations.find(key);
+        if (configuration == configurations.end()) {  // dropped while opening
+          if (encoder) {
+            finished.push_back(encoder);
+          }
+        } else {
+          configuration->second.opening--;
+          if (encoder) {
+            configuration->second.warm.push_back(encoder);
+          } else {
+            configuration->second.failed = true;
+          }
+        }
+      }
+    }
+  }
+  auto acquire(const x264_param_t& param) -> x264_t* {
+    x264_t* encoder = nullptr;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if (!worker.joinable()) {
+        worker = std::thread(&_H264Pool::worker_main, this);
+      }
+      const string key = Key(param);
+      auto configuration = configurations.find(key);
+      if (configuration == configurations.end()) {
+        if (configurations.size() >= max_configurations) {
+          auto oldest = std::min_element(configurations.begin(), configurations.end(), [](const pair<const string, Configuration>& a, const pair<const string, Configuration>& b) {
+            return a.second.last_used < b.second.last_used;
+          });
+          finished.insert(finished.end(), oldest->second.warm.begin(), oldest->second.warm.end());
+          configurations.erase(oldest);
+        }
+        configuration = configurations.insert(make_pair(key, Configuration())).first;
+        configuration->second.param = param;
+      }
+      configuration->second.last_used = ++requests;
+      if (!configuration->second.warm.empty()) {
+        encoder = configuration->second.warm.back();
+        configuration->second.warm.pop_back();
+      }
+    }
+    work_available.notify_all();
+    if (!encoder) {  // cold: open on the calling thread, the pool warms up the next one meanwhile
+      x264_param_t cold_param = param;
+      encoder = x264_encoder_open(&cold_param);
+    }
+    return encoder;
+  }
+  auto release(x264_t* encoder) -> void {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      finished.push_back(encoder);
+    }
+    work_available.notify_all();
+  }
+};
+
+H264Pool::H264Pool(uint32_t spares, uint32_t max_configurations) : _this(make_shared<_H264Pool>(spares, max_configurations)) {}
+
+H264Pool::H264Pool(const H264Pool& pool) : _this(pool._this) {}
+
+auto H264Pool::warm() const -> uint32_t {
+  std::lock_guard<std::mutex> guard(_this->lock);
+  uint32_t count = 0;
+  for (const auto& configuration: _this->configurations) {
+    count += configuration.second.warm.size();
+  }
+  return count;
+}
+
+// Rewrites x264 first pass stats gathered at a lower resolution as if they came from an encode at the full one:
+// bits scale with the area, macroblock counts with the number of macroblocks
+static void RescaleStats(const string& path, uint16_t width, uint16_t height, uint16_t first_pass_width, uint16_t first_pass_height) {
+  const double area_ratio = ((double)width * height) / ((double)first_pass_width * first_pass_height);
+  const int64_t mb_count = (int64_t)((width + 15) / 16) * ((height + 15) / 16);
+  const double mb_ratio = (double)mb_count / (((first_pass_width + 15) / 16) * ((first_pass_height + 15) / 16));
+  std::ifstream in(path);
+  THROW_IF(!in.is_open(), Invalid, "cannot read first pass stats");
+  stringstream out;
+  string line;
+  while (std::getline(in, line)) {
+    if (line.compare(0, 9, "#options:") == 0) {  // "#options: WxH ..."
+      const size_t resolution = line.find(' ', 10);
+      if (resolution != string::npos) {
+        line = "#options: " + std::to_string(width) + "x" + std::to_string(height) + line.substr(resolution);
+      }
+      out << line << endl;
+      continue;
+    }
+    stringstream tokens(line);
+    vector<string> fields;
+    string token;
+    while (std::getline(tokens, token, ' ')) {
+      fields.push_back(token);
+    }
+    vector<pair<uint32_t, int64_t>> mb_fields;
+    for (uint32_t i = 0; i < fields.size(); ++i) {
+      auto& field = fields[i];
+      const size_t colon = field.find(':');
+      if (colon == string::npos) {
+        continue;
+      }
+      const string name = field.substr(0, colon);
+      if (name == "tex" || name == "mv" || name == "misc") {
+        field = name + ":" + std::to_string((int64_t)(std::stoll(field.substr(colon + 1)) * area_ratio + 0.5));
+      } else if (name == "imb" || name == "pmb" || name == "smb") {
+        mb_fields.push_back(make_pair(i, (int64_t)(std::stoll(field.substr(colon + 1)) * mb_ratio + 0.5)));
+      }
+    }
+    if (!mb_fields.empty()) {  // keep the counts adding up to the number of macroblocks of a frame
+      int64_t total = 0;
+      uint32_t largest = 0;
+      for (uint32_t i = 0; i < mb_fields.size(); ++i) {
+        total += mb_fields[i].second;
+        largest = mb_fields[i].second > mb_fields[largest].second ? i : largest;
+      }
+      mb_fields[largest].second = max(mb_fields[largest].second + mb_count - total, (int64_t)0);
+      for (const auto& mb_field: mb_fields) {
+        auto& field = fields[mb_field.first];
+        field = field.substr(0, field.find(':') + 1) + std::to_string(mb_field.second);
+      }
+    }
+    for (uint32_t i = 0; i < fields.size(); ++i) {
+      out << (i ? " " : "") << fields[i];
+    }
+    out << endl;
+  }
+  in.close();
+  std::ofstream rewritten(path, std::ios::trunc);
+  THROW_IF(!rewritten.is_open(), Invalid, "cannot write first pass stats");
+  rewritten << out.str();
+}
+
+// Stats of two_pass encodes live in memory backed storage when available
+static string TemporaryStatsPath() {
+  const char* tmpdir = getenv("TMPDIR");
+  const string dir = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : (tmpdir ? tmpdir : "/tmp");
+  string path = dir + "/vireo_x264_XXXXXX";
+  vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+  const int fd = mkstemp(name.data());
+  THROW_IF(fd == -1, Invalid, "cannot create first pass stats");
+  close(fd);
+  return string(name.data());
+}
+
+static x264_picture_t Picture(const frame::YUV& yuv, int64_t pts) {
+  x264_picture_t picture;
+  x264_picture_init(&picture);
+  picture.i_pts = pts;
+  picture.img.i_csp = X264_CSP;
+  picture.img.i_plane = 3;
+  picture.img.plane[0] = (uint8_t*)yuv.plane(frame::Y).bytes().data();
+  picture.img.plane[1] = (uint8_t*)yuv.plane(frame::U).bytes().data();
+  picture.img.plane[2] = (uint8_t*)yuv.plane(frame::V).bytes().data();
+  picture.img.i_stride[0] = (int)yuv.plane(frame::Y).row();
+  picture.img.i_stride[1] = (int)yuv.plane(frame::U).row();
+  picture.img.i_stride[2] = (int)yuv.plane(frame::V).row();
+  return picture;
+}
+
 struct _H264 {
-  unique_ptr<x264_t, decltype(&x264_encoder_close)> encoder = { NULL, [](x264_t* encoder) { if (encoder) x264_encoder_close(encoder); } };
+  unique_ptr<x264_t, std::function<void(x264_t*)>> encoder = { NULL, [](x264_t* encoder) { if (encoder) x264_encoder_close(encoder); } };
   functional::Video<frame::Frame> frames;
   uint32_t num_cached_frames = 0;
   uint32_t num_threads = 0;
   uint32_t max_delay = 0;
+  struct {  // two_pass only
+    bool pending = false;
+    x264_param_t param;  // of the second pass
+    string stats_path;
+    uint32_t downscale = 1;
+    uint64_t cache_size = 0;
+    map<uint32_t, frame::YUV> cached_yuvs;  // frames pulled by the first pass, kept for the second one
+  } two_pass;
+  ~_H264() {
+    if (!two_pass.stats_path.empty()) {
+      encoder.reset();
+      unlink(two_pass.stats_path.c_str());
+      unlink((two_pass.stats_path + ".temp").c_str());
+      unlink((two_pass.stats_path + ".mbtree").c_str());
+      unlink((two_pass.stats_path + ".mbtree.temp").c_str());
+    }
+  }
+  auto yuv(uint32_t index, const frame::Frame& frame) -> frame::YUV {
+    auto cached = two_pass.cached_yuvs.find(index);
+    if (cached == two_pass.cached_yuvs.end()) {
+      return frame.yuv();
+    }
+    frame::YUV yuv = move(cached->second);
+    two_pass.cached_yuvs.erase(cached);
+    return yuv;
+  }
+  // Runs a fast analysis pass over all frames, then replaces the encoder with the one of the second pass
+  auto first_pass(const header::SPS_PPS& sps_pps) -> void {
+    x264_param_t param = two_pass.param;
+    param.rc.b_stat_read = 0;
+    param.rc.b_stat_write = 1;
+    param.rc.psz_stat_out = (char*)two_pass.stats_path.c_str();
+    const uint16_t width = param.i_width;
+    const uint16_t height = param.i_height;
+    if (two_pass.downscale > 1) {
+      param.i_width = (int)((width / two_pass.downscale + 1) / 2) * 2;
+      param.i_height = (int)((height / two_pass.downscale + 1) / 2) * 2;
+      THROW_IF(param.i_width < 16 || param.i_height < 16, InvalidArguments, "first pass resolution is too low");
+    }
+    x264_param_apply_fastfirstpass(&param);
+    {
+      unique_ptr<x264_t, decltype(&x264_encoder_close)> first_pass_encoder(x264_encoder_open(&param), x264_encoder_close);
+      CHECK(first_pass_encoder);
+      x264_nal_t* nals;
+      int i_nals;
+      x264_picture_t out_picture;
+      uint64_t cached_size = 0;
+      for (uint32_t index = 0; index < frames.count(); ++index) {
+        const frame::Frame frame = frames(index);
+        const frame::YUV yuv = frame.yuv();
+        const uint64_t size = (uint64_t)yuv.plane(frame::Y).bytes().count() + yuv.plane(frame::U).bytes().count() + yuv.plane(frame::V).bytes().count();
+        if (cached_size + size <= two_pass.cache_size) {
+          cached_size += size;
+          two_pass.cached_yuvs.insert(make_pair(index, yuv));
+        }
+        const frame::YUV analyzed = two_pass.downscale > 1 ? frame::YUV(yuv).stretch(param.i_width, width, param.i_height, height, false) : yuv;
+        x264_picture_t in_picture = Picture(analyzed, frame.pts);
+        THROW_IF(x264_encoder_encode(first_pass_encoder.get(), &nals, &i_nals, &in_picture, &out_picture) < 0, Invalid);
+      }
+      while (x264_encoder_delayed_frames(first_pass_encoder.get())) {
+        THROW_IF(x264_encoder_encode(first_pass_encoder.get(), &nals, &i_nals, nullptr, &out_picture) < 0, Invalid);
+      }
+    }  // closing the encoder completes the stats
+    if (two_pass.downscale > 1) {
+      RescaleStats(two_pass.stats_path, width, height, param.i_width, param.i_height);
+    }
+    param = two_pass.param;
+    param.rc.b_stat_read = 1;
+    param.rc.psz_stat_in = (char*)two_pass.stats_path.c_str();
+    encoder.reset(x264_encoder_open(&param));
+    THROW_IF(!encoder, Invalid, "cannot start second pass");
+    x264_nal_t* nals;
+    int count;
+    THROW_IF(x264_encoder_headers(encoder.get(), &nals, &count) < 0, InvalidArguments);
+    CHECK(count >= 3);
+    const header::SPS_PPS second_pass_sps_pps = {
+      Data16(nals[0].p_payload + X264_NALU_LENGTH_SIZE, nals[0].i_payload - X264_NALU_LENGTH_SIZE, NULL),
+      Data16(nals[1].p_payload + X264_NALU_LENGTH_SIZE, nals[1].i_payload - X264_NALU_LENGTH_SIZE, NULL),
+      X264_NALU_LENGTH_SIZE
+    };
+    THROW_IF(second_pass_sps_pps != sps_pps, Unsupported, "second pass headers differ from the announced ones");
+    two_pass.pending = false;
+  }
   static inline const char* const GetProfile(VideoProfileType profile) {
     THROW_IF(profile != VideoProfileType::Baseline && profile != VideoProfileType::Main && profile != VideoProfileType::High, Unsupported, "unsupported profile type");
     switch (profile) {
@@ -77,6 +397,12 @@ H264::H264(const functional::Video<frame::Frame>& frames, float crf, uint32_t op
   : H264(frames, H264Params(H264Params::ComputationalParams(optimization, thread_count), H264Params::RateControlParams(RCMethod::CRF, crf, max_bitrate), H264Params::GopParams(0), GetDefaultProfile(frames.settings().width, frames.settings().height), fps)) {};
 
 H264::H264(const functional::Video<frame::Frame>& frames, const H264Params& params)
+  : H264(frames, params, nullptr) {};
+
+H264::H264(const functional::Video<frame::Frame>& frames, const H264Params& params, const H264Pool& pool)
+  : H264(frames, params, pool._this) {};
+
+H264::H264(const functional::Video<frame::Frame>& frames, const H264Params& params, const std::shared_ptr<_H264Pool>& pool)
   : functional::DirectVideo<H264, Sample>(frames.a(), frames.b()), _this(new _H264()) {
   THROW_IF(frames.count() >= security::kMaxSampleCount, Unsafe);
   THROW_IF(params.computation.optimization < kH264MinOptimization || params.computation.optimization > kH264MaxOptimization, InvalidArguments);
@@ -111,8 +437,10 @@ H264::H264(const functional::Video<frame::Frame>& frames, const H264Params& para
       param.b_sliced_threads = 1;
     }
 
-    if (!params.rc.stats_log_path.empty()) {
-      if (!params.rc.is_second_pass) {
+    if (!params.rc.stats_log_path.empty() || params.rc.two_pass) {
+      if (params.rc.two_pass) {
+        // stats are set up when the passes run
+      } else if (!params.rc.is_second_pass) {
         param.rc.b_stat_write = true;
         param.rc.psz_stat_out = (char*)params.rc.stats_log_path.c_str();
       } else {
@@ -134,6 +462,12 @@ H264::H264(const functional::Video<frame::Frame>& frames, const H264Params& para
       param.b_sliced_threads = 0;
       param.i_lookahead_threads = 1;
     }
+    if (!params.gop.scenecut) {
+      THROW_IF(params.gop.keyint_max == 0, InvalidArguments);
+      param.i_scenecut_threshold = 0;
+      param.i_keyint_max = params.gop.keyint_max;
+      param.b_open_gop = 0;
+    }
 
     switch (params.rc.rc_method) {
       case RCMethod::CRF:
@@ -164,13 +498,30 @@ H264::H264(const functional::Video<frame::Frame>& frames, const H264Params& para
         break;
     }
 
+    if (params.rc.two_pass && params.rc.first_pass_downscale > 1) {
+      param.rc.b_mb_tree = 0;  // mb-tree stats are per macroblock and cannot be rescaled
+    }
+
     THROW_IF(x264_param_apply_profile(&param, _H264::GetProfile(params.profile)) < 0, InvalidArguments);
   }
   _this->frames = frames;
   _this->num_threads = params.computation.thread_count;
   _this->max_delay = params.computation.thread_count + params.rc.look_ahead + params.gop.num_bframes;
+  if (params.rc.two_pass) {  // the encoder opened here only provides the headers until the first pass is done
+    _this->two_pass.pending = true;
+    _this->two_pass.param = param;
+    _this->two_pass.stats_path = TemporaryStatsPath();
+    _this->two_pass.downscale = params.rc.first_pass_downscale;
+    _this->two_pass.cache_size = params.rc.first_pass_cache_size;
+  }
   {  // Encoder
-    _this->encoder.reset(x264_encoder_open(&param));
+    if (pool && params.rc.stats_log_path.empty() && !params.rc.two_pass) {  // stats files are opened along with the encoder
+      _this->encoder = unique_ptr<x264_t, std::function<void(x264_t*)>>(pool->acquire(param), [pool](x264_t* encoder) {
+        if (encoder) pool->release(encoder);
+      });
+    } else {
+      _this->encoder.reset(x264_encoder_open(&param));
+    }
     CHECK(_this->encoder);
   }
   _settings = frames.settings();
@@ -195,6 +546,9 @@ H264::H264(const H264& h264)
 auto H264::operator()(uint32_t index) const -> Sample {
   THROW_IF(index >= count(), OutOfRange);
   THROW_IF(index >= _this->frames.count(), OutOfRange);
+  if (_this->two_pass.pending) {
+    _this->first_pass(_settings.sps_pps);
+  }
 
   x264_nal_t* nals = nullptr;
   int i_nals;
@@ -205,22 +559,10 @@ auto H264::operator()(uint32_t index) const -> Sample {
   };
   if (has_more_frames_to_encode()) {
     while (video_size == 0 && has_more_frames_to_encode()) {
-      const frame::Frame frame = _this->frames(index + _this->num_cached_frames);
-      const uint64_t pts = frame.pts;
-      const frame::YUV yuv = frame.yuv();
-
-      x264_picture_t in_picture;
-      x264_picture_init(&in_picture);
-      in_picture.i_pts = pts;
-
-      in_picture.img.i_csp = X264_CSP;
-      in_picture.img.i_plane = 3;
-      in_picture.img.plane[0] = (uint8_t*)yuv.plane(frame::Y).bytes().data();
-      in_picture.img.plane[1] = (uint8_t*)yuv.plane(frame::U).bytes().data();
-      in_picture.img.plane[2] = (uint8_t*)yuv.plane(frame::V).bytes().data();
-      in_picture.img.i_stride[0] = (int)yuv.plane(frame::Y).row();
-      in_picture.img.i_stride[1] = (int)yuv.plane(frame::U).row();
-      in_picture.img.i_stride[2] = (int)yuv.plane(frame::V).row();
+      const uint32_t frame_index = index + _this->num_cached_frames;
+      const frame::Frame frame = _this->frames(frame_index);
+      const frame::YUV yuv = _this->yuv(frame_index, frame);
+      x264_picture_t in_picture = Picture(yuv, frame.pts);
       video_size = x264_encoder_encode(_this->encoder.get(), &nals, &i_nals, &in_picture, &out_picture);
       _this->num_cached_frames += (video_size == 0);
       THROW_IF(_this->num_cached_frames > _this->max_delay, Unsupported);
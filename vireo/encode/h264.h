@@ -42,6 +42,7 @@ static const int kH264MinThreadCount = 0;
 static const int kH264MaxThreadCount = 64;
 static const int kDefaultH264KeyintMax = 1 << 30;
 static const int kDefaultH264KeyintMin = 0;
+static const uint64_t kDefaultH264FirstPassCacheSize = 256 * 1024 * 1024;
 
 enum RCMethod {
   CRF = 0,
@@ -121,6 +122,13 @@ struct H264Params {
     // - 10: QP-RD - requires trellis=2, aq-mode>0
     // - 11: Full RD: disable all early terminations
     uint32_t subpel_refine;
+    // dual-pass encoding within a single encoder: a fast analysis pass over all frames, optionally downscaled by
+    // first_pass_downscale in each dimension, then the actual encode - stats stay in a private temporary file and up to
+    // first_pass_cache_size bytes of the frames pulled by the first pass are kept for the second one; frames past the
+    // cache are requested again from the input, which for a decoder means seeking back and decoding them again
+    bool two_pass;
+    uint32_t first_pass_downscale;
+    uint64_t first_pass_cache_size;
     RateControlParams(RCMethod rc_method = RCMethod::CRF,
                       float crf = 28.0f,
                       uint32_t max_bitrate = 0,
@@ -136,8 +144,11 @@ struct H264Params {
                       bool mixed_refs = true,
                       uint32_t trellis = 1,
                       MotionEstimationMethod me_method = MotionEstimationMethod::Hexagon,
-                      uint32_t subpel_refine = 7)
-      : rc_method(rc_method), crf(crf), max_bitrate(max_bitrate), bitrate(bitrate), buffer_size(buffer_size), buffer_init(buffer_init), look_ahead(look_ahead), is_second_pass(is_second_pass), enable_mb_tree(enable_mb_tree), aq_mode(aq_mode), qp_min(qp_min), stats_log_path(stats_log_path), mixed_refs(mixed_refs), trellis(trellis), me_method(me_method), subpel_refine(subpel_refine) {
+                      uint32_t subpel_refine = 7,
+                      bool two_pass = false,
+                      uint32_t first_pass_downscale = 1,
+                      uint64_t first_pass_cache_size = kDefaultH264FirstPassCacheSize)
+      : rc_method(rc_method), crf(crf), max_bitrate(max_bitrate), bitrate(bitrate), buffer_size(buffer_size), buffer_init(buffer_init), look_ahead(look_ahead), is_second_pass(is_second_pass), enable_mb_tree(enable_mb_tree), aq_mode(aq_mode), qp_min(qp_min), stats_log_path(stats_log_path), mixed_refs(mixed_refs), trellis(trellis), me_method(me_method), subpel_refine(subpel_refine), two_pass(two_pass), first_pass_downscale(first_pass_downscale), first_pass_cache_size(first_pass_cache_size) {
       if (rc_method == RCMethod::CRF) {
         THROW_IF(crf < kH264MinCRF || crf > kH264MaxCRF, InvalidArguments);
       }
@@ -147,6 +158,11 @@ struct H264Params {
       THROW_IF(trellis > 2, InvalidArguments, "trellis should be [0,2]");
       THROW_IF(qp_min > 69, InvalidArguments, "qp_min should be [0, 69]");
       THROW_IF(subpel_refine > 11, InvalidArguments, "subpel_refine should be [0, 11]");
+      if (two_pass) {
+        THROW_IF(rc_method == RCMethod::CRF, InvalidArguments, "two_pass requires a target bitrate");
+        THROW_IF(!stats_log_path.empty(), InvalidArguments, "two_pass keeps its own stats");
+        THROW_IF(first_pass_downscale == 0, InvalidArguments);
+      }
     };
   } rc;
 
@@ -156,12 +172,14 @@ struct H264Params {
     uint32_t keyint_max; // maximum key frame interval
     uint32_t keyint_min;
     uint32_t frame_references;
+    bool scenecut;  // false: key frames only every keyint_max frames, so separate encodes of the same frames align
     GopParams(int32_t num_bframes = -1,
               PyramidMode mode = PyramidMode::Normal,
               uint32_t keyint_max = kDefaultH264KeyintMax,
               uint32_t keyint_min = kDefaultH264KeyintMin,
-              uint32_t frame_references = 3)
-      : num_bframes(num_bframes), pyramid_mode(mode), keyint_max(keyint_max), keyint_min(keyint_min), frame_references(frame_references) {};
+              uint32_t frame_references = 3,
+              bool scenecut = true)
+      : num_bframes(num_bframes), pyramid_mode(mode), keyint_max(keyint_max), keyint_min(keyint_min), frame_references(frame_references), scenecut(scenecut) {};
   } gop;
 
   // Other Params
@@ -176,11 +194,28 @@ struct H264Params {
     : computation(computation), rc(rc), gop(gop), profile(profile), fps(fps) {};
 };
 
+// Keeps x264 encoders opened ahead of use, so that encoders of short clips skip the setup (thread spawn, lookahead
+// allocation) and teardown of x264. A flushed x264 encoder cannot be rewound, so encoders are never handed out twice:
+// an H264 built with a pool takes a warm encoder opened with the exact same settings when there is one, and the pool
+// opens its replacement, as well as closes finished encoders, on a background thread. Settings that were not requested
+// recently are dropped past max_configurations; two-pass encodes bypass the pool.
+class PUBLIC H264Pool final {
+  std::shared_ptr<struct _H264Pool> _this;
+  friend class H264;
+public:
+  H264Pool(uint32_t spares = 1, uint32_t max_configurations = 4);
+  H264Pool(const H264Pool& pool);
+  DISALLOW_ASSIGN(H264Pool);
+  auto warm() const -> uint32_t;  // encoders opened and not handed out yet
+};
+
 class PUBLIC H264 final : public functional::DirectVideo<H264, Sample> {
   std::shared_ptr<struct _H264> _this;
+  H264(const functional::Video<frame::Frame>& frames, const H264Params& params, const std::shared_ptr<struct _H264Pool>& pool);
 public:
   H264(const functional::Video<frame::Frame>& frames, float crf, uint32_t optimization, float fps, uint32_t max_bitrate = 0, uint32_t thread_count = 0);
   H264(const functional::Video<frame::Frame>& frames, const H264Params& params);
+  H264(const functional::Video<frame::Frame>& frames, const H264Params& params, const H264Pool& pool);
   H264(const H264& h264);
   DISALLOW_ASSIGN(H264);
   auto operator()(uint32_t sample) const -> Sample;
@@ -22,6 +22,8 @@
  * SOFTWARE.
  */
 
+#include <thread>
+
 #include "vireo/base_cpp.h"
 #include "vireo/common/security.h"
 #include "vireo/constants.h"
@@ -46,9 +48,14 @@ struct _VP8 {
     delete codec;
   }};
   functional::Video<frame::Frame> frames;
+  uint32_t next_frame = 0;  // next frame to hand to the encoder
+  map<int64_t, int64_t> pts;  // frame index -> pts of the frames in the encoder
+  queue<Sample> samples;  // encoded ahead of the requested sample
+  uint32_t next_sample = 0;  // samples come out of the encoder in order, so they can only be requested in order
 };
 
-VP8::VP8(const functional::Video<frame::Frame>& frames, int quantizer, int optimization, float fps, int max_bitrate)
+VP8::VP8(const functional::Video<frame::Frame>& frames, int quantizer, int optimization, float fps, int max_bitrate,
+         const VP8Params::ComputationalParams& computation)
   : functional::DirectVideo<VP8, Sample>(frames.a(), frames.b()), _this(new _VP8()) {
   THROW_IF(_this->frames.count() >= security::kMaxSampleCount, Unsafe);
   THROW_IF(quantizer < kVP8MinQuantizer || quantizer > kVP8MaxQuantizer, InvalidArguments);
@@ -78,11 +85,16 @@ VP8::VP8(const functional::Video<frame::Frame>& frames, int quantizer, int optim
       cfg.rc_min_quantizer = quantizer;
     }
     cfg.g_error_resilient = 0;
-    cfg.g_threads = 0;
+    cfg.g_threads = computation.thread_count ? computation.thread_count : max(std::thread::hardware_concurrency(), 1U);
+    cfg.g_lag_in_frames = computation.lag_in_frames;
   }
   {  // Encoder
     THROW_IF(vpx_codec_enc_init(_this->codec.get(), codec_iface, &cfg, 0) != VPX_CODEC_OK, InvalidArguments);
     _this->initialized = true;
+    THROW_IF(vpx_codec_control(_this->codec.get(), VP8E_SET_TOKEN_PARTITIONS, (int)computation.token_partitions) != VPX_CODEC_OK, InvalidArguments);
+    if (computation.cpu_used) {
+      THROW_IF(vpx_codec_control(_this->codec.get(), VP8E_SET_CPUUSED, computation.cpu_used) != VPX_CODEC_OK, InvalidArguments);
+    }
 
     if (optimization == 0) {
       _this->deadline = VPX_DL_REALTIME;
@@ -104,30 +116,49 @@ VP8::VP8(const VP8& vp8)
 auto VP8::operator()(uint32_t index) const -> Sample {
   THROW_IF(index >= count(), OutOfRange);
   THROW_IF(index >= _this->frames.count(), OutOfRange);
+  THROW_IF(index != _this->next_sample, Unsupported, "VP8 samples must be requested in order, expected " << _this->next_sample << ", got " << index);
+
+  // with lag_in_frames the encoder holds frames back: keep feeding it, or flush it past the last frame, until it emits
+  while (_this->samples.empty()) {
+    if (_this->next_frame < _this->frames.count()) {
+      const uint32_t frame_index = _this->next_frame++;
+      const frame::Frame& frame = _this->frames(frame_index);
+      const frame::YUV yuv = frame.yuv();
+
+      vpx_image_t raw;
+      CHECK(vpx_img_wrap(&raw, VPX_IMG_FMT_I420, yuv.width(), yuv.height(), IMAGE_ROW_DEFAULT_ALIGNMENT, NULL) == &raw);
+      raw.planes[0] = (unsigned char*)yuv.plane(frame::PlaneIndex::Y).bytes().data();
+      raw.planes[1] = (unsigned char*)yuv.plane(frame::PlaneIndex::U).bytes().data();
+      raw.planes[2] = (unsigned char*)yuv.plane(frame::PlaneIndex::V).bytes().data();
+      raw.stride[0] = yuv.plane(frame::PlaneIndex::Y).row();
+      raw.stride[1] = yuv.plane(frame::PlaneIndex::U).row();
+      raw.stride[2] = yuv.plane(frame::PlaneIndex::V).row();
+
+      _this->pts[frame_index] = frame.pts;
+      CHECK(vpx_codec_encode(_this->codec.get(), &raw, frame_index, 1, 0, _this->deadline) == VPX_CODEC_OK);
+      vpx_img_free(&raw);
+    } else {
+      THROW_IF(_this->pts.empty(), Invalid);
+      CHECK(vpx_codec_encode(_this->codec.get(), NULL, -1, 1, 0, _this->deadline) == VPX_CODEC_OK);
+    }
+
+    vpx_codec_iter_t iter = NULL;
+    while (const vpx_codec_cx_pkt_t* pkt = vpx_codec_get_cx_data(_this->codec.get(), &iter)) {
+      CHECK(pkt->kind == VPX_CODEC_CX_FRAME_PKT);
+      CHECK(pkt->data.frame.sz && pkt->data.frame.sz < 8 * 1048576 && pkt->data.frame.buf);
+      CHECK((pkt->data.frame.flags & 0xf) == 0 || (pkt->data.frame.flags & 0xf) == VPX_FRAME_IS_KEY);
+      auto pts = _this->pts.find(pkt->data.frame.pts);
+      CHECK(pts != _this->pts.end());
+      auto data = common::Data32((uint8_t*)pkt->data.frame.buf, (uint32_t)pkt->data.frame.sz, NULL);
+      _this->samples.push(Sample((uint64_t)pts->second, (uint64_t)pts->second, (bool)(pkt->data.frame.flags & VPX_FRAME_IS_KEY), SampleType::Video, data));
+      _this->pts.erase(pts);
+    }
+  }
 
-  const frame::Frame& frame = _this->frames(index);
-  const frame::YUV yuv = frame.yuv();
-
-  vpx_image_t raw;
-  CHECK(vpx_img_wrap(&raw, VPX_IMG_FMT_I420, yuv.width(), yuv.height(), IMAGE_ROW_DEFAULT_ALIGNMENT, NULL) == &raw);
-  raw.planes[0] = (unsigned char*)yuv.plane(frame::PlaneIndex::Y).bytes().data();
-  raw.planes[1] = (unsigned char*)yuv.plane(frame::PlaneIndex::U).bytes().data();
-  raw.planes[2] = (unsigned char*)yuv.plane(frame::PlaneIndex::V).bytes().data();
-  raw.stride[0] = yuv.plane(frame::PlaneIndex::Y).row();
-  raw.stride[1] = yuv.plane(frame::PlaneIndex::U).row();
-  raw.stride[2] = yuv.plane(frame::PlaneIndex::V).row();
-
-  CHECK(vpx_codec_encode(_this->codec.get(), &raw, index, 1, 0, _this->deadline) == VPX_CODEC_OK);
-  vpx_img_free(&raw);
-
-  vpx_codec_iter_t iter = NULL;
-  const vpx_codec_cx_pkt_t* pkt = vpx_codec_get_cx_data(_this->codec.get(), &iter);
-  CHECK(pkt && pkt->kind == VPX_CODEC_CX_FRAME_PKT);
-  CHECK(pkt->data.frame.sz && pkt->data.frame.sz < 8 * 1048576 && pkt->data.frame.buf);
-  CHECK((pkt->data.frame.flags & 0xf) == 0 || (pkt->data.frame.flags & 0xf) == VPX_FRAME_IS_KEY);
-  auto data = common::Data32((uint8_t*)pkt->data.frame.buf, (uint32_t)pkt->data.frame.sz, NULL);
-
-  return Sample((uint64_t)frame.pts, (uint64_t)frame.pts, (bool)(pkt->data.frame.flags & VPX_FRAME_IS_KEY), SampleType::Video, data);
+  Sample sample = _this->samples.front();
+  _this->samples.pop();
+  _this->next_sample++;
+  return sample;
 }
 
 }}
@@ -36,11 +36,38 @@ static const int kVP8MinQuantizer = 5;
 static const int kVP8MaxQuantizer = 68;
 static const int kVP8MinOptimization = 0;
 static const int kVP8MaxOptimization = 2;
+static const int kVP8MinThreadCount = 0;
+static const int kVP8MaxThreadCount = 64;
+static const int kVP8MaxTokenPartitions = 3;  // log2 of the partition count: 1, 2, 4 or 8
+static const int kVP8MinCpuUsed = -16;
+static const int kVP8MaxCpuUsed = 16;
+static const int kVP8MaxLagInFrames = 25;
+
+struct VP8Params {
+  struct ComputationalParams {
+    uint32_t thread_count;  // 0: one per core
+    uint32_t token_partitions;  // lets decoders, and multi-threaded encoders, work on parts of a frame in parallel
+    int cpu_used;  // 0: libvpx default, higher is faster
+    uint32_t lag_in_frames;  // frames the encoder looks ahead, delaying its output
+    ComputationalParams(uint32_t thread_count = 1,
+                        uint32_t token_partitions = 0,
+                        int cpu_used = 0,
+                        uint32_t lag_in_frames = 0)
+      : thread_count(thread_count), token_partitions(token_partitions), cpu_used(cpu_used), lag_in_frames(lag_in_frames) {
+      THROW_IF(thread_count < kVP8MinThreadCount || thread_count > kVP8MaxThreadCount, InvalidArguments);
+      THROW_IF(token_partitions > kVP8MaxTokenPartitions, InvalidArguments);
+      THROW_IF(cpu_used < kVP8MinCpuUsed || cpu_used > kVP8MaxCpuUsed, InvalidArguments);
+      THROW_IF(lag_in_frames > kVP8MaxLagInFrames, InvalidArguments);
+    };
+  };
+};
+
 
 class PUBLIC VP8 final : public functional::DirectVideo<VP8, Sample> {
   std::shared_ptr<struct _VP8> _this;
 public:
-  VP8(const functional::Video<frame::Frame>& frames, int quantizer, int optimization, float fps, int max_bitrate = 0);
+  VP8(const functional::Video<frame::Frame>& frames, int quantizer, int optimization, float fps, int max_bitrate = 0,
+      const VP8Params::ComputationalParams& computation = VP8Params::ComputationalParams());
   VP8(const VP8& vp8);
   DISALLOW_ASSIGN(VP8);
   auto operator()(uint32_t sample) const -> Sample;
@@ -38,6 +38,7 @@ enum ErrorCategory {
   Unsafe = 10,                // due to enforced security limits
   Unsupported = 11,           // unsupported data (e.g. unsupported video codec)
   MissingDependency = 12,     // built without required library
+  WriterError = 13,           // an error occurred during abstract method call Writer.write()
 };
 
 const static char* kErrorCategoryToString[] = {
@@ -54,6 +55,7 @@ const static char* kErrorCategoryToString[] = {
   "unsafe",
   "unsupported",
   "missing dependency",
+  "writer error",
 };
 
 const static char* kErrorCategoryToGenericReason[] = {
@@ -70,6 +72,7 @@ const static char* kErrorCategoryToGenericReason[] = {
   "file is currently unsupported",
   "file is currently unsupported",
   "built without the library required",
+  "unexpected error, please report back",
 };
 
 #ifndef __EXCEPTIONS
@@ -27,6 +27,8 @@ extern "C" {
 #include "libavutil/opt.h"
 #include "libswscale/swscale.h"
 }
+#include <list>
+
 #include "vireo/base_cpp.h"
 #include "vireo/frame/rgb.h"
 #include "vireo/frame/yuv.h"
@@ -37,6 +39,119 @@ namespace frame {
 template <typename Available = has_swscale>
 auto stretch_swscale(const RGB& rgb, int num_x, int denum_x, int num_y, int denum_y) -> RGB;
 
+struct SwsContextKey {
+  int src_width;
+  int src_height;
+  AVPixelFormat src_format;
+  int dst_width;
+  int dst_height;
+  AVPixelFormat dst_format;
+  int flags;
+  bool full_range;
+  auto operator==(const SwsContextKey& other) const -> bool {
+    return src_width == other.src_width && src_height == other.src_height && src_format == other.src_format &&
+           dst_width == other.dst_width && dst_height == other.dst_height && dst_format == other.dst_format &&
+           flags == other.flags && full_range == other.full_range;
+  }
+};
+
+static auto create_context(const SwsContextKey& key) -> SwsContext* {
+  // Need to do custom init to work around ffmpeg bug with sws_getContext, that doesn't set
+  // lumConvertRange to ctx->lumRangeToJpeg_c and ctx->chrConvertRange to chrRangeToJpeg_c otherwise.
+  SwsContext* context = sws_alloc_context();
+  CHECK(context);
+  av_opt_set_int(context, "srcw", key.src_width, 0);
+  av_opt_set_int(context, "srch", key.src_height, 0);
+  av_opt_set_int(context, "src_format", key.src_format, 0);
+  av_opt_set_int(context, "dstw", key.dst_width, 0);
+  av_opt_set_int(context, "dsth", key.dst_height, 0);
+  av_opt_set_int(context, "dst_format", key.dst_format, 0);
+  av_opt_set_int(context, "sws_flags", key.flags, 0);
+  if (key.full_range) {
+    sws_setColorspaceDetails(context, sws_getCoefficients(SWS_CS_DEFAULT), AVCOL_RANGE_JPEG,
+                                      sws_getCoefficients(SWS_CS_DEFAULT), AVCOL_RANGE_JPEG,
+                                      0, 1 << 16, 1 << 16);
+  }
+  if (sws_init_context(context, NULL, NULL) < 0) {
+    sws_freeContext(context);
+    return NULL;
+  }
+  return context;
+}
+
+// Setting up a context (filter tables, runtime generated scalers) costs more than converting a frame,
+// so the most recently used contexts are kept around; per thread since a context cannot be shared while in use
+class SwsContextCache {
+  static constexpr size_t kMaxContexts = 8;
+  struct Entry {
+    SwsContextKey key;
+    SwsContext* context;
+  };
+  std::list<Entry> entries; // most recently used first
+public:
+  ~SwsContextCache() {
+    for (auto& entry: entries) {
+      sws_freeContext(entry.context);
+    }
+  }
+  auto get(const SwsContextKey& key) -> SwsContext* {
+    for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+      if (entry->key == key) {
+        entries.splice(entries.begin(), entries, entry);
+        return entry->context;
+      }
+    }
+    SwsContext* context = create_context(key);
+    CHECK(context);
+    if (entries.size() == kMaxContexts) {
+      sws_freeContext(entries.back().context);
+      entries.pop_back();
+    }
+    entries.push_front({ key, context });
+    return context;
+  }
+};
+
+static auto cached_context(const SwsContextKey& key) -> SwsContext* {
+  static thread_local SwsContextCache cache;
+  return cache.get(key);
+}
+
+template <>
+auto YUV::rgb<std::true_type>(uint8_t component_count) -> RGB {
+  THROW_IF(component_count < 3 || component_count > 4, InvalidArguments);
+  frame::RGB rgb(width(), height(), component_count);
+  uint8_t* const src[] = {
+    (uint8_t* const)plane(frame::Y).bytes().data(),
+    (uint8_t* const)plane(frame::U).bytes().data(),
+    (uint8_t* const)plane(frame::V).bytes().data()
+  };
+  const int src_stride[] = {
+    plane(frame::Y).row(),
+    plane(frame::U).row(),
+    plane(frame::V).row()
+  };
+  uint8_t* const dst[] = { (uint8_t* const)rgb.plane().bytes().data() };
+  const int dst_stride[] = { rgb.plane().row() };
+  AVPixelFormat src_format = AV_PIX_FMT_NONE;
+  if (uv_ratio().first == 2 && uv_ratio().second == 2) {
+    src_format = AV_PIX_FMT_YUV420P;
+  } else if (uv_ratio().first == 2 && uv_ratio().second == 1) {
+    src_format = AV_PIX_FMT_YUV422P;
+  }
+  CHECK(src_format != AV_PIX_FMT_NONE);
+  AVPixelFormat dst_format = AV_PIX_FMT_NONE;
+  if (component_count == 3) {
+    dst_format = AV_PIX_FMT_RGB24;
+  } else if (component_count == 4) {
+    dst_format = AV_PIX_FMT_RGBA;
+  }
+  CHECK(dst_format != AV_PIX_FMT_NONE);
+  SwsContext* img_convert_ctx = cached_context({ width(), height(), src_format, width(), height(), dst_format, SWS_LANCZOS, full_range() });
+  sws_scale(img_convert_ctx, src, src_stride, 0, height(), dst, dst_stride);
+  return rgb;
+}
+
 template <>
 auto RGB::rgb<std::true_type>(uint8_t component_count) const -> RGB {
   THROW_IF(component_count != 3 && component_count != 4, InvalidArguments);
@@ -60,12 +175,8 @@ auto RGB::rgb<std::true_type>(uint8_t component_count) const -> RGB {
     dst_format = AV_PIX_FMT_RGBA;
   }
   CHECK(dst_format != AV_PIX_FMT_NONE);
-  struct SwsContext* img_convert_ctx = sws_getContext(width(), height(), src_format,
-                                                      width(), height(), dst_format,
-                                                      SWS_LANCZOS, NULL, NULL, NULL);
-  CHECK(img_convert_ctx);
+  SwsContext* img_convert_ctx = cached_context({ width(), height(), src_format, width(), height(), dst_format, SWS_LANCZOS, false });
   sws_scale(img_convert_ctx, src, src_stride, 0, height(), dst, dst_stride);
-  sws_freeContext(img_convert_ctx);
   return rgb;
 }
 
@@ -98,24 +209,8 @@ auto RGB::yuv<std::true_type>(uint8_t uv_x_ratio, uint8_t uv_y_ratio) const -> Y
     dst_format = AV_PIX_FMT_YUV422P;
   }
   CHECK(dst_format != AV_PIX_FMT_NONE);
-  // Need to do custom init to work around ffmpeg bug with sws_getContext, that doesn't set
-  // lumConvertRange to ctx->lumRangeToJpeg_c and ctx->chrConvertRange to chrRangeToJpeg_c otherwise.
-  SwsContext* img_convert_ctx = sws_alloc_context();
-  if (yuv.full_range()) {
-    av_opt_set_int(img_convert_ctx, "srcw", width(), 0);
-    av_opt_set_int(img_convert_ctx, "srch", height(), 0);
-    av_opt_set_int(img_convert_ctx, "src_format", src_format, 0);
-    av_opt_set_int(img_convert_ctx, "dstw", width(), 0);
-    av_opt_set_int(img_convert_ctx, "dsth", height(), 0);
-    av_opt_set_int(img_convert_ctx, "dst_format", dst_format, 0);
-    sws_setColorspaceDetails(img_convert_ctx, sws_getCoefficients(SWS_CS_DEFAULT), AVCOL_RANGE_JPEG,
-                                              sws_getCoefficients(SWS_CS_DEFAULT), AVCOL_RANGE_JPEG,
-                                              0, 1 << 16, 1 << 16);
-    int32_t res = sws_init_context(img_convert_ctx, NULL, NULL);
-    CHECK(res >= 0);
-  }
+  SwsContext* img_convert_ctx = cached_context({ width(), height(), src_format, width(), height(), dst_format, SWS_BICUBIC, yuv.full_range() });
   sws_scale(img_convert_ctx, src, src_stride, 0, height(), dst, dst_stride);
-  sws_freeContext(img_convert_ctx);
   return yuv;
 }
 
@@ -137,9 +232,7 @@ auto stretch_swscale<std::true_type>(const RGB& rgb, int num_x, int denum_x, int
     format = AV_PIX_FMT_RGBA;
   }
   CHECK(format != AV_PIX_FMT_NONE);
-  SwsContext* img_convert_ctx = sws_getContext(rgb.width(), rgb.height(), format, new_width, new_height,
-                                               format, SWS_LANCZOS, NULL, NULL, NULL);
-  CHECK(img_convert_ctx);
+  SwsContext* img_convert_ctx = cached_context({ rgb.width(), rgb.height(), format, (int)new_width, (int)new_height, format, SWS_LANCZOS, false });
 
   // sws_scale checks for all 4 components (r, g, b, a) even though we pass in a packed format
   // to avoid valgrind issues we just pass the same pointer and stride 4 times
@@ -154,7 +247,6 @@ auto stretch_swscale<std::true_type>(const RGB& rgb, int num_x, int denum_x, int
   const int dstStride[] = { dst_stride, dst_stride, dst_stride, dst_stride };
 
   sws_scale(img_convert_ctx, src, srcStride, 0, rgb.height(), dst, dstStride);
-  sws_freeContext(img_convert_ctx);
   return new_rgb;
 }
 
@@ -33,6 +33,7 @@
 #include "vireo/frame/rgb.h"
 #include "vireo/frame/util.h"
 #include "vireo/frame/yuv.h"
+#include "vireo/internal/frame/kernels.h"
 
 namespace vireo {
 namespace frame {
@@ -107,18 +108,11 @@ auto RGB::crop(uint16_t x_offset, uint16_t y_offset, uint16_t cropped_width, uin
              cropped_width <= 8192 && cropped_height <= 8192), InvalidArguments);
   THROW_IF(x_offset + cropped_width > width() || y_offset + cropped_height > height(), InvalidArguments);
   frame::RGB rgb_cropped(cropped_width, cropped_height, component_count());
-  uint16_t y = 0;
-  for (auto line: plane()) {
-    if (y >= y_offset + cropped_height) {
-      break;
-    }
-    if (y >= y_offset) {
-      memcpy((void*)rgb_cropped.plane()(y - y_offset).data(),
-             (const void*)(line.data() + x_offset * component_count()),
-             cropped_width * component_count());
-    }
-    ++y;
-  }
+  const Plane& src = plane();
+  const Plane& dst = rgb_cropped.plane();
+  internal::frame::copy_plane(src.bytes().data() + y_offset * src.row() + x_offset * component_count(), src.row(),
+                              (uint8_t*)dst.bytes().data(), dst.row(),
+                              cropped_width * component_count(), cropped_height);
   return rgb_cropped;
 }
 
@@ -34,6 +34,7 @@
 #include "vireo/frame/rgb.h"
 #include "vireo/frame/util.h"
 #include "vireo/frame/yuv.h"
+#include "vireo/internal/frame/kernels.h"
 
 namespace vireo {
 namespace frame {
@@ -79,6 +80,16 @@ YUV::YUV(uint16_t width, uint16_t height, uint8_t uv_x_ratio, uint8_t uv_y_ratio
   _this = new _YUV(move(y), move(u), move(v), full_range);
 }
 
+YUV::YUV(const Plane& y, const Plane& uv, bool full_range)
+  : YUV(y.width(), y.height(), 2, 2, full_range) {
+  THROW_IF(uv.width() != _this->u.width() * 2 || uv.height() != _this->u.height(), InvalidArguments);
+  internal::frame::copy_plane(y.bytes().data(), y.row(), (uint8_t*)_this->y.bytes().data(), _this->y.row(), y.width(), y.height());
+  internal::frame::deinterleave_uv(uv.bytes().data(), uv.row(),
+                                   (uint8_t*)_this->u.bytes().data(), _this->u.row(),
+                                   (uint8_t*)_this->v.bytes().data(), _this->v.row(),
+                                   _this->u.width(), _this->u.height());
+}
+
 YUV::YUV(YUV&& yuv) : YUV(move(yuv._this->y), move(yuv._this->u), move(yuv._this->v), yuv._this->full_range) {}
 
 YUV::YUV(const YUV& yuv)
@@ -114,94 +125,40 @@ auto YUV::plane(PlaneIndex index) const -> const Plane& {
   }
 }
 
+auto YUV::interleaved_uv() const -> Plane {
+  const Plane& u = _this->u;
+  const Plane& v = _this->v;
+  const uint16_t uv_width = u.width() * 2;
+  const uint16_t uv_row = common::align_shift(uv_width, IMAGE_ROW_DEFAULT_ALIGNMENT_SHIFT);
+  const uint32_t uv_size = uv_row * u.height() + IMAGE_ROW_DEFAULT_ALIGNMENT;
+  common::Data32 uv_data((uint8_t*)memalign(IMAGE_ROW_DEFAULT_ALIGNMENT, uv_size), uv_size, [](uint8_t* p) { free(p); });
+  THROW_IF(!uv_data.data(), OutOfMemory);
+  internal::frame::interleave_uv(u.bytes().data(), u.row(), v.bytes().data(), v.row(),
+                                 (uint8_t*)uv_data.data(), uv_row, u.width(), u.height());
+  return Plane(uv_row, uv_width, u.height(), move(uv_data));
+}
+
 template <>
 auto YUV::rgb<std::false_type>(uint8_t component_count) -> RGB {
-  THROW_IF(true, MissingDependency);
+  THROW_IF(component_count < 3 || component_count > 4, InvalidArguments);
+  frame::RGB rgb(width(), height(), component_count);
+  unique_ptr<ImageYUV> src_yuv(as_imagecore(*this));
+  src_yuv->setRange(full_range() ? kYUVRange_Full : kYUVRange_Compressed);
+  CHECK(src_yuv->convertToRGB((uint8_t*)rgb.plane().bytes().data(), rgb.plane().row(), component_count, kYUVColorMatrix_BT601));
+  return rgb;
 }
 
 auto YUV::full_range(bool full_range) -> YUV {
   THROW_IF(_this->full_range == full_range, InvalidArguments);
   frame::YUV new_yuv(width(), height(), uv_ratio().first, uv_ratio().second, full_range);
-  uint8_t* const src[] = {
-    (uint8_t* const)plane(frame::Y).bytes().data(),
-    (uint8_t* const)plane(frame::U).bytes().data(),
-    (uint8_t* const)plane(frame::V).bytes().data()
-  };
-  uint8_t* const dst[] = {
-    (uint8_t* const)new_yuv.plane(frame::Y).bytes().data(),
-    (uint8_t* const)new_yuv.plane(frame::U).bytes().data(),
-    (uint8_t* const)new_yuv.plane(frame::V).bytes().data()
-  };
-  const int src_stride[] = {
-    plane(frame::Y).row(),
-    plane(frame::U).row(),
-    plane(frame::V).row()
-  };
-  const int dst_stride[] = {
-    new_yuv.plane(frame::Y).row(),
-    new_yuv.plane(frame::U).row(),
-    new_yuv.plane(frame::V).row()
-  };
-  const int width[] = {
-    plane(frame::Y).width(),
-    plane(frame::U).width(),
-    plane(frame::V).width()
-  };
-  const int height[] = {
-    plane(frame::Y).height(),
-    plane(frame::U).height(),
-    plane(frame::V).height()
-  };
-
-#define CLIP3(x, low, high) ({\
-  __typeof__(x) _x = x;\
-  (((_x) < (low)) ? (low) : ((_x) > (high)) ? (high) : (_x));\
-})
-
-  const int16_t   _0 =   0;
-  const int16_t  _16 =  16;
-  const int16_t _219 = 219;
-  const int16_t _224 = 224;
-  const int16_t _128 = 128;
-  const int16_t _235 = 235;
-  const int16_t _240 = 240;
-  const int16_t _255 = 255;
-  if (full_range) {
-    int p = frame::Y;
-    for (int y = 0; y < height[p]; ++y) {
-      uint8_t* sptr = src[p] + y * src_stride[p];
-      uint8_t* dptr = dst[p] + y * dst_stride[p];
-      for (int x = 0, w = width[p]; x < w; ++x) {
-        *dptr++ = (uint8_t)CLIP3((int16_t)_255 * ((int16_t)*sptr++ - _16) / _219, _0, _255);
-      }
-    }
-    for (auto p: enumeration::Enum<frame::PlaneIndex>(frame::U, frame::V)) {
-      for (int y = 0; y < height[p]; ++y) {
-        uint8_t* sptr = src[p] + y * src_stride[p];
-        uint8_t* dptr = dst[p] + y * dst_stride[p];
-        for (int x = 0, w = width[p]; x < w; ++x) {
-          *dptr++ = (uint8_t)CLIP3((int16_t)_255 * ((int16_t)*sptr++ - _128) / _224 + _128, _0, _255);
-        }
-      }
-    }
-  } else {
-    int p = frame::Y;
-    for (int y = 0; y < height[p]; ++y) {
-      uint8_t* sptr = src[p] + y * src_stride[p];
-      uint8_t* dptr = dst[p] + y * dst_stride[p];
-      for (int x = 0, w = width[p]; x < w; ++x) {
-        *dptr++ = (uint8_t)CLIP3((int16_t)_219 * *sptr++ / _255 + _16, _16, _235);
-      }
-    }
-    for (auto p: enumeration::Enum<frame::PlaneIndex>(frame::U, frame::V)) {
-      for (int y = 0; y < height[p]; ++y) {
-        uint8_t* sptr = src[p] + y * src_stride[p];
-        uint8_t* dptr = dst[p] + y * dst_stride[p];
-        for (int x = 0, w = width[p]; x < w; ++x) {
-          *dptr++ = (uint8_t)CLIP3((int16_t)_224 * ((int16_t)*sptr++ - _128) / _255 + _128, _16, _240);
-        }
-      }
-    }
+  for (auto p: enumeration::Enum<frame::PlaneIndex>(frame::Y, frame::V)) {
+    const Plane& src = plane(p);
+    const Plane& dst = new_yuv.plane(p);
+    const internal::frame::RangeConversion conversion = (p == frame::Y) ?
+      (full_range ? internal::frame::ExpandY : internal::frame::CompressY) :
+      (full_range ? internal::frame::ExpandUV : internal::frame::CompressUV);
+    internal::frame::convert_range(src.bytes().data(), src.row(), (uint8_t*)dst.bytes().data(), dst.row(),
+                                   src.width(), src.height(), conversion);
   }
   return new_yuv;
 }
@@ -223,6 +180,51 @@ auto YUV::crop(uint16_t x_offset, uint16_t y_offset, uint16_t cropped_width, uin
   return new_yuv;
 }
 
+auto YUV::crop_scale_rotate(uint16_t x_offset, uint16_t y_offset, uint16_t cropped_width, uint16_t cropped_height,
+                            uint16_t new_width, uint16_t new_height, Rotation direction, bool high_quality,
+                            uint8_t thread_count) const -> YUV {
+  THROW_IF(uv_ratio().first != 2 || uv_ratio().second != 2, Unsupported);
+  THROW_IF(!(cropped_width > 0 && cropped_height > 0 && cropped_width <= 8192 && cropped_height <= 8192), InvalidArguments);
+  THROW_IF(x_offset + cropped_width > width() || y_offset + cropped_height > height(), InvalidArguments);
+  THROW_IF(!security::valid_dimensions(new_width, new_height), InvalidArguments);
+  THROW_IF(thread_count == 0, InvalidArguments);
+
+  const bool flip_coords = direction == Rotation::Left || direction == Rotation::Right;
+  const uint16_t scaled_width  = flip_coords ? new_height : new_width;
+  const uint16_t scaled_height = flip_coords ? new_width : new_height;
+
+  // Cropping only moves the origin of the source planes, the resize kernels read the cropped region in place
+  unique_ptr<ImageYUV> src_yuv(as_imagecore(*this));
+  if (x_offset != 0 || y_offset != 0 || cropped_width != width() || cropped_height != height()) {
+    ImageRegion bounding_box(cropped_width, cropped_height, x_offset, y_offset);
+    THROW_IF(!src_yuv->crop(bounding_box), InvalidArguments);
+  }
+
+  frame::YUV new_yuv(new_width, new_height, uv_ratio().first, uv_ratio().second, full_range());
+  unique_ptr<ImageYUV> dst_yuv(as_imagecore(new_yuv));
+
+  EImageOrientation orientation = EImageOrientation::kImageOrientation_Up;
+  switch (direction) {
+    case Rotation::Right:
+      orientation = EImageOrientation::kImageOrientation_Right;
+      break;
+    case Rotation::Down:
+      orientation = EImageOrientation::kImageOrientation_Down;
+      break;
+    case Rotation::Left:
+      orientation = EImageOrientation::kImageOrientation_Left;
+      break;
+    default:
+      break;
+  }
+
+  bool is_up_sample = (scaled_width > cropped_width) || (scaled_height > cropped_height);
+  EResizeQuality resize_quality = high_quality ? kResizeQuality_High : (is_up_sample ? kResizeQuality_Low : kResizeQuality_Bilinear);
+  THROW_IF(!src_yuv->resizeRotate(dst_yuv.get(), resize_quality, orientation, thread_count), OutOfMemory);
+
+  return new_yuv;
+}
+
 auto YUV::rotate(Rotation direction) -> YUV {
   THROW_IF(uv_ratio().first != 2 || uv_ratio().second != 2, Unsupported);
   THROW_IF(direction == Rotation::None, InvalidArguments);
@@ -253,8 +255,9 @@ auto YUV::rotate(Rotation direction) -> YUV {
   return new_yuv;
 }
 
-auto YUV::stretch(int num_x, int denum_x, int num_y, int denum_y, bool high_quality) -> YUV {
+auto YUV::stretch(int num_x, int denum_x, int num_y, int denum_y, bool high_quality, uint8_t thread_count) -> YUV {
   THROW_IF(uv_ratio().first != 2 || uv_ratio().second != 2, Unsupported);
+  THROW_IF(thread_count == 0, InvalidArguments);
   THROW_IF(!(num_x < 10000 && denum_x < 10000 && num_x >= 0 && denum_x >= 0), InvalidArguments);
   THROW_IF(!(num_y < 10000 && denum_y < 10000 && num_y >= 0 && denum_y >= 0), InvalidArguments);
   const uint32_t new_width = common::round_divide((uint32_t)width(), (uint32_t)num_x, (uint32_t)denum_x);
@@ -269,7 +272,7 @@ auto YUV::stretch(int num_x, int denum_x, int num_y, int denum_y, bool high_qual
 
   bool is_up_sample = (num_x > denum_x) || (num_y > denum_y);
   EResizeQuality resize_quality = high_quality ? kResizeQuality_High : (is_up_sample ? kResizeQuality_Low : kResizeQuality_Bilinear);
-  src_yuv->resize(dst_yuv.get(), resize_quality);
+  src_yuv->resize(dst_yuv.get(), resize_quality, thread_count);
 
   return new_yuv;
 }
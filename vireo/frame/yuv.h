@@ -41,6 +41,8 @@ class PUBLIC YUV : public domain::Interval<YUV, std::function<common::Data16(Pla
 public:
   YUV(uint16_t width, uint16_t height, uint8_t uv_x_ratio, uint8_t uv_y_ratio, bool full_range = true);
   YUV(Plane&& y, Plane&& u, Plane&& v, bool full_range = true);
+  // NV12: 4:2:0 with the U and V samples interleaved in a single plane, each uv row being twice the chroma width
+  YUV(const Plane& y, const Plane& uv, bool full_range = true);
   YUV(YUV&& yuv);
   YUV(const YUV& yuv);
   virtual ~YUV();
@@ -51,15 +53,23 @@ public:
   auto uv_ratio() const -> std::pair<uint8_t, uint8_t>;
   auto full_range() const -> bool;
   auto plane(PlaneIndex index) const -> const Plane&;
+  auto interleaved_uv() const -> Plane; // U and V planes as a single NV12 chroma plane
 
   // Transforms
+  // BT.601; chroma is upsampled with Lanczos through swscale when available, by replication otherwise
   template <typename Available = has_swscale>
   auto rgb(uint8_t component_count) -> RGB;
   auto full_range(bool full_range) -> YUV;
   auto crop(uint16_t x_offset, uint16_t y_offset, uint16_t width, uint16_t height) const -> YUV;
+  // Equivalent of crop(), then stretch() to the pre-rotation size, then rotate(), done in a single pass;
+  // width and height are the dimensions of the final (rotated) frame
+  auto crop_scale_rotate(uint16_t x_offset, uint16_t y_offset, uint16_t cropped_width, uint16_t cropped_height,
+                         uint16_t width, uint16_t height, Rotation direction, bool high_quality = true,
+                         uint8_t thread_count = 1) const -> YUV;
   auto rotate(Rotation direction) -> YUV;
   auto scale(int num, int denum) -> YUV { return stretch(num, denum, num, denum); }
-  auto stretch(int num_x, int denum_x, int num_y, int denum_y, bool high_quality = true) -> YUV;
+  // thread_count > 1 downscales stripes of each plane concurrently, with the same output as a single thread
+  auto stretch(int num_x, int denum_x, int num_y, int denum_y, bool high_quality = true, uint8_t thread_count = 1) -> YUV;
 };
 
 }}
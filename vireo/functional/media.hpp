@@ -28,6 +28,7 @@
 #include "vireo/types.h"
 #include "vireo/domain/interval.hpp"
 #include "vireo/domain/util.h"
+#include "vireo/functional/prefetch.hpp"
 #include "vireo/settings/settings.h"
 
 namespace vireo {
@@ -165,6 +166,23 @@ struct Media : public domain::Interval<ObjectType, ReturnType, ArgType>, public
     }, 0, (ArgType)mapping.size(), this->settings());
   }
 
+  // Values [start, end) as a view indexed from 0, without going through the rest of the media like filter_index
+  auto slice(ArgType start, ArgType end) const -> Media<Function<ReturnType, ArgType>, ReturnType, ArgType, Type> {
+    THROW_IF(start < this->a() || end > this->b() || start > end, OutOfRange);
+    return Media<Function<ReturnType, ArgType>, ReturnType, ArgType, Type>([f = *static_cast<const ObjectType*>(this), start](ArgType arg) {
+      return f(start + arg);
+    }, 0, end - start, this->settings());
+  }
+
+  // Evaluates up to lookahead values past the last requested one on thread_count background threads (see Prefetcher),
+  // so that the work of this media overlaps with whatever consumes it
+  auto prefetch(uint32_t lookahead, uint32_t thread_count = 1) -> Media<Function<ReturnType, ArgType>, ReturnType, ArgType, Type> {
+    auto prefetcher = make_shared<Prefetcher<ReturnType, ArgType>>(*static_cast<ObjectType*>(this), this->b(), lookahead, thread_count);
+    return Media<Function<ReturnType, ArgType>, ReturnType, ArgType, Type>([prefetcher](ArgType arg) -> ReturnType {
+      return (*prefetcher)(arg);
+    }, this->a(), this->b(), this->settings());
+  }
+
   auto vectorize() const -> vector<ReturnType> {
     vector<ReturnType> out;
     for (const auto& value: *this) {
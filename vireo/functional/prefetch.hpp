@@ -0,0 +1,178 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+#include "vireo/base_h.h"
+#include "vireo/base_cpp.h"
+#include "vireo/error/error.h"
+
+namespace vireo {
+namespace functional {
+
+// Evaluates f ahead of the caller on dedicated worker threads: a request for index x returns once f(x) is ready
+// and lets the workers compute up to x + lookahead meanwhile. Results are handed out by index, so the order of
+// delivery is the order of the requests; an exception thrown by f(x) is rethrown to whoever requests x.
+// Requesting an index outside of the window (seeking) drops the pending results and restarts from there.
+// With a single thread f is called serially, in increasing index order, so stateful functions such as decoders
+// are safe to prefetch as long as nothing else calls them concurrently; more threads require f to be reentrant.
+// Several consumers can share the same results (e.g. one decoder feeding many encoders): each of them requests
+// through its own id, results are kept until every consumer moved past them and the window trails the slowest one,
+// so a consumer that stops requesting before the end must be released for the others to make progress.
+template <typename ReturnType, typename ArgType>
+class Prefetcher {
+  struct Slot {
+    uint64_t ticket;
+    bool done;
+    unique_ptr<ReturnType> value;
+    std::exception_ptr error;
+  };
+  const std::function<ReturnType(ArgType)> f;
+  const ArgType b;
+  const uint32_t lookahead;
+  const uint32_t thread_count;
+  vector<ArgType> positions;  // last index requested by each consumer
+  std::mutex lock;
+  std::condition_variable work_available;
+  std::condition_variable result_available;
+  map<ArgType, Slot> slots;
+  vector<std::thread> workers;
+  bool started = false;
+  bool exiting = false;
+  ArgType next = 0;
+  uint64_t tickets = 0;
+
+  auto current() const -> ArgType {
+    return *std::min_element(positions.begin(), positions.end());
+  }
+  auto schedulable() const -> bool {
+    // the requested index is always evaluated, but nothing is prefetched past b or once every consumer is released
+    const ArgType current = this->current();
+    return started && current != std::numeric_limits<ArgType>::max()
+        && (uint64_t)next <= (uint64_t)current + lookahead && (next < b || next == current);
+  }
+  auto worker_main() -> void {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+      work_available.wait(guard, [this] { return exiting || schedulable(); });
+      if (exiting) {
+        return;
+      }
+      const ArgType index = next++;
+      const uint64_t ticket = ++tickets;
+      slots[index] = { ticket, false, nullptr, nullptr };
+      unique_ptr<ReturnType> value;
+      std::exception_ptr error;
+      guard.unlock();
+      try {
+        value.reset(new ReturnType(f(index)));
+      } catch (...) {
+        error = std::current_exception();
+      }
+      guard.lock();
+      auto slot = slots.find(index);
+      if (slot != slots.end() && slot->second.ticket == ticket) {  // otherwise dropped by a seek while computing
+        slot->second.done = true;
+        slot->second.value = move(value);
+        slot->second.error = error;
+        result_available.notify_all();
+      }
+    }
+  }
+public:
+  Prefetcher(const std::function<ReturnType(ArgType)>& f, ArgType b, uint32_t lookahead, uint32_t thread_count,
+             uint32_t consumer_count = 1)
+    : f(f), b(b), lookahead(lookahead), thread_count(thread_count), positions(consumer_count, 0) {
+    THROW_IF(lookahead == 0, InvalidArguments);
+    THROW_IF(thread_count == 0, InvalidArguments);
+    THROW_IF(consumer_count == 0, InvalidArguments);
+  }
+  ~Prefetcher() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      exiting = true;
+    }
+    work_available.notify_all();
+    for (auto& worker: workers) {
+      worker.join();
+    }
+  }
+  // Number of values computed past the index last requested by the slowest consumer
+  auto ready() -> uint32_t {
+    std::lock_guard<std::mutex> guard(lock);
+    uint32_t count = 0;
+    for (auto slot = slots.upper_bound(current()); slot != slots.end(); ++slot) {
+      count += slot->second.done;
+    }
+    return count;
+  }
+  // Stops holding results back for consumer, which must not request anything afterwards
+  auto release(uint32_t consumer) -> void {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      THROW_IF(consumer >= positions.size(), OutOfRange);
+      positions[consumer] = std::numeric_limits<ArgType>::max();
+      slots.erase(slots.begin(), slots.lower_bound(current()));
+    }
+    work_available.notify_all();
+  }
+  auto operator()(ArgType x, uint32_t consumer = 0) -> ReturnType {
+    std::unique_lock<std::mutex> guard(lock);
+    THROW_IF(consumer >= positions.size(), OutOfRange);
+    if (!started) {
+      for (uint32_t i = 0; i < thread_count; ++i) {
+        workers.emplace_back(&Prefetcher::worker_main, this);
+      }
+      started = true;
+    }
+    positions[consumer] = x;
+    slots.erase(slots.begin(), slots.lower_bound(current()));
+    while (true) {
+      auto slot = slots.find(x);
+      if (slot == slots.end()) {
+        if (x < next || x == current()) {  // dropped by a seek, or a jump of the slowest consumer: restart at x
+          slots.clear();
+          next = x;
+        }  // otherwise x becomes schedulable once the slower consumers catch up
+        work_available.notify_all();
+      } else if (slot->second.done) {
+        if (slot->second.error) {
+          std::rethrow_exception(slot->second.error);
+        }
+        return *slot->second.value;
+      } else {
+        work_available.notify_all();
+      }
+      result_available.wait(guard);
+    }
+  }
+};
+
+}}
@@ -0,0 +1,339 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#define KERNELS_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include "imagecore/image/internal/platform_support.h"
+#include "vireo/base_cpp.h"
+#include "vireo/error/error.h"
+#include "vireo/internal/frame/kernels.h"
+
+namespace vireo {
+namespace internal {
+namespace frame {
+
+// y = clip(num * (x - bias_in) / den + bias_out, low, high), with the division truncating towards zero;
+// the vector kernels compute |num * (x - bias_in)| / den as a 16-bit multiply-high by magic followed by a shift,
+// magic / shift being the smallest pair that is exact over the whole 8-bit input range
+struct RangeParams {
+  int16_t bias_in;
+  uint16_t num;
+  uint16_t den;
+  uint16_t magic;
+  uint16_t shift;
+  int16_t bias_out;
+  uint8_t low;
+  uint8_t high;
+};
+
+static const RangeParams kRangeParams[] = {
+  {  16, 255, 219, 19153, 6,   0,  0, 255 }, // ExpandY
+  { 128, 255, 224, 18725, 6, 128,  0, 255 }, // ExpandUV
+  {   0, 219, 255, 16449, 6,  16, 16, 235 }, // CompressY
+  { 128, 224, 255, 16449, 6, 128, 16, 240 }, // CompressUV
+};
+
+static inline uint8_t convert_range_pixel(uint8_t p, const RangeParams& r) {
+  const int y = (int)r.num * ((int)p - r.bias_in) / (int)r.den + r.bias_out;
+  return (uint8_t)min(max(y, (int)r.low), (int)r.high);
+}
+
+static void convert_range_row_c(const uint8_t* src, uint8_t* dst, int width, const RangeParams& r) {
+  for (int x = 0; x < width; ++x) {
+    dst[x] = convert_range_pixel(src[x], r);
+  }
+}
+
+static void interleave_row_c(const uint8_t* u, const uint8_t* v, uint8_t* uv, int width) {
+  for (int x = 0; x < width; ++x) {
+    uv[2 * x]     = u[x];
+    uv[2 * x + 1] = v[x];
+  }
+}
+
+static void deinterleave_row_c(const uint8_t* uv, uint8_t* u, uint8_t* v, int width) {
+  for (int x = 0; x < width; ++x) {
+    u[x] = uv[2 * x];
+    v[x] = uv[2 * x + 1];
+  }
+}
+
+#if KERNELS_X86
+
+__attribute__((target("sse2")))
+static void convert_range_row_sse2(const uint8_t* src, uint8_t* dst, int width, const RangeParams& r) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias_in = _mm_set1_epi16(r.bias_in);
+  const __m128i num = _mm_set1_epi16((int16_t)r.num);
+  const __m128i magic = _mm_set1_epi16((int16_t)r.magic);
+  const __m128i shift = _mm_cvtsi32_si128(r.shift);
+  const __m128i bias_out = _mm_set1_epi16(r.bias_out);
+  const __m128i low = _mm_set1_epi8((char)r.low);
+  const __m128i high = _mm_set1_epi8((char)r.high);
+  auto convert = [&](__m128i p) __attribute__((target("sse2"))) -> __m128i {
+    const __m128i x = _mm_sub_epi16(p, bias_in);
+    const __m128i sign = _mm_srai_epi16(x, 15);
+    const __m128i abs_x = _mm_sub_epi16(_mm_xor_si128(x, sign), sign);
+    const __m128i q = _mm_srl_epi16(_mm_mulhi_epu16(_mm_mullo_epi16(abs_x, num), magic), shift);
+    return _mm_add_epi16(_mm_sub_epi16(_mm_xor_si128(q, sign), sign), bias_out);
+  };
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const __m128i p = _mm_loadu_si128((const __m128i*)(src + x));
+    const __m128i y = _mm_packus_epi16(convert(_mm_unpacklo_epi8(p, zero)), convert(_mm_unpackhi_epi8(p, zero)));
+    _mm_storeu_si128((__m128i*)(dst + x), _mm_min_epu8(_mm_max_epu8(y, low), high));
+  }
+  convert_range_row_c(src + x, dst + x, width - x, r);
+}
+
+__attribute__((target("ssse3")))
+static void convert_range_row_ssse3(const uint8_t* src, uint8_t* dst, int width, const RangeParams& r) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias_in = _mm_set1_epi16(r.bias_in);
+  const __m128i num = _mm_set1_epi16((int16_t)r.num);
+  const __m128i magic = _mm_set1_epi16((int16_t)r.magic);
+  const __m128i shift = _mm_cvtsi32_si128(r.shift);
+  const __m128i bias_out = _mm_set1_epi16(r.bias_out);
+  const __m128i low = _mm_set1_epi8((char)r.low);
+  const __m128i high = _mm_set1_epi8((char)r.high);
+  auto convert = [&](__m128i p) __attribute__((target("ssse3"))) -> __m128i {
+    const __m128i x = _mm_sub_epi16(p, bias_in);
+    const __m128i q = _mm_srl_epi16(_mm_mulhi_epu16(_mm_mullo_epi16(_mm_abs_epi16(x), num), magic), shift);
+    return _mm_add_epi16(_mm_sign_epi16(q, x), bias_out);
+  };
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const __m128i p = _mm_loadu_si128((const __m128i*)(src + x));
+    const __m128i y = _mm_packus_epi16(convert(_mm_unpacklo_epi8(p, zero)), convert(_mm_unpackhi_epi8(p, zero)));
+    _mm_storeu_si128((__m128i*)(dst + x), _mm_min_epu8(_mm_max_epu8(y, low), high));
+  }
+  convert_range_row_c(src + x, dst + x, width - x, r);
+}
+
+__attribute__((target("avx2")))
+static void convert_range_row_avx2(const uint8_t* src, uint8_t* dst, int width, const RangeParams& r) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i bias_in = _mm256_set1_epi16(r.bias_in);
+  const __m256i num = _mm256_set1_epi16((int16_t)r.num);
+  const __m256i magic = _mm256_set1_epi16((int16_t)r.magic);
+  const __m128i shift = _mm_cvtsi32_si128(r.shift);
+  const __m256i bias_out = _mm256_set1_epi16(r.bias_out);
+  const __m256i low = _mm256_set1_epi8((char)r.low);
+  const __m256i high = _mm256_set1_epi8((char)r.high);
+  auto convert = [&](__m256i p) __attribute__((target("avx2"))) -> __m256i {
+    const __m256i x = _mm256_sub_epi16(p, bias_in);
+    const __m256i q = _mm256_srl_epi16(_mm256_mulhi_epu16(_mm256_mullo_epi16(_mm256_abs_epi16(x), num), magic), shift);
+    return _mm256_add_epi16(_mm256_sign_epi16(q, x), bias_out);
+  };
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    // unpack and pack both operate within 128-bit lanes, so the pixel order is preserved
+    const __m256i p = _mm256_loadu_si256((const __m256i*)(src + x));
+    const __m256i y = _mm256_packus_epi16(convert(_mm256_unpacklo_epi8(p, zero)), convert(_mm256_unpackhi_epi8(p, zero)));
+    _mm256_storeu_si256((__m256i*)(dst + x), _mm256_min_epu8(_mm256_max_epu8(y, low), high));
+  }
+  convert_range_row_sse2(src + x, dst + x, width - x, r);
+}
+
+__attribute__((target("sse2")))
+static void interleave_row_sse2(const uint8_t* u, const uint8_t* v, uint8_t* uv, int width) {
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const __m128i u16 = _mm_loadu_si128((const __m128i*)(u + x));
+    const __m128i v16 = _mm_loadu_si128((const __m128i*)(v + x));
+    _mm_storeu_si128((__m128i*)(uv + 2 * x),      _mm_unpacklo_epi8(u16, v16));
+    _mm_storeu_si128((__m128i*)(uv + 2 * x + 16), _mm_unpackhi_epi8(u16, v16));
+  }
+  interleave_row_c(u + x, v + x, uv + 2 * x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void interleave_row_avx2(const uint8_t* u, const uint8_t* v, uint8_t* uv, int width) {
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    const __m256i u32 = _mm256_loadu_si256((const __m256i*)(u + x));
+    const __m256i v32 = _mm256_loadu_si256((const __m256i*)(v + x));
+    const __m256i lo = _mm256_unpacklo_epi8(u32, v32);
+    const __m256i hi = _mm256_unpackhi_epi8(u32, v32);
+    _mm256_storeu_si256((__m256i*)(uv + 2 * x),      _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*)(uv + 2 * x + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+  interleave_row_sse2(u + x, v + x, uv + 2 * x, width - x);
+}
+
+__attribute__((target("sse2")))
+static void deinterleave_row_sse2(const uint8_t* uv, uint8_t* u, uint8_t* v, int width) {
+  const __m128i mask = _mm_set1_epi16(0x00FF);
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const __m128i a = _mm_loadu_si128((const __m128i*)(uv + 2 * x));
+    const __m128i b = _mm_loadu_si128((const __m128i*)(uv + 2 * x + 16));
+    _mm_storeu_si128((__m128i*)(u + x), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+    _mm_storeu_si128((__m128i*)(v + x), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+  }
+  deinterleave_row_c(uv + 2 * x, u + x, v + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void deinterleave_row_avx2(const uint8_t* uv, uint8_t* u, uint8_t* v, int width) {
+  const __m256i mask = _mm256_set1_epi16(0x00FF);
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    // packus interleaves the 128-bit lanes of its operands, restore the order with a 64-bit permute
+    const __m256i a = _mm256_loadu_si256((const __m256i*)(uv + 2 * x));
+    const __m256i b = _mm256_loadu_si256((const __m256i*)(uv + 2 * x + 32));
+    const __m256i u32 = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+    const __m256i v32 = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+    _mm256_storeu_si256((__m256i*)(u + x), _mm256_permute4x64_epi64(u32, 0xD8));
+    _mm256_storeu_si256((__m256i*)(v + x), _mm256_permute4x64_epi64(v32, 0xD8));
+  }
+  deinterleave_row_sse2(uv + 2 * x, u + x, v + x, width - x);
+}
+
+#elif KERNELS_NEON
+
+static void convert_range_row_neon(const uint8_t* src, uint8_t* dst, int width, const RangeParams& r) {
+  const int16x8_t zero = vdupq_n_s16(0);
+  const int16x8_t bias_in = vdupq_n_s16(r.bias_in);
+  const uint16x8_t num = vdupq_n_u16(r.num);
+  const uint16x4_t magic = vdup_n_u16(r.magic);
+  const int32x4_t shift = vdupq_n_s32(-(16 + (int32_t)r.shift));
+  const int16x8_t bias_out = vdupq_n_s16(r.bias_out);
+  const uint8x16_t low = vdupq_n_u8(r.low);
+  const uint8x16_t high = vdupq_n_u8(r.high);
+  auto convert = [&](uint8x8_t p) -> uint8x8_t {
+    const int16x8_t x = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(p)), bias_in);
+    const uint16x8_t t = vmulq_u16(vreinterpretq_u16_s16(vabsq_s16(x)), num);
+    const uint32x4_t q_lo = vshlq_u32(vmull_u16(vget_low_u16(t), magic), shift);
+    const uint32x4_t q_hi = vshlq_u32(vmull_u16(vget_high_u16(t), magic), shift);
+    const int16x8_t q = vreinterpretq_s16_u16(vcombine_u16(vmovn_u32(q_lo), vmovn_u32(q_hi)));
+    return vqmovun_s16(vaddq_s16(vbslq_s16(vcltq_s16(x, zero), vnegq_s16(q), q), bias_out));
+  };
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const uint8x16_t p = vld1q_u8(src + x);
+    const uint8x16_t y = vcombine_u8(convert(vget_low_u8(p)), convert(vget_high_u8(p)));
+    vst1q_u8(dst + x, vminq_u8(vmaxq_u8(y, low), high));
+  }
+  convert_range_row_c(src + x, dst + x, width - x, r);
+}
+
+static void interleave_row_neon(const uint8_t* u, const uint8_t* v, uint8_t* uv, int width) {
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x2_t uv16;
+    uv16.val[0] = vld1q_u8(u + x);
+    uv16.val[1] = vld1q_u8(v + x);
+    vst2q_u8(uv + 2 * x, uv16);
+  }
+  interleave_row_c(u + x, v + x, uv + 2 * x, width - x);
+}
+
+static void deinterleave_row_neon(const uint8_t* uv, uint8_t* u, uint8_t* v, int width) {
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const uint8x16x2_t uv16 = vld2q_u8(uv + 2 * x);
+    vst1q_u8(u + x, uv16.val[0]);
+    vst1q_u8(v + x, uv16.val[1]);
+  }
+  deinterleave_row_c(uv + 2 * x, u + x, v + x, width - x);
+}
+
+#endif
+
+struct Kernels {
+  void (*convert_range_row)(const uint8_t* src, uint8_t* dst, int width, const RangeParams& r);
+  void (*interleave_row)(const uint8_t* u, const uint8_t* v, uint8_t* uv, int width);
+  void (*deinterleave_row)(const uint8_t* uv, uint8_t* u, uint8_t* v, int width);
+};
+
+static auto select_kernels() -> Kernels {
+  Kernels kernels = { convert_range_row_c, interleave_row_c, deinterleave_row_c };
+#if KERNELS_X86
+  if (checkForCPUSupport(kCPUFeature_AVX2)) {
+    kernels = { convert_range_row_avx2, interleave_row_avx2, deinterleave_row_avx2 };
+  } else if (checkForCPUSupport(kCPUFeature_SSE3_S)) {
+    kernels = { convert_range_row_ssse3, interleave_row_sse2, deinterleave_row_sse2 };
+  } else if (checkForCPUSupport(kCPUFeature_SSE2)) {
+    kernels = { convert_range_row_sse2, interleave_row_sse2, deinterleave_row_sse2 };
+  }
+#elif KERNELS_NEON
+  kernels = { convert_range_row_neon, interleave_row_neon, deinterleave_row_neon };
+#endif
+  return kernels;
+}
+
+static auto kernels() -> const Kernels& {
+  // Selected on first use rather than during static initialization: imagecore's sCPUFeatures is itself dynamically
+  // initialized in another translation unit, so a static initializer here may run first and see no CPU features
+  static const Kernels kernels = select_kernels();
+  return kernels;
+}
+
+auto convert_range(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride, int width, int height, RangeConversion conversion) -> void {
+  THROW_IF(conversion < ExpandY || conversion > CompressUV, InvalidArguments);
+  THROW_IF(width > src_stride || width > dst_stride, InvalidArguments);
+  const RangeParams& r = kRangeParams[conversion];
+  const auto convert_range_row = kernels().convert_range_row;
+  for (int y = 0; y < height; ++y) {
+    convert_range_row(src + y * src_stride, dst + y * dst_stride, width, r);
+  }
+}
+
+auto copy_plane(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride, int width, int height) -> void {
+  THROW_IF(width > src_stride || width > dst_stride, InvalidArguments);
+  if (src_stride == width && dst_stride == width) {
+    memcpy(dst, src, (size_t)width * height);
+    return;
+  }
+  for (int y = 0; y < height; ++y) {
+    memcpy(dst + y * dst_stride, src + y * src_stride, width);
+  }
+}
+
+auto interleave_uv(const uint8_t* u, int u_stride, const uint8_t* v, int v_stride, uint8_t* uv, int uv_stride, int width, int height) -> void {
+  THROW_IF(width > u_stride || width > v_stride || 2 * width > uv_stride, InvalidArguments);
+  const auto interleave_row = kernels().interleave_row;
+  for (int y = 0; y < height; ++y) {
+    interleave_row(u + y * u_stride, v + y * v_stride, uv + y * uv_stride, width);
+  }
+}
+
+auto deinterleave_uv(const uint8_t* uv, int uv_stride, uint8_t* u, int u_stride, uint8_t* v, int v_stride, int width, int height) -> void {
+  THROW_IF(width > u_stride || width > v_stride || 2 * width > uv_stride, InvalidArguments);
+  const auto deinterleave_row = kernels().deinterleave_row;
+  for (int y = 0; y < height; ++y) {
+    deinterleave_row(uv + y * uv_stride, u + y * u_stride, v + y * v_stride, width);
+  }
+}
+
+}}}
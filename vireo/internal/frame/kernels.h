@@ -0,0 +1,46 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "vireo/base_h.h"
+
+namespace vireo {
+namespace internal {
+namespace frame {
+
+// Pixel kernels shared by the frame transforms, dispatched at runtime to AVX2 / SSSE3 / SSE2 on x86 and NEON on ARM
+enum RangeConversion { ExpandY = 0, ExpandUV = 1, CompressY = 2, CompressUV = 3 };
+
+// Converts between limited (16-235 / 16-240) and full (0-255) range, bit-exact with the integer division formula
+auto convert_range(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride, int width, int height, RangeConversion conversion) -> void;
+
+// Copies a width x height region between planes with different strides
+auto copy_plane(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride, int width, int height) -> void;
+
+// NV12 <-> I420 chroma: width is the number of chroma samples per row in each of U and V
+auto interleave_uv(const uint8_t* u, int u_stride, const uint8_t* v, int v_stride, uint8_t* uv, int uv_stride, int width, int height) -> void;
+auto deinterleave_uv(const uint8_t* uv, int uv_stride, uint8_t* u, int u_stride, uint8_t* v, int v_stride, int width, int height) -> void;
+
+}}}
@@ -22,26 +22,16 @@
  * SOFTWARE.
  */
 
-extern "C" {
-#include "libavformat/avformat.h"
-#include "libavcodec/avcodec.h"
-#include "libavutil/opt.h"
-}
+#include <iomanip>
+
 #include "vireo/base_cpp.h"
-#include "vireo/common/math.h"
 #include "vireo/common/security.h"
 #include "vireo/constants.h"
 #include "vireo/encode/util.h"
-#include "vireo/internal/decode/annexb.h"
 #include "vireo/internal/decode/avcc.h"
 #include "vireo/internal/decode/types.h"
 #include "vireo/mux/mp2ts.h"
 #include "vireo/util/caption.h"
-#include "vireo/version.h"
-
-CONSTRUCTOR static void _Init() {
-  av_register_all();
-}
 
 const static uint8_t kNumTracks = 2;
 
@@ -51,26 +41,55 @@ namespace mux {
 // TS packet size minus mandatory TS header size
 const static uint32_t kTSPayloadSize = MP2TS_PACKET_LENGTH - 4;
 const static uint32_t kNALUDelimiterSize = 6;
+const static uint8_t kAnnexBStartCode[] = { 0x00, 0x00, 0x00, 0x01 };
+// TS packets are written into blocks of whole packets rather than into one growing buffer
+const static uint32_t kBlockSize = (512 * 1024 / MP2TS_PACKET_LENGTH) * MP2TS_PACKET_LENGTH;
+
+const static uint16_t kPATPid = 0x0000;
+const static uint16_t kPMTPid = 0x1000;
+const static uint16_t kFirstElementaryPid = 0x0100;
+const static uint16_t kProgramNumber = 1;
+const static uint16_t kTransportStreamId = 1;
+const static uint8_t kStreamTypeH264 = 0x1b;
+const static uint8_t kStreamTypeAACADTS = 0x0f;
+const static uint8_t kStreamIdVideo = 0xe0;
+const static uint8_t kStreamIdAudio = 0xc0;
+const static int64_t kPCRPeriod = kMP2TSTimescale / 25;  // 40 ms, well within the 100 ms required between PCRs
+const static int64_t kPCRDelay = kMP2TSTimescale / 10;  // the decoder clock runs behind the DTS of the data being sent
+
+static uint32_t CRC32(const uint8_t* bytes, size_t size) {  // CRC-32/MPEG-2 of PSI sections
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < size; ++i) {
+    crc ^= (uint32_t)bytes[i] << 24;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+static void WriteTimestamp(uint8_t* bytes, uint8_t prefix, int64_t timestamp) {  // 33-bit PTS / DTS with marker bits
+  const uint64_t ts = (uint64_t)timestamp & 0x1ffffffffULL;
+  bytes[0] = (uint8_t)(prefix << 4) | (uint8_t)((ts >> 29) & 0x0e) | 0x01;
+  bytes[1] = (uint8_t)(ts >> 22);
+  bytes[2] = (uint8_t)((ts >> 14) & 0xfe) | 0x01;
+  bytes[3] = (uint8_t)(ts >> 7);
+  bytes[4] = (uint8_t)((ts << 1) & 0xfe) | 0x01;
+}
 
 struct _MP2TS {
-  static const size_t kSize_Buffer = 4 * 1024;
-  static const size_t kSize_Default = 512 * 1024;
-  unique_ptr<AVFormatContext, function<void(AVFormatContext*)>> format_context = { nullptr, [](AVFormatContext* p) {
-    if (p->pb) {
-      av_free(p->pb);
-      p->pb = nullptr;
-    }
-    avformat_free_context(p);
-  }};
+  common::Data32 block;  // TS packets not handed out yet
+  vector<common::Data32> blocks;  // full blocks waiting to be taken
+  const common::Writer* writer = nullptr;  // full blocks are written into it instead when streaming
+  uint64_t written = 0;  // bytes written into writer
   unique_ptr<common::Data32> movie = nullptr;
-  common::Data16 buffer = common::Data16((uint8_t*)av_malloc(kSize_Buffer), kSize_Buffer, av_free);
 
   uint8_t nalu_length_size;
   common::Data16 sps_pps;
   uint16_t audio_object_type = 0;
   uint8_t channel_configuration = 0;
   uint8_t sample_rate_index = 0xf0;
-  AVCodec* codec = nullptr;
+  uint32_t sample_rate = 0;
 
   class VideoPacker {
     std::vector<common::Data32> cached_data;
@@ -93,11 +112,13 @@ struct _MP2TS {
       cached_data.clear();
     }
 
-    std::vector<common::Data32> cache_and_flush(int64_t pts, int64_t dts, bool keyframe,
-                                                const std::vector<common::Data32>& video_frame) {
+    std::vector<common::Data32> cache_and_flush(int64_t pts, int64_t dts, bool pcr,
+                                                const std::vector<common::Data32>& video_frame, bool ends_with_nal) {
       // This function caches some of the data in video_frame (maybe none), and
       // returns a vector containing data for a PES packet. You must use the
       // return value of this function before calling cache_and_flush() again.
+      // video_frame only refers to the sample, ends_with_nal tells whether its
+      // last item is the body of a single NAL unit.
 
       remaining_frames--;
       std::vector<common::Data32> result_packet;
@@ -110,8 +131,8 @@ struct _MP2TS {
         return result_packet;
       }
 
-      // Add NAL delimiter before each frame. If we don't add it explicitly,
-      // libavformat would add it for us -- even for the first frame.
+      // Add NAL delimiter before each frame, as required for H.264 in
+      // MPEG-TS -- even for the first frame.
       result_packet.emplace_back(nalu_aud.data() + nalu_aud.a(),
                                  nalu_aud.count(), nullptr /* deleter */);
 
@@ -134,16 +155,14 @@ struct _MP2TS {
       overhead += 2;  // PES packet length;
       overhead += 2;  // flags
       overhead += 1;  // PES header data length field.
-      CHECK(pts != AV_NOPTS_VALUE);
       overhead += 5;
-      CHECK(dts != AV_NOPTS_VALUE);
       if (dts != pts) {
         overhead += 5;
       }
-      if (keyframe) {
-        // Adaptation field. On a keyframe, libavformat sets the PCR, and it
-        // sets Random Access Indicator bit, telling us we can decode without
-        // errors from this point.
+      if (pcr) {
+        // Adaptation field carrying the PCR, and on a keyframe the Random
+        // Access Indicator bit, telling us we can decode without errors from
+        // this point.
         //
         overhead += 8;
       }
@@ -166,40 +185,37 @@ struct _MP2TS {
         num_bytes_to_cache = 0;
       }
 
-      common::Data32 frame_data_h264_annexb(
-          video_frame.back().data() + video_frame.back().a(),
-          video_frame.back().count(), nullptr /* deleter */);
-      internal::decode::ANNEXB<internal::decode::H264NalType> annexb_parser(frame_data_h264_annexb);
-      if (annexb_parser.count() == 0) {
-        // Do not cache if we can't recognise the video data format.
+      // We must split within the last nal because the PTS & DTS from the
+      // PES apply to the first NAL unit inside this PES - this must be the
+      // NAL unit delimiter for the next frame.
+      //
+      common::Data32 last_nal(video_frame.back().data() + video_frame.back().a(),
+                              video_frame.back().count(), nullptr /* deleter */);
+      if (!ends_with_nal || last_nal.count() < num_bytes_to_cache) {
         num_bytes_to_cache = 0;
-      } else {
-        const uint32_t last_nal_offset = annexb_parser(annexb_parser.count() - 1).byte_offset;
-        // We must split after the last nal because the PTS & DTS from the
-        // PES apply to the first NAL unit inside this PES - this must be the
-        // NAL unit delimiter for the next frame.
-        //
-        CHECK(frame_data_h264_annexb.count() >= last_nal_offset);
-        if (frame_data_h264_annexb.count() - last_nal_offset < num_bytes_to_cache) {
-          num_bytes_to_cache = 0;
-        }
       }
 
-      frame_data_h264_annexb.set_bounds(frame_data_h264_annexb.a(),
-                                        frame_data_h264_annexb.b() - num_bytes_to_cache);
-      result_packet.emplace_back(frame_data_h264_annexb.data() + frame_data_h264_annexb.a(),
-                                 frame_data_h264_annexb.count(), nullptr /* deleter */);
+      last_nal.set_bounds(last_nal.a(), last_nal.b() - num_bytes_to_cache);
+      result_packet.emplace_back(last_nal.data() + last_nal.a(),
+                                 last_nal.count(), nullptr /* deleter */);
 
       if (num_bytes_to_cache > 0) {
-        // Copy the last num_bytes_to_cache bytes from frame_data_h264_annexb
-        // to data cache.
-        frame_data_h264_annexb.set_bounds(frame_data_h264_annexb.b(),
-                                          frame_data_h264_annexb.b() + num_bytes_to_cache);
+        // Copy the last num_bytes_to_cache bytes from last_nal to data cache,
+        // the sample does not outlive this call.
+        last_nal.set_bounds(last_nal.b(), last_nal.b() + num_bytes_to_cache);
         // Copy-construct data to be cached.
-        cached_data.emplace_back(frame_data_h264_annexb);
+        cached_data.emplace_back(last_nal);
       }
       return result_packet;
     }
+
+    std::vector<common::Data32> flush() {
+      // Returns the end of the last frame held back for the next PES, which
+      // has to be written before a segment is cut.
+      std::vector<common::Data32> result_packet;
+      result_packet.swap(cached_data);
+      return result_packet;
+    }
   } video_packer;
 
   class ADTSPacker {
@@ -308,8 +324,8 @@ struct _MP2TS {
       // playback a little earlier (before file download is finished)
       // if we would keep the audio and video frames ordered by PTS.
       //
-      // libavformat dumps a PES as a contiguous block. Ideally, we would want
-      // to interleave audio and video PES packets on the TS level.
+      // A PES is written as a contiguous block. Ideally, we would want to
+      // interleave audio and video PES packets on the TS level.
       if (!frames_in_buffer) {
         reset();
         return std::vector<common::Data32>();
@@ -327,8 +343,10 @@ struct _MP2TS {
   struct Track {
     uint32_t timescale;
     uint64_t num_frames = 0;
-    uint32_t track_ID = 0;
-    int64_t start_offset = 0;
+    uint16_t pid = 0;
+    uint8_t stream_type;
+    uint8_t stream_id;
+    uint8_t continuity_counter = 0;
   };
   class {
     Track _tracks[kNumTracks];
@@ -343,57 +361,216 @@ struct _MP2TS {
   functional::Video<encode::Sample> video;
   functional::Caption<encode::Sample> caption;
   vector<util::PtsIndexPair> caption_pts_index_pairs;
+  uint16_t pcr_pid = 0;
+  int64_t last_pcr_dts = -1;
+  uint8_t pat_continuity_counter = 0;
+  uint8_t pmt_continuity_counter = 0;
   bool initialized = false;
   bool finalized = false;
   _MP2TS(uint8_t nalu_length_size, common::Data16&& sps_pps)
     : nalu_length_size(nalu_length_size), sps_pps(move(sps_pps)) {}
-  void write_avpacket(int64_t packet_pts, int64_t packet_dts, bool keyframe, uint32_t track_ID,
-      const std::vector<common::Data32>& packet_data) {
 
-    CHECK(packet_data.size() > 0);
+  template <class F>
+  void apply_on_tracks(F f) {
+    for (auto type: { SampleType::Video, SampleType::Audio }) {
+      if (tracks(type).pid) {
+        f(type);
+      }
+    }
+  }
 
-    uint32_t packet_size = 0;
-    for (const auto& data: packet_data) {
-      packet_size += data.count();
+  void flush_block() {  // hands the current block to writer, or keeps it to be taken
+    if (!block.count()) {
+      return;
     }
+    if (writer) {
+      writer->write(written, block);
+      written += block.count();
+      block.set_bounds(0, 0);  // reused for the next packets
+    } else {
+      blocks.push_back(move(block));
+      block = common::Data32();
+    }
+  }
 
-    AVPacket packet;
-    av_init_packet(&packet);
-    av_new_packet(&packet, packet_size);
+  uint8_t* packet() {  // appends a TS packet to the current block and returns it to be filled
+    if (block.b() + MP2TS_PACKET_LENGTH > block.capacity()) {
+      flush_block();
+      if (!block.capacity()) {
+        block = common::Data32(new uint8_t[kBlockSize], kBlockSize, [](uint8_t* p) { delete[] p; });
+        THROW_IF(!block.data(), OutOfMemory);
+        block.set_bounds(0, 0);
+      }
+    }
+    const uint32_t size = block.b();
+    block.set_bounds(0, size + MP2TS_PACKET_LENGTH);
+    return (uint8_t*)block.data() + size;
+  }
 
-    auto out = common::Data32(packet.data, packet_size, nullptr /* deleter */);
-    out.set_bounds(0, 0);
-    for (const auto& data: packet_data) {
-      out.set_bounds(out.b(), out.b());
-      out.copy(data);
+  common::Data32 take() {  // TS packets written since the previous call, gathered once if they span several blocks
+    if (blocks.empty()) {
+      common::Data32 data = move(block);
+      block = common::Data32();
+      return data;
     }
-    out.set_bounds(0, out.b());
-    CHECK(out.count() == packet_size);
+    flush_block();
+    uint64_t size = 0;
+    for (const auto& data: blocks) {
+      size += data.count();
+    }
+    THROW_IF(size > numeric_limits<uint32_t>::max(), Overflow);
+    common::Data32 data(new uint8_t[size], (uint32_t)size, [](uint8_t* p) { delete[] p; });
+    THROW_IF(!data.data(), OutOfMemory);
+    uint8_t* bytes = (uint8_t*)data.data();
+    for (const auto& full: blocks) {
+      memcpy(bytes, full.data() + full.a(), full.count());
+      bytes += full.count();
+    }
+    blocks.clear();
+    return data;
+  }
 
-    packet.pts = packet_pts;
-    packet.dts = packet_dts;
-    packet.flags = keyframe ? AV_PKT_FLAG_KEY : 0;
-    packet.stream_index = track_ID;
+  void write_section(uint16_t pid, uint8_t& continuity_counter, uint8_t table_id, uint16_t table_id_extension, const vector<uint8_t>& body) {
+    // section header: table id, syntax indicator and length, id, version 0 / current, section numbers, then CRC
+    const uint16_t section_length = (uint16_t)(5 + body.size() + 4);
+    vector<uint8_t> section = { table_id, (uint8_t)(0xb0 | (section_length >> 8)), (uint8_t)section_length,
+                                (uint8_t)(table_id_extension >> 8), (uint8_t)table_id_extension, 0xc1, 0x00, 0x00 };
+    section.insert(section.end(), body.begin(), body.end());
+    const uint32_t crc = CRC32(section.data(), section.size());
+    section.insert(section.end(), { (uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc });
+    CHECK(section.size() + 1 <= kTSPayloadSize);
+
+    uint8_t* bytes = packet();
+    bytes[0] = MP2TS_SYNC_BYTE;
+    bytes[1] = 0x40 | (uint8_t)(pid >> 8);  // payload unit start
+    bytes[2] = (uint8_t)pid;
+    bytes[3] = 0x10 | (continuity_counter++ & 0x0f);  // payload only
+    bytes[4] = 0x00;  // pointer field
+    memcpy(bytes + 5, section.data(), section.size());
+    memset(bytes + 5 + section.size(), 0xff, MP2TS_PACKET_LENGTH - 5 - section.size());
+  }
 
-    if (track_ID == tracks(SampleType::Video).track_ID) {
-      // For video, we get a warning from libavformat that tells us the packet
-      // doesn't start with H.264 start code. That is correct - the packet
-      // might start with data for the previuous frame.
-      // See https://github.com/FFmpeg/FFmpeg/blob/e7282674a505d548746a4734cbe902a9f242eb6b/libavformat/mpegtsenc.c#L1435
-      // for details.
-      //
-      int log_level = av_log_get_level();
-      av_log_set_level(AV_LOG_ERROR);
-      CHECK(av_write_frame(format_context.get(), &packet) == 0);
-      av_log_set_level(log_level);
-    } else {
-      CHECK(av_write_frame(format_context.get(), &packet) == 0);
+  void write_pat_pmt() {
+    write_section(kPATPid, pat_continuity_counter, 0x00, kTransportStreamId,
+                  { (uint8_t)(kProgramNumber >> 8), (uint8_t)kProgramNumber, (uint8_t)(0xe0 | (kPMTPid >> 8)), (uint8_t)kPMTPid });
+    vector<uint8_t> program = { (uint8_t)(0xe0 | (pcr_pid >> 8)), (uint8_t)pcr_pid, 0xf0, 0x00 };  // no program descriptors
+    apply_on_tracks([&](SampleType type) {
+      const Track& track = tracks(type);
+      program.insert(program.end(), { track.stream_type, (uint8_t)(0xe0 | (track.pid >> 8)), (uint8_t)track.pid, 0xf0, 0x00 });
+    });
+    write_section(kPMTPid, pmt_continuity_counter, 0x02, kProgramNumber, program);
+  }
+
+  bool needs_pcr(const Track& track, int64_t dts, bool keyframe) const {
+    return track.pid == pcr_pid && (keyframe || last_pcr_dts < 0 || dts - last_pcr_dts >= kPCRPeriod);
+  }
+
+  void write_pes(Track& track, bool timestamps, int64_t pts, int64_t dts, bool keyframe, const std::vector<common::Data32>& payload) {
+    // PES packets are split into TS packets straight from the payload, with the PCR and the Random Access Indicator
+    // in the adaptation field of the first one and stuffing in the adaptation field of the last one
+    CHECK(payload.size() > 0);
+    uint64_t payload_size = 0;
+    for (const auto& data: payload) {
+      payload_size += data.count();
+    }
+
+    const bool with_dts = timestamps && dts != pts;
+    const uint8_t header_data_length = timestamps ? (with_dts ? 10 : 5) : 0;
+    uint8_t header[9 + 10];
+    const uint32_t header_size = 9 + header_data_length;
+    uint64_t pes_packet_length = 0;  // unbounded for video
+    if (track.stream_id != kStreamIdVideo) {
+      pes_packet_length = 3 + header_data_length + payload_size;
+      THROW_IF(pes_packet_length > 0xffff, Unsupported);
+    }
+    header[0] = 0x00;
+    header[1] = 0x00;
+    header[2] = 0x01;
+    header[3] = track.stream_id;
+    header[4] = (uint8_t)(pes_packet_length >> 8);
+    header[5] = (uint8_t)pes_packet_length;
+    header[6] = 0x80;
+    header[7] = timestamps ? (with_dts ? 0xc0 : 0x80) : 0x00;
+    header[8] = header_data_length;
+    if (timestamps) {
+      WriteTimestamp(header + 9, with_dts ? 0x3 : 0x2, pts);
+      if (with_dts) {
+        WriteTimestamp(header + 14, 0x1, dts);
+      }
+    }
+
+    const bool pcr = timestamps && needs_pcr(track, dts, keyframe);
+    const bool random_access = timestamps && keyframe;
+    uint64_t remaining = header_size + payload_size;
+    uint32_t index = 0;  // payload being copied, header first
+    uint32_t offset = 0;  // bytes of it already copied
+    bool first = true;
+    while (remaining) {
+      uint8_t* bytes = packet();
+      bytes[0] = MP2TS_SYNC_BYTE;
+      bytes[1] = (first ? 0x40 : 0x00) | (uint8_t)(track.pid >> 8);
+      bytes[2] = (uint8_t)track.pid;
+
+      // adaptation field, including its length byte
+      const uint32_t flagged_size = (first && (pcr || random_access)) ? 2 + (pcr ? 6 : 0) : 0;
+      const uint32_t adaptation_size = (remaining < kTSPayloadSize - flagged_size) ? kTSPayloadSize - (uint32_t)remaining : flagged_size;
+      bytes[3] = (adaptation_size ? 0x30 : 0x10) | (track.continuity_counter++ & 0x0f);
+      if (adaptation_size) {
+        bytes[4] = (uint8_t)(adaptation_size - 1);
+        if (adaptation_size > 1) {
+          bytes[5] = (flagged_size && random_access ? 0x40 : 0x00) | (flagged_size && pcr ? 0x10 : 0x00);
+          uint32_t position = 6;
+          if (flagged_size && pcr) {
+            const uint64_t pcr_base = (uint64_t)max<int64_t>(dts - kPCRDelay, 0) & 0x1ffffffffULL;  // 90 kHz, no 27 MHz extension
+            bytes[position++] = (uint8_t)(pcr_base >> 25);
+            bytes[position++] = (uint8_t)(pcr_base >> 17);
+            bytes[position++] = (uint8_t)(pcr_base >> 9);
+            bytes[position++] = (uint8_t)(pcr_base >> 1);
+            bytes[position++] = (uint8_t)((pcr_base & 0x01) << 7) | 0x7e;
+            bytes[position++] = 0x00;
+          }
+          memset(bytes + position, 0xff, 4 + adaptation_size - position);
+        }
+      }
+
+      uint8_t* out = bytes + 4 + adaptation_size;
+      uint32_t size = kTSPayloadSize - adaptation_size;
+      remaining -= size;
+      while (size) {
+        const uint8_t* source = (index == 0) ? header : payload[index - 1].data() + payload[index - 1].a();
+        const uint32_t source_size = (index == 0) ? header_size : payload[index - 1].count();
+        const uint32_t copy_size = min(size, source_size - offset);
+        memcpy(out, source + offset, copy_size);
+        out += copy_size;
+        size -= copy_size;
+        offset += copy_size;
+        if (offset == source_size) {
+          ++index;
+          offset = 0;
+        }
+      }
+      first = false;
+    }
+    if (pcr) {
+      last_pcr_dts = dts;
     }
-    av_packet_unref(&packet);
   }
+
+  uint32_t append_annexb(std::vector<common::Data32>& video_packet, const common::Data32& nal) const {
+    // Annex B as start codes and views of the NAL units, which are written from the sample straight into the TS packets
+    common::Data32 data(nal.data() + nal.a(), nal.count(), nullptr /* deleter */);
+    internal::decode::AVCC<internal::decode::H264NalType> avcc_parser(data, nalu_length_size);
+    for (const auto& nal_info: avcc_parser) {
+      video_packet.emplace_back(kAnnexBStartCode, sizeof(kAnnexBStartCode), nullptr /* deleter */);
+      video_packet.emplace_back(data.data() + nal_info.byte_offset, nal_info.size, nullptr /* deleter */);
+    }
+    return avcc_parser.count();
+  }
+
   void mux_video(const encode::Sample& sample) {
     THROW_IF(sample.type != SampleType::Video, Unsupported);
 
+    // video_packet only refers to sps_pps and to the samples, which have to outlive it
     std::vector<common::Data32> video_packet;
     // add SPS/PPS before each keyframe
     if (sample.keyframe && !internal::decode::contain_sps_pps(sample.nal, nalu_length_size)) {
@@ -412,35 +589,34 @@ struct _MP2TS {
     if (caption_pts_and_index != caption_pts_index_pairs.end()) {
       caption_index = caption_pts_and_index->index;
     }
+    common::Data32 caption_nal;
+    uint32_t nal_count = 0;
     if (caption_index >= 0) {
-      auto caption_sample = caption(caption_index);
-
-      if (caption_sample.nal.count()) { // caption size could be 0 in case there is no caption data associated with the corresponding video sample
-        // Move version of push_back is used here.
-        video_packet.push_back(internal::decode::avcc_to_annexb(caption_sample.nal, nalu_length_size));
+      caption_nal = move(caption(caption_index).nal);
+      if (caption_nal.count()) { // caption size could be 0 in case there is no caption data associated with the corresponding video sample
+        nal_count += append_annexb(video_packet, caption_nal);
       }
     }
 
-    // insert video frame data. Move version of push_back is used here.
-    video_packet.push_back(internal::decode::avcc_to_annexb(sample.nal, nalu_length_size));
+    // insert video frame data
+    nal_count += append_annexb(video_packet, sample.nal);
 
-    AVStream* stream = format_context->streams[tracks(sample.type).track_ID];
-    CHECK(stream);
-    CHECK(stream->codec->time_base.den != 0);
-    int64_t pts = sample.pts * kMP2TSTimescale * stream->codec->time_base.num / stream->codec->time_base.den;
-    int64_t dts = sample.dts * kMP2TSTimescale * stream->codec->time_base.num / stream->codec->time_base.den;
+    Track& track = tracks(sample.type);
+    CHECK(track.timescale != 0);
+    int64_t pts = sample.pts * kMP2TSTimescale / track.timescale;
+    int64_t dts = sample.dts * kMP2TSTimescale / track.timescale;
 
-    write_avpacket(pts, dts, sample.keyframe, tracks(sample.type).track_ID,
-                   video_packer.cache_and_flush(pts, dts, sample.keyframe, video_packet));
+    const bool pcr = needs_pcr(track, dts, sample.keyframe);
+    write_pes(track, true, pts, dts, sample.keyframe,
+              video_packer.cache_and_flush(pts, dts, pcr, video_packet, nal_count > 0));
   }
   void mux_audio(const encode::Sample& sample) {
     THROW_IF(sample.type != SampleType::Audio, Unsupported);
 
-    AVStream* stream = format_context->streams[tracks(sample.type).track_ID];
-    CHECK(stream);
-    CHECK(stream->codec->time_base.den != 0);
-    int64_t pts = sample.pts * kMP2TSTimescale * stream->codec->time_base.num / stream->codec->time_base.den;
-    int64_t dts = sample.dts * kMP2TSTimescale * stream->codec->time_base.num / stream->codec->time_base.den;
+    Track& track = tracks(sample.type);
+    CHECK(track.timescale != 0);
+    int64_t pts = sample.pts * kMP2TSTimescale / track.timescale;
+    int64_t dts = sample.dts * kMP2TSTimescale / track.timescale;
 
     if (adts_packer.empty()) {
       // Start packing ADTS frames.
@@ -448,16 +624,16 @@ struct _MP2TS {
       adts_packer.set_ts(pts, dts);
     }
 
-    if (!adts_packer.can_cache(pts, dts, stream->codec->sample_rate, sample.nal)) {
+    if (!adts_packer.can_cache(pts, dts, sample_rate, sample.nal)) {
       // Start over.
-      write_avpacket(adts_packer.get_first_pts(), adts_packer.get_first_dts(),
-          false /* keyframe */, tracks(sample.type).track_ID, adts_packer.flush());
+      write_pes(track, true, adts_packer.get_first_pts(), adts_packer.get_first_dts(),
+                false /* keyframe */, adts_packer.flush());
       adts_packer.set_ts(pts, dts);
     }
     adts_packer.cache(sample.nal, audio_object_type, channel_configuration, sample_rate_index);
     if (adts_packer.cached_last_frame()) {
-      write_avpacket(adts_packer.get_first_pts(), adts_packer.get_first_dts(),
-          false /* keyframe */, tracks(sample.type).track_ID, adts_packer.flush());
+      write_pes(track, true, adts_packer.get_first_pts(), adts_packer.get_first_dts(),
+                false /* keyframe */, adts_packer.flush());
     }
   }
   void mux(const encode::Sample& sample) {
@@ -475,23 +651,119 @@ struct _MP2TS {
 
     ++tracks(sample.type).num_frames;
   }
+  void start() {
+    video_packer.init(video.count());
+    adts_packer.init(audio.count());
+    apply_on_tracks([&](SampleType type) {
+      tracks(type).num_frames = 0;
+    });
+    last_pcr_dts = -1;
+    block = common::Data32();
+    blocks.clear();
+    writer = nullptr;
+    write_pat_pmt();
+  }
+  void flush_pending() {  // PES data held back by the packers
+    if (!adts_packer.empty()) {
+      write_pes(tracks(SampleType::Audio), true, adts_packer.get_first_pts(), adts_packer.get_first_dts(),
+                false /* keyframe */, adts_packer.flush());
+    }
+    auto tail = video_packer.flush();
+    if (!tail.empty()) {  // continues the previous access unit, so no timestamps
+      write_pes(tracks(SampleType::Video), false, 0, 0, false /* keyframe */, tail);
+    }
+  }
   void flush() {
     THROW_IF(!initialized, Uninitialized);
     if (!finalized) {
-      video_packer.init(video.count());
-      adts_packer.init(audio.count());
+      start();
       order_samples(tracks(SampleType::Audio).timescale, audio,
                     tracks(SampleType::Video).timescale, video,
                     [this](const encode::Sample& sample) {
                       mux(sample);
                     }
       );
-
-      CHECK(av_write_trailer(format_context.get()) == 0);
-      movie->set_bounds(0, movie->b());
+      flush_pending();
+      movie.reset(new common::Data32(take()));
       finalized = true;
     }
   }
+  uint64_t stream(const common::Writer& output) {
+    THROW_IF(!initialized, Uninitialized);
+    start();
+    writer = &output;
+    written = 0;
+    order_samples(tracks(SampleType::Audio).timescale, audio,
+                  tracks(SampleType::Video).timescale, video,
+                  [this](const encode::Sample& sample) {
+                    mux(sample);
+                  }
+    );
+    flush_pending();
+    flush_block();
+    writer = nullptr;
+    return written;
+  }
+  string segments(const uint32_t target_duration_ms, const function<void(common::Data32&& data, uint32_t index)>& output, const function<string(uint32_t index)>& segment_name) {
+    THROW_IF(!initialized, Uninitialized);
+    THROW_IF(!target_duration_ms, InvalidArguments);
+    THROW_IF(!output || !segment_name, InvalidArguments);
+
+    // segments are cut at key frames of the video track, or anywhere in the audio track when there is no video
+    const SampleType primary = video.count() ? SampleType::Video : SampleType::Audio;
+    const uint32_t timescale = tracks(primary).timescale;
+    const int64_t target_duration = (int64_t)target_duration_ms * timescale / 1000;
+    vector<float> durations;
+    int64_t segment_start_dts = 0;
+    int64_t last_dts = 0;
+    int64_t last_duration = 0;
+    bool empty = true;
+    auto cut = [&](const int64_t end_dts) {
+      flush_pending();
+      durations.push_back((float)(end_dts - segment_start_dts) / timescale);
+      output(take(), (uint32_t)durations.size() - 1);
+    };
+
+    start();
+    order_samples(tracks(SampleType::Audio).timescale, audio,
+                  tracks(SampleType::Video).timescale, video,
+                  [&](const encode::Sample& sample) {
+                    if (sample.type == primary) {
+                      if (empty) {
+                        segment_start_dts = sample.dts;
+                        empty = false;
+                      } else {
+                        last_duration = sample.dts - last_dts;
+                        if (sample.dts - segment_start_dts >= target_duration && (primary == SampleType::Audio || sample.keyframe)) {
+                          cut(sample.dts);
+                          segment_start_dts = sample.dts;
+                          write_pat_pmt();  // every segment can be decoded on its own
+                        }
+                      }
+                      last_dts = sample.dts;
+                    }
+                    mux(sample);
+                  }
+    );
+    cut(last_dts + last_duration);
+
+    float max_duration = 0.0f;
+    for (const auto duration: durations) {
+      max_duration = max(max_duration, duration);
+    }
+    stringstream playlist;
+    playlist << "#EXTM3U" << endl;
+    playlist << "#EXT-X-VERSION:3" << endl;
+    playlist << "#EXT-X-TARGETDURATION:" << (uint32_t)ceil(max_duration) << endl;
+    playlist << "#EXT-X-MEDIA-SEQUENCE:0" << endl;
+    playlist << "#EXT-X-PLAYLIST-TYPE:VOD" << endl;
+    for (uint32_t index = 0; index < durations.size(); ++index) {
+      playlist << "#EXTINF:" << std::fixed << std::setprecision(3) << durations[index] << "," << endl;
+      playlist << segment_name(index) << endl;
+    }
+    playlist << "#EXT-X-ENDLIST" << endl;
+    return playlist.str();
+  }
 };
 
 MP2TS::MP2TS(const functional::Audio<encode::Sample>& audio, const functional::Video<encode::Sample>& video, const functional::Caption<encode::Sample>& caption) {
@@ -507,80 +779,9 @@ MP2TS::MP2TS(const functional::Audio<encode::Sample>& audio, const functional::V
   _this.reset(new _MP2TS(video.settings().sps_pps.nalu_length_size,
                          video.settings().sps_pps.as_extradata(header::SPS_PPS::annex_b)));
 
-  auto write_func = [] (void* opaque, uint8_t* buf, int size) -> int {
-    if (size > security::kMaxWriteSize) {
-      return 0;
-    }
-    _MP2TS* _this = (_MP2TS*)opaque;
-    if (!_this->movie || size + _this->movie->a() > _this->movie->capacity()) {
-      const uint32_t new_capacity = _this->movie ? _this->movie->capacity() + common::align_divide(size + _this->movie->a() - _this->movie->capacity(), (uint32_t)_MP2TS::kSize_Default) : common::align_divide(size, (int)_MP2TS::kSize_Default);
-      common::Data32* new_data = new common::Data32(new uint8_t[new_capacity], new_capacity, [](uint8_t* p) { delete[] p; });
-      THROW_IF(!new_data->data(), OutOfMemory);
-      if (_this->movie) {
-        new_data->set_bounds(_this->movie->a(), _this->movie->b());
-        memcpy((uint8_t*)new_data->data(), _this->movie->data(), _this->movie->b());
-      } else {
-        new_data->set_bounds(0, 0);
-      }
-      _this->movie.reset(new_data);
-    }
-    memcpy((uint8_t*)_this->movie->data() + _this->movie->a(), buf, size);
-    _this->movie->set_bounds(_this->movie->a() + (uint32_t)size,
-                                   std::max(_this->movie->b(), _this->movie->a() + (uint32_t)size));
-    return size;
-  };
-  auto seek_func = [] (void* opaque, int64_t offset, int whence) -> int64_t {
-    _MP2TS* _this = (_MP2TS*)opaque;
-    if (whence == SEEK_SET) {
-      THROW_IF(offset < 0 || offset > _this->movie->b(), OutOfRange);
-      _MP2TS* _this = (_MP2TS*)opaque;
-      _this->movie->set_bounds((uint32_t)offset, _this->movie->b());
-      return (int)offset;
-    }
-    return 0;
-  };
-
-  AVOutputFormat* format = av_guess_format("mpegts", nullptr, nullptr);
-  CHECK(format);
-  AVFormatContext* format_context = nullptr;
-  CHECK(avformat_alloc_output_context2(&format_context, format, nullptr, nullptr) >= 0);
-  _this->format_context.reset(format_context);
-  _this->format_context->flags |= AVFMT_ALLOW_FLUSH;
-  _this->format_context->oformat->flags |= AVFMT_TS_NONSTRICT;
-  _this->format_context->pb = avio_alloc_context((uint8_t*)_this->buffer.data(), _this->buffer.count(), 1, _this.get(), nullptr, write_func, seek_func);
-  CHECK(_this->format_context->pb);
-
-  char title[] = "title";
-  av_dict_set(&_this->format_context->metadata, title, VIREO_VERSION, 0);
-  char service_provider[] = "service_provider";
-  char vireo[] = "Vireo";
-  av_dict_set(&_this->format_context->metadata, service_provider, vireo, 0);
-
-  // Request fewer PAT/PMT packets - one per keyframe, and one at
-  // the beginning.
-  // The max allowed period between PAT packets is (INT_MAX / 2) - 1.
-  //
-  std::stringstream period;
-  period << (INT_MAX / 2) - 1;
-
-  av_opt_set(_this->format_context->priv_data, "mpegts_flags", "-resend_headers", 0);
-  av_opt_set(_this->format_context->priv_data, "mpegts_flags", "-pat_pmt_at_frames", 0);
-  av_opt_set(_this->format_context->priv_data, "pat_period", period.str().c_str(), 0);
-  // SDT packets are only sent in DVB. We shouldn't be sending it anyway.
-  //
-  av_opt_set(_this->format_context->priv_data, "sdt_period", period.str().c_str(), 0);
-
+  // elementary streams get consecutive PIDs, video first; the PCR is carried by the first one
+  uint16_t pid = kFirstElementaryPid;
   if (video.settings().timescale != 0) {
-    AVStream* stream = avformat_new_stream(_this->format_context.get(), nullptr);
-    stream->time_base = (AVRational){ 1, (int)video.settings().timescale };
-
-    avcodec_get_context_defaults3(stream->codec, nullptr);
-    stream->codec->codec_type = AVMEDIA_TYPE_VIDEO;
-    stream->codec->codec_id = AV_CODEC_ID_H264;
-    stream->codec->width = video.settings().width;
-    stream->codec->height = video.settings().height;
-    stream->codec->time_base = stream->time_base;
-
     uint32_t index = 0;
     for (const auto& sample: caption) {
       util::PtsIndexPair pts_index(sample.pts, index);
@@ -589,7 +790,9 @@ MP2TS::MP2TS(const functional::Audio<encode::Sample>& audio, const functional::V
     }
     sort(_this->caption_pts_index_pairs.begin(), _this->caption_pts_index_pairs.end());
 
-    _this->tracks(SampleType::Video).track_ID = stream->index;
+    _this->tracks(SampleType::Video).pid = pid++;
+    _this->tracks(SampleType::Video).stream_type = kStreamTypeH264;
+    _this->tracks(SampleType::Video).stream_id = kStreamIdVideo;
     _this->tracks(SampleType::Video).timescale = video.settings().timescale;
     _this->video = video;
     _this->caption = caption;
@@ -597,15 +800,7 @@ MP2TS::MP2TS(const functional::Audio<encode::Sample>& audio, const functional::V
 
   if (audio.settings().sample_rate != 0) {
     uint32_t sample_rate = audio.settings().sample_rate;
-    AVStream* stream = avformat_new_stream(_this->format_context.get(), nullptr);
-    stream->time_base = (AVRational){ 1, (int)audio.settings().timescale };
-
-    avcodec_get_context_defaults3(stream->codec, nullptr);
-    stream->codec->codec_type = AVMEDIA_TYPE_AUDIO;
-    stream->codec->codec_id = AV_CODEC_ID_AAC;
-    stream->codec->sample_rate = sample_rate;
-    stream->codec->channels = audio.settings().channels;
-    stream->codec->time_base = stream->time_base;
+    THROW_IF(audio.settings().timescale == 0, InvalidArguments);
 
     _this->audio_object_type = 0;
     switch (audio.settings().codec) {
@@ -623,13 +818,15 @@ MP2TS::MP2TS(const functional::Audio<encode::Sample>& audio, const functional::V
 
     _this->sample_rate_index = find(kSampleRate.begin(), kSampleRate.end(), sample_rate) - kSampleRate.begin();
     THROW_IF(_this->sample_rate_index >= 13, InvalidArguments);
+    _this->sample_rate = sample_rate;
 
-    _this->tracks(SampleType::Audio).track_ID = stream->index;
+    _this->tracks(SampleType::Audio).pid = pid++;
+    _this->tracks(SampleType::Audio).stream_type = kStreamTypeAACADTS;
+    _this->tracks(SampleType::Audio).stream_id = kStreamIdAudio;
     _this->tracks(SampleType::Audio).timescale = audio.settings().timescale;
     _this->audio = audio;
   }
-
-  CHECK(avformat_write_header(_this->format_context.get(), nullptr) == 0);
+  _this->pcr_pid = kFirstElementaryPid;
   _this->initialized = true;
 
   *static_cast<std::function<common::Data32(void)>*>(this) = [_this = _this]() {
@@ -645,4 +842,16 @@ MP2TS::MP2TS(MP2TS&& mp2ts)
   mp2ts._this = nullptr;
 }
 
+auto MP2TS::operator()() -> common::Data32 {
+  return move((*static_cast<std::function<common::Data32(void)>*>(this))());
+}
+
+auto MP2TS::operator()(const common::Writer& writer) -> uint64_t {
+  return _this->stream(writer);
+}
+
+auto MP2TS::segments(const uint32_t target_duration_ms, const std::function<void(common::Data32&& data, uint32_t index)>& output, const std::function<std::string(uint32_t index)>& segment_name) -> std::string {
+  return _this->segments(target_duration_ms, output, segment_name);
+}
+
 }}
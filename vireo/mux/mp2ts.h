@@ -25,6 +25,7 @@
 #pragma once
 
 #include "vireo/base_h.h"
+#include "vireo/common/writer.h"
 #include "vireo/encode/types.h"
 #include "vireo/functional/media.hpp"
 
@@ -38,6 +39,14 @@ public:
   MP2TS(const functional::Audio<encode::Sample>& audio, const functional::Video<encode::Sample>& video) : MP2TS(audio, video, functional::Caption<encode::Sample>()) {};
   MP2TS(const functional::Audio<encode::Sample>& audio, const functional::Video<encode::Sample>& video, const functional::Caption<encode::Sample>& caption);
   MP2TS(MP2TS&& mp2ts);
+  auto operator()() -> common::Data32;
+  // Streams the transport stream into writer while muxing, a block of TS packets at a time. Returns the size written.
+  auto operator()(const common::Writer& writer) -> uint64_t;
+  // HLS: splits the stream into segments of about target_duration_ms starting at video key frames, each beginning
+  // with PAT / PMT, passes them to output as they are cut and returns the VOD playlist naming them with segment_name
+  auto segments(const uint32_t target_duration_ms,
+                const std::function<void(common::Data32&& data, uint32_t index)>& output,
+                const std::function<std::string(uint32_t index)>& segment_name) -> std::string;
   DISALLOW_COPY_AND_ASSIGN(MP2TS);
 };
 
@@ -33,7 +33,9 @@ extern "C" {
 #include "vireo/constants.h"
 #include "vireo/encode/util.h"
 #include "vireo/error/error.h"
+#include "vireo/functional/prefetch.hpp"
 #include "vireo/internal/decode/annexb.h"
+#include "vireo/internal/decode/avcc.h"
 #include "vireo/mux/mp4.h"
 #include "vireo/types.h"
 #include "vireo/util/caption.h"
@@ -44,6 +46,162 @@ const static uint8_t kNumTracks = 2;
 namespace vireo {
 namespace mux {
 
+struct MP4BoxHandler {
+  static uint32_t LocateBox(const common::Data32* file, const char box_name[]) {
+    size_t box_name_length = strlen(box_name);
+    THROW_IF(box_name_length <= 0, InvalidArguments);
+    THROW_IF(!file, InvalidArguments);
+    THROW_IF(file->count() < sizeof(uint32_t) + box_name_length, InvalidArguments);
+    int64_t box_location = -1;
+    auto data = common::Data32(file->data() + file->a(), file->count(), nullptr);
+    while (data.count()) {
+      for (uint32_t j = 0; j < box_name_length; ++j) {
+        if (data(data.a() + sizeof(uint32_t) + j) != box_name[j]) {
+          break;
+        } else if (j == box_name_length - 1) {
+          box_location = data.a();
+        }
+      }
+      if (box_location < 0) {
+        const uint64_t box_size = BoxSize(data);
+        THROW_IF(box_size == 0 || box_size > data.count(), Invalid);
+        data.set_bounds(data.a() + box_size, data.b());
+      } else {
+        break;
+      }
+    }
+    THROW_IF(box_location < 0, Invalid);
+    return (uint32_t)box_location;
+  }
+
+  static uint64_t BoxSize(const common::Data32& box) {
+    THROW_IF(box.count() < sizeof(uint32_t), InvalidArguments);  // each box starts with a 32-bit size field
+    const uint8_t* buffer = box.data() + box.a();
+    const uint32_t box_size = Read32(buffer);
+    if (box_size == 1) {  // extended size field after the box type, for boxes larger than 2^32 bytes
+      THROW_IF(box.count() < 2 * sizeof(uint64_t), Invalid);
+      return Read64(buffer + sizeof(uint64_t));
+    } else if (box_size == 0) {  // implicit
+      return box.count();
+    } else {
+      return box_size;
+    }
+  }
+
+  static uint32_t HeaderSize(const common::Data32* file) {  // assumes [header | samples] format
+    THROW_IF(!file, Invalid);
+    const char box_name[] = "mdat";
+    const uint32_t location = LocateBox(file, box_name);
+    const auto mdat = common::Data32(file->data() + file->a() + location, file->count() - location, nullptr);
+    THROW_IF(BoxSize(mdat) != mdat.count(), Invalid);  // mdat has to span till the end of file
+    const uint32_t size_length = Read32(mdat.data() + mdat.a()) == 1 ? sizeof(uint32_t) + sizeof(uint64_t) : sizeof(uint32_t);
+    return location + size_length + (uint32_t)strlen(box_name);  // mdat box size and "mdat" belongs to header
+  }
+
+  static uint32_t Read32(const uint8_t* buffer) {
+    return ((uint32_t)buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
+  }
+
+  static uint64_t Read64(const uint8_t* buffer) {
+    return ((uint64_t)Read32(buffer) << 32) | Read32(buffer + sizeof(uint32_t));
+  }
+
+  static void Write32(vector<uint8_t>& out, const uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      out.push_back((uint8_t)(value >> shift));
+    }
+  }
+
+  static void Write64(vector<uint8_t>& out, const uint64_t value) {
+    Write32(out, (uint32_t)(value >> 32));
+    Write32(out, (uint32_t)value);
+  }
+
+  // Appends box to out with every chunk offset shifted by delta, stco is promoted to co64 once a shifted offset
+  // does not fit in 32 bits anymore and the size of each enclosing box is updated accordingly
+  static void ShiftChunkOffsets(const uint8_t* box, const uint32_t size, const int64_t delta, vector<uint8_t>& out, uint64_t& first_chunk_offset) {
+    const uint32_t kHeaderSize = 2 * sizeof(uint32_t);
+    THROW_IF(size < kHeaderSize, Invalid);
+    const uint32_t box_size = Read32(box);
+    THROW_IF(box_size < kHeaderSize || box_size > size, Invalid);  // no extended or implicit sizes inside moov
+    const string type((const char*)box + sizeof(uint32_t), sizeof(uint32_t));
+    if (type == "moov" || type == "trak" || type == "mdia" || type == "minf" || type == "stbl") {
+      const size_t start = out.size();
+      out.insert(out.end(), box, box + kHeaderSize);
+      for (uint32_t offset = kHeaderSize; offset < box_size; offset += Read32(box + offset)) {
+        ShiftChunkOffsets(box + offset, box_size - offset, delta, out, first_chunk_offset);
+      }
+      const uint64_t new_size = out.size() - start;
+      THROW_IF(new_size > numeric_limits<uint32_t>::max(), Overflow);
+      for (int i = 0; i < 4; ++i) {
+        out[start + i] = (uint8_t)(new_size >> (24 - 8 * i));
+      }
+    } else if (type == "stco" || type == "co64") {
+      const uint32_t kFullHeaderSize = kHeaderSize + 2 * sizeof(uint32_t);  // version, flags and entry count
+      THROW_IF(box_size < kFullHeaderSize, Invalid);
+      const uint32_t entry_count = Read32(box + kFullHeaderSize - sizeof(uint32_t));
+      const uint32_t entry_size = (type == "co64") ? sizeof(uint64_t) : sizeof(uint32_t);
+      THROW_IF((uint64_t)entry_count * entry_size != box_size - kFullHeaderSize, Invalid);
+      vector<uint64_t> chunk_offsets;
+      bool large = (type == "co64");
+      for (uint32_t i = 0; i < entry_count; ++i) {
+        const uint8_t* entry = box + kFullHeaderSize + i * entry_size;
+        const uint64_t chunk_offset = (entry_size == sizeof(uint64_t)) ? Read64(entry) : Read32(entry);
+        first_chunk_offset = min(first_chunk_offset, chunk_offset);
+        THROW_IF((int64_t)chunk_offset + delta < 0, Invalid);
+        chunk_offsets.push_back((uint64_t)((int64_t)chunk_offset + delta));
+        large |= (chunk_offsets.back() > numeric_limits<uint32_t>::max());
+      }
+      const uint64_t new_size = kFullHeaderSize + (uint64_t)entry_count * (large ? sizeof(uint64_t) : sizeof(uint32_t));
+      THROW_IF(new_size > numeric_limits<uint32_t>::max(), Overflow);
+      Write32(out, (uint32_t)new_size);
+      out.insert(out.end(), large ? "co64" : "stco", (large ? "co64" : "stco") + sizeof(uint32_t));
+      out.insert(out.end(), box + kHeaderSize, box + kFullHeaderSize);
+      for (auto chunk_offset: chunk_offsets) {
+        if (large) {
+          Write64(out, chunk_offset);
+        } else {
+          Write32(out, (uint32_t)chunk_offset);
+        }
+      }
+    } else {
+      out.insert(out.end(), box, box + box_size);
+    }
+  }
+
+  static void Patch32(vector<uint8_t>& out, size_t position, uint32_t value) {
+    out[position] = (uint8_t)(value >> 24);
+    out[position + 1] = (uint8_t)(value >> 16);
+    out[position + 2] = (uint8_t)(value >> 8);
+    out[position + 3] = (uint8_t)value;
+  }
+
+  static uint64_t FirstChunkOffset(const common::Data32& moov) {
+    vector<uint8_t> out;
+    uint64_t first_chunk_offset = numeric_limits<uint64_t>::max();
+    ShiftChunkOffsets(moov.data() + moov.a(), moov.count(), 0, out, first_chunk_offset);
+    THROW_IF(first_chunk_offset == numeric_limits<uint64_t>::max(), Invalid);
+    return first_chunk_offset;
+  }
+
+  // Rewrites moov for a new position in front of the media data, delta maps the size of the rewritten moov to the shift
+  // of the chunk offsets; since co64 promotion grows moov which in turn shifts the chunks further, iterate until stable
+  static vector<uint8_t> RelocateMoov(const common::Data32& moov, function<int64_t(uint64_t moov_size)> delta) {
+    vector<uint8_t> out;
+    uint64_t moov_size = moov.count();
+    while (true) {
+      out.clear();
+      uint64_t first_chunk_offset = numeric_limits<uint64_t>::max();
+      ShiftChunkOffsets(moov.data() + moov.a(), moov.count(), delta(moov_size), out, first_chunk_offset);
+      if (out.size() == moov_size) {
+        return out;
+      }
+      THROW_IF(out.size() < moov_size, Invalid);
+      moov_size = out.size();
+    }
+  }
+};
+
 class MP4Creator {
   struct Track {
     uint32_t timescale;
@@ -92,6 +250,11 @@ class MP4Creator {
   }};
   unique_ptr<common::Data32> main_segment = nullptr;
   unique_ptr<common::Data32> dash_data_segment = nullptr;
+  const common::Writer* writer = nullptr;  // when set, the file is streamed into it instead of main_segment
+  bool faststart = false;  // when streaming, only the sample tables are muxed and media data is written separately behind moov
+  uint64_t payload_size = 0;
+  uint64_t trailer_offset = numeric_limits<uint64_t>::max();  // where moov starts when streaming
+  function<void(encode::Sample&& sample, uint32_t index)> payload;  // faststart: receives every sample in file order once muxed
   uint32_t movie_timescale;
   functional::Caption<encode::Sample> caption;
   vector<util::PtsIndexPair> caption_pts_index_pairs;
@@ -104,6 +267,13 @@ class MP4Creator {
     SampleType type;
   };
   queue<CachedSample> cached_samples;  // caching is used only when enable_strict_dts_ordering is true, otherwise l-smash handles everything
+  struct VideoSampleEntry {
+    header::SPS_PPS sps_pps;
+    uint32_t index;
+  };
+  vector<VideoSampleEntry> video_sample_entries;  // the first one holds the SPS / PPS of the video settings
+  uint32_t video_coded_width = 0;
+  uint32_t video_coded_height = 0;
 
   static int Write(unique_ptr<common::Data32>& data, uint8_t* buf, int size) {
     if (size > security::kMaxWriteSize) {
@@ -206,6 +376,18 @@ class MP4Creator {
     }
   };
 
+  int32_t caption_index_for(const encode::Sample& sample) {
+    int32_t caption_index = -1;
+    if (sample.type == SampleType::Video) {
+      util::PtsIndexPair pts_index(sample.pts, 0); // only pts value is used when searching for the index
+      auto caption_pts_and_index = lower_bound(caption_pts_index_pairs.begin(), caption_pts_index_pairs.end(), pts_index);
+      if (caption_pts_and_index != caption_pts_index_pairs.end()) {
+        caption_index = caption_pts_and_index->index;
+      }
+    }
+    return caption_index;
+  }
+
   void mux(const encode::Sample& sample) {
     THROW_IF(file_format == DashInitializer, Invalid);  // dash init segment does not contain sample information
     THROW_IF(!initialized, Uninitialized);
@@ -231,26 +413,19 @@ class MP4Creator {
     }
 
     // create and append sample to track
-    const bool write_data = (file_format != FileFormat::HeaderOnly);
+    const bool write_data = (file_format != FileFormat::HeaderOnly) && !faststart;
     lsmash_sample_t* lsmash_sample = nullptr;
     uint64_t offset = 0;
     uint32_t caption_size = 0;
-    int32_t caption_index = -1;
+    const int32_t caption_index = caption_index_for(sample);
     uint32_t lsmash_sample_size = sample.nal.count();
 
-    if (sample.type == SampleType::Video) {
-      util::PtsIndexPair pts_index(sample.pts, 0); // only pts value is used when searching for the index
-      auto caption_pts_and_index = lower_bound(caption_pts_index_pairs.begin(), caption_pts_index_pairs.end(), pts_index);
-      if (caption_pts_and_index != caption_pts_index_pairs.end()) {
-        caption_index = caption_pts_and_index->index;
-      }
-
-      if (caption_index >= 0) {
-        auto caption_sample = caption(caption_index);
-        caption_size = caption_sample.nal.count();
-        lsmash_sample_size += caption_size;
-      }
+    if (caption_index >= 0) {
+      auto caption_sample = caption(caption_index);
+      caption_size = caption_sample.nal.count();
+      lsmash_sample_size += caption_size;
     }
+    payload_size += lsmash_sample_size;
 
     lsmash_sample = lsmash_create_sample(lsmash_sample_size);
     THROW_IF(!lsmash_sample, OutOfMemory);
@@ -268,6 +443,9 @@ class MP4Creator {
     }
     lsmash_sample->dts = adjusted_dts;
     lsmash_sample->cts = sample_pts;
+    if (sample.type == SampleType::Video && sample.keyframe && file_format == Regular && sample.nal.data()) {
+      select_video_sample_entry(sample.nal);
+    }
     lsmash_sample->index = tracks(sample.type).sample_entry;
     lsmash_sample->prop.ra_flags = sample.keyframe ? ISOM_SAMPLE_RANDOM_ACCESS_FLAG_SYNC : ISOM_SAMPLE_RANDOM_ACCESS_FLAG_NONE;
     append_sample(lsmash_sample, sample.type);
@@ -312,13 +490,26 @@ class MP4Creator {
     if (file_format != DashInitializer) {
       order_samples(tracks(SampleType::Audio).timescale, audio,
                     tracks(SampleType::Video).timescale, video,
-                    [this](const encode::Sample& sample) {
+                    [this](auto&& sample) {  // samples are not used by order_samples once handed over
                       mux(sample);
+                      if (payload) {
+                        payload(move(sample), (uint32_t)tracks(sample.type).num_samples - 1);
+                      }
                     });
       finalize_tracks();
     }
 
-    CHECK(lsmash_finish_movie(root.get(), &moov_to_front) == 0);  // Remux moov to beginning to cover progressive download case
+    if (writer) {
+      trailer_offset = writer->size();
+      CHECK(lsmash_finish_movie(root.get(), nullptr) == 0);  // moov follows the streamed mdat
+      return;
+    }
+    if (is_dash) {
+      CHECK(lsmash_finish_movie(root.get(), &moov_to_front) == 0);
+    } else {
+      CHECK(lsmash_finish_movie(root.get(), nullptr) == 0);
+      move_moov_to_front();  // cover progressive download case
+    }
 
     if (file_format == DashData) {
       dash_data_segment->set_bounds(0, dash_data_segment->b());
@@ -326,12 +517,98 @@ class MP4Creator {
     main_segment->set_bounds(0, main_segment->b());
   }
 
-  void setup_video_track(const settings::Video& video_settings) {
+  void move_moov_to_front() {
+    // [ftyp | mdat | moov] -> [ftyp | moov | mdat], unlike the adhoc remux of l-smash media data is moved only once
+    // and in place whenever the buffer has room for the relocated moov
+    CHECK(main_segment);
+    main_segment->set_bounds(0, main_segment->b());
+    const uint32_t ftyp_size = (uint32_t)MP4BoxHandler::BoxSize(*main_segment);
+    const uint32_t moov_location = MP4BoxHandler::LocateBox(main_segment.get(), "moov");
+    THROW_IF(moov_location < ftyp_size, Invalid);
+    const auto moov = common::Data32(main_segment->data() + moov_location, main_segment->count() - moov_location, nullptr);
+    THROW_IF(MP4BoxHandler::BoxSize(moov) != moov.count(), Invalid);  // moov has to be the last box
+    const auto relocated_moov = MP4BoxHandler::RelocateMoov(moov, [](uint64_t moov_size) { return (int64_t)moov_size; });
+    const uint32_t media_size = moov_location - ftyp_size;
+    const uint64_t size = (uint64_t)ftyp_size + relocated_moov.size() + media_size;
+    THROW_IF(size > numeric_limits<uint32_t>::max(), Overflow);
+    if (main_segment->capacity() >= size) {
+      uint8_t* data = (uint8_t*)main_segment->data();
+      memmove(data + ftyp_size + relocated_moov.size(), data + ftyp_size, media_size);
+    } else {
+      const uint32_t capacity = common::align_divide((uint32_t)size, kSize_Default);
+      common::Data32* new_data = new common::Data32(new uint8_t[capacity], capacity, [](uint8_t* p) { delete[] p; });
+      THROW_IF(!new_data->data(), OutOfMemory);
+      memcpy((uint8_t*)new_data->data(), main_segment->data(), ftyp_size);
+      memcpy((uint8_t*)new_data->data() + ftyp_size + relocated_moov.size(), main_segment->data() + ftyp_size, media_size);
+      main_segment.reset(new_data);
+    }
+    memcpy((uint8_t*)main_segment->data() + ftyp_size, relocated_moov.data(), relocated_moov.size());
+    main_segment->set_bounds(0, (uint32_t)size);
+  }
+
+  uint32_t add_video_sample_entry(const header::SPS_PPS& sps_pps) {
     lsmash_video_summary_t* video_summary = (lsmash_video_summary_t*)lsmash_create_summary(LSMASH_SUMMARY_TYPE_VIDEO);
     CHECK(video_summary);
     video_summary->sample_type = ISOM_CODEC_TYPE_AVC1_VIDEO;
-    video_summary->width = video_settings.coded_width;
-    video_summary->height = video_settings.coded_height;
+    video_summary->width = video_coded_width;
+    video_summary->height = video_coded_height;
+
+    // SPS / PPS
+    auto cs = unique_ptr<lsmash_codec_specific_t, decltype(&lsmash_destroy_codec_specific_data)>(lsmash_create_codec_specific_data(LSMASH_CODEC_SPECIFIC_DATA_TYPE_ISOM_VIDEO_H264, LSMASH_CODEC_SPECIFIC_FORMAT_STRUCTURED), lsmash_destroy_codec_specific_data);
+    CHECK(cs);
+    lsmash_h264_specific_parameters_t* parameters = (lsmash_h264_specific_parameters_t*)cs->data.structured;
+    parameters->lengthSizeMinusOne = sps_pps.nalu_length_size - 1;
+    THROW_IF(lsmash_append_h264_parameter_set(parameters, H264_PARAMETER_SET_TYPE_SPS, (void*)sps_pps.sps.data(), sps_pps.sps.count()) != 0, InvalidArguments);
+    THROW_IF(lsmash_append_h264_parameter_set(parameters, H264_PARAMETER_SET_TYPE_PPS, (void*)sps_pps.pps.data(), sps_pps.pps.count()) != 0, InvalidArguments);
+    THROW_IF(lsmash_add_codec_specific_data((lsmash_summary_t*)video_summary, cs.get()) != 0, InvalidArguments);
+
+    auto csb = unique_ptr<lsmash_codec_specific_t, decltype(&lsmash_destroy_codec_specific_data)>(lsmash_create_codec_specific_data(LSMASH_CODEC_SPECIFIC_DATA_TYPE_ISOM_VIDEO_H264_BITRATE, LSMASH_CODEC_SPECIFIC_FORMAT_STRUCTURED), lsmash_destroy_codec_specific_data);
+    CHECK(csb);
+    THROW_IF(lsmash_add_codec_specific_data((lsmash_summary_t*)video_summary, csb.get()) != 0, InvalidArguments);
+
+    // Sample entry
+    const uint32_t index = lsmash_add_sample_entry(root.get(), tracks(SampleType::Video).track_ID, video_summary);
+    CHECK(index);
+    lsmash_cleanup_summary((lsmash_summary_t*)video_summary);
+    video_sample_entries.push_back({ sps_pps, index });
+    return index;
+  }
+
+  // Key frames carrying in-band SPS / PPS other than the ones of the current sample entry (e.g. the re-encoded GOPs of
+  // transcode::SmartTrim) switch to a sample entry holding theirs, so that decoders reading only avcC get the right ones.
+  // Only done for regular files, whose sample descriptions are written once all samples are muxed
+  void select_video_sample_entry(const common::Data32& nal) {
+    CHECK(video_sample_entries.size());
+    const uint8_t nalu_length_size = video_sample_entries.front().sps_pps.nalu_length_size;
+    const common::Data32 data(nal.data() + nal.a(), nal.count(), nullptr);
+    internal::decode::AVCC<internal::decode::H264NalType> avcc_parser(data, nalu_length_size);
+    common::Data16 sps;
+    common::Data16 pps;
+    for (const auto& nal_info: avcc_parser) {
+      if (nal_info.type == internal::decode::H264NalType::SPS && !sps.count()) {
+        THROW_IF(nal_info.size >= security::kMaxHeaderSize, Unsafe);
+        sps = common::Data16(data.data() + nal_info.byte_offset, (uint16_t)nal_info.size, nullptr);
+      } else if (nal_info.type == internal::decode::H264NalType::PPS && !pps.count()) {
+        THROW_IF(nal_info.size >= security::kMaxHeaderSize, Unsafe);
+        pps = common::Data16(data.data() + nal_info.byte_offset, (uint16_t)nal_info.size, nullptr);
+      }
+    }
+    if (!sps.count() || !pps.count()) {
+      return;  // keeps the current sample entry
+    }
+    const header::SPS_PPS sps_pps(sps, pps, nalu_length_size);  // copies the parameter sets out of the sample
+    for (const auto& entry: video_sample_entries) {
+      if (entry.sps_pps == sps_pps) {
+        tracks(SampleType::Video).sample_entry = entry.index;
+        return;
+      }
+    }
+    tracks(SampleType::Video).sample_entry = add_video_sample_entry(sps_pps);
+  }
+
+  void setup_video_track(const settings::Video& video_settings) {
+    video_coded_width = video_settings.coded_width;
+    video_coded_height = video_settings.coded_height;
 
     // Video track
     tracks(SampleType::Video).track_ID = lsmash_create_track(root.get(), ISOM_MEDIA_HANDLER_TYPE_VIDEO_TRACK);
@@ -354,22 +631,22 @@ class MP4Creator {
         track_parameters.matrix[1] =  0x00000;
         track_parameters.matrix[3] =  0x00000;
         track_parameters.matrix[4] = -0x10000 * video_settings.par_height;
-        track_parameters.matrix[6] =  video_summary->width << 16;
-        track_parameters.matrix[7] =  video_summary->height << 16;
+        track_parameters.matrix[6] =  video_coded_width << 16;
+        track_parameters.matrix[7] =  video_coded_height << 16;
         break;
       case settings::Video::Orientation::Portrait:
         track_parameters.matrix[0] =  0x00000;
         track_parameters.matrix[1] =  0x10000 * video_settings.par_width;
         track_parameters.matrix[3] = -0x10000 * video_settings.par_height;
         track_parameters.matrix[4] =  0x00000;
-        track_parameters.matrix[6] =  video_summary->height << 16;
+        track_parameters.matrix[6] =  video_coded_height << 16;
         break;
       case settings::Video::Orientation::PortraitReverse:
         track_parameters.matrix[0] =  0x00000;
         track_parameters.matrix[1] = -0x10000 * video_settings.par_width;
         track_parameters.matrix[3] =  0x10000 * video_settings.par_height;
         track_parameters.matrix[4] =  0x00000;
-        track_parameters.matrix[7] =  video_summary->width << 16;
+        track_parameters.matrix[7] =  video_coded_width << 16;
         break;
       case settings::Video::Orientation::Landscape:
         track_parameters.matrix[0] =  0x10000 * video_settings.par_width;
@@ -393,23 +670,9 @@ class MP4Creator {
     tracks(SampleType::Video).media_timescale = lsmash_get_media_timescale(root.get(), tracks(SampleType::Video).track_ID);
     CHECK(tracks(SampleType::Video).media_timescale);
 
-    // SPS / PPS
-    auto cs = unique_ptr<lsmash_codec_specific_t, decltype(&lsmash_destroy_codec_specific_data)>(lsmash_create_codec_specific_data(LSMASH_CODEC_SPECIFIC_DATA_TYPE_ISOM_VIDEO_H264, LSMASH_CODEC_SPECIFIC_FORMAT_STRUCTURED), lsmash_destroy_codec_specific_data);
-    CHECK(cs);
-    lsmash_h264_specific_parameters_t* parameters = (lsmash_h264_specific_parameters_t*)cs->data.structured;
-    parameters->lengthSizeMinusOne = video_settings.sps_pps.nalu_length_size - 1;
-    THROW_IF(lsmash_append_h264_parameter_set(parameters, H264_PARAMETER_SET_TYPE_SPS, (void*)video_settings.sps_pps.sps.data(), video_settings.sps_pps.sps.count()) != 0, InvalidArguments);
-    THROW_IF(lsmash_append_h264_parameter_set(parameters, H264_PARAMETER_SET_TYPE_PPS, (void*)video_settings.sps_pps.pps.data(), video_settings.sps_pps.pps.count()) != 0, InvalidArguments);
-    THROW_IF(lsmash_add_codec_specific_data((lsmash_summary_t*)video_summary, cs.get()) != 0, InvalidArguments);
-
-    auto csb = unique_ptr<lsmash_codec_specific_t, decltype(&lsmash_destroy_codec_specific_data)>(lsmash_create_codec_specific_data(LSMASH_CODEC_SPECIFIC_DATA_TYPE_ISOM_VIDEO_H264_BITRATE, LSMASH_CODEC_SPECIFIC_FORMAT_STRUCTURED), lsmash_destroy_codec_specific_data);
-    CHECK(csb);
-    THROW_IF(lsmash_add_codec_specific_data((lsmash_summary_t*)video_summary, csb.get()) != 0, InvalidArguments);
-
     // Sample entry
-    tracks(SampleType::Video).sample_entry = lsmash_add_sample_entry(root.get(), tracks(SampleType::Video).track_ID, video_summary);
-    CHECK(tracks(SampleType::Video).sample_entry);
-    lsmash_cleanup_summary((lsmash_summary_t*)video_summary);
+    video_sample_entries.clear();
+    tracks(SampleType::Video).sample_entry = add_video_sample_entry(video_settings.sps_pps);
 
     tracks(SampleType::Video).timescale = video_settings.timescale;
   }
@@ -509,10 +772,17 @@ class MP4Creator {
     // Setup main / initializer segment
     main_param.reset(new lsmash_file_parameters_t());
     memset((void*)main_param.get(), 0, sizeof(lsmash_file_parameters_t));
-    main_param->opaque = (void*)this;
-    main_param->read = read_func;
-    main_param->write = write_func;
-    main_param->seek = seek_func;
+    if (writer) {
+      main_param->opaque = (void*)writer->opaque;
+      main_param->read = [](void* opaque, uint8_t* buf, int size) -> int { return 0; };  // write only
+      main_param->write = writer->write_callback;
+      main_param->seek = writer->seek_callback;
+    } else {
+      main_param->opaque = (void*)this;
+      main_param->read = read_func;
+      main_param->write = write_func;
+      main_param->seek = seek_func;
+    }
     lsmash_brand_type main_brands[3];
     if (qt_compatible) {
       main_brands[0] = ISOM_BRAND_TYPE_QT;
@@ -603,7 +873,7 @@ class MP4Creator {
 
   void init(const settings::Audio audio_settings, const settings::Video video_settings, const FileFormat file_format) {
     THROW_IF(initialized, Uninitialized);
-    if (file_format == HeaderOnly || file_format == SamplesOnly) {
+    if (file_format == HeaderOnly || file_format == SamplesOnly || faststart) {
       enforce_strict_dts_ordering = true;
     } else if (file_format == DashInitializer || file_format == DashData) {
       is_dash = true;
@@ -638,55 +908,285 @@ public:
     mux(audio, video, caption, edit_boxes);
     return file();
   }
-};
 
-struct MP4BoxHandler {
-  static uint32_t LocateBox(const common::Data32* file, const char box_name[]) {
-    size_t box_name_length = strlen(box_name);
-    THROW_IF(box_name_length <= 0, InvalidArguments);
-    THROW_IF(!file, InvalidArguments);
-    THROW_IF(file->count() < sizeof(uint32_t) + box_name_length, InvalidArguments);
-    int64_t box_location = -1;
-    auto data = common::Data32(file->data() + file->a(), file->count(), nullptr);
-    while (data.count()) {
-      for (uint32_t j = 0; j < box_name_length; ++j) {
-        if (data(data.a() + sizeof(uint32_t) + j) != box_name[j]) {
-          break;
-        } else if (j == box_name_length - 1) {
-          box_location = data.a();
-        }
+  vector<uint8_t> faststart_header(const functional::Audio<encode::Sample>& audio, const functional::Video<encode::Sample>& video, const functional::Caption<encode::Sample>& caption, const vector<common::EditBox> edit_boxes, const FileFormat file_format) {
+    // mux the sample tables with a strict dts ordering (one chunk per sample) without touching media data, l-smash
+    // lays the file out as [ftyp | mdat | moov] so ftyp is kept from the start of the file and moov from its end
+    const uint32_t kSize_Prefix = 1024;
+    vector<uint8_t> prefix;
+    vector<uint8_t> trailer;
+    auto keep = [](vector<uint8_t>& bytes, const uint64_t offset, const common::Data32& data, const uint64_t limit) {
+      const uint64_t end = min(offset + data.count(), limit);
+      if (offset < end) {
+        THROW_IF(end > security::kMaxWriteSize, Unsafe);
+        bytes.resize(max<size_t>(bytes.size(), end));
+        memcpy(bytes.data() + offset, data.data() + data.a(), end - offset);
       }
-      if (box_location < 0) {
-        uint32_t box_size = BoxSize(data);
-        THROW_IF(box_size == 0, Invalid);
-        data.set_bounds(data.a() + box_size, data.b());
-      } else {
-        break;
+    };
+    common::Writer tables([&](const uint64_t offset, const common::Data32& data) {
+      keep(prefix, offset, data, kSize_Prefix);
+      if (offset >= trailer_offset) {
+        keep(trailer, offset - trailer_offset, data, numeric_limits<uint64_t>::max());
       }
+    });
+    this->writer = &tables;
+    this->faststart = true;
+    init(audio.settings(), video.settings(), file_format);
+    mux(audio, video, caption, edit_boxes);
+    this->writer = nullptr;
+
+    const auto ftyp = common::Data32(prefix.data(), (uint32_t)prefix.size(), nullptr);
+    const uint64_t ftyp_size = MP4BoxHandler::BoxSize(ftyp);
+    THROW_IF(ftyp_size > ftyp.count(), Invalid);
+    const auto moov = common::Data32(trailer.data(), (uint32_t)trailer.size(), nullptr);
+    THROW_IF(MP4BoxHandler::LocateBox(&moov, "moov") != 0 || MP4BoxHandler::BoxSize(moov) != moov.count(), Invalid);
+
+    // [ftyp | moov | mdat]: chunk offsets move from behind the old mdat header to behind the new one
+    const bool large_mdat = payload_size + 2 * sizeof(uint32_t) > numeric_limits<uint32_t>::max();
+    const uint32_t mdat_header_size = (large_mdat ? 4 : 2) * sizeof(uint32_t);
+    const uint64_t first_chunk_offset = MP4BoxHandler::FirstChunkOffset(moov);
+    const auto relocated_moov = MP4BoxHandler::RelocateMoov(moov, [&](uint64_t moov_size) {
+      return (int64_t)(ftyp_size + moov_size + mdat_header_size) - (int64_t)first_chunk_offset;
+    });
+    vector<uint8_t> header(ftyp.data(), ftyp.data() + ftyp_size);
+    header.insert(header.end(), relocated_moov.begin(), relocated_moov.end());
+    if (large_mdat) {
+      MP4BoxHandler::Write32(header, 1);
+      header.insert(header.end(), { 'm', 'd', 'a', 't' });
+      MP4BoxHandler::Write64(header, payload_size + mdat_header_size);
+    } else {
+      MP4BoxHandler::Write32(header, (uint32_t)(payload_size + mdat_header_size));
+      header.insert(header.end(), { 'm', 'd', 'a', 't' });
     }
-    THROW_IF(box_location < 0, Invalid);
-    return (uint32_t)box_location;
+    return header;
   }
 
-  static uint32_t BoxSize(const common::Data32& box) {
-    THROW_IF(box.count() < sizeof(uint32_t), InvalidArguments);  // each box starts with a 32-bit size field
-    const uint8_t* buffer = box.data() + box.a();
-    const uint32_t box_size = (buffer[0] << 24) + (buffer[1] << 16) + (buffer[2] << 8) + buffer[3];
-    THROW_IF(box_size == 1, Unsupported);  // extended size field present to support files larger than 2^32 bytes
-    if (box_size == 0) {  // implicit
-      return box.count();
-    } else {
-      return box_size;
+  uint64_t stream(const functional::Audio<encode::Sample>& audio, const functional::Video<encode::Sample>& video, const functional::Caption<encode::Sample>& caption, const vector<common::EditBox> edit_boxes, const FileFormat file_format, const common::Writer& writer, const bool faststart) {
+    THROW_IF(file_format != Regular, Unsupported);
+    THROW_IF(!audio.count() && !video.count(), InvalidArguments);
+
+    if (!faststart) {
+      this->writer = &writer;
+      init(audio.settings(), video.settings(), file_format);
+      mux(audio, video, caption, edit_boxes);
+      return writer.size();
     }
+
+    // 1st pass: sample tables
+    const auto header = faststart_header(audio, video, caption, edit_boxes, file_format);
+    uint64_t offset = 0;
+    auto write = [&](const uint8_t* bytes, const uint32_t size) {
+      writer.write(offset, common::Data32((uint8_t*)bytes, size, nullptr));
+      offset += size;
+    };
+    write(header.data(), (uint32_t)header.size());
+
+    // 2nd pass: media data goes straight to writer, in the same order the samples were laid out by the 1st pass
+    order_samples(tracks(SampleType::Audio).timescale, audio,
+                  tracks(SampleType::Video).timescale, video,
+                  [&](const encode::Sample& sample) {
+                    const int32_t caption_index = caption_index_for(sample);
+                    if (caption_index >= 0) {
+                      const auto caption_sample = caption(caption_index);
+                      write(caption_sample.nal.data() + caption_sample.nal.a(), caption_sample.nal.count());
+                    }
+                    THROW_IF(!sample.nal.data(), Invalid);
+                    write(sample.nal.data() + sample.nal.a(), sample.nal.count());
+                  });
+    THROW_IF(offset - header.size() != payload_size, Invalid);  // tracks have to produce the same samples on every pass
+    return offset;
   }
 
-  static uint32_t HeaderSize(const common::Data32* file) {  // assumes [header | samples] format
-    THROW_IF(!file, Invalid);
-    const char box_name[] = "mdat";
-    const uint32_t location = LocateBox(file, box_name);
-    const auto mdat = common::Data32(file->data() + file->a() + location, file->count() - location, nullptr);
-    THROW_IF(BoxSize(mdat) != mdat.count(), Invalid);  // mdat has to span till the end of file
-    return location + sizeof(uint32_t) + (uint32_t)strlen(box_name);  // mdat box size and "mdat" belongs to header
+  // source appends the media data of samples muxed without any (see MP4::chain), given their index in the track
+  common::Chain chain(const functional::Audio<encode::Sample>& audio, const functional::Video<encode::Sample>& video, const functional::Caption<encode::Sample>& caption, const vector<common::EditBox> edit_boxes, const FileFormat file_format,
+                      function<void(common::Chain& payloads, const encode::Sample& sample, uint32_t index)> source = nullptr) {
+    THROW_IF(file_format != Regular, Unsupported);
+    THROW_IF(!audio.count() && !video.count(), InvalidArguments);
+
+    // single pass: the media data of each sample is kept as is and chained behind the header once the tables are done
+    common::Chain payloads;
+    payload = [&](encode::Sample&& sample, uint32_t index) {
+      const int32_t caption_index = caption_index_for(sample);
+      if (caption_index >= 0) {
+        payloads.append(move(caption(caption_index).nal));
+      }
+      if (!sample.nal.data() && sample.nal.count()) {
+        THROW_IF(!source, Invalid);
+        source(payloads, sample, index);
+      } else {
+        payloads.append(move(sample.nal));
+      }
+    };
+    const auto header = faststart_header(audio, video, caption, edit_boxes, file_format);
+    payload = nullptr;
+    THROW_IF(payloads.count() != payload_size, Invalid);
+
+    common::Chain chain;
+    common::Data32 header_data(new uint8_t[header.size()], (uint32_t)header.size(), [](uint8_t* p) { delete[] p; });
+    memcpy((uint8_t*)header_data.data(), header.data(), header.size());
+    chain.append(move(header_data));
+    chain.append(payloads);
+    return chain;
+  }
+
+  // init segment as muxed by l-smash for DashInitializer, then [moof | mdat] fragments laid out here as soon as their
+  // samples are available, since l-smash only writes fragments out once the whole movie is finished
+  void fragments(const functional::Audio<encode::Sample>& audio, const functional::Video<encode::Sample>& video, const functional::Caption<encode::Sample>& caption,
+                 const function<void(common::Data32&& data, uint32_t sequence_number, bool key)>& output, const uint32_t chunk_duration_ms) {
+    THROW_IF(!output, InvalidArguments);
+    THROW_IF(!audio.count() && !video.count(), InvalidArguments);
+    THROW_IF(!video.count() && !chunk_duration_ms, InvalidArguments, "audio only fragments need a chunk duration");
+
+    // no sample is pulled for the init segment
+    init(audio.settings(), video.settings(), DashInitializer);
+    mux(audio, video, caption, vector<common::EditBox>());
+    unique_ptr<common::Data32> init_segment(file());
+    output(move(*init_segment), 0, true);
+
+    struct Run {  // samples of a track waiting for their fragment to be complete
+      vector<encode::Sample> samples;
+      vector<int32_t> caption_indices;
+      int64_t last_duration = 0;
+    };
+    Run runs[kNumTracks];
+    auto run = [&runs](const SampleType type) -> Run& {
+      return runs[type - SampleType::Video];
+    };
+    const SampleType primary = video.count() ? SampleType::Video : SampleType::Audio;  // track fragments are cut on
+    uint32_t sequence_number = 0;
+
+    auto emit = [&](const int64_t next_dts) {  // next_dts: first sample of the primary track after the fragment, -1 if none
+      const uint32_t kFlags_DefaultBaseIsMoof = 0x020000;
+      const uint32_t kFlags_Trun = 0x000001 | 0x000100 | 0x000200 | 0x000400 | 0x000800;  // data offset, duration, size, flags, composition offset
+      const uint32_t kSampleFlags_Sync = 0x02000000;  // depends on no other sample
+      const uint32_t kSampleFlags_NonSync = 0x01010000;  // depends on others, non sync sample
+      auto box_header = [](vector<uint8_t>& out, const char type[]) {
+        MP4BoxHandler::Write32(out, 0);  // patched once the box is complete
+        out.insert(out.end(), type, type + 4);
+      };
+      vector<uint8_t> moof;
+      box_header(moof, "moof");
+      MP4BoxHandler::Write32(moof, 4 * sizeof(uint32_t));
+      moof.insert(moof.end(), { 'm', 'f', 'h', 'd' });
+      MP4BoxHandler::Write32(moof, 0);
+      MP4BoxHandler::Write32(moof, ++sequence_number);
+
+      vector<size_t> data_offset_positions;
+      vector<uint32_t> run_sizes;
+      apply_on_tracks([&](SampleType type) {
+        const Run& r = run(type);
+        if (r.samples.empty()) {
+          return;
+        }
+        const size_t traf_position = moof.size();
+        box_header(moof, "traf");
+        MP4BoxHandler::Write32(moof, 4 * sizeof(uint32_t));
+        moof.insert(moof.end(), { 't', 'f', 'h', 'd' });
+        MP4BoxHandler::Write32(moof, kFlags_DefaultBaseIsMoof);
+        MP4BoxHandler::Write32(moof, tracks(type).track_ID);
+        MP4BoxHandler::Write32(moof, 5 * sizeof(uint32_t));
+        moof.insert(moof.end(), { 't', 'f', 'd', 't' });
+        MP4BoxHandler::Write32(moof, 0x01000000);  // version 1: 64-bit decode time
+        MP4BoxHandler::Write64(moof, (uint64_t)r.samples.front().dts);
+
+        bool negative_offsets = false;
+        for (const auto& sample: r.samples) {
+          negative_offsets |= sample.pts < sample.dts;
+        }
+        const size_t trun_position = moof.size();
+        box_header(moof, "trun");
+        MP4BoxHandler::Write32(moof, (negative_offsets ? 0x01000000 : 0) | kFlags_Trun);
+        MP4BoxHandler::Write32(moof, (uint32_t)r.samples.size());
+        data_offset_positions.push_back(moof.size());
+        MP4BoxHandler::Write32(moof, 0);
+        uint64_t run_size = 0;
+        for (uint32_t i = 0; i < r.samples.size(); ++i) {
+          const auto& sample = r.samples[i];
+          int64_t duration;
+          if (i + 1 < r.samples.size()) {
+            duration = r.samples[i + 1].dts - sample.dts;
+          } else if (type == primary && next_dts >= 0) {
+            duration = next_dts - sample.dts;
+          } else {  // last sample so far, predict its duration from the previous one
+            duration = r.last_duration ? r.last_duration : 1;
+          }
+          THROW_IF(duration <= 0 || duration > numeric_limits<uint32_t>::max(), Invalid);
+          run(type).last_duration = duration;
+          const int64_t composition_offset = sample.pts - sample.dts;
+          THROW_IF(composition_offset > numeric_limits<int32_t>::max() || composition_offset < numeric_limits<int32_t>::min(), Overflow);
+          const uint32_t caption_size = r.caption_indices[i] >= 0 ? caption(r.caption_indices[i]).nal.count() : 0;
+          const uint32_t size = sample.nal.count() + caption_size;
+          const bool sync = type == SampleType::Audio || sample.keyframe;
+          MP4BoxHandler::Write32(moof, (uint32_t)duration);
+          MP4BoxHandler::Write32(moof, size);
+          MP4BoxHandler::Write32(moof, sync ? kSampleFlags_Sync : kSampleFlags_NonSync);
+          MP4BoxHandler::Write32(moof, (uint32_t)(int32_t)composition_offset);
+          run_size += size;
+        }
+        THROW_IF(run_size > numeric_limits<uint32_t>::max(), Overflow);
+        run_sizes.push_back((uint32_t)run_size);
+        MP4BoxHandler::Patch32(moof, trun_position, (uint32_t)(moof.size() - trun_position));
+        MP4BoxHandler::Patch32(moof, traf_position, (uint32_t)(moof.size() - traf_position));
+      });
+      MP4BoxHandler::Patch32(moof, 0, (uint32_t)moof.size());
+
+      // [moof | mdat], runs follow each other in mdat and their data offsets are relative to the start of moof
+      const uint32_t kMdatHeaderSize = 2 * sizeof(uint32_t);
+      uint64_t size = moof.size() + kMdatHeaderSize;
+      for (uint32_t i = 0; i < run_sizes.size(); ++i) {
+        MP4BoxHandler::Patch32(moof, data_offset_positions[i], (uint32_t)size);
+        size += run_sizes[i];
+      }
+      THROW_IF(size > numeric_limits<uint32_t>::max(), Overflow);
+      common::Data32 fragment(new uint8_t[size], (uint32_t)size, [](uint8_t* p) { delete[] p; });
+      uint8_t* bytes = (uint8_t*)fragment.data();
+      memcpy(bytes, moof.data(), moof.size());
+      bytes += moof.size();
+      vector<uint8_t> mdat_header;
+      MP4BoxHandler::Write32(mdat_header, (uint32_t)(size - moof.size()));
+      mdat_header.insert(mdat_header.end(), { 'm', 'd', 'a', 't' });
+      memcpy(bytes, mdat_header.data(), kMdatHeaderSize);
+      bytes += kMdatHeaderSize;
+      const bool key = primary == SampleType::Audio || run(primary).samples.empty() || run(primary).samples.front().keyframe;
+      apply_on_tracks([&](SampleType type) {
+        Run& r = run(type);
+        for (uint32_t i = 0; i < r.samples.size(); ++i) {
+          if (r.caption_indices[i] >= 0) {
+            const auto caption_sample = caption(r.caption_indices[i]);
+            memcpy(bytes, caption_sample.nal.data() + caption_sample.nal.a(), caption_sample.nal.count());
+            bytes += caption_sample.nal.count();
+          }
+          memcpy(bytes, r.samples[i].nal.data() + r.samples[i].nal.a(), r.samples[i].nal.count());
+          bytes += r.samples[i].nal.count();
+        }
+        r.samples.clear();
+        r.caption_indices.clear();
+      });
+      output(move(fragment), sequence_number, key);
+    };
+
+    const int64_t chunk_duration = (int64_t)chunk_duration_ms * tracks(primary).timescale / 1000;
+    order_samples(tracks(SampleType::Audio).timescale, audio,
+                  tracks(SampleType::Video).timescale, video,
+                  [&](auto&& sample) {  // samples are not used by order_samples once handed over
+                    THROW_IF(sample.nal.count() >= 0x400000, Unsafe);
+                    THROW_IF(!sample.nal.data(), Invalid);
+                    THROW_IF(sample.dts < 0, Unsupported);
+                    Run& r = run(sample.type);
+                    THROW_IF(!r.samples.empty() && sample.dts <= r.samples.back().dts, Invalid);
+                    if (sample.type == primary && !r.samples.empty()) {
+                      const bool gop = sample.type == SampleType::Video && sample.keyframe;
+                      const bool chunk = chunk_duration && sample.dts - r.samples.front().dts >= chunk_duration;
+                      if (gop || chunk) {
+                        emit(sample.dts);
+                      }
+                    }
+                    r.caption_indices.push_back(caption_index_for(sample));
+                    r.samples.push_back(move(sample));
+                  });
+    if (!run(SampleType::Video).samples.empty() || !run(SampleType::Audio).samples.empty()) {
+      emit(-1);
+    }
   }
 };
 
@@ -748,6 +1248,100 @@ auto MP4::operator()() -> common::Data32 {
   // 4- move(...)                           : prevents copying the common::Data32
 }
 
+auto MP4::operator()(const common::Writer& writer, const bool faststart) -> uint64_t {
+  MP4Creator creator;
+  return creator.stream(_this->audio, _this->video, _this->caption, _this->edit_boxes, _this->file_format, writer, faststart);
+}
+
+auto MP4::chain() -> common::Chain {
+  MP4Creator creator;
+  return creator.chain(_this->audio, _this->video, _this->caption, _this->edit_boxes, _this->file_format);
+}
+
+auto MP4::fragments(const std::function<void(common::Data32&& data, uint32_t sequence_number, bool key)>& output, const uint32_t chunk_duration_ms) -> void {
+  THROW_IF(!_this->edit_boxes.empty(), Unsupported, "edit boxes are not supported in fragments");
+  MP4Creator creator;
+  creator.fragments(_this->audio, _this->video, _this->caption, output, chunk_duration_ms);
+}
+
+static auto CheckBoundaries(const vector<uint32_t>& boundaries, const uint32_t count, const bool allow_empty) -> void {
+  for (uint32_t i = 0; i < boundaries.size(); ++i) {
+    THROW_IF(allow_empty ? boundaries[i] > count : boundaries[i] >= count, InvalidArguments);
+    THROW_IF(i && (allow_empty ? boundaries[i] < boundaries[i - 1] : boundaries[i] <= boundaries[i - 1]), InvalidArguments);
+  }
+}
+
+static auto SegmentEnd(const vector<uint32_t>& boundaries, const uint32_t count, const uint32_t index) -> uint32_t {
+  return (index + 1 < boundaries.size()) ? boundaries[index + 1] : count;
+}
+
+static auto MuxSegments(const uint32_t num_segments, const uint32_t thread_count,
+                        const std::function<common::Data32(uint32_t index)>& mux,
+                        const std::function<void(common::Data32&& data, uint32_t index)>& output) -> void {
+  THROW_IF(num_segments == 0 || thread_count == 0 || !output, InvalidArguments);
+  // each segment goes through its own MP4Creator, so segments only share the (read only) tracks
+  auto segment = [&mux](uint32_t index) -> shared_ptr<common::Data32> {
+    return make_shared<common::Data32>(mux(index));
+  };
+  functional::Prefetcher<shared_ptr<common::Data32>, uint32_t> prefetcher(segment, num_segments, 2 * thread_count, thread_count);
+  for (uint32_t index = 0; index < num_segments; ++index) {
+    output(move(*prefetcher(index)), index);
+  }
+}
+
+auto MP4::segments(const functional::Video<encode::Sample>& video, const vector<uint32_t>& boundaries, const FileFormat file_format, const uint32_t thread_count,
+                   const std::function<void(common::Data32&& data, uint32_t index)>& output) -> void {
+  CheckBoundaries(boundaries, video.count(), false);
+  MuxSegments((uint32_t)boundaries.size(), thread_count, [&video, &boundaries, file_format](uint32_t index) -> common::Data32 {
+    const uint32_t end = SegmentEnd(boundaries, video.count(), index);
+    return MP4(video.slice(video.a() + boundaries[index], video.a() + end), file_format)();
+  }, output);
+}
+
+auto MP4::segments(const functional::Audio<encode::Sample>& audio, const vector<uint32_t>& boundaries, const FileFormat file_format, const uint32_t thread_count,
+                   const std::function<void(common::Data32&& data, uint32_t index)>& output) -> void {
+  CheckBoundaries(boundaries, audio.count(), false);
+  MuxSegments((uint32_t)boundaries.size(), thread_count, [&audio, &boundaries, file_format](uint32_t index) -> common::Data32 {
+    const uint32_t end = SegmentEnd(boundaries, audio.count(), index);
+    return MP4(audio.slice(audio.a() + boundaries[index], audio.a() + end), functional::Video<encode::Sample>(), file_format)();
+  }, output);
+}
+
+auto MP4::segments(const functional::Audio<encode::Sample>& audio, const vector<uint32_t>& audio_boundaries,
+                   const functional::Video<encode::Sample>& video, const vector<uint32_t>& video_boundaries,
+                   const FileFormat file_format, const uint32_t thread_count,
+                   const std::function<void(common::Data32&& data, uint32_t index)>& output) -> void {
+  THROW_IF(audio_boundaries.size() != video_boundaries.size(), InvalidArguments);
+  CheckBoundaries(video_boundaries, video.count(), false);
+  CheckBoundaries(audio_boundaries, audio.count(), true);
+  MuxSegments((uint32_t)video_boundaries.size(), thread_count, [&](uint32_t index) -> common::Data32 {
+    const uint32_t video_end = SegmentEnd(video_boundaries, video.count(), index);
+    const uint32_t audio_end = SegmentEnd(audio_boundaries, audio.count(), index);
+    const auto audio_segment = (audio_end > audio_boundaries[index]) ? audio.slice(audio.a() + audio_boundaries[index], audio.a() + audio_end) : functional::Audio<encode::Sample>();
+    return MP4(audio_segment, video.slice(video.a() + video_boundaries[index], video.a() + video_end), file_format)();
+  }, output);
+}
+
+auto MP4::chain(int file_descriptor, const functional::Audio<decode::Sample>& audio, const functional::Video<decode::Sample>& video, const vector<common::EditBox> edit_boxes) -> common::Chain {
+  THROW_IF(file_descriptor < 0, InvalidArguments);
+  THROW_IF(video.settings().timescale == 0 && audio.settings().sample_rate == 0.0, InvalidArguments);
+  // only the size of samples with a known byte range is needed to mux, their media data is never read
+  auto convert = [](const decode::Sample& sample) -> encode::Sample {
+    if (sample.byte_range.available) {
+      return encode::Sample(sample.pts, sample.dts, sample.keyframe, sample.type, common::Data32(sample.byte_range.size));
+    } else {
+      return encode::Sample(sample);
+    }
+  };
+  auto source = [file_descriptor, &audio, &video](common::Chain& payloads, const encode::Sample& sample, uint32_t index) {
+    const auto byte_range = (sample.type == SampleType::Video) ? video(index).byte_range : audio(index).byte_range;
+    THROW_IF(!byte_range.available || byte_range.size != sample.nal.count(), Invalid);
+    payloads.append(file_descriptor, byte_range.pos, byte_range.size);
+  };
+  MP4Creator creator;
+  return creator.chain(functional::Audio<encode::Sample>(audio, convert), functional::Video<encode::Sample>(video, convert), functional::Caption<encode::Sample>(), edit_boxes, FileFormat::Regular, source);
+}
+
 auto MP4::operator()(FileFormat file_format) -> common::Data32 {
   if (file_format != _this->file_format) {
     if (file_format == FileFormat::HeaderOnly && _this->file_format == FileFormat::SamplesOnly && _this->cached_file) {  // special case where we can avoid reprocessing
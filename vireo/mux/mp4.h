@@ -25,13 +25,18 @@
 #pragma once
 
 #include "vireo/base_h.h"
+#include "vireo/common/chain.h"
 #include "vireo/common/editbox.h"
+#include "vireo/common/writer.h"
+#include "vireo/decode/types.h"
 #include "vireo/encode/types.h"
 #include "vireo/functional/media.hpp"
 
 namespace vireo {
 namespace mux {
 
+// Regular files get an avc1 sample entry per set of SPS / PPS carried in-band by video key frames, the first one holds
+// the SPS / PPS of the video settings
 class PUBLIC MP4 final : public functional::Function<common::Data32> {
   std::shared_ptr<struct _MP4> _this = nullptr;
 public:
@@ -50,6 +55,35 @@ public:
   DISALLOW_ASSIGN(MP4);
   auto operator()() -> common::Data32;
   auto operator()(FileFormat file_format) -> common::Data32;
+  // Streams a Regular file into writer while muxing: media data is written as samples arrive and the moov box last,
+  // so memory is bound by the sample tables rather than the size of the file. Returns the size of the file.
+  // With faststart, moov is computed from a first pass over the samples and written in front of the media data,
+  // which the second pass writes directly; tracks are thus evaluated twice and have to be deterministic.
+  auto operator()(const common::Writer& writer, const bool faststart = false) -> uint64_t;
+  // Fragmented MP4 (CMAF) muxed while the tracks are evaluated, for live packaging in constant memory: output gets the
+  // init segment [ftyp | moov] (sequence number 0) before any sample is pulled, then a [moof | mdat] fragment per GOP
+  // as soon as the first sample of the next GOP is available. With chunk_duration_ms, fragments are also cut once they
+  // last that long (low latency chunks); key tells whether a fragment starts with a key frame and can begin a segment.
+  // Audio only movies are cut by chunk_duration_ms alone.
+  auto fragments(const std::function<void(common::Data32&& data, uint32_t sequence_number, bool key)>& output, const uint32_t chunk_duration_ms = 0) -> void;
+  // Faststart Regular file as a chain of the header followed by the media data of the samples, which is never copied
+  auto chain() -> common::Chain;
+  // Remux without reading media data: samples are copied byte for byte from their byte range in file_descriptor,
+  // kernel-side once the chain is written into a file. Caption SEIs stay in place within video samples.
+  static auto chain(int file_descriptor, const functional::Audio<decode::Sample>& audio, const functional::Video<decode::Sample>& video, const vector<common::EditBox> edit_boxes = vector<common::EditBox>()) -> common::Chain;
+  // Segments of a single track (e.g. DashData per GOP): segment i holds samples [boundaries[i], boundaries[i + 1]), the
+  // last one runs to the end of the track. They are muxed concurrently on thread_count threads and handed to output in
+  // order, identical to muxing each of them on its own; the track is evaluated from several threads and has to be reentrant.
+  static auto segments(const functional::Video<encode::Sample>& video, const vector<uint32_t>& boundaries, const FileFormat file_format, const uint32_t thread_count,
+                       const std::function<void(common::Data32&& data, uint32_t index)>& output) -> void;
+  static auto segments(const functional::Audio<encode::Sample>& audio, const vector<uint32_t>& boundaries, const FileFormat file_format, const uint32_t thread_count,
+                       const std::function<void(common::Data32&& data, uint32_t index)>& output) -> void;
+  // Same with both tracks, split at their own boundaries (e.g. audio at the dts of the key frames, see transform::Chunk);
+  // audio segments may be empty
+  static auto segments(const functional::Audio<encode::Sample>& audio, const vector<uint32_t>& audio_boundaries,
+                       const functional::Video<encode::Sample>& video, const vector<uint32_t>& video_boundaries,
+                       const FileFormat file_format, const uint32_t thread_count,
+                       const std::function<void(common::Data32&& data, uint32_t index)>& output) -> void;
 };
 
 }}
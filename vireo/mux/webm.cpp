@@ -28,6 +28,7 @@
 #include "vireo/common/enum.hpp"
 #include "vireo/common/math.h"
 #include "vireo/common/security.h"
+#include "vireo/common/writer.h"
 #include "vireo/constants.h"
 #include "vireo/encode/util.h"
 #include "vireo/error/error.h"
@@ -77,6 +78,66 @@ struct _WebM {
     }
     void ElementStartNotify(mkvmuxer::uint64 element_id, mkvmuxer::int64 position) {}
   };
+  struct StreamWriter : public mkvmuxer::IMkvWriter {
+    // Coalesces the many small writes of mkvmuxer and hands them to the output a cluster at a time; the size
+    // of a cluster is patched in place while it is still buffered, or with a positioned write once it is not
+    static const size_t kSize_Buffer = 512 * 1024;
+    const common::Writer& writer;
+    common::Data32 buffer = common::Data32(new uint8_t[kSize_Buffer], kSize_Buffer, [](uint8_t* p) { delete[] p; });
+    uint64_t buffer_position = 0;  // file offset of buffer
+    uint64_t position = 0;
+    const bool live;
+    StreamWriter(const common::Writer& writer, bool live) : writer(writer), live(live) {
+      buffer.set_bounds(0, 0);
+    }
+    void flush() {
+      if (buffer.count()) {
+        writer.write(buffer_position, buffer);
+      }
+      buffer_position = position;
+      buffer.set_bounds(0, 0);
+    }
+    mkvmuxer::int64 Position() const {
+      return (mkvmuxer::int64)position;
+    }
+    mkvmuxer::int32 Position(mkvmuxer::int64 new_position) {
+      if (live || new_position < 0) {
+        return 1;
+      }
+      position = (uint64_t)new_position;
+      return 0;
+    }
+    bool Seekable() const {
+      return !live;
+    }
+    mkvmuxer::int32 Write(const void* data, mkvmuxer::uint32 length) {
+      if (length > security::kMaxWriteSize) {
+        return 1;
+      }
+      if (position < buffer_position || position > buffer_position + buffer.count() || position + length > buffer_position + buffer.capacity()) {
+        flush();
+        if (length > buffer.capacity()) {
+          writer.write(position, common::Data32((uint8_t*)data, length, nullptr));
+          position += length;
+          buffer_position = position;
+          return 0;
+        }
+      }
+      const uint32_t offset = (uint32_t)(position - buffer_position);
+      memcpy((uint8_t*)buffer.data() + offset, data, length);
+      buffer.set_bounds(0, std::max(buffer.b(), offset + length));
+      position += length;
+      return 0;
+    }
+    void ElementStartNotify(mkvmuxer::uint64 element_id, mkvmuxer::int64 element_position) {
+      if (element_id == mkvmuxer::kMkvCluster) {  // previous cluster is complete
+        const uint64_t current_position = position;
+        position = (uint64_t)element_position;
+        flush();
+        position = current_position;
+      }
+    }
+  };
   Writer writer;
   mkvmuxer::Segment muxer_segment;
   uint32_t movie_timescale;
@@ -98,14 +159,14 @@ struct _WebM {
   bool initialized = false;
   bool finalized = false;
 
-  auto mux(const encode::Sample& sample) -> void {
+  auto mux(mkvmuxer::Segment& segment, const encode::Sample& sample) -> void {
     THROW_IF(sample.nal.count() >= 0x400000, Unsafe);
     THROW_IF(sample.type != SampleType::Video && sample.type != SampleType::Audio, InvalidArguments);
     THROW_IF(tracks(SampleType::Audio).num_frames >= security::kMaxSampleCount, Unsafe);
     THROW_IF(tracks(SampleType::Video).num_frames >= security::kMaxSampleCount, Unsafe);
 
     THROW_IF(!sample.nal.data(), Invalid);
-    THROW_IF(muxer_segment.AddFrame((const mkvmuxer::uint8*)sample.nal.data(),
+    THROW_IF(segment.AddFrame((const mkvmuxer::uint8*)sample.nal.data(),
                                     sample.nal.count(),
                                     tracks(sample.type).track_ID,
                                     common::round_divide((uint64_t)sample.pts * kMicroSecondScale,
@@ -122,7 +183,7 @@ struct _WebM {
       order_samples(tracks(SampleType::Audio).timescale, audio,
                     tracks(SampleType::Video).timescale, video,
                     [this](const encode::Sample& sample) {
-                      mux(sample);
+                      mux(muxer_segment, sample);
                     });
 
       CHECK(muxer_segment.Finalize());
@@ -131,6 +192,61 @@ struct _WebM {
       finalized = true;
     }
   }
+
+  auto stream(const common::Writer& output, const bool live) -> uint64_t {
+    THROW_IF(!initialized, Uninitialized);
+    StreamWriter stream_writer(output, live);
+    mkvmuxer::Segment segment;
+    setup(segment, &stream_writer);
+    if (live) {
+      segment.set_mode(mkvmuxer::Segment::kLive);  // sizes are left unknown and nothing is patched
+    }
+    tracks(SampleType::Audio).num_frames = 0;
+    tracks(SampleType::Video).num_frames = 0;
+    order_samples(tracks(SampleType::Audio).timescale, audio,
+                  tracks(SampleType::Video).timescale, video,
+                  [this, &segment](const encode::Sample& sample) {
+                    mux(segment, sample);
+                  });
+    CHECK(segment.Finalize());
+    stream_writer.flush();
+    return output.size();
+  }
+
+  auto setup(mkvmuxer::Segment& segment, mkvmuxer::IMkvWriter* segment_writer) -> void {
+    CHECK(segment.Init(segment_writer));
+
+    mkvmuxer::SegmentInfo* const info = segment.GetSegmentInfo();
+    info->set_timecode_scale(kMicroSecondScale);
+    char vireo_version[64];
+    snprintf(vireo_version, 64, "Vireo Feet v%s", VIREO_VERSION);
+    info->set_writing_app(vireo_version);
+    snprintf(vireo_version, 64, "Vireo Wings v%s", VIREO_VERSION);
+    info->set_muxing_app(vireo_version);
+
+    if (tracks(SampleType::Video).track_ID) {
+      THROW_IF(segment.AddVideoTrack(video.settings().width,
+                                     video.settings().height,
+                                     tracks(SampleType::Video).track_ID) != tracks(SampleType::Video).track_ID, InvalidArguments);
+
+      mkvmuxer::VideoTrack* const track = static_cast<mkvmuxer::VideoTrack*>(segment.GetTrackByNumber(tracks(SampleType::Video).track_ID));
+      CHECK(track);
+      track->set_display_width(video.settings().width);
+      track->set_display_height(video.settings().height);
+    }
+
+    if (tracks(SampleType::Audio).track_ID) {
+      THROW_IF(segment.AddAudioTrack(audio.settings().sample_rate,
+                                     audio.settings().channels,
+                                     tracks(SampleType::Audio).track_ID) != tracks(SampleType::Audio).track_ID, InvalidArguments);
+
+      mkvmuxer::AudioTrack* const track = static_cast<mkvmuxer::AudioTrack*>(segment.GetTrackByNumber(tracks(SampleType::Audio).track_ID));
+      CHECK(track);
+      auto codec_private = audio.settings().as_extradata(settings::Audio::ExtraDataType::vorbis);
+      track->SetCodecPrivate(codec_private.data(), codec_private.count());
+      track->set_bit_depth(CHAR_BIT * sizeof(int16_t));
+    }
+  }
 };
 
 WebM::WebM(const functional::Audio<encode::Sample>& audio, const functional::Video<encode::Sample>& video)
@@ -143,47 +259,19 @@ WebM::WebM(const functional::Audio<encode::Sample>& audio, const functional::Vid
     THROW_IF(video.settings().orientation != settings::Video::Orientation::Landscape, Unsupported);
     THROW_IF(!security::valid_dimensions(video.settings().width, video.settings().height), Unsafe);
   }
-  CHECK(_this->muxer_segment.Init(&_this->writer));
-
-  mkvmuxer::SegmentInfo* const info = _this->muxer_segment.GetSegmentInfo();
-  info->set_timecode_scale(kMicroSecondScale);
-  char vireo_version[64];
-  snprintf(vireo_version, 64, "Vireo Feet v%s", VIREO_VERSION);
-  info->set_writing_app(vireo_version);
-  snprintf(vireo_version, 64, "Vireo Wings v%s", VIREO_VERSION);
-  info->set_muxing_app(vireo_version);
-
   uint32_t track_id = 0;
   if (video.settings().timescale != 0.0) {  // Video
     _this->tracks(SampleType::Video).track_ID = ++track_id;
-    THROW_IF(_this->muxer_segment.AddVideoTrack(video.settings().width,
-                                                video.settings().height,
-                                                _this->tracks(SampleType::Video).track_ID) != _this->tracks(SampleType::Video).track_ID, InvalidArguments);
-
-    mkvmuxer::VideoTrack* const track = static_cast<mkvmuxer::VideoTrack*>(_this->muxer_segment.GetTrackByNumber(_this->tracks(SampleType::Video).track_ID));
-    CHECK(track);
-    track->set_display_width(video.settings().width);
-    track->set_display_height(video.settings().height);
-
     _this->tracks(SampleType::Video).timescale = video.settings().timescale;
     _this->video = video;
   }
 
   if (audio.settings().sample_rate != 0.0) {  // Audio
     _this->tracks(SampleType::Audio).track_ID = ++track_id;
-    THROW_IF(_this->muxer_segment.AddAudioTrack(audio.settings().sample_rate,
-                                                audio.settings().channels,
-                                                _this->tracks(SampleType::Audio).track_ID) != _this->tracks(SampleType::Audio).track_ID, InvalidArguments);
-
-    mkvmuxer::AudioTrack* const track = static_cast<mkvmuxer::AudioTrack*>(_this->muxer_segment.GetTrackByNumber(_this->tracks(SampleType::Audio).track_ID));
-    CHECK(track);
-    auto codec_private = audio.settings().as_extradata(settings::Audio::ExtraDataType::vorbis);
-    track->SetCodecPrivate(codec_private.data(), codec_private.count());
-    track->set_bit_depth(CHAR_BIT * sizeof(int16_t));
-
     _this->tracks(SampleType::Audio).timescale = audio.settings().timescale;
     _this->audio = audio;
   }
+  _this->setup(_this->muxer_segment, &_this->writer);
 
   _this->initialized = true;
 
@@ -195,6 +283,14 @@ WebM::WebM(const functional::Audio<encode::Sample>& audio, const functional::Vid
   };
 }
 
+auto WebM::operator()() -> common::Data32 {
+  return move((*static_cast<std::function<common::Data32(void)>*>(this))());
+}
+
+auto WebM::operator()(const common::Writer& writer, const bool live) -> uint64_t {
+  return _this->stream(writer, live);
+}
+
 WebM::WebM(const WebM& webm)
   : Function<common::Data32>(*static_cast<const functional::Function<common::Data32>*>(&webm)), _this(webm._this) {
 }
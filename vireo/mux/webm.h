@@ -25,6 +25,7 @@
 #pragma once
 
 #include "vireo/base_h.h"
+#include "vireo/common/writer.h"
 #include "vireo/encode/types.h"
 #include "vireo/functional/media.hpp"
 #include "vireo/settings/settings.h"
@@ -40,6 +41,12 @@ public:
   WebM(const WebM& webm);
   WebM(WebM&& webm);
   DISALLOW_ASSIGN(WebM);
+  auto operator()() -> common::Data32;
+  // Streams the movie to writer one cluster at a time, so memory does not grow with the length of the movie; the
+  // seek head and cluster sizes are patched in place and cues are appended at the end. With live, nothing is
+  // patched and writes only ever move forward, at the cost of unknown sizes and no cues, so writer can be a pipe or a
+  // socket. Returns the size written.
+  auto operator()(const common::Writer& writer, const bool live = false) -> uint64_t;
 };
 
 }}
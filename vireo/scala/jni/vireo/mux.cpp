@@ -27,6 +27,7 @@
 
 #include "vireo/base_h.h"
 #include "vireo/base_cpp.h"
+#include "vireo/common/chain.h"
 #include "vireo/common/data.h"
 #include "vireo/common/path.h"
 #include "vireo/error/error.h"
@@ -132,6 +133,7 @@ jobject JNICALL Java_com_twitter_vireo_mux_jni_MP2TS_encode(JNIEnv* env, jobject
 
 struct _JNIMP4EncodeStruct : public jni::Struct<common::Data32> {
   unique_ptr<mux::MP4> encoder;
+  unique_ptr<common::Chain> regular;  // muxed once, whatever the file format of encoder
   functional::Audio<encode::Sample> audio;
   functional::Video<encode::Sample> video;
   functional::Caption<encode::Sample> caption;
@@ -220,7 +222,20 @@ jobject JNICALL Java_com_twitter_vireo_mux_jni_MP4_encode(JNIEnv* env, jobject m
       _CreateMP4Encoder(env, mp4_obj);
     }
 
-    auto data = (*jni->encoder)((FileFormat)file_format);
+    common::Data32 data;
+    if ((FileFormat)file_format == FileFormat::Regular) {
+      // regular files are gathered from the chained header and samples rather than copied through l-smash
+      if (!jni->regular) {
+        mux::MP4 regular(jni->audio, jni->video, jni->caption, jni->edit_boxes, FileFormat::Regular);
+        jni->regular.reset(new common::Chain(regular.chain()));
+      }
+      THROW_IF(jni->regular->count() > numeric_limits<uint32_t>::max(), Overflow);
+      const uint32_t size = (uint32_t)jni->regular->count();
+      data = common::Data32(new uint8_t[size], size, [](uint8_t* p) { delete[] p; });
+      jni->regular->copy((uint8_t*)data.data());
+    } else {
+      data = (*jni->encoder)((FileFormat)file_format);
+    }
     jobject byte_buffer_obj = env->NewDirectByteBuffer((void*)(data.data() + data.a()), (jlong)data.count());
     auto jni_byte_data = jni::Wrap(env, "com/twitter/vireo/common/ByteData", "(Ljava/nio/ByteBuffer;)V", byte_buffer_obj);
     jni->add_buffer_ref(move(data), jni_byte_data);
@@ -15,6 +15,7 @@ object ExceptionType {
   case object InternalError extends ExceptionType
   case object InvalidFile extends ExceptionType
   case object ReaderError extends ExceptionType
+  case object WriterError extends ExceptionType
   case object UnsupportedFile extends ExceptionType
   case object UnknownError extends ExceptionType
 }
@@ -27,6 +28,7 @@ case class VireoException(message: String) extends Exception(message) {
     case "invalid" => ExceptionType.InvalidFile
     case "invalid arguments" => ExceptionType.InternalError
     case "reader error" => ExceptionType.ReaderError
+    case "writer error" => ExceptionType.WriterError
     case "out of memory" => ExceptionType.InternalError
     case "out of range" => ExceptionType.InternalError
     case "overflow" => ExceptionType.InternalError
@@ -0,0 +1,140 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cmath>
+
+#include "vireo/base_cpp.h"
+#include "vireo/constants.h"
+#include "vireo/decode/audio.h"
+#include "vireo/encode/aac.h"
+#include "vireo/error/error.h"
+#include "vireo/sound/sound.h"
+
+using namespace vireo;
+
+// Encodes the same PCM sequentially and in concurrent segments and checks that the segmented track is
+// interchangeable with the sequential one: same access units at the same timestamps, and decoded audio that
+// only differs by quantization noise, in particular across the segment boundaries.
+
+static const uint32_t kTestSampleRate = 44100;
+static const uint8_t kChannels = 2;
+static const uint32_t kBitrate = 128 * 1024;
+static const uint32_t kFrameCount = 2600;  // two full segments and a partial one
+static const uint32_t kThreadCount = 4;
+static const double kMinSNR = 20.0;  // dB, whole track
+static const double kMinFrameSNR = 10.0;  // dB, any single frame
+
+static auto pcm(uint32_t index) -> sound::PCM {
+  // Tones with slowly varying pitch and level so every segment boundary falls on moving, non silent audio
+  const uint32_t count = AUDIO_FRAME_SIZE * kChannels;
+  int16_t* samples = (int16_t*)calloc(count, sizeof(int16_t));
+  for (uint32_t i = 0; i < AUDIO_FRAME_SIZE; ++i) {
+    const double t = (double)(index * AUDIO_FRAME_SIZE + i) / kTestSampleRate;
+    const double level = 0.25 + 0.1 * sin(2.0 * M_PI * 0.3 * t);
+    samples[i * kChannels] = (int16_t)(8000.0 * (level * sin(2.0 * M_PI * 440.0 * t) + 0.2 * sin(2.0 * M_PI * 1250.0 * t)));
+    samples[i * kChannels + 1] = (int16_t)(8000.0 * level * sin(2.0 * M_PI * (300.0 + 20.0 * t) * t));
+  }
+  return sound::PCM(AUDIO_FRAME_SIZE, kChannels, common::Sample16(samples, count, [](int16_t* p) { free(p); }));
+}
+
+static auto decode_track(const encode::AAC& aac, vector<encode::Sample>& samples) -> vector<sound::PCM> {
+  vector<decode::Sample> encoded;
+  for (const auto& sample: aac) {
+    samples.push_back(sample);
+    const auto nal = std::make_shared<common::Data32>(sample.nal);
+    encoded.push_back(decode::Sample(sample.pts, sample.dts, sample.keyframe, sample.type, [nal]() {
+      return common::Data32(nal->data(), nal->count(), nullptr);
+    }));
+  }
+  vector<sound::PCM> pcms;
+  for (const auto& sound: decode::Audio(functional::Audio<decode::Sample>(encoded, aac.settings()))) {
+    pcms.push_back(sound.pcm());
+  }
+  return pcms;
+}
+
+static auto snr(double signal, double noise) -> double {
+  return noise > 0.0 ? 10.0 * log10(signal / noise) : numeric_limits<double>::infinity();
+}
+
+int main(int argc, const char* argv[]) {
+  __try {
+    const settings::Audio settings = { settings::Audio::Codec::Unknown, kTestSampleRate, kTestSampleRate, kChannels, 0 };
+    functional::Audio<sound::Sound> sounds([](uint32_t index) -> sound::Sound {
+      return { (int64_t)index * AUDIO_FRAME_SIZE, [index]() { return pcm(index); } };
+    }, 0, kFrameCount, settings);
+
+    vector<encode::Sample> sequential_samples;
+    vector<encode::Sample> segmented_samples;
+    const auto sequential = decode_track(encode::AAC(sounds, kChannels, kBitrate, 1), sequential_samples);
+    const auto segmented = decode_track(encode::AAC(sounds, kChannels, kBitrate, kThreadCount), segmented_samples);
+
+    // Sample exact: one access unit per frame, at the same timestamps as the sequential encode
+    CHECK(sequential_samples.size() == kFrameCount);
+    CHECK(segmented_samples.size() == kFrameCount);
+    for (uint32_t index = 0; index < kFrameCount; ++index) {
+      const auto& expected = sequential_samples[index];
+      const auto& actual = segmented_samples[index];
+      THROW_IF(actual.pts != expected.pts || actual.dts != expected.dts, Invalid, "timestamps differ at frame " << index);
+      THROW_IF(actual.keyframe != expected.keyframe || actual.type != expected.type, Invalid, "sample differs at frame " << index);
+      THROW_IF(actual.nal.count() == 0, Invalid, "empty access unit at frame " << index);
+    }
+
+    // Null test: the difference between the two decodes must stay at the level of quantization noise,
+    // a splice that is out of step with the sequential encoder shows up as a burst in the frames around the boundary
+    CHECK(sequential.size() == kFrameCount);
+    CHECK(segmented.size() == kFrameCount);
+    double total_signal = 0.0;
+    double total_noise = 0.0;
+    double min_frame_snr = numeric_limits<double>::infinity();
+    uint32_t min_frame = 0;
+    for (uint32_t index = 0; index < kFrameCount; ++index) {
+      const auto& expected = sequential[index].samples();
+      const auto& actual = segmented[index].samples();
+      THROW_IF(actual.count() != expected.count(), Invalid, "decoded size differs at frame " << index);
+      double signal = 0.0;
+      double noise = 0.0;
+      for (uint32_t i = 0; i < expected.count(); ++i) {
+        const double difference = (double)actual(i) - expected(i);
+        signal += (double)expected(i) * expected(i);
+        noise += difference * difference;
+      }
+      total_signal += signal;
+      total_noise += noise;
+      if (signal > 0.0 && snr(signal, noise) < min_frame_snr) {
+        min_frame_snr = snr(signal, noise);
+        min_frame = index;
+      }
+    }
+    const double total_snr = snr(total_signal, total_noise);
+    cout << "sequential vs segmented: " << total_snr << " dB, worst frame " << min_frame << ": " << min_frame_snr << " dB" << endl;
+    THROW_IF(total_snr < kMinSNR, Invalid, "segmented audio differs from sequential audio");
+    THROW_IF(min_frame_snr < kMinFrameSNR, Invalid, "segmented audio has a discontinuity at frame " << min_frame);
+  } __catch (std::exception& e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+  cout << "success" << endl;
+  return 0;
+}
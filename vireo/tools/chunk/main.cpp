@@ -25,7 +25,9 @@
 #include <iomanip>
 #include <fstream>
 #include <future>
+#include <mutex>
 #include <set>
+#include <thread>
 #include <vector>
 
 #include "vireo/base_h.h"
@@ -36,6 +38,7 @@
 #include "vireo/encode/util.h"
 #include "vireo/error/error.h"
 #include "vireo/mux/mp4.h"
+#include "vireo/transform/chunk.h"
 #include "vireo/util/util.h"
 #include "vireo/tests/test_common.h"
 
@@ -46,16 +49,35 @@ using std::vector;
 
 using namespace vireo;
 
+// The demuxer is shared by both tracks of the movie and is not thread safe, so chunks are muxed in parallel
+// but every access to it, sample metadata and payloads alike, goes through lock
+template <int Type>
+static auto serialize(const functional::Media<functional::Function<decode::Sample, uint32_t>, decode::Sample, uint32_t, Type>& track,
+                      const shared_ptr<std::mutex>& lock)
+  -> functional::Media<functional::Function<decode::Sample, uint32_t>, decode::Sample, uint32_t, Type> {
+  return functional::Media<functional::Function<decode::Sample, uint32_t>, decode::Sample, uint32_t, Type>([track, lock](uint32_t index) -> decode::Sample {
+    std::lock_guard<std::mutex> guard(*lock);
+    decode::Sample sample = track(index);
+    sample.nal = [nal = sample.nal, lock]() -> common::Data32 {
+      std::lock_guard<std::mutex> guard(*lock);
+      return nal();
+    };
+    return sample;
+  }, track.a(), track.b(), track.settings());
+}
+
 int main(int argc, const char* argv[]) {
   if (argc < 3) {
     const string name = common::Path::Filename(argv[0]);
     cout << "Usage: " << name << " [options] input.mp4 output_dir" << endl;
     cout << "\nOptions:" << endl;
     cout << "-i, -iterations:\titeration count (for profiling, default: 1)" << endl;
+    cout << "-threads:\t\tnumber of chunks muxed in parallel (default: number of cores)" << endl;
     return 1;
   }
 
   int iterations = 1;
+  int threads = max(std::thread::hardware_concurrency(), 1u);
   int last_arg = 1;
   for (int i = 1; i < argc; ++i) {
     if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "-iterations") == 0) {
@@ -66,6 +88,14 @@ int main(int argc, const char* argv[]) {
       }
       iterations = (uint16_t)arg_iterations;
       last_arg = i + 1;
+    } else if (strcmp(argv[i], "-threads") == 0) {
+      int arg_threads = atoi(argv[++i]);
+      if (arg_threads < 1 || arg_threads > 64) {
+        cerr << "Invalid number of threads" << endl;
+        return 1;
+      }
+      threads = arg_threads;
+      last_arg = i + 1;
     }
   }
 
@@ -85,40 +115,28 @@ int main(int argc, const char* argv[]) {
     cout << "Writing chunks to " << s_dst.str() << "/..." << endl;
     cout << Profile::Function("Chunking", [&]{
       demux::Movie movie(s_src.str());
-      if (movie.video_track.count()) {  // Video
-        // setup mp4 encoder
-        unique_ptr<mux::MP4> mp4_encoder;
-        auto write_chunk = [&](uint32_t index, uint64_t start_pts, uint64_t end_pts){
+      if (movie.video_track.count()) {  // Video, with the audio of each GOP
+        auto lock = make_shared<std::mutex>();
+        const auto audio = serialize<SampleType::Audio>(movie.audio_track, lock);
+        const auto video = serialize<SampleType::Video>(movie.video_track, lock);
+        transform::Chunk chunk(audio, video);
+        auto write_chunk = [&](common::Data32&& data, uint32_t index) {
+          const auto video_track = chunk.video_track(index);
+          const uint64_t start_pts = video_track(0).pts;
+          const uint64_t end_pts = video_track(video_track.count() - 1).pts;
           cout << index << ".mp4 (start time: " << (float)start_pts / movie.video_track.settings().timescale << "s, ";
           cout << "duration: " << (float)(end_pts - start_pts) / movie.video_track.settings().timescale << "s)" << endl;
           std::stringstream s_dst_chunk; s_dst_chunk << s_dst.str() << "/" << index << ".mp4";
           const string abs_dst_chunk = vireo::common::Path::MakeAbsolute(s_dst_chunk.str());
-          util::save(abs_dst_chunk, (*mp4_encoder)());
+          util::save(abs_dst_chunk, data);
         };
-
-        // get
-        vector<uint32_t> gop_boundaries;
-        for (uint32_t i = 0; i < movie.video_track.count(); ++i) {
-          if (movie.video_track(i).keyframe) {
-            gop_boundaries.push_back(i);
-          }
-        }
-        gop_boundaries.push_back(movie.video_track.count());
-
-        uint32_t chunk_index = 0;
-        for (auto it = gop_boundaries.begin(); it != gop_boundaries.end() - 1; ++it ) {
-          auto next = it + 1;
-          uint32_t start_idx = *it;
-          uint32_t end_idx = (*next) - 1;
-          uint64_t start_pts = movie.video_track(start_idx).pts;
-          uint64_t end_pts = movie.video_track(end_idx).pts;
-          auto video_track = movie.video_track.filter_index([start_idx, end_idx](uint32_t index) { return (index >= start_idx && index <= end_idx); });
-          mp4_encoder.reset(new mux::MP4(functional::Video<encode::Sample>(video_track, encode::Sample::Convert)));
-          write_chunk(chunk_index, start_pts, end_pts);
-          ++chunk_index;
+        // chunks are muxed in parallel and written in order
+        if (chunk.count()) {
+          mux::MP4::segments(functional::Audio<encode::Sample>(audio, encode::Sample::Convert), chunk.audio_boundaries(),
+                             functional::Video<encode::Sample>(video, encode::Sample::Convert), chunk.video_boundaries(),
+                             FileFormat::Regular, threads, write_chunk);
         }
-      }
-      if (movie.audio_track.count()) {  // Audio
+      } else if (movie.audio_track.count()) {  // Audio
         mux::MP4 mp4_encoder(functional::Audio<encode::Sample>(movie.audio_track, encode::Sample::Convert), functional::Video<encode::Sample>());
         cout << "audio.m4a (duration: " << (float)movie.audio_track.duration() / movie.audio_track.settings().timescale << "s)" << endl;
         std::stringstream s_dst_chunk; s_dst_chunk << s_dst.str() << "/audio.m4a";
@@ -22,9 +22,11 @@
  * SOFTWARE.
  */
 
+#include <fcntl.h>
 #include <iomanip>
 #include <fstream>
 #include <set>
+#include <unistd.h>
 
 #include "vireo/base_cpp.h"
 #include "vireo/common/math.h"
@@ -54,6 +56,8 @@ struct Config {
   FileFormat file_format = FileFormat::Regular;
   bool video_only = false;
   bool audio_only = false;
+  int segment_duration = 6000;
+  bool hls = false;
   string infile = "";
   string outfile = "";
   FileType outfile_type = UnknownFileType;
@@ -71,6 +75,7 @@ void print_usage(const string name) {
   cout << std::left << std::setw(opt_len) << "-s, -start_gop:"   << std::left << std::setw(desc_len) << "start GOP (when video exists)"      << "(default: " << defaults.start_gop << ")" << endl;
   cout << std::left << std::setw(opt_len) << "-n, -num_gops:"    << std::left << std::setw(desc_len) << "number of GOPs (when video exists)" << "(default: all GOPs)" << endl;
   cout << std::left << std::setw(opt_len) << "-t, -type:"        << std::left << std::setw(desc_len) << file_format_options.str()            << "(default: " << defaults.file_format << ")" << endl;
+  cout << std::left << std::setw(opt_len) << "-segment:"         << std::left << std::setw(desc_len) << "HLS segment duration in ms (when outfile is .m3u8)" << "(default: " << defaults.segment_duration << ")" << endl;
   cout << std::left << std::setw(opt_len) << "--vonly:"          << std::left << std::setw(desc_len) << "remux only video"                   << "(default: " << (defaults.video_only ? "true" : "false") << ")" << endl;
   cout << std::left << std::setw(opt_len) << "--aonly:"          << std::left << std::setw(desc_len) << "remux only audio"                   << "(default: " << (defaults.audio_only ? "true" : "false") << ")" << endl;
 }
@@ -111,6 +116,14 @@ int parse_arguments(int argc, const char* argv[], Config& config) {
       }
       config.file_format = arg_file_format;
       last_arg = i + 1;
+    } else if (strcmp(argv[i], "-segment") == 0) {
+      int arg_segment_duration = atoi(argv[++i]);
+      if (arg_segment_duration <= 0) {
+        cerr << "segment duration must be positive" << endl;
+        return 1;
+      }
+      config.segment_duration = arg_segment_duration;
+      last_arg = i + 1;
     } else if (strcmp(argv[i], "--vonly") == 0) {
       config.video_only = true;
       last_arg = i + 1;
@@ -130,7 +143,7 @@ int parse_arguments(int argc, const char* argv[], Config& config) {
     string ext;
     FileType outfile_type;
   };
-  const vector<ExtFileTypePair> ext_file_types = { {".mp4", MP4}, {".m4a", MP4}, {".m4v", MP4}, {".mov", MP4}, {".ts", MP2TS}, {".webm", WebM} };
+  const vector<ExtFileTypePair> ext_file_types = { {".mp4", MP4}, {".m4a", MP4}, {".m4v", MP4}, {".mov", MP4}, {".ts", MP2TS}, {".m3u8", MP2TS}, {".webm", WebM} };
 
   // Get output file format
   for (auto ext_file_type: ext_file_types) {
@@ -145,6 +158,7 @@ int parse_arguments(int argc, const char* argv[], Config& config) {
     cerr << "Output content type is unknown" << endl;
     return 1;
   }
+  config.hls = common::Path::Extension(config.outfile) == "m3u8";
 
   return 0;
 }
@@ -155,14 +169,20 @@ static inline auto no_data_sample_convert(decode::Sample sample) -> encode::Samp
 };
 
 template <int Type>
-functional::Media<functional::Function<encode::Sample, uint32_t>, encode::Sample, uint32_t, Type> remux(const functional::Media<functional::Function<decode::Sample, uint32_t>, decode::Sample, uint32_t, Type> track, const Config config, const int64_t start_dts, const int64_t end_dts, const bool print_info) {
+functional::Media<functional::Function<decode::Sample, uint32_t>, decode::Sample, uint32_t, Type> select(functional::Media<functional::Function<decode::Sample, uint32_t>, decode::Sample, uint32_t, Type> track, const int64_t start_dts, const int64_t end_dts, const bool print_info) {
   if (print_info) {
     cout << ((Type == SampleType::Video) ? "video" : "audio") << " samples with dts from " << start_dts << " to " << end_dts << endl;
   }
+  return track.filter([start_dts, end_dts](const decode::Sample& sample) { return (sample.dts >= start_dts && sample.dts < end_dts); });
+};
+
+// Samples are selected before they are converted, so that their payloads are only read when muxed
+template <int Type>
+functional::Media<functional::Function<encode::Sample, uint32_t>, encode::Sample, uint32_t, Type> remux(const functional::Media<functional::Function<decode::Sample, uint32_t>, decode::Sample, uint32_t, Type> track, const Config config) {
   if (config.file_format == FileFormat::HeaderOnly) {
-    return functional::Media<functional::Function<encode::Sample, uint32_t>, encode::Sample, uint32_t, Type>(track, no_data_sample_convert).filter([start_dts, end_dts](const encode::Sample& sample) { return (sample.dts >= start_dts && sample.dts < end_dts); });
+    return functional::Media<functional::Function<encode::Sample, uint32_t>, encode::Sample, uint32_t, Type>(track, no_data_sample_convert);
   } else {
-    return functional::Media<functional::Function<encode::Sample, uint32_t>, encode::Sample, uint32_t, Type>(track, encode::Sample::Convert).filter([start_dts, end_dts](const encode::Sample& sample) { return (sample.dts >= start_dts && sample.dts < end_dts); });
+    return functional::Media<functional::Function<encode::Sample, uint32_t>, encode::Sample, uint32_t, Type>(track, encode::Sample::Convert);
   }
 };
 
@@ -237,23 +257,15 @@ int main(int argc, const char* argv[]) {
       auto start_dts_pair = dts_at_gop_boundaries[config.start_gop];
       auto end_dts_pair = dts_at_gop_boundaries[config.start_gop + config.num_gops];
 
-      // Get output video track
-      auto output_video_track = functional::Video<encode::Sample>();
-      if (remux_video) {
-        output_video_track = remux<SampleType::Video>(movie.video_track, config, start_dts_pair.video, end_dts_pair.video, i == 0);
-      }
+      // Select the samples of the output tracks
+      auto video_track = remux_video ? select<SampleType::Video>(movie.video_track, start_dts_pair.video, end_dts_pair.video, i == 0) : functional::Video<decode::Sample>();
+      auto audio_track = remux_audio ? select<SampleType::Audio>(movie.audio_track, start_dts_pair.audio, end_dts_pair.audio, i == 0) : functional::Audio<decode::Sample>();
+      auto caption_track = remux_video ? select<SampleType::Caption>(movie.caption_track, start_dts_pair.video, end_dts_pair.video, i == 0) : functional::Caption<decode::Sample>();
 
-      // Get output audio track
-      auto output_audio_track = functional::Audio<encode::Sample>();
-      if (remux_audio) {
-        output_audio_track = remux<SampleType::Audio>(movie.audio_track, config, start_dts_pair.audio, end_dts_pair.audio, i == 0);
-      }
-
-      // Get output caption track
-      auto output_caption_track = functional::Caption<encode::Sample>();
-      if (remux_video) {
-        output_caption_track = remux<SampleType::Caption>(movie.caption_track, config, start_dts_pair.video, end_dts_pair.video, i == 0);
-      }
+      // Get output tracks
+      auto output_video_track = remux<SampleType::Video>(video_track, config);
+      auto output_audio_track = remux<SampleType::Audio>(audio_track, config);
+      auto output_caption_track = remux<SampleType::Caption>(caption_track, config);
 
       // Add edit boxes only if remuxing input file without any modifications
       vector<common::EditBox> edit_boxes;
@@ -268,19 +280,64 @@ int main(int argc, const char* argv[]) {
 
       // Create muxer
       functional::Function<common::Data32> muxer;
+      std::function<void(void)> stream;  // writes the output file while muxing, when the format allows it
       if (config.outfile_type == MP4) {
-        muxer = mux::MP4(output_audio_track, output_video_track, output_caption_track, edit_boxes, config.file_format);
+        if (config.file_format == FileFormat::Regular && infile_type == MP4) {
+          stream = [&]() {  // samples are copied from their byte ranges in the input file without being read
+            const int input_fd = open(config.infile.c_str(), O_RDONLY);
+            THROW_IF(input_fd < 0, ReaderError, "cannot open " << config.infile);
+            __try {
+              util::save(common::Path::MakeAbsolute(config.outfile), mux::MP4::chain(input_fd, audio_track, video_track, edit_boxes));
+            } __catch (...) {
+              close(input_fd);
+              __throw_exception_again;
+            }
+            close(input_fd);
+          };
+        } else {
+          mux::MP4 mp4(output_audio_track, output_video_track, output_caption_track, edit_boxes, config.file_format);
+          if (config.file_format == FileFormat::Regular) {
+            stream = [mp4, outfile = config.outfile]() mutable {
+              mp4(common::Writer(common::Path::MakeAbsolute(outfile)), true);  // remuxed samples are cheap to read twice
+            };
+          }
+          muxer = mp4;
+        }
       } else if (config.outfile_type == MP2TS) {
-        muxer = mux::MP2TS(output_audio_track, output_video_track, output_caption_track);
+        if (config.hls) {
+          stream = [&]() {  // segments are saved next to the playlist as they are cut
+            const string prefix = common::Path::RemoveExtension(config.outfile);
+            mux::MP2TS mp2ts(output_audio_track, output_video_track, output_caption_track);
+            const string playlist = mp2ts.segments(config.segment_duration, [&prefix](common::Data32&& data, uint32_t index) {
+              util::save(prefix + "_" + std::to_string(index) + ".ts", data);
+            }, [name = common::Path::Filename(prefix)](uint32_t index) {
+              return name + "_" + std::to_string(index) + ".ts";
+            });
+            ofstream ostream(config.outfile.c_str(), ofstream::out);
+            ostream << playlist;
+            ostream.close();
+          };
+        } else {
+          stream = [&]() {  // written a block of TS packets at a time
+            mux::MP2TS mp2ts(output_audio_track, output_video_track, output_caption_track);
+            mp2ts(common::Writer(common::Path::MakeAbsolute(config.outfile)));
+          };
+        }
       } else {
-        muxer = mux::WebM(output_audio_track, output_video_track);
+        mux::WebM webm(output_audio_track, output_video_track);
+        if (config.file_format == FileFormat::Regular) {
+          stream = [webm, outfile = config.outfile]() mutable {
+            webm(common::Writer(common::Path::MakeAbsolute(outfile)));  // written a cluster at a time
+          };
+        }
+        muxer = webm;
       }
 
-      // Save the output file once
-      if (i == 0) {
-        util::save(common::Path::MakeAbsolute(config.outfile), muxer());
+      // Save the output file, the same way on every iteration
+      if (stream) {
+        stream();
       } else {
-        muxer();
+        util::save(common::Path::MakeAbsolute(config.outfile), muxer());
       }
       ++i;
     }, config.iterations) << endl;
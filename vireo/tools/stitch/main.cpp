@@ -28,10 +28,10 @@
 #include "version.h"
 #include "vireo/base_cpp.h"
 #include "vireo/common/path.h"
+#include "vireo/common/writer.h"
 #include "vireo/demux/movie.h"
 #include "vireo/error/error.h"
 #include "vireo/mux/mp4.h"
-#include "vireo/util/util.h"
 #include "vireo/transform/stitch.h"
 #include "vireo/version.h"
 
@@ -135,7 +135,8 @@ int main(int argc, const char* argv[]) {
     mux::MP4 muxer(functional::Audio<encode::Sample>(stitched.audio_track, encode::Sample::Convert),
                    functional::Video<encode::Sample>(stitched.video_track, encode::Sample::Convert),
                    edit_boxes);
-    util::save(vireo::common::Path::MakeAbsolute(argv[argc - 1]), muxer());
+    // faststart in two passes over the inputs, so that memory does not grow with the output, which can exceed 4 GB
+    muxer(common::Writer(vireo::common::Path::MakeAbsolute(argv[argc - 1])), true);
   } __catch (std::exception& e) {
 #if __EXCEPTIONS
     cerr << "Error stitching movie: " << e.what() << endl;
@@ -30,10 +30,9 @@
 #include "vireo/base_cpp.h"
 #include "vireo/common/math.h"
 #include "vireo/common/path.h"
-#include "vireo/decode/video.h"
 #include "vireo/demux/movie.h"
-#include "vireo/encode/jpg.h"
 #include "vireo/error/error.h"
+#include "vireo/transcode/thumbnails.h"
 
 using namespace vireo;
 
@@ -45,7 +44,9 @@ using std::vector;
 int main(int argc, const char* argv[]) {
   if (argc < 5) {
     const string name = common::Path::Filename(argv[0]);
-    cout << "Usage: " << name << " size count input output" << endl;
+    cout << "Usage: " << name << " size count input output [--keyframes] [-threads count]" << endl;
+    cout << "  --keyframes: snap to the nearest key frames, decoding only those" << endl;
+    cout << "  -threads: thumbnails decoded and encoded in parallel (default: 1)" << endl;
     return 1;
   }
   const int size = atoi(argv[1]);
@@ -63,6 +64,24 @@ int main(int argc, const char* argv[]) {
 
   stringstream s_dst;
   s_dst << common::Path::MakeAbsolute(argv[4]);
+
+  transcode::Thumbnails::Seek seek = transcode::Thumbnails::Exact;
+  int threads = 1;
+  for (int i = 5; i < argc; ++i) {
+    if (strcmp(argv[i], "--keyframes") == 0) {
+      seek = transcode::Thumbnails::KeyFrame;
+    } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+      if (threads < 1 || threads > 64) {
+        cout << "Invalid thread count: " << threads << " (minimum 1, maximum 64)" << endl;
+        return 1;
+      }
+    } else {
+      cout << "Invalid argument: " << argv[i] << endl;
+      return 1;
+    }
+  }
+
   if (!common::Path::Exists(s_dst.str())) {
     if (common::Path::CreateFolder(s_dst.str())) {
       cout << "Error creating output folder: " << s_dst.str() << endl;
@@ -73,25 +92,30 @@ int main(int argc, const char* argv[]) {
   __try {
     // Demux file
     vireo::demux::Movie movie(s_src.str());
-    vireo::decode::Video decoder(movie.video_track);
+    THROW_IF(movie.video_track.count() == 0, Invalid);
 
-    // Get indices at which to produce thumbnails
+    // Get timestamps at which to produce thumbnails, evenly spaced in frames
+    vector<int64_t> frame_pts;
+    for (const auto& sample: movie.video_track) {
+      frame_pts.push_back(sample.pts);
+    }
+    sort(frame_pts.begin(), frame_pts.end());
     set<uint32_t> indices;
     for (uint32_t i = 0; i < count; ++i) {
-      indices.insert(common::round_divide(i * (decoder.count() - 1), (uint32_t)1, (uint32_t)count - 1));
+      indices.insert(common::round_divide(i * ((uint32_t)frame_pts.size() - 1), (uint32_t)1, (uint32_t)count - 1));
     }
-    // Stream resized frames to jpg encoder
-    vireo::encode::JPG jpg_encoder(functional::Video<frame::YUV>(decoder.filter_index([&indices](uint32_t index) { return indices.find(index) != indices.end(); }), [size, width=decoder.settings().width](const frame::Frame& frame) -> frame::YUV { return frame.yuv().full_range(true).scale(size, width); }), 95, 0);
-    // Create thumbnails
-    uint32_t index = 0;
-    uint32_t jpg_index = 0;
-    for (auto jpg: jpg_encoder) {
+    vector<int64_t> pts;
+    for (auto index: indices) {
+      pts.push_back(frame_pts[index]);
+    }
+    // Decode, resize and encode in parallel, saving each thumbnail as soon as it is ready
+    transcode::Thumbnails thumbnails(movie.video_track, pts, seek, (uint16_t)size, (uint32_t)threads);
+    thumbnails([&s_dst](uint32_t index, const common::Data32& jpg) {
       stringstream jpg_dst;
-      jpg_dst << s_dst.str() << "/" << jpg_index++ << ".jpg";
+      jpg_dst << s_dst.str() << "/" << index << ".jpg";
       ofstream ostream(common::Path::MakeAbsolute(jpg_dst.str()).c_str(), ofstream::out | ofstream::binary);
       ostream << jpg;
-      ++index;
-    }
+    });
   } __catch (std::exception& e) {
     cerr << "Error reading movie" << endl;
     return 1;
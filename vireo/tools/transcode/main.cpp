@@ -27,25 +27,17 @@
 #include <set>
 
 #include "vireo/base_cpp.h"
-#include "vireo/common/editbox.h"
-#include "vireo/common/math.h"
 #include "vireo/common/path.h"
+#include "vireo/common/writer.h"
 #include "vireo/constants.h"
-#include "vireo/decode/audio.h"
-#include "vireo/decode/video.h"
 #include "vireo/demux/movie.h"
-#include "vireo/encode/aac.h"
 #include "vireo/encode/h264.h"
 #include "vireo/encode/util.h"
-#include "vireo/encode/vorbis.h"
 #include "vireo/encode/vp8.h"
 #include "vireo/error/error.h"
-#include "vireo/mux/mp2ts.h"
-#include "vireo/mux/mp4.h"
-#include "vireo/mux/webm.h"
 #include "vireo/util/util.h"
 #include "vireo/tests/test_common.h"
-#include "vireo/transform/trim.h"
+#include "vireo/transcode/transcoder.h"
 
 using std::ifstream;
 using std::ofstream;
@@ -90,9 +82,15 @@ void print_usage(const string name) {
   cout << std::left << std::setw(opt_len) << "-vbitrate:"         << std::left << std::setw(desc_len) << "max video bitrate" << "(default: 0)" << endl;
   cout << std::left << std::setw(opt_len) << "-vmaxbitrate:"      << std::left << std::setw(desc_len) << "max video max bitrate" << "(default: 0)" << endl;
   cout << std::left << std::setw(opt_len) << "-dthreads:"         << std::left << std::setw(desc_len) << "H.264 decoder thread count" << "(default: 1)" << endl;
-  cout << std::left << std::setw(opt_len) << "-ethreads:"         << std::left << std::setw(desc_len) << "H.264 encoder thread count" << "(default: 1)" << endl;
+  cout << std::left << std::setw(opt_len) << "-ethreads:"         << std::left << std::setw(desc_len) << "H.264 / VP8 encoder thread count" << "(default: 1)" << endl;
+  cout << std::left << std::setw(opt_len) << "-partitions:"       << std::left << std::setw(desc_len) << "VP8 token partitions (log2: 0 to 3)" << "(default: 0)" << endl;
+  cout << std::left << std::setw(opt_len) << "-cpuused:"          << std::left << std::setw(desc_len) << "VP8 speed (-16 to 16, 0: libvpx default)" << "(default: 0)" << endl;
+  cout << std::left << std::setw(opt_len) << "-lag:"              << std::left << std::setw(desc_len) << "VP8 frames of look ahead" << "(default: 0)" << endl;
+  cout << std::left << std::setw(opt_len) << "-chunks:"           << std::left << std::setw(desc_len) << "H.264 chunks split at key frames and encoded in parallel" << "(default: 1)" << endl;
+  cout << std::left << std::setw(opt_len) << "--warm:"            << std::left << std::setw(desc_len) << "keep H.264 encoders opened ahead of the next iteration" << "(default: false)" << endl;
   cout << std::left << std::setw(opt_len) << "--vonly:"           << std::left << std::setw(desc_len) << "transcode only video" << "(default: false)" << endl;
   cout << std::left << std::setw(opt_len) << "-abitrate:"         << std::left << std::setw(desc_len) << "audio bitrate" << audio_bitrate_defaults.str() << endl;
+  cout << std::left << std::setw(opt_len) << "-athreads:"         << std::left << std::setw(desc_len) << "AAC encoder thread count, each encoding its own audio segments" << "(default: 1)" << endl;
   cout << std::left << std::setw(opt_len) << "--aonly:"           << std::left << std::setw(desc_len) << "transcode only audio" << "(default: false)" << endl;
   cout << std::left << std::setw(opt_len) << "-bframes:"          << std::left << std::setw(desc_len) << "H.264 number of b frames" << "(default: 0)" << endl;
   cout << std::left << std::setw(opt_len) << "--dashdata:"        << std::left << std::setw(desc_len) << "transcode dash data" << "(default: false)" << endl;
@@ -108,11 +106,15 @@ void print_usage(const string name) {
   cout << std::left << std::setw(opt_len) << "-qp_min:"           << std::left << std::setw(desc_len) << "minimum quantizer" << "(default: 0)" << endl;
   cout << std::left << std::setw(opt_len) << "-keyint_max:"       << std::left << std::setw(desc_len) << "maximum interval between IDR-frames" << "(default: 1<<30)" << endl;
   cout << std::left << std::setw(opt_len) << "-keyint_min:"       << std::left << std::setw(desc_len) << "minimum interval between IDR-frames" << "(default: 0)" << endl;
+  cout << std::left << std::setw(opt_len) << "-two_pass:"         << std::left << std::setw(desc_len) << "dual-pass encoding in a single run, first pass downscaled by the given factor (ABR / CBR)" << "(default: off)" << endl;
   cout << std::left << std::setw(opt_len) << "-stats_log_path:"   << std::left << std::setw(desc_len) << "input/output path for stats file" << "(default: \"\")" << endl;
   cout << std::left << std::setw(opt_len) << "--rc_b_mb_tree:"    << std::left << std::setw(desc_len) << "enable macroblock tree rate control" << "(default: 0)" << endl;
   cout << std::left << std::setw(opt_len) << "-pyramid_mode:"     << std::left << std::setw(desc_len) << "allow the use of B-frames as references for other frames" << "(none: 0, strcit: 1, normal: 2, default: 0)" << endl;
   cout << std::left << std::setw(opt_len) << "-me_method:"        << std::left << std::setw(desc_len) << "motion estimation method" << "(DIA: 0, HEX: 1, UMH: 2, ESA: 3, TESA: 4, default: 1)" << endl;
   cout << std::left << std::setw(opt_len) << "-subpel_refine:"    << std::left << std::setw(desc_len) << "subpixel motion estimation quality" << "(default: 4)" << endl;
+  cout << std::left << std::setw(opt_len) << "--stats:"           << std::left << std::setw(desc_len) << "print per-stage pipeline statistics" << "(default: false)" << endl;
+  cout << std::left << std::setw(opt_len) << "--stream:"          << std::left << std::setw(desc_len) << "write the mp4 / webm while transcoding, for outputs above 4 GB" << "(default: false)" << endl;
+  cout << std::left << std::setw(opt_len) << "-ladder:"           << std::left << std::setw(desc_len) << "decode once and encode renditions height:crf,... to outfile_<height>p (H.264 only)" << "(default: none)" << endl;
 }
 
 
@@ -131,8 +133,14 @@ struct Config {
   float buffer_init = 0;
   int decoder_threads = 1;
   int encoder_threads = 1;
+  int chunks = 1;
+  int token_partitions = 0;
+  int cpu_used = 0;
+  int lag_in_frames = 0;
+  bool warm = false;
   bool video_only = false;
   int audio_bitrate = kDefaultAudioBitrateInKb * 1024;
+  int audio_threads = 1;
   bool audio_only = false;
   int bframes = 0;
   encode::PyramidMode pyramid_mode = encode::PyramidMode::Normal;
@@ -156,11 +164,38 @@ struct Config {
   uint32_t keyint_min = encode::kDefaultH264KeyintMin;
   bool rc_b_mb_tree = false;
   string stats_log_path = "";
+  uint32_t two_pass_downscale = 0;  // 0: single pass
   int fps = -1;
   encode::MotionEstimationMethod me_method = encode::MotionEstimationMethod::Hexagon;
   uint32_t subpel_refine = 4;
+  bool print_stats = false;
+  bool stream = false;
+  vector<pair<uint16_t, float>> ladder;  // height and crf of each rendition
 };
 
+int parse_ladder(const string& arg, Config& config) {
+  stringstream renditions(arg);
+  string rendition;
+  while (std::getline(renditions, rendition, ',')) {
+    int height = 0;
+    float crf = 0.0f;
+    if (sscanf(rendition.c_str(), "%d:%f", &height, &crf) != 2 || height < 0 || height > 4096) {
+      cerr << "ladder renditions must be height:crf with a height between 0 and 4096" << endl;
+      return 1;
+    }
+    if (crf < encode::kH264MinCRF || crf > encode::kH264MaxCRF) {
+      cerr << "crf has to be between " << encode::kH264MinCRF << " - " << encode::kH264MaxCRF << endl;
+      return 1;
+    }
+    config.ladder.push_back(make_pair((uint16_t)height, crf));
+  }
+  if (config.ladder.empty()) {
+    cerr << "ladder needs at least one rendition" << endl;
+    return 1;
+  }
+  return 0;
+}
+
 int parse_arguments(int argc, const char* argv[], Config& config) {
   int last_arg = 1;
   for (int i = 1; i < argc; ++i) {
@@ -255,6 +290,41 @@ int parse_arguments(int argc, const char* argv[], Config& config) {
       }
       config.encoder_threads = (int)arg_encoder_threads;
       last_arg = i + 1;
+    } else if (strcmp(argv[i], "-partitions") == 0) {
+      int arg_token_partitions = atoi(argv[++i]);
+      if (arg_token_partitions < 0 || arg_token_partitions > encode::kVP8MaxTokenPartitions) {
+        cerr << "token partitions have to be between 0 - " << encode::kVP8MaxTokenPartitions << endl;
+        return 1;
+      }
+      config.token_partitions = arg_token_partitions;
+      last_arg = i + 1;
+    } else if (strcmp(argv[i], "-cpuused") == 0) {
+      int arg_cpu_used = atoi(argv[++i]);
+      if (arg_cpu_used < encode::kVP8MinCpuUsed || arg_cpu_used > encode::kVP8MaxCpuUsed) {
+        cerr << "cpu used has to be between " << encode::kVP8MinCpuUsed << " - " << encode::kVP8MaxCpuUsed << endl;
+        return 1;
+      }
+      config.cpu_used = arg_cpu_used;
+      last_arg = i + 1;
+    } else if (strcmp(argv[i], "-lag") == 0) {
+      int arg_lag_in_frames = atoi(argv[++i]);
+      if (arg_lag_in_frames < 0 || arg_lag_in_frames > encode::kVP8MaxLagInFrames) {
+        cerr << "lag has to be between 0 - " << encode::kVP8MaxLagInFrames << endl;
+        return 1;
+      }
+      config.lag_in_frames = arg_lag_in_frames;
+      last_arg = i + 1;
+    } else if (strcmp(argv[i], "-chunks") == 0) {
+      int arg_chunks = atoi(argv[++i]);
+      if (arg_chunks < 1 || arg_chunks > kMaxThreads) {
+        cerr << "chunk count has to be between 1 and " << kMaxThreads << endl;
+        return 1;
+      }
+      config.chunks = arg_chunks;
+      last_arg = i + 1;
+    } else if (strcmp(argv[i], "--warm") == 0) {
+      config.warm = true;
+      last_arg = i + 1;
     } else if (strcmp(argv[i], "--vonly") == 0) {
       config.video_only = true;
       last_arg = i + 1;
@@ -266,6 +336,14 @@ int parse_arguments(int argc, const char* argv[], Config& config) {
       }
       config.audio_bitrate = (int)arg_audio_bitrate;
       last_arg = i + 1;
+    } else if (strcmp(argv[i], "-athreads") == 0) {
+      int arg_audio_threads = atoi(argv[++i]);
+      if (arg_audio_threads < 1 || arg_audio_threads > kMaxThreads) {
+        cerr << "audio thread count has to be between 1 and " << kMaxThreads << endl;
+        return 1;
+      }
+      config.audio_threads = arg_audio_threads;
+      last_arg = i + 1;
     } else if (strcmp(argv[i], "--aonly") == 0) {
       config.audio_only = true;
       last_arg = i + 1;
@@ -326,6 +404,14 @@ int parse_arguments(int argc, const char* argv[], Config& config) {
     } else if (strcmp(argv[i], "--rc_b_mb_tree") == 0) {
       config.rc_b_mb_tree = (bool)atoi(argv[++i]);
       last_arg = i + 1;
+    } else if (strcmp(argv[i], "-two_pass") == 0) {
+      int arg_downscale = atoi(argv[++i]);
+      if (arg_downscale < 1 || arg_downscale > 8) {
+        cerr << "first pass downscale factor has to be between 1 and 8" << endl;
+        return 1;
+      }
+      config.two_pass_downscale = arg_downscale;
+      last_arg = i + 1;
     } else if (strcmp(argv[i], "-stats_log_path") == 0) {
       config.stats_log_path = argv[++i];
       last_arg = i + 1;
@@ -341,6 +427,17 @@ int parse_arguments(int argc, const char* argv[], Config& config) {
     } else if (strcmp(argv[i], "-subpel_refine") == 0) {
       config.subpel_refine = atoi(argv[++i]);
       last_arg = i + 1;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      config.print_stats = true;
+      last_arg = i + 1;
+    } else if (strcmp(argv[i], "--stream") == 0) {
+      config.stream = true;
+      last_arg = i + 1;
+    } else if (strcmp(argv[i], "-ladder") == 0) {
+      if (parse_ladder(argv[++i], config)) {
+        return 1;
+      }
+      last_arg = i + 1;
     }
   }
   if (last_arg + 1 >= argc) {
@@ -367,6 +464,18 @@ int parse_arguments(int argc, const char* argv[], Config& config) {
     cerr << "Output content type is unknown" << endl;
     return 1;
   }
+  if (!config.ladder.empty() && config.outfile_type != MP4 && config.outfile_type != MP2TS) {
+    cerr << "ladder is only supported for H.264 outputs" << endl;
+    return 1;
+  }
+  if (config.stream && ((config.outfile_type != MP4 && config.outfile_type != WebM) || config.dash_data || config.dash_init || config.samples_only || !config.ladder.empty())) {
+    cerr << "stream is only supported for regular mp4 and webm outputs" << endl;
+    return 1;
+  }
+  if (config.chunks > 1 && config.bframes != 0) {
+    cerr << "chunks are only supported without b frames" << endl;
+    return 1;
+  }
 
   auto max_optimization = (config.outfile_type == MP4 || config.outfile_type == MP2TS) ? encode::kH264MaxOptimization : encode::kVP8MaxOptimization;
   auto default_optimization = (config.outfile_type == MP4 || config.outfile_type == MP2TS) ? kH264DefaultOptimization : kVP8DefaultOptimization;
@@ -380,186 +489,124 @@ int parse_arguments(int argc, const char* argv[], Config& config) {
   return 0;
 }
 
-struct FirstPtsAndTimescale {
-  int64_t first_pts = -1;
-  uint32_t timescale = 0;
-};
-
-bool include_pts(const uint64_t pts,
-                 const uint32_t timescale,
-                 const vector<common::EditBox>& edit_boxes,
-                 const uint32_t start,
-                 const uint32_t duration,
-                 FirstPtsAndTimescale& first_pts_and_timescale) {
-  auto new_pts = common::EditBox::RealPts(edit_boxes, pts);
-  auto time = 1000.0f * new_pts / timescale;
-  if (new_pts >= 0 && time >= start && time < (start + duration)) {
-    auto first_pts = first_pts_and_timescale.first_pts;
-    if (first_pts == -1) {
-      first_pts_and_timescale.first_pts = new_pts;
-      first_pts_and_timescale.timescale = timescale;
+transcode::Params transcode_params(const Config& config, bool transcode_video, bool transcode_audio) {
+  transcode::Params params;
+  params.file_type = config.outfile_type;
+  if (config.outfile_type == MP4) {
+    if (config.dash_data) {
+      params.file_format = FileFormat::DashData;
+    } else if (config.dash_init) {
+      params.file_format = FileFormat::DashInitializer;
+    } else if (config.samples_only) {
+      params.file_format = FileFormat::SamplesOnly;
     }
-    int64_t scaled_first_pts = first_pts_and_timescale.first_pts * timescale / first_pts_and_timescale.timescale;
-    return ((int64_t)new_pts - scaled_first_pts) >= 0;
   }
-  return false;
-};
-
-struct Resolution {
-  const uint16_t width;
-  const uint16_t height;
-};
-
-Resolution out_resolution(uint16_t in_width, uint16_t in_height, settings::Video::Orientation in_orientation, uint16_t out_height, bool square) {
-  const uint16_t min_dim = min(in_width, in_height);
-  uint16_t w = (out_height == 0) ? in_width : common::round_divide((uint32_t)in_width, (uint32_t)out_height, (uint32_t)min_dim);
-  uint16_t h = (out_height == 0) ? in_height : common::round_divide((uint32_t)in_height, (uint32_t)out_height, (uint32_t)min_dim);
-  if (square) {
-    w = min(w, h);
-    h = w;
+  params.start_ms = config.start;
+  params.duration_ms = config.duration;
+  params.video = transcode_video;
+  params.audio = transcode_audio;
+  params.height = config.height;
+  params.square = config.square;
+  params.fps = (config.fps == -1) ? 0.0f : config.fps;
+  params.decoder_threads = config.decoder_threads;
+  if (config.outfile_type == MP4 || config.outfile_type == MP2TS) {
+    params.h264_computation = encode::H264Params::ComputationalParams(config.optimization, config.encoder_threads);
+    params.h264_rc = encode::H264Params::RateControlParams(config.rc_method, config.crf, config.max_video_bitrate, config.video_bitrate, config.buffer_size, config.buffer_init, config.rc_look_ahead, config.is_second_pass, config.rc_b_mb_tree, config.aq_mode, config.qp_min, config.stats_log_path, config.mixed_refs, config.trellis, config.me_method, config.subpel_refine, config.two_pass_downscale != 0, max(config.two_pass_downscale, (uint32_t)1));
+    params.h264_gop = encode::H264Params::GopParams(config.bframes, config.pyramid_mode, config.keyint_max, config.keyint_min, config.frame_references);
+    params.h264_profile = config.vprofile;
+    params.h264_chunks = config.chunks;
+    if (config.warm) {
+      params.h264_pool = make_shared<encode::H264Pool>();
+    }
+  } else {
+    params.vp8_quantizer = config.quantizer;
+    params.vp8_optimization = config.optimization;
+    params.vp8_max_bitrate = config.max_video_bitrate;
+    params.vp8_computation = encode::VP8Params::ComputationalParams(config.encoder_threads, config.token_partitions, config.cpu_used, config.lag_in_frames);
   }
-  if (in_orientation % 2) {
-    uint16_t tmp = w;
-    w = h;
-    h = tmp;
+  params.audio_bitrate = config.audio_bitrate;
+  params.aac_threads = config.audio_threads;
+  return params;
+}
+
+vector<transcode::Rendition> ladder_renditions(const Config& config, const transcode::Params& params) {
+  vector<transcode::Rendition> renditions;
+  for (const auto& height_crf: config.ladder) {
+    transcode::Rendition rendition;
+    rendition.file_type = params.file_type;
+    rendition.height = height_crf.first;
+    rendition.square = params.square;
+    rendition.h264_computation = params.h264_computation;
+    rendition.h264_rc = params.h264_rc;
+    rendition.h264_rc.crf = height_crf.second;
+    rendition.h264_profile = params.h264_profile;
+    renditions.push_back(rendition);
   }
-  return { w, h };
-};
+  return renditions;
+}
 
-functional::Video<encode::Sample> transcode(const functional::Video<decode::Sample> track,
-                                            const float fps,
-                                            const vector<common::EditBox> &edit_boxes,
-                                            const Config config,
-                                            FirstPtsAndTimescale &first_pts_and_timescale,
-                                            const bool print_info) {
-  settings::Video video_settings = track.settings();
-  THROW_IF(video_settings.codec != settings::Video::Codec::H264, Unsupported);
-
-  const uint16_t in_width = video_settings.width;
-  const uint16_t in_height = video_settings.height;
-  const settings::Video::Orientation in_orientation = video_settings.orientation;
-  auto resolution = out_resolution(in_width, in_height, in_orientation, config.height, config.square);
-  const uint16_t out_width = resolution.width;
-  const uint16_t out_height = resolution.height;
-
-  if (print_info) {
-    cout << "Video resolution " << out_width << "x" << out_height;
-    if (out_width != in_width || out_height != in_height) {
-      cout << ", resized from " << in_width << "x" << in_height;
-    }
-    cout << endl << "video framerate = " << fps << "fps";
-    cout << endl << "Optimization = " << config.optimization;
-    if (config.outfile_type == MP4 || config.outfile_type == MP2TS) {
-      if (config.rc_method == vireo::encode::RCMethod::CRF) {
-        cout << ", CRF = " << config.crf  << ", number of b-frames = " << config.bframes;
-      } else {
-        cout << ", bitrate = " << config.video_bitrate;
-      }
-    } else {
-      cout << ", Quantizer = " << config.quantizer;
-    }
+string ladder_outfile(const Config& config, uint16_t height) {
+  stringstream outfile;
+  outfile << common::Path::RemoveExtension(config.outfile) << "_" << height << "p" << common::Path::Extension(config.outfile);
+  return outfile.str();
+}
 
-    if (config.max_video_bitrate) {
-      cout << ", max bitrate = " << config.max_video_bitrate;
-    }
-    cout << endl << "Threads = " << config.decoder_threads << " (decoder)";
-    if (config.outfile_type == MP4 || config.outfile_type == MP2TS) {
-      cout << ", " << config.encoder_threads;
-    } else {
-      cout << ", 1";
-    }
-    cout << " (encoder)" << endl;
-    cout << "Video Profile = " << vireo::encode::kVideoProfileTypeToString[config.vprofile] << endl;
-    cout << "Output type = " << kFileTypeToString[config.outfile_type];
-    if (config.dash_init) {
-      cout << ", dash_init" << endl;
-    } else if (config.dash_data) {
-      cout << ", dash_data" << endl;
+void print_video_info(const demux::Movie& movie, const transcode::Transcoder& transcoder, const Config& config) {
+  const settings::Video in_settings = movie.video_track.settings();
+  const settings::Video out_settings = transcoder.video_track().settings();
+  cout << "Video resolution " << out_settings.width << "x" << out_settings.height;
+  if (out_settings.width != in_settings.width || out_settings.height != in_settings.height) {
+    cout << ", resized from " << in_settings.width << "x" << in_settings.height;
+  }
+  cout << endl << "video framerate = " << ((config.fps == -1) ? movie.video_track.fps() : config.fps) << "fps";
+  cout << endl << "Optimization = " << config.optimization;
+  if (config.outfile_type == MP4 || config.outfile_type == MP2TS) {
+    if (config.rc_method == vireo::encode::RCMethod::CRF) {
+      cout << ", CRF = " << config.crf  << ", number of b-frames = " << config.bframes;
     } else {
-      cout << endl;
+      cout << ", bitrate = " << config.video_bitrate;
     }
+  } else {
+    cout << ", Quantizer = " << config.quantizer;
   }
 
-  auto crop_scale_rotate = [](frame::Frame frame, uint16_t in_width, uint16_t in_height, settings::Video::Orientation orientation, uint16_t out_width, uint16_t out_height) -> frame::Frame {
-    return (frame::Frame){ frame.pts, [in_width, in_height, orientation, out_width, out_height, yuv_func = frame.yuv]() {
-      // crop - if necessary
-      const bool square = (out_width == out_height);
-      const uint16_t min_dim = min(in_width, in_height);
-      const uint16_t crop_x_offset = square ? (in_width - min_dim) / 2 : 0;
-      const uint16_t crop_y_offset = square ? (in_height - min_dim) / 2 : 0;
-      auto yuv_cropped_func = (crop_x_offset == 0 && crop_y_offset == 0) ? yuv_func : [crop_x_offset, crop_y_offset, min_dim, &yuv_func](){
-        return yuv_func().crop(crop_x_offset, crop_y_offset, min_dim, min_dim);
-      };
-      const uint16_t cropped_width = in_width - 2 * crop_x_offset;
-      const uint16_t cropped_height = in_height - 2 * crop_y_offset;
-      // scale - if necessary
-      const bool is_portrait = orientation % 2;
-      const uint16_t real_height = is_portrait ? cropped_width : cropped_height;
-      auto yuv_scaled_func = (real_height == out_height) ? yuv_cropped_func : [real_height, out_height, &yuv_cropped_func](){
-        return yuv_cropped_func().scale(out_height, real_height);
-      };
-      // rotate - if necessary
-      auto yuv_rotated_func = (orientation == settings::Video::Landscape) ? yuv_scaled_func : [orientation, &yuv_scaled_func](){
-        return yuv_scaled_func().rotate((frame::Rotation)orientation);
-      };
-      return yuv_rotated_func();
-    }};
-  };
-
-  auto decoder = decode::Video(track, config.decoder_threads).filter(
-    [&edit_boxes, timescale = video_settings.timescale, start = config.start, duration = config.duration, &first_pts_and_timescale](const frame::Frame& frame) {
-      return include_pts(frame.pts, timescale, edit_boxes, start, duration, first_pts_and_timescale);
-    }
-  ).transform<frame::Frame>(
-    [&edit_boxes, timescale = video_settings.timescale, &first_pts_and_timescale, &crop_scale_rotate, in_width, in_height, in_orientation, out_width, out_height](const frame::Frame& frame) {
-      int64_t first_pts = first_pts_and_timescale.first_pts;
-      CHECK(first_pts >= 0);
-      int64_t scaled_first_pts = first_pts * timescale / first_pts_and_timescale.timescale;
-      return crop_scale_rotate(frame.adjust_pts(edit_boxes).shift_pts(-scaled_first_pts), in_width, in_height, in_orientation, out_width, out_height);
-    }
-  );
-
-  auto output_video_settings = settings::Settings<SampleType::Video>(decoder.settings().codec, out_width, out_height, video_settings.timescale, settings::Video::Landscape, decoder.settings().sps_pps);
-
-  if (config.outfile_type == MP4 || config.outfile_type == MP2TS) {
-    auto computation = encode::H264Params::ComputationalParams(config.optimization, config.encoder_threads);
-    auto rc = encode::H264Params::RateControlParams(config.rc_method, config.crf, config.max_video_bitrate, config.video_bitrate, config.buffer_size, config.buffer_init, config.rc_look_ahead, config.is_second_pass, config.rc_b_mb_tree, config.aq_mode, config.qp_min, config.stats_log_path, config.mixed_refs, config.trellis, config.me_method, config.subpel_refine);
-    auto gop = encode::H264Params::GopParams(config.bframes, config.pyramid_mode, config.keyint_max, config.keyint_min, config.frame_references);
-    encode::H264Params params(computation, rc, gop, config.vprofile, fps);
-    return encode::H264(functional::Video<frame::Frame>(decoder, output_video_settings), params);
+  if (config.max_video_bitrate) {
+    cout << ", max bitrate = " << config.max_video_bitrate;
+  }
+  cout << endl << "Threads = " << config.decoder_threads << " (decoder)";
+  cout << ", " << config.encoder_threads << " (encoder)" << endl;
+  cout << "Video Profile = " << vireo::encode::kVideoProfileTypeToString[config.vprofile] << endl;
+  cout << "Output type = " << kFileTypeToString[config.outfile_type];
+  if (config.dash_init) {
+    cout << ", dash_init" << endl;
+  } else if (config.dash_data) {
+    cout << ", dash_data" << endl;
   } else {
-    return encode::VP8(functional::Video<frame::Frame>(decoder, output_video_settings), config.quantizer, config.optimization, fps, config.max_video_bitrate);
+    cout << endl;
   }
-};
+}
 
-functional::Audio<encode::Sample> transcode(const functional::Audio<decode::Sample> track,
-                                            const vector<common::EditBox> &edit_boxes,
-                                            const Config config,
-                                            FirstPtsAndTimescale &first_pts_and_timescale,
-                                            const bool print_info) {
-  settings::Audio audio_settings = track.settings();
+void print_audio_info(const demux::Movie& movie, const Config& config) {
+  cout << "Audio channels = " << (int)movie.audio_track.settings().channels << ", bitrate = " << (config.audio_bitrate / 1024.0f) << " Kbps" << endl;
+}
 
-  if (print_info) {
-    cout << "Audio channels = " << (int)audio_settings.channels << ", bitrate = " << (config.audio_bitrate / 1024.0f) << " Kbps" << endl;
+void print_ladder_info(const transcode::Ladder& ladder, const Config& config) {
+  for (uint32_t i = 0; i < ladder.count(); ++i) {
+    const settings::Video out_settings = ladder.video_track(i).settings();
+    cout << "Rendition " << i << ": " << out_settings.width << "x" << out_settings.height << ", CRF = " << config.ladder[i].second;
+    cout << " -> " << ladder_outfile(config, config.ladder[i].first) << endl;
   }
+}
 
-  auto decoder = decode::Audio(track).filter(
-    [&edit_boxes, timescale = audio_settings.timescale, start = config.start, duration = config.duration, &first_pts_and_timescale](const sound::Sound& sound) {
-      return include_pts(sound.pts, timescale, edit_boxes, start, duration, first_pts_and_timescale);
-    }
-  ).transform<sound::Sound>(
-    [&edit_boxes, timescale = audio_settings.timescale, first_pts_and_timescale](const sound::Sound& sound) {
-      int64_t first_pts = first_pts_and_timescale.first_pts;
-      CHECK(first_pts >= 0);
-      int64_t scaled_first_pts = first_pts * timescale / first_pts_and_timescale.timescale;
-      return sound.adjust_pts(edit_boxes).shift_pts(-scaled_first_pts);
+void print_stats(const vector<transcode::Stats>& stats, bool ladder) {
+  const char* kStageToString[] = { "demux", "decode", "filter", "encode", "mux" };
+  for (const auto& stage: stats) {
+    const char* lane = stage.type == SampleType::Video ? "video " : (stage.type == SampleType::Audio ? "audio " : "");
+    if (ladder && stage.rendition >= 0) {
+      cout << "rendition " << stage.rendition << " ";
     }
-  );
-
-  if (config.outfile_type == MP4 || config.outfile_type == MP2TS) {
-    return encode::AAC(decoder, audio_settings.channels, config.audio_bitrate);
-  } else {
-    return encode::Vorbis(decoder, audio_settings.channels, config.audio_bitrate);
+    cout << lane << kStageToString[stage.stage] << ": " << stage.count << " values, " << stage.busy_us / 1000 << " ms busy, ";
+    cout << stage.wait_us / 1000 << " ms waited on by the next stage" << endl;
   }
 }
 
@@ -623,55 +670,53 @@ int main(int argc, const char* argv[]) {
     cout << "Transcoding " << (transcode_video ? (transcode_audio ? "video with audio" : "video") : "audio");
     cout << " of duration " << config.duration << " ms, starting from " << config.start << " ms" << endl;
 
+    const transcode::Params params = transcode_params(config, transcode_video, transcode_audio);
     uint32_t i = 0;
+    if (!config.ladder.empty()) {
+      cout << Profile::Function("Transcoding", [&]{
+        // Setup a single demux -> decode pipeline feeding a filter -> encode -> mux branch per rendition
+        transcode::Ladder ladder(movie, params, ladder_renditions(config, params));
+        if (i == 0 && transcode_video) {
+          print_ladder_info(ladder, config);
+        }
+        auto outputs = ladder();
+        if (i == 0) {
+          for (uint32_t j = 0; j < outputs.size(); ++j) {
+            util::save(ladder_outfile(config, config.ladder[j].first), outputs[j]);
+          }
+          if (config.print_stats) {
+            print_stats(ladder.stats(), true);
+          }
+        }
+        ++i;
+      }, config.iterations) << endl;
+      return 0;
+    }
     cout << Profile::Function("Transcoding", [&]{
-      // Keep track of the first pts of the encoded tracks (could be either audio or video)
-      FirstPtsAndTimescale first_pts_and_timescale;
-
-      // Get output video track
-      auto output_video_track = functional::Video<encode::Sample>();
-      auto fps = (config.fps == -1) ? movie.video_track.fps() : config.fps;
-      if (transcode_video) {
-        output_video_track = transcode(movie.video_track, fps, movie.video_track.edit_boxes(), config, first_pts_and_timescale, i == 0);
-      }
-
-      // Get output audio track
-      auto output_audio_track = functional::Audio<encode::Sample>();
-      if (transcode_audio) {
-        output_audio_track = transcode(movie.audio_track, movie.audio_track.edit_boxes(), config, first_pts_and_timescale, i == 0);
-      }
-
-      // Get output caption track
-      auto output_caption_track = functional::Caption<encode::Sample>();
-      if (transcode_video) {
-        auto trimmed_caption = transform::Trim<SampleType::Caption>(movie.caption_track, movie.caption_track.edit_boxes(), config.start, config.duration);
-        output_caption_track = functional::Caption<encode::Sample>(trimmed_caption.track, encode::Sample::Convert);
-      }
-
-      // Create necessary encoder
-      functional::Function<common::Data32> encoder;
-      if (config.outfile_type == MP4) {
-        FileFormat format = FileFormat::Regular;
-        if (config.dash_data) {
-          format = FileFormat::DashData;
-        } else if (config.dash_init) {
-          format = FileFormat::DashInitializer;
-        } else if (config.samples_only) {
-          format = FileFormat::SamplesOnly;
+      // Setup the demux -> decode -> filter -> encode -> mux pipeline
+      transcode::Transcoder transcoder(movie, params);
+      if (i == 0) {
+        if (transcode_video) {
+          print_video_info(movie, transcoder, config);
+        }
+        if (transcode_audio) {
+          print_audio_info(movie, config);
         }
-        encoder = mux::MP4(output_audio_track, output_video_track, output_caption_track, format);
-      } else if (config.outfile_type == MP2TS) {
-        encoder = mux::MP2TS(output_audio_track, output_video_track, output_caption_track);
-      } else {
-        encoder = mux::WebM(output_audio_track, output_video_track);
       }
 
       // Start encoding and save the output file once
       const string abs_dst = common::Path::MakeAbsolute(config.outfile);
       if (i == 0) {
-        util::save(abs_dst, encoder());
+        if (config.stream) {
+          transcoder(common::Writer(abs_dst));
+        } else {
+          util::save(abs_dst, transcoder());
+        }
+        if (config.print_stats) {
+          print_stats(transcoder.stats(), false);
+        }
       } else {
-        encoder();
+        transcoder();
       }
       ++i;
     }, config.iterations) << endl;
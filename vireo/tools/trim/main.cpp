@@ -22,14 +22,20 @@
  * SOFTWARE.
  */
 
+#include <fcntl.h>
 #include <fstream>
+#include <unistd.h>
 #include <vector>
 
 #include "vireo/base_cpp.h"
 #include "vireo/common/path.h"
+#include "vireo/config.h"
 #include "vireo/demux/movie.h"
 #include "vireo/error/error.h"
 #include "vireo/mux/mp4.h"
+#ifdef HAVE_LIBAVCODEC
+#include "vireo/transcode/smart_trim.h"
+#endif
 #include "vireo/transform/trim.h"
 #include "vireo/util/util.h"
 
@@ -40,21 +46,41 @@ using std::ofstream;
 using std::vector;
 
 int main(int argc, const char* argv[]) {
-  if (argc < 5) {
+  const bool smart = argc > 1 && strcmp(argv[1], "--smart") == 0;
+  if (argc < 5 + smart) {
     const string name = common::Path::Filename(argv[0]);
-    cout << "Usage: " << name << " start_in_ms duration_in_ms input output" << endl;
+    cout << "Usage: " << name << " [--smart] start_in_ms duration_in_ms input output" << endl;
+    cout << "  --smart: frame accurate, re-encodes the video GOPs cut at start and end and copies the others" << endl;
     return 1;
   }
-  uint64_t start_ms = atoi(argv[1]);
-  uint64_t duration_ms = atoi(argv[2]);
-  string input = vireo::common::Path::MakeAbsolute(argv[3]);
-  string output = vireo::common::Path::MakeAbsolute(argv[4]);
+  uint64_t start_ms = atoi(argv[1 + smart]);
+  uint64_t duration_ms = atoi(argv[2 + smart]);
+  string input = vireo::common::Path::MakeAbsolute(argv[3 + smart]);
+  string output = vireo::common::Path::MakeAbsolute(argv[4 + smart]);
   __try {
     THROW_IF(duration_ms == 0, InvalidArguments);
 
     // Demux movie
     demux::Movie demuxer(input);
 
+#ifdef HAVE_LIBAVCODEC
+    if (smart) {
+      // Trim video track, re-encoding only the GOPs cut by the trim boundaries
+      auto smart_video = transcode::SmartTrim(demuxer.video_track, demuxer.video_track.edit_boxes(), start_ms, duration_ms);
+      auto trimmed_audio = transform::Trim<SampleType::Audio>(demuxer.audio_track, demuxer.audio_track.edit_boxes(), start_ms, duration_ms);
+      auto audio_track = functional::Audio<encode::Sample>(trimmed_audio.track, encode::Sample::Convert);
+      vector<common::EditBox> edit_boxes;
+      edit_boxes.insert(edit_boxes.end(), smart_video.track.edit_boxes().begin(), smart_video.track.edit_boxes().end());
+      edit_boxes.insert(edit_boxes.end(), trimmed_audio.track.edit_boxes().begin(), trimmed_audio.track.edit_boxes().end());
+      mux::MP4 mp4_encoder(audio_track, functional::Video<encode::Sample>(smart_video.track), edit_boxes);
+      util::save(output, mp4_encoder.chain());
+      cout << smart_video.reencoded() << " of " << smart_video.track.count() << " video frames re-encoded" << endl;
+      return 0;
+    }
+#else
+    THROW_IF(smart, MissingDependency);
+#endif
+
     // Trim video track
     auto trimmed_video = transform::Trim<SampleType::Video>(demuxer.video_track, demuxer.video_track.edit_boxes(), start_ms, duration_ms);
 
@@ -74,11 +100,16 @@ int main(int argc, const char* argv[]) {
     edit_boxes.insert(edit_boxes.end(), trimmed_video.track.edit_boxes().begin(), trimmed_video.track.edit_boxes().end());
     edit_boxes.insert(edit_boxes.end(), trimmed_audio.track.edit_boxes().begin(), trimmed_audio.track.edit_boxes().end());
 
-    // Prepare encoder
-    mux::MP4 mp4_encoder(audio_track, video_track, caption_track, edit_boxes);
-
-    // Mux
-    util::save(output, mp4_encoder());
+    // Mux: samples of an mp4 input are copied from their byte ranges without being read
+    if (demuxer.file_type() == FileType::MP4) {
+      const int input_fd = open(input.c_str(), O_RDONLY);
+      THROW_IF(input_fd < 0, ReaderError, "cannot open " << input);
+      util::save(output, mux::MP4::chain(input_fd, trimmed_audio.track, trimmed_video.track, edit_boxes));
+      close(input_fd);
+    } else {
+      mux::MP4 mp4_encoder(audio_track, video_track, caption_track, edit_boxes);
+      util::save(output, mp4_encoder.chain());
+    }
   } __catch (std::exception& e) {
 #if __EXCEPTIONS
     cerr << "Error trimming movie: " << e.what() << endl;
@@ -151,7 +151,7 @@ int main(int argc, const char* argv[]) {
     auto video_track = functional::Video<encode::Sample>(functional::Video<decode::Sample>(video_samples, video_settings), encode::Sample::Convert);
     mux::MP4 mp4_encoder(audio_track, video_track, edit_boxes);
     const string abs_dst = vireo::common::Path::MakeAbsolute(argv[first_chunk_arg + num_chunks]);
-    util::save(abs_dst, mp4_encoder());
+    util::save(abs_dst, mp4_encoder.chain());
   } __catch (std::exception& e) {
     cerr << "Error unchunking: " << e.what() << endl;
     return 1;
@@ -0,0 +1,243 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include "vireo/base_cpp.h"
+#include "vireo/common/math.h"
+#include "vireo/common/security.h"
+#include "vireo/config.h"
+#include "vireo/decode/video.h"
+#include "vireo/encode/h264.h"
+#include "vireo/error/error.h"
+#include "vireo/frame/frame.h"
+#include "vireo/transcode/smart_trim.h"
+
+namespace vireo {
+namespace transcode {
+
+static const uint8_t kNALULengthSize = 4;  // length size of the samples produced by encode::H264
+
+struct _SmartTrim {
+  struct Entry {
+    bool encoded;  // index into encoded, otherwise into samples
+    uint32_t index;
+    int64_t pts;
+    int64_t dts;
+    bool parameter_sets;  // first copied key frame after re-encoded ones: carries the source SPS / PPS in-band, so that it goes back to their sample entry
+  };
+  functional::Video<decode::Sample> track;
+  vector<decode::Sample> samples;
+  vector<encode::Sample> encoded;
+  vector<Entry> entries;
+  vector<common::EditBox> edit_boxes;
+  uint64_t duration = 0;
+  float crf;
+  uint32_t optimization;
+  uint32_t thread_count;
+
+  auto profile() const -> encode::VideoProfileType {
+    const auto& sps = track.settings().sps_pps.sps;
+    THROW_IF(sps.count() < 2, Invalid);
+    switch (sps.data()[sps.a() + 1]) {  // profile_idc, after the NAL unit header
+      case 66:
+        return encode::VideoProfileType::Baseline;
+      case 77:
+        return encode::VideoProfileType::Main;
+      default:
+        return encode::VideoProfileType::High;
+    }
+  }
+
+  // Decodes the GOP of samples [first, last) and re-encodes its frames displayed within [start_pts, end_pts)
+  auto reencode(uint32_t first, uint32_t last, int64_t start_pts, int64_t end_pts, int64_t frame_duration) -> void {
+#ifdef HAVE_LIBX264
+    const vector<decode::Sample> gop(samples.begin() + first, samples.begin() + last);
+    THROW_IF(gop.size() >= security::kMaxGOPSize, Unsafe);
+    decode::Video decoder(functional::Video<decode::Sample>(gop, track.settings()), 1);
+    vector<frame::Frame> frames;
+    for (const auto frame: decoder) {
+      if (frame.pts >= start_pts && frame.pts < end_pts) {
+        frames.push_back(frame);
+      }
+    }
+    CHECK(frames.size());
+
+    // cap the bitrate at the one of the source GOP, when the sizes of its samples are known
+    uint64_t bytes = 0;
+    int64_t min_pts = numeric_limits<int64_t>::max();
+    int64_t max_pts = numeric_limits<int64_t>::min();
+    for (const auto& sample: gop) {
+      if (!sample.byte_range.available) {
+        bytes = 0;  // a partial sum would understate the bitrate, leave it uncapped
+        break;
+      }
+      bytes += sample.byte_range.size;
+      min_pts = min(min_pts, sample.pts);
+      max_pts = max(max_pts, sample.pts);
+    }
+    const uint32_t timescale = track.settings().timescale;
+    const uint32_t max_bitrate = bytes ? (uint32_t)common::round_divide<uint64_t>(bytes * 8, timescale, (max_pts + frame_duration - min_pts) * 1000) : 0;
+    const encode::H264Params params(encode::H264Params::ComputationalParams(optimization, thread_count),
+                                    encode::H264Params::RateControlParams(encode::RCMethod::CRF, crf, max_bitrate),
+                                    encode::H264Params::GopParams(0),
+                                    profile(),
+                                    (float)timescale / frame_duration);
+    encode::H264 encoder(functional::Video<frame::Frame>(frames, decoder.settings()), params);
+
+    // without B-frames the samples come out in presentation order; their dts keep the delay of the source key frame,
+    // so that they line up with the decode order of the copied GOPs around them
+    const int64_t delay = gop.front().pts - gop.front().dts;
+    for (uint32_t index = 0; index < encoder.count(); ++index) {
+      const encode::Sample sample = encoder(index);
+      entries.push_back({ true, (uint32_t)encoded.size(), sample.pts, sample.pts - delay, false });
+      encoded.push_back(sample);  // copies the payload, the encoder reuses its buffer for the next sample
+    }
+#else
+    THROW_IF(true, MissingDependency);
+#endif
+  }
+};
+
+SmartTrim::SmartTrim(const functional::Video<decode::Sample>& track, const vector<common::EditBox>& edit_boxes, uint64_t start_ms, uint64_t duration_ms,
+                     float crf, uint32_t optimization, uint32_t thread_count)
+  : _this(make_shared<_SmartTrim>()), track(_this) {
+  const auto& video_settings = track.settings();
+  THROW_IF(track.count() == 0, InvalidArguments);
+  THROW_IF(track.count() >= security::kMaxSampleCount, Unsafe);
+  THROW_IF(duration_ms == 0, InvalidArguments);
+  THROW_IF(video_settings.codec != settings::Video::Codec::H264, Unsupported);
+  THROW_IF(video_settings.sps_pps.nalu_length_size != kNALULengthSize, Unsupported, "re-encoded samples would not match the NAL unit length size of the source");
+  THROW_IF(edit_boxes.size() > 1 || (edit_boxes.size() && edit_boxes[0].start_pts == EMPTY_EDIT_BOX), Unsupported, "only a single non-empty edit box is supported");
+  _this->track = track;
+  _this->crf = crf;
+  _this->optimization = optimization;
+  _this->thread_count = thread_count;
+  auto& samples = _this->samples;
+  for (const auto sample: track) {
+    samples.push_back(sample);
+  }
+  THROW_IF(!samples.front().keyframe, Invalid, "Video has to start with a keyframe");
+
+  // Trim boundaries in the track timescale, the output starts with the frame displayed at start_pts
+  const uint32_t timescale = video_settings.timescale;
+  vector<int64_t> pts;
+  for (const auto& sample: samples) {
+    pts.push_back(sample.pts);
+  }
+  sort(pts.begin(), pts.end());
+  vector<int64_t> pts_offsets;
+  for (uint32_t index = 1; index < pts.size(); ++index) {
+    pts_offsets.push_back(pts[index] - pts[index - 1]);
+  }
+  const int64_t frame_duration = max(common::median(pts_offsets), (int64_t)1);
+  const int64_t origin = edit_boxes.size() ? edit_boxes[0].start_pts : 0;
+  const int64_t start_pts = max(origin + (int64_t)((start_ms * timescale) / 1000), pts.front());
+  const int64_t end_pts = min(start_pts + (int64_t)((duration_ms * timescale + 999) / 1000), pts.back() + frame_duration);
+  THROW_IF(start_pts >= end_pts, OutOfRange);
+  const int64_t first_pts = *(upper_bound(pts.begin(), pts.end(), start_pts) - 1);
+
+  // GOPs entirely within [first_pts, end_pts) are copied, the ones cut by a boundary are re-encoded
+  bool after_encoded = false;
+  for (uint32_t first = 0; first < samples.size();) {
+    uint32_t last = first + 1;
+    while (last < samples.size() && !samples[last].keyframe) {
+      ++last;
+    }
+    uint32_t kept = 0;
+    for (uint32_t index = first; index < last; ++index) {
+      kept += samples[index].pts >= first_pts && samples[index].pts < end_pts;
+    }
+    if (kept == last - first) {
+      for (uint32_t index = first; index < last; ++index) {
+        _this->entries.push_back({ false, index, samples[index].pts, samples[index].dts, after_encoded && index == first });
+      }
+      after_encoded = false;
+    } else if (kept) {
+      _this->reencode(first, last, first_pts, end_pts, frame_duration);
+      after_encoded = true;
+    }
+    first = last;
+  }
+
+  // Rebase the timestamps on the first dts, the edit box starts the output at start_pts
+  auto& entries = _this->entries;
+  CHECK(entries.size());
+  const int64_t shift = entries.front().dts;
+  for (uint32_t index = 0; index < entries.size(); ++index) {
+    THROW_IF(index && entries[index].dts <= entries[index - 1].dts, Unsupported, "re-encoded frames do not fit in the decode order of the copied ones");
+    THROW_IF(entries[index].pts < entries[index].dts, Unsupported);
+    entries[index].pts -= shift;
+    entries[index].dts -= shift;
+  }
+  _this->duration = end_pts - first_pts;
+  _this->edit_boxes.push_back(common::EditBox(start_pts - shift, end_pts - start_pts, 1.0f, SampleType::Video));
+
+  this->track._settings = video_settings;
+  this->track.set_bounds(0, (uint32_t)entries.size());
+}
+
+SmartTrim::SmartTrim(const SmartTrim& smart_trim) : _this(smart_trim._this), track(_this) {}
+
+auto SmartTrim::reencoded() const -> uint32_t {
+  return (uint32_t)_this->encoded.size();
+}
+
+SmartTrim::Track::Track(const std::shared_ptr<_SmartTrim>& _this) : _this(_this) {}
+
+SmartTrim::Track::Track(const Track& track)
+  : functional::DirectVideo<Track, encode::Sample>(track.a(), track.b(), track.settings()), _this(track._this) {}
+
+auto SmartTrim::Track::duration() const -> uint64_t {
+  return _this->duration;
+}
+
+auto SmartTrim::Track::edit_boxes() const -> const vector<common::EditBox>& {
+  return _this->edit_boxes;
+}
+
+auto SmartTrim::Track::operator()(uint32_t index) const -> encode::Sample {
+  THROW_IF(index < a() || index >= b(), OutOfRange);
+  CHECK(index < _this->entries.size());
+  const auto& entry = _this->entries[index];
+  if (entry.encoded) {
+    const auto& sample = _this->encoded[entry.index];
+    return encode::Sample(entry.pts, entry.dts, sample.keyframe, SampleType::Video, common::Data32(sample.nal.data() + sample.nal.a(), sample.nal.count(), nullptr));
+  }
+  const auto& sample = _this->samples[entry.index];
+  const common::Data32 nal = sample.nal();
+  if (!entry.parameter_sets) {
+    return encode::Sample(entry.pts, entry.dts, sample.keyframe, SampleType::Video, nal);
+  }
+  const common::Data16 sps_pps = settings().sps_pps.as_extradata(header::SPS_PPS::ExtraDataType::avcc);
+  const uint32_t size = sps_pps.count() + nal.count();
+  common::Data32 data = common::Data32(new uint8_t[size], size, [](uint8_t* p) { delete[] p; });
+  data.copy(common::Data32(sps_pps.data() + sps_pps.a(), sps_pps.count(), nullptr));
+  data.set_bounds(sps_pps.count(), size);
+  data.copy(nal);
+  data.set_bounds(0, size);
+  return encode::Sample(entry.pts, entry.dts, sample.keyframe, SampleType::Video, data);
+}
+
+}}
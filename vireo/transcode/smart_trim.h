@@ -0,0 +1,68 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "vireo/base_h.h"
+#include "vireo/common/editbox.h"
+#include "vireo/decode/types.h"
+#include "vireo/encode/types.h"
+#include "vireo/functional/media.hpp"
+
+namespace vireo {
+namespace transcode {
+
+static const float kDefaultSmartTrimCRF = 18.0f;
+
+// Frame accurate trim of an H.264 video track ("smart render"): the GOPs cut by start_ms or by start_ms + duration_ms
+// are decoded and the frames kept from them re-encoded, every GOP in between is copied as is. The re-encoded frames
+// match the resolution, profile and frame rate of the source and are capped at its bitrate; they carry their own
+// SPS / PPS in-band, and the first copied key frame after them carries the source ones: a regular file muxed by mux::MP4
+// gets a sample entry per set, so that decoders only reading avcC get the right ones. GOPs have to be closed.
+// The output starts with the frame displayed at start_ms, edit_boxes() hides whatever of it precedes start_ms.
+class PUBLIC SmartTrim final {
+  std::shared_ptr<struct _SmartTrim> _this;
+public:
+  SmartTrim(const functional::Video<decode::Sample>& track, const std::vector<common::EditBox>& edit_boxes, uint64_t start_ms, uint64_t duration_ms,
+            float crf = kDefaultSmartTrimCRF, uint32_t optimization = 3, uint32_t thread_count = 0);
+  SmartTrim(const SmartTrim& smart_trim);
+  DISALLOW_ASSIGN(SmartTrim);
+  auto reencoded() const -> uint32_t;  // number of output samples that were re-encoded
+
+  class Track final : public functional::DirectVideo<Track, encode::Sample> {
+    std::shared_ptr<_SmartTrim> _this;
+    Track(const std::shared_ptr<_SmartTrim>& _this);
+    friend class SmartTrim;
+  public:
+    Track(const Track& track);
+    DISALLOW_ASSIGN(Track);
+    auto duration() const -> uint64_t;
+    auto edit_boxes() const -> const std::vector<common::EditBox>&;
+    auto operator()(uint32_t index) const -> encode::Sample;
+  } track;
+};
+
+}}
@@ -0,0 +1,184 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "vireo/base_cpp.h"
+#include "vireo/common/security.h"
+#include "vireo/decode/video.h"
+#include "vireo/encode/jpg.h"
+#include "vireo/error/error.h"
+#include "vireo/frame/frame.h"
+#include "vireo/transcode/thumbnails.h"
+
+namespace vireo {
+namespace transcode {
+
+struct _Thumbnails {
+  functional::Video<decode::Sample> track;
+  uint16_t width;
+  uint32_t thread_count;
+  int quality;
+  vector<uint32_t> frames;  // per thumbnail: index of its frame in presentation order, as used by decode::Video
+  vector<int64_t> pts;  // per thumbnail: pts of its frame
+  vector<vector<uint32_t>> gops;  // distinct frames to decode, grouped by the key frame they decode from, ascending
+  map<uint32_t, vector<uint32_t>> thumbnails;  // frame -> thumbnails showing it
+};
+
+Thumbnails::Thumbnails(const functional::Video<decode::Sample>& track, const vector<int64_t>& pts, Seek seek, uint16_t width, uint32_t thread_count, int quality)
+  : _this(make_shared<_Thumbnails>()) {
+  THROW_IF(track.count() == 0, InvalidArguments);
+  THROW_IF(track.count() >= security::kMaxSampleCount, Unsafe);
+  THROW_IF(pts.size() >= security::kMaxSampleCount, Unsafe);
+  THROW_IF(seek != Exact && seek != KeyFrame, InvalidArguments);
+  THROW_IF(width == 0, InvalidArguments);
+  THROW_IF(thread_count == 0, InvalidArguments);
+
+  // every worker decodes through its own decoder, but reads the samples of the shared track one at a time
+  auto lock = make_shared<std::mutex>();
+  _this->track = functional::Video<decode::Sample>([track, lock](uint32_t index) -> decode::Sample {
+    std::unique_lock<std::mutex> guard(*lock);
+    decode::Sample sample = track(index);
+    guard.unlock();
+    sample.nal = [nal = sample.nal, lock]() -> common::Data32 {
+      std::lock_guard<std::mutex> guard(*lock);
+      return nal();
+    };
+    return sample;
+  }, track.a(), track.b(), track.settings());
+  _this->width = width;
+  _this->thread_count = thread_count;
+  _this->quality = quality;
+
+  // frames in presentation order, key frames are known from the samples alone
+  vector<pair<int64_t, bool>> frames;
+  for (const auto& sample: track) {
+    frames.push_back(make_pair(sample.pts, sample.keyframe));
+  }
+  sort(frames.begin(), frames.end(), [](const pair<int64_t, bool>& a, const pair<int64_t, bool>& b) {
+    return a.first < b.first;
+  });
+  vector<uint32_t> keyframes = { 0 };  // decoding always starts from the first frame when there is no earlier key frame
+  for (uint32_t index = 1; index < frames.size(); ++index) {
+    if (frames[index].second) {
+      keyframes.push_back(index);
+    }
+  }
+
+  for (const int64_t target: pts) {
+    // last frame displayed at or before target
+    auto it = upper_bound(frames.begin(), frames.end(), target, [](int64_t pts, const pair<int64_t, bool>& frame) {
+      return pts < frame.first;
+    });
+    uint32_t frame = it == frames.begin() ? 0 : (uint32_t)(it - frames.begin() - 1);
+    if (seek == KeyFrame) {
+      auto next = lower_bound(keyframes.begin(), keyframes.end(), frame + 1);
+      frame = *(next - 1);
+      if (next != keyframes.end() && frames[*next].first - target < target - frames[frame].first) {
+        frame = *next;
+      }
+    }
+    _this->thumbnails[frame].push_back((uint32_t)_this->frames.size());
+    _this->frames.push_back(frame);
+    _this->pts.push_back(frames[frame].first);
+  }
+
+  uint32_t gop_start = numeric_limits<uint32_t>::max();
+  for (const auto& frame_thumbnails: _this->thumbnails) {
+    const uint32_t frame = frame_thumbnails.first;
+    const uint32_t keyframe = *(upper_bound(keyframes.begin(), keyframes.end(), frame) - 1);
+    if (keyframe != gop_start) {
+      _this->gops.push_back({});
+      gop_start = keyframe;
+    }
+    _this->gops.back().push_back(frame);
+  }
+}
+
+Thumbnails::Thumbnails(const Thumbnails& thumbnails)
+  : _this(thumbnails._this) {
+}
+
+auto Thumbnails::count() const -> uint32_t {
+  return (uint32_t)_this->frames.size();
+}
+
+auto Thumbnails::pts(uint32_t index) const -> int64_t {
+  THROW_IF(index >= count(), OutOfRange);
+  return _this->pts[index];
+}
+
+auto Thumbnails::operator()(const std::function<void(uint32_t index, const common::Data32& jpg)>& write) const -> void {
+  if (_this->gops.empty()) {
+    return;
+  }
+  std::atomic<uint32_t> next_gop(0);
+  std::atomic<bool> failed(false);
+  std::mutex write_lock;
+  std::exception_ptr error;
+
+  auto work = [_this = _this, &write, &next_gop, &failed, &write_lock, &error]() {
+    try {
+      decode::Video decoder(_this->track, 1);
+      for (uint32_t gop = next_gop++; gop < _this->gops.size() && !failed; gop = next_gop++) {
+        for (const uint32_t frame: _this->gops[gop]) {  // ascending, so the decoder keeps going within the GOP
+          frame::YUV yuv = decoder(frame).yuv();
+          const uint16_t width = yuv.width();
+          const frame::YUV thumbnail = yuv.full_range(true).scale(_this->width, width);
+          encode::JPG jpg_encoder(functional::Video<frame::YUV>([thumbnail](uint32_t) -> frame::YUV {
+            return thumbnail;
+          }, 0, 1, settings::Video::None), _this->quality, 0);
+          const common::Data32 jpg = jpg_encoder(0);
+          std::lock_guard<std::mutex> guard(write_lock);
+          for (const uint32_t index: _this->thumbnails.at(frame)) {
+            write(index, jpg);
+          }
+        }
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(write_lock);
+      if (!error) {
+        error = std::current_exception();
+      }
+      failed = true;
+    }
+  };
+
+  vector<std::thread> workers;
+  const uint32_t worker_count = min(_this->thread_count, (uint32_t)_this->gops.size());
+  for (uint32_t i = 1; i < worker_count; ++i) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto& worker: workers) {
+    worker.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+}}
@@ -0,0 +1,52 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "vireo/base_h.h"
+#include "vireo/common/data.h"
+#include "vireo/decode/types.h"
+#include "vireo/functional/media.hpp"
+
+namespace vireo {
+namespace transcode {
+
+// JPG thumbnails of a video track at the requested timestamps (in the track timescale).
+// Exact: the frame displayed at each timestamp, which may need its GOP to be decoded up to it.
+// KeyFrame: the key frame nearest to each timestamp, so only that frame is decoded.
+// The positions are decoded, scaled and encoded on thread_count workers, each with its own decoder.
+class PUBLIC Thumbnails final {
+  std::shared_ptr<struct _Thumbnails> _this;
+public:
+  enum Seek { Exact = 0, KeyFrame = 1 };
+  Thumbnails(const functional::Video<decode::Sample>& track, const std::vector<int64_t>& pts, Seek seek, uint16_t width, uint32_t thread_count = 1, int quality = 95);
+  Thumbnails(const Thumbnails& thumbnails);
+  DISALLOW_ASSIGN(Thumbnails);
+  auto count() const -> uint32_t;
+  auto pts(uint32_t index) const -> int64_t;  // pts of the frame used for thumbnail index
+  // Produces all thumbnails, calling write for each as soon as it is encoded (one call at a time, in completion order)
+  auto operator()(const std::function<void(uint32_t index, const common::Data32& jpg)>& write) const -> void;
+};
+
+}}
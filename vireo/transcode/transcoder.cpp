@@ -0,0 +1,719 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "vireo/base_cpp.h"
+#include "vireo/common/editbox.h"
+#include "vireo/common/math.h"
+#include "vireo/config.h"
+#include "vireo/decode/audio.h"
+#include "vireo/decode/video.h"
+#include "vireo/error/error.h"
+#include "vireo/frame/frame.h"
+#include "vireo/functional/prefetch.hpp"
+#include "vireo/mux/mp2ts.h"
+#include "vireo/mux/mp4.h"
+#include "vireo/sound/sound.h"
+#include "vireo/transcode/transcoder.h"
+#include "vireo/transform/trim.h"
+#ifdef HAVE_LIBFDK_AAC
+#include "vireo/encode/aac.h"
+#endif
+#ifdef HAVE_LIBVORBISENC
+#include "vireo/encode/vorbis.h"
+#endif
+#ifdef HAVE_LIBVPX
+#include "vireo/encode/vp8.h"
+#endif
+#ifdef HAVE_LIBWEBM
+#include "vireo/mux/webm.h"
+#endif
+
+namespace vireo {
+namespace transcode {
+
+using Clock = std::chrono::steady_clock;
+
+static inline auto elapsed_us(const Clock::time_point& start) -> uint64_t {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+}
+
+struct Counter {
+  const SampleType type;
+  const Stats::Stage stage;
+  const int32_t rendition;
+  vector<shared_ptr<Counter>> upstream;  // stages this one waits on while busy
+  std::atomic<uint64_t> count = ATOMIC_VAR_INIT(0);
+  std::atomic<uint64_t> busy_us = ATOMIC_VAR_INIT(0);
+  std::atomic<uint64_t> wait_us = ATOMIC_VAR_INIT(0);
+  std::function<uint32_t(void)> queue_depth = []() -> uint32_t { return 0; };
+  Counter(SampleType type, Stats::Stage stage, int32_t rendition, const vector<shared_ptr<Counter>>& upstream)
+    : type(type), stage(stage), rendition(rendition), upstream(upstream) {}
+};
+
+// Evaluates f on a dedicated thread, up to lookahead values ahead of the slowest of its consumers, each of which
+// requests values through its own function
+template <typename T>
+class Queue {
+  shared_ptr<Counter> counter;
+  shared_ptr<functional::Prefetcher<T, uint32_t>> prefetcher;
+public:
+  Queue(const shared_ptr<Counter>& counter, const std::function<T(uint32_t)>& f, uint32_t b, uint32_t lookahead, uint32_t consumer_count = 1)
+    : counter(counter), prefetcher(make_shared<functional::Prefetcher<T, uint32_t>>([counter, f](uint32_t index) -> T {
+        const auto start = Clock::now();
+        T value = f(index);
+        counter->busy_us += elapsed_us(start);
+        counter->count++;
+        return value;
+      }, b, lookahead, 1, consumer_count)) {
+    counter->queue_depth = [prefetcher = std::weak_ptr<functional::Prefetcher<T, uint32_t>>(prefetcher)]() -> uint32_t {
+      auto p = prefetcher.lock();
+      return p ? p->ready() : 0;
+    };
+  }
+  auto consumer(uint32_t id = 0) const -> std::function<T(uint32_t)> {
+    return [counter = counter, prefetcher = prefetcher, id](uint32_t index) -> T {
+      const auto start = Clock::now();
+      T value = (*prefetcher)(index, id);
+      counter->wait_us += elapsed_us(start);
+      return value;
+    };
+  }
+  auto release(uint32_t id) const -> void {
+    prefetcher->release(id);
+  }
+};
+
+// The demuxer is shared by all tracks of a movie and is not thread safe, so every access to it goes through lock;
+// only the payloads are read ahead, sample metadata is still fetched synchronously
+template <int Type>
+static auto demux(const functional::Media<functional::Function<decode::Sample, uint32_t>, decode::Sample, uint32_t, Type>& track,
+                  const shared_ptr<std::mutex>& lock, const shared_ptr<Counter>& counter, uint32_t queue_size)
+  -> functional::Media<functional::Function<decode::Sample, uint32_t>, decode::Sample, uint32_t, Type> {
+  std::function<common::Data32(uint32_t)> nals = [track, lock](uint32_t index) -> common::Data32 {
+    std::lock_guard<std::mutex> guard(*lock);
+    return track(index).nal();
+  };
+  if (counter) {
+    nals = Queue<common::Data32>(counter, nals, track.b(), queue_size).consumer();
+  }
+  return functional::Media<functional::Function<decode::Sample, uint32_t>, decode::Sample, uint32_t, Type>([track, lock, nals](uint32_t index) -> decode::Sample {
+    std::unique_lock<std::mutex> guard(*lock);
+    decode::Sample sample = track(index);
+    guard.unlock();
+    sample.nal = [nals, index]() -> common::Data32 {
+      return nals(index);
+    };
+    return sample;
+  }, track.a(), track.b(), track.settings());
+}
+
+// Splits frames [0, count) into at most chunk_count runs of similar length that start on key frames
+static auto chunk_bounds(const vector<uint32_t>& keyframes, uint32_t count, uint32_t chunk_count) -> vector<uint32_t> {
+  vector<uint32_t> bounds = { 0 };
+  for (uint32_t chunk = 1; chunk < chunk_count; ++chunk) {
+    const uint32_t target = (uint32_t)((uint64_t)count * chunk / chunk_count);
+    auto keyframe = std::lower_bound(keyframes.begin(), keyframes.end(), target);
+    if (keyframe != keyframes.end() && *keyframe > bounds.back() && *keyframe < count) {
+      bounds.push_back(*keyframe);
+    }
+  }
+  bounds.push_back(count);
+  return bounds;
+}
+
+struct FirstPtsAndTimescale {
+  int64_t first_pts = -1;
+  uint32_t timescale = 0;
+};
+
+static auto include_pts(const uint64_t pts, const uint32_t timescale, const vector<common::EditBox>& edit_boxes,
+                        const uint64_t start_ms, const uint64_t duration_ms, FirstPtsAndTimescale& first_pts_and_timescale) -> bool {
+  auto new_pts = common::EditBox::RealPts(edit_boxes, pts);
+  auto time = 1000.0f * new_pts / timescale;
+  if (new_pts >= 0 && time >= start_ms && time < (start_ms + duration_ms)) {
+    if (first_pts_and_timescale.first_pts == -1) {
+      first_pts_and_timescale.first_pts = new_pts;
+      first_pts_and_timescale.timescale = timescale;
+    }
+    int64_t scaled_first_pts = first_pts_and_timescale.first_pts * timescale / first_pts_and_timescale.timescale;
+    return ((int64_t)new_pts - scaled_first_pts) >= 0;
+  }
+  return false;
+}
+
+static auto scaled_first_pts(const FirstPtsAndTimescale& first_pts_and_timescale, const uint32_t timescale) -> int64_t {
+  CHECK(first_pts_and_timescale.first_pts >= 0);
+  return first_pts_and_timescale.first_pts * timescale / first_pts_and_timescale.timescale;
+}
+
+static auto out_resolution(uint16_t in_width, uint16_t in_height, settings::Video::Orientation in_orientation, uint16_t out_height, bool square) -> pair<uint16_t, uint16_t> {
+  const uint16_t min_dim = min(in_width, in_height);
+  uint16_t w = (out_height == 0) ? in_width : common::round_divide((uint32_t)in_width, (uint32_t)out_height, (uint32_t)min_dim);
+  uint16_t h = (out_height == 0) ? in_height : common::round_divide((uint32_t)in_height, (uint32_t)out_height, (uint32_t)min_dim);
+  if (square) {
+    w = min(w, h);
+    h = w;
+  }
+  if (in_orientation % 2) {
+    std::swap(w, h);
+  }
+  return make_pair(w, h);
+}
+
+static auto crop_scale_rotate(const frame::Frame& frame, uint16_t in_width, uint16_t in_height, settings::Video::Orientation orientation, uint16_t out_width, uint16_t out_height) -> frame::Frame {
+  return (frame::Frame){ frame.pts, [in_width, in_height, orientation, out_width, out_height, yuv_func = frame.yuv]() {
+    // crop - if necessary
+    const bool square = (out_width == out_height);
+    const uint16_t min_dim = min(in_width, in_height);
+    const uint16_t crop_x_offset = square ? (in_width - min_dim) / 2 : 0;
+    const uint16_t crop_y_offset = square ? (in_height - min_dim) / 2 : 0;
+    const uint16_t cropped_width = in_width - 2 * crop_x_offset;
+    const uint16_t cropped_height = in_height - 2 * crop_y_offset;
+    // scale - if necessary
+    const bool is_portrait = orientation % 2;
+    const uint16_t real_height = is_portrait ? cropped_width : cropped_height;
+    const bool crop = (crop_x_offset != 0 || crop_y_offset != 0);
+    const bool scale = (real_height != out_height);
+    const bool rotate = (orientation != settings::Video::Landscape);
+    if (!crop && !scale && !rotate) {
+      return yuv_func();
+    }
+    // crop, scale and rotate in a single pass over the frame
+    return yuv_func().crop_scale_rotate(crop_x_offset, crop_y_offset, cropped_width, cropped_height, out_width, out_height, (frame::Rotation)orientation);
+  }};
+}
+
+
+struct Output {
+  Rendition rendition;
+  shared_ptr<Counter> mux_counter;
+  functional::Video<encode::Sample> video_track;
+  functional::Audio<encode::Sample> audio_track;
+  functional::Function<common::Data32> muxer;
+  std::function<uint64_t(const common::Writer& writer)> streamer;  // set for MP4 Regular and WebM outputs only
+  vector<std::function<void(void)>> releases;  // stop holding back the values shared with the other outputs
+};
+
+struct _Transcoder {
+  Params params;
+  vector<Output> outputs;
+  vector<shared_ptr<Counter>> counters;
+  shared_ptr<std::mutex> demux_lock = make_shared<std::mutex>();
+  shared_ptr<FirstPtsAndTimescale> first_pts_and_timescale = make_shared<FirstPtsAndTimescale>();  // shared by the audio and video tracks
+  functional::Caption<encode::Sample> caption_track;
+  std::atomic<bool> started = ATOMIC_VAR_INIT(false);
+
+  _Transcoder(const Params& params, const vector<Rendition>& renditions) : params(params) {
+    THROW_IF(params.queue_size == 0, InvalidArguments);
+    THROW_IF(renditions.empty(), InvalidArguments);
+    // each chunk has its own encoder, whose B-frame delay would make its first dts overlap the end of the previous chunk
+    THROW_IF(params.video && params.h264_chunks > 1 && params.h264_gop.num_bframes != 0, Unsupported, "chunked encoding requires num_bframes = 0");
+    for (const auto& rendition: renditions) {
+      THROW_IF(rendition.file_type != FileType::MP4 && rendition.file_type != FileType::MP2TS && rendition.file_type != FileType::WebM, Unsupported);
+      THROW_IF(rendition.file_type != FileType::MP4 && params.file_format != FileFormat::Regular, InvalidArguments);
+      THROW_IF((rendition.file_type == FileType::WebM) != (renditions[0].file_type == FileType::WebM), Unsupported, "all outputs must share the same audio codec");
+      const int32_t index = (int32_t)outputs.size();
+      outputs.push_back({ rendition, make_shared<Counter>(SampleType::Unknown, Stats::Mux, index, vector<shared_ptr<Counter>>()) });
+    }
+  }
+
+  auto counter(SampleType type, Stats::Stage stage, int32_t rendition, const vector<shared_ptr<Counter>>& upstream) -> shared_ptr<Counter> {
+    counters.push_back(make_shared<Counter>(type, stage, rendition, upstream));
+    return counters.back();
+  }
+
+  auto setup(const demux::Movie& movie) -> void {
+    const auto& video_settings = movie.video_track.settings();
+    const auto& audio_settings = movie.audio_track.settings();
+    const bool has_video = params.video && video_settings.timescale && movie.video_track.duration();
+    const bool has_audio = params.audio && audio_settings.timescale && audio_settings.sample_rate && movie.audio_track.duration();
+    THROW_IF(!has_video && !has_audio, InvalidArguments);
+
+    // clamp the requested time range to the content
+    const uint64_t duration = has_video ? movie.video_track.duration() : movie.audio_track.duration();
+    const uint32_t timescale = has_video ? video_settings.timescale : audio_settings.timescale;
+    const int64_t first_pts = has_video ? movie.video_track(0).pts : movie.audio_track(0).pts;
+    THROW_IF(first_pts < 0, Unsupported);
+    const uint64_t input_start_ms = 1000 * (uint64_t)first_pts / timescale;
+    const uint64_t input_end_ms = input_start_ms + 1000 * duration / timescale;
+    const uint64_t end_ms = min(params.start_ms + min(params.duration_ms, numeric_limits<uint64_t>::max() - params.start_ms), input_end_ms);
+    params.start_ms = max(params.start_ms, input_start_ms);
+    params.duration_ms = end_ms > params.start_ms ? end_ms - params.start_ms : 0;
+    THROW_IF(params.duration_ms == 0, InvalidArguments, "no content in the given time range");
+
+    if (has_video) {
+      if (params.h264_chunks > 1) {
+        transcode_video_in_chunks(movie.video_track);
+      } else {
+        transcode_video(movie.video_track);
+      }
+      transcode_caption(movie.caption_track);
+    }
+    if (has_audio) {
+      transcode_audio(movie.audio_track);
+    }
+    for (auto& output: outputs) {
+      counters.push_back(output.mux_counter);
+      setup_muxer(output);
+    }
+  }
+
+#ifdef HAVE_LIBX264
+  auto h264(const functional::Video<frame::Frame>& frames, const Rendition& rendition, float fps) const -> encode::H264 {
+    const encode::H264Params h264_params(rendition.h264_computation, rendition.h264_rc, params.h264_gop, rendition.h264_profile, fps);
+    return params.h264_pool ? encode::H264(frames, h264_params, *params.h264_pool) : encode::H264(frames, h264_params);
+  }
+#endif
+
+  auto transcode_video(const demux::Movie::VideoTrack& track) -> void {
+    const settings::Video video_settings = track.settings();
+    THROW_IF(video_settings.codec != settings::Video::Codec::H264, Unsupported);
+    const uint32_t timescale = video_settings.timescale;
+    const uint16_t in_width = video_settings.width;
+    const uint16_t in_height = video_settings.height;
+    const settings::Video::Orientation in_orientation = video_settings.orientation;
+    const vector<common::EditBox> edit_boxes = track.edit_boxes();
+
+    // demux
+    auto demux_counter = counter(SampleType::Video, Stats::Demux, -1, {});
+    auto samples = demux<SampleType::Video>(track, demux_lock, demux_counter, params.queue_size);
+
+    // decode: once for all outputs
+    auto decoder = decode::Video(samples, params.decoder_threads).filter(
+      [edit_boxes, timescale, start_ms = params.start_ms, duration_ms = params.duration_ms, first_pts_and_timescale = first_pts_and_timescale](const frame::Frame& frame) {
+        return include_pts(frame.pts, timescale, edit_boxes, start_ms, duration_ms, *first_pts_and_timescale);
+      }
+    );
+    auto decode_counter = counter(SampleType::Video, Stats::Decode, -1, { demux_counter });
+    const Queue<frame::YUV> decoded_yuvs(decode_counter, [decoder](uint32_t index) -> frame::YUV {
+      return decoder(index).yuv();
+    }, decoder.b(), params.queue_size, (uint32_t)outputs.size());
+
+    for (uint32_t i = 0; i < outputs.size(); ++i) {
+      Output& output = outputs[i];
+      const Rendition& rendition = output.rendition;
+      const auto resolution = out_resolution(in_width, in_height, in_orientation, rendition.height, rendition.square);
+      const uint16_t out_width = resolution.first;
+      const uint16_t out_height = resolution.second;
+      auto decoded = functional::Video<frame::Frame>([decoder, yuvs = decoded_yuvs.consumer(i)](uint32_t index) -> frame::Frame {
+        frame::Frame frame = decoder(index);
+        frame.yuv = [yuvs, index]() -> frame::YUV {
+          return yuvs(index);
+        };
+        return frame;
+      }, decoder.a(), decoder.b(), decoder.settings());
+      output.releases.push_back([decoded_yuvs, i]() {
+        decoded_yuvs.release(i);
+      });
+
+      // filter
+      auto filtered = decoded.transform<frame::Frame>(
+        [edit_boxes, timescale, first_pts_and_timescale = first_pts_and_timescale, in_width, in_height, in_orientation, out_width, out_height](const frame::Frame& frame) {
+          const int64_t first_pts = scaled_first_pts(*first_pts_and_timescale, timescale);
+          return crop_scale_rotate(frame.adjust_pts(edit_boxes).shift_pts(-first_pts), in_width, in_height, in_orientation, out_width, out_height);
+        }
+      );
+      auto filter_counter = counter(SampleType::Video, Stats::Filter, i, { decode_counter });
+      auto filtered_yuvs = Queue<frame::YUV>(filter_counter, [filtered](uint32_t index) -> frame::YUV {
+        return filtered(index).yuv();
+      }, filtered.b(), params.queue_size).consumer();
+      auto output_settings = settings::Settings<SampleType::Video>(decoder.settings().codec, out_width, out_height, timescale, settings::Video::Landscape, decoder.settings().sps_pps);
+      auto frames = functional::Video<frame::Frame>([filtered, filtered_yuvs](uint32_t index) -> frame::Frame {
+        frame::Frame frame = filtered(index);
+        frame.yuv = [filtered_yuvs, index]() -> frame::YUV {
+          return filtered_yuvs(index);
+        };
+        frame.rgb = [yuv = frame.yuv]() -> frame::RGB {
+          return yuv().rgb(4);
+        };
+        return frame;
+      }, filtered.a(), filtered.b(), output_settings);
+
+      // encode
+      const float fps = params.fps > 0.0f ? params.fps : track.fps();
+      functional::Video<encode::Sample> encoder;
+      if (rendition.file_type == FileType::MP4 || rendition.file_type == FileType::MP2TS) {
+#ifdef HAVE_LIBX264
+        encoder = functional::Video<encode::Sample>(h264(frames, rendition, fps));
+#else
+        THROW_IF(true, Unsupported, "H.264 encoding requires libx264");
+#endif
+      } else {
+#ifdef HAVE_LIBVPX
+        encoder = functional::Video<encode::Sample>(encode::VP8(frames, params.vp8_quantizer, params.vp8_optimization, fps, params.vp8_max_bitrate, params.vp8_computation));
+#else
+        THROW_IF(true, Unsupported, "VP8 encoding requires libvpx");
+#endif
+      }
+      auto encode_counter = counter(SampleType::Video, Stats::Encode, i, { filter_counter });
+      auto encoded = Queue<encode::Sample>(encode_counter, encoder, encoder.b(), params.queue_size).consumer();
+      output.video_track = functional::Video<encode::Sample>([encoded, mux_counter = output.mux_counter](uint32_t index) -> encode::Sample {
+        encode::Sample sample = encoded(index);
+        mux_counter->count++;
+        return sample;
+      }, encoder.a(), encoder.b(), encoder.settings());
+      output.mux_counter->upstream.push_back(encode_counter);
+    }
+  }
+
+  auto transcode_video_in_chunks(const demux::Movie::VideoTrack& track) -> void {
+    Output& output = outputs[0];
+    const Rendition& rendition = output.rendition;
+    THROW_IF(outputs.size() != 1, Unsupported, "chunked encoding supports a single output");
+    THROW_IF(rendition.file_type != FileType::MP4 && rendition.file_type != FileType::MP2TS, Unsupported, "chunked encoding requires H.264");
+    THROW_IF(!rendition.h264_rc.stats_log_path.empty(), Unsupported, "chunked encoding does not support multiple passes");
+    const settings::Video video_settings = track.settings();
+    THROW_IF(video_settings.codec != settings::Video::Codec::H264, Unsupported);
+    const uint32_t timescale = video_settings.timescale;
+    const uint16_t in_width = video_settings.width;
+    const uint16_t in_height = video_settings.height;
+    const settings::Video::Orientation in_orientation = video_settings.orientation;
+    const auto resolution = out_resolution(in_width, in_height, in_orientation, rendition.height, rendition.square);
+    const uint16_t out_width = resolution.first;
+    const uint16_t out_height = resolution.second;
+    const vector<common::EditBox> edit_boxes = track.edit_boxes();
+    const float fps = params.fps > 0.0f ? params.fps : track.fps();
+
+    // every chunk has its own decoder, so chunks start on frames decoded from key frames of the source
+    auto samples = demux<SampleType::Video>(track, demux_lock, nullptr, 0);
+    auto include = [edit_boxes, timescale, start_ms = params.start_ms, duration_ms = params.duration_ms, first_pts_and_timescale = first_pts_and_timescale](const frame::Frame& frame) {
+      return include_pts(frame.pts, timescale, edit_boxes, start_ms, duration_ms, *first_pts_and_timescale);
+    };
+    vector<functional::Video<frame::Frame>> decoders = { decode::Video(samples, params.decoder_threads).filter(include) };
+    set<int64_t> keyframe_pts;
+    for (const auto& sample: samples) {
+      if (sample.keyframe) {
+        keyframe_pts.insert(sample.pts);
+      }
+    }
+    vector<uint32_t> keyframes;
+    for (uint32_t index = 0; index < decoders[0].count(); ++index) {
+      if (keyframe_pts.count(decoders[0](index).pts)) {
+        keyframes.push_back(index);
+      }
+    }
+    const vector<uint32_t> bounds = chunk_bounds(keyframes, decoders[0].count(), params.h264_chunks);
+
+    vector<functional::Video<encode::Sample>> encoders;
+    for (uint32_t chunk = 0; chunk + 1 < bounds.size(); ++chunk) {
+      if (chunk) {
+        decoders.push_back(decode::Video(samples, params.decoder_threads).filter(include));
+      }
+      const uint32_t start = bounds[chunk];
+      auto output_settings = settings::Settings<SampleType::Video>(video_settings.codec, out_width, out_height, timescale, settings::Video::Landscape, video_settings.sps_pps);
+      auto frames = functional::Video<frame::Frame>(
+        [decoder = decoders[chunk], start, edit_boxes, timescale, first_pts_and_timescale = first_pts_and_timescale, in_width, in_height, in_orientation, out_width, out_height](uint32_t index) {
+          const int64_t first_pts = scaled_first_pts(*first_pts_and_timescale, timescale);
+          return crop_scale_rotate(decoder(start + index).adjust_pts(edit_boxes).shift_pts(-first_pts), in_width, in_height, in_orientation, out_width, out_height);
+        }, 0, bounds[chunk + 1] - start, output_settings);
+#ifdef HAVE_LIBX264
+      encoders.push_back(h264(frames, rendition, fps));
+#else
+      THROW_IF(true, Unsupported, "H.264 encoding requires libx264");
+#endif
+      THROW_IF(encoders.back().settings().sps_pps != encoders[0].settings().sps_pps, Unsupported, "chunks must share the same SPS / PPS");
+    }
+
+    // encode all chunks in parallel from the first request for a sample on, and hand them out in order as they
+    // complete: a chunk is muxed as soon as it and the ones before it are encoded. The encoders keep the pts of the
+    // source frames, so the chunks already share a single timeline, variable frame rates included
+    using ChunkSamples = shared_ptr<vector<encode::Sample>>;
+    struct Chunks {
+      std::mutex lock;
+      vector<ChunkSamples> samples;  // completed chunks, in order
+      unique_ptr<functional::Prefetcher<ChunkSamples, uint32_t>> encoded;
+    };
+    auto chunks = make_shared<Chunks>();
+    auto encode_counter = counter(SampleType::Video, Stats::Encode, 0, {});
+    const uint32_t chunk_count = (uint32_t)encoders.size();
+    chunks->encoded.reset(new functional::Prefetcher<ChunkSamples, uint32_t>([encoders, encode_counter](uint32_t chunk) -> ChunkSamples {
+      const auto start = Clock::now();
+      auto samples = make_shared<vector<encode::Sample>>(encoders[chunk].vectorize());
+      encode_counter->count += samples->size();
+      encode_counter->busy_us += elapsed_us(start);
+      return samples;
+    }, chunk_count, chunk_count, chunk_count));
+    output.video_track = functional::Video<encode::Sample>([chunks, bounds, mux_counter = output.mux_counter](uint32_t index) -> encode::Sample {
+      const uint32_t chunk = (uint32_t)(upper_bound(bounds.begin(), bounds.end(), index) - bounds.begin()) - 1;
+      ChunkSamples samples;
+      {
+        std::lock_guard<std::mutex> guard(chunks->lock);
+        while (chunks->samples.size() <= chunk) {
+          const ChunkSamples next = (*chunks->encoded)((uint32_t)chunks->samples.size());
+          THROW_IF(next->size() != bounds[chunks->samples.size() + 1] - bounds[chunks->samples.size()], Invalid);
+          THROW_IF(!chunks->samples.empty() && next->front().dts <= chunks->samples.back()->back().dts, Unsupported, "chunks overlap in decode order");
+          chunks->samples.push_back(next);
+        }
+        samples = chunks->samples[chunk];
+      }
+      mux_counter->count++;
+      const encode::Sample& sample = (*samples)[index - bounds[chunk]];
+      return encode::Sample(sample.pts, sample.dts, sample.keyframe, sample.type, common::Data32(sample.nal.data() + sample.nal.a(), sample.nal.count(), nullptr));
+    }, 0, bounds.back(), encoders[0].settings());
+    output.mux_counter->upstream.push_back(encode_counter);
+  }
+
+  auto transcode_audio(const demux::Movie::AudioTrack& track) -> void {
+    const settings::Audio audio_settings = track.settings();
+    const uint32_t timescale = audio_settings.timescale;
+    const vector<common::EditBox> edit_boxes = track.edit_boxes();
+
+    // demux
+    auto demux_counter = counter(SampleType::Audio, Stats::Demux, -1, {});
+    auto samples = demux<SampleType::Audio>(track, demux_lock, demux_counter, params.queue_size);
+
+    // decode and filter: only timestamps change past decoding, so there is no separate filter stage
+    auto decoder = decode::Audio(samples).filter(
+      [edit_boxes, timescale, start_ms = params.start_ms, duration_ms = params.duration_ms, first_pts_and_timescale = first_pts_and_timescale](const sound::Sound& sound) {
+        return include_pts(sound.pts, timescale, edit_boxes, start_ms, duration_ms, *first_pts_and_timescale);
+      }
+    );
+    auto decode_counter = counter(SampleType::Audio, Stats::Decode, -1, { demux_counter });
+    auto pcms = Queue<sound::PCM>(decode_counter, [decoder](uint32_t index) -> sound::PCM {
+      return decoder(index).pcm();
+    }, decoder.b(), params.queue_size).consumer();
+    auto sounds = functional::Audio<sound::Sound>([decoder, pcms, edit_boxes, timescale, first_pts_and_timescale = first_pts_and_timescale](uint32_t index) -> sound::Sound {
+      const int64_t first_pts = scaled_first_pts(*first_pts_and_timescale, timescale);
+      sound::Sound sound = decoder(index).adjust_pts(edit_boxes).shift_pts(-first_pts);
+      sound.pcm = [pcms, index]() -> sound::PCM {
+        return pcms(index);
+      };
+      return sound;
+    }, decoder.a(), decoder.b(), decoder.settings());
+
+    // encode: once for all outputs
+    functional::Audio<encode::Sample> encoder;
+    if (outputs[0].rendition.file_type == FileType::MP4 || outputs[0].rendition.file_type == FileType::MP2TS) {
+#ifdef HAVE_LIBFDK_AAC
+      encoder = functional::Audio<encode::Sample>(encode::AAC(sounds, audio_settings.channels, params.audio_bitrate, params.aac_threads));
+#else
+      THROW_IF(true, Unsupported, "AAC encoding requires libfdk-aac");
+#endif
+    } else {
+#ifdef HAVE_LIBVORBISENC
+      encoder = functional::Audio<encode::Sample>(encode::Vorbis(sounds, audio_settings.channels, params.audio_bitrate));
+#else
+      THROW_IF(true, Unsupported, "Vorbis encoding requires libvorbisenc");
+#endif
+    }
+    auto encode_counter = counter(SampleType::Audio, Stats::Encode, -1, { decode_counter });
+    // encoded audio is small, so the audio encoder is not held back by the muxer: it runs through the track on its own
+    // thread while video is encoded, rather than a few samples ahead of the interleaving. With several outputs this also
+    // keeps outputs muxing ahead from waiting on it for audio while it waits on them for the shared video frames
+    const uint32_t lookahead = max(encoder.b(), params.queue_size);
+    const Queue<encode::Sample> encoded(encode_counter, encoder, encoder.b(), lookahead, (uint32_t)outputs.size());
+    for (uint32_t i = 0; i < outputs.size(); ++i) {
+      Output& output = outputs[i];
+      output.audio_track = functional::Audio<encode::Sample>([encoded = encoded.consumer(i), mux_counter = output.mux_counter](uint32_t index) -> encode::Sample {
+        encode::Sample sample = encoded(index);
+        mux_counter->count++;
+        return sample;
+      }, encoder.a(), encoder.b(), encoder.settings());
+      output.releases.push_back([encoded, i]() {
+        encoded.release(i);
+      });
+      output.mux_counter->upstream.push_back(encode_counter);
+    }
+  }
+
+  auto transcode_caption(const demux::Movie::CaptionTrack& track) -> void {
+    auto samples = demux<SampleType::Caption>(track, demux_lock, nullptr, 0);
+    auto trimmed = transform::Trim<SampleType::Caption>(samples, track.edit_boxes(), params.start_ms, params.duration_ms);
+    caption_track = functional::Caption<encode::Sample>(trimmed.track, encode::Sample::Convert);
+  }
+
+  auto setup_muxer(Output& output) -> void {
+    if (output.rendition.file_type == FileType::MP4) {
+      auto mp4 = mux::MP4(output.audio_track, output.video_track, caption_track, params.file_format);
+      output.muxer = mp4;
+      if (params.file_format == FileFormat::Regular) {
+        output.streamer = [mp4](const common::Writer& writer) mutable -> uint64_t {
+          return mp4(writer);
+        };
+      }
+    } else if (output.rendition.file_type == FileType::MP2TS) {
+      output.muxer = mux::MP2TS(output.audio_track, output.video_track, caption_track);
+    } else {
+#ifdef HAVE_LIBWEBM
+      auto webm = mux::WebM(output.audio_track, output.video_track);
+      output.muxer = webm;
+      output.streamer = [webm](const common::Writer& writer) mutable -> uint64_t {
+        return webm(writer);
+      };
+#else
+      THROW_IF(true, Unsupported, "WebM muxing requires libwebm");
+#endif
+    }
+  }
+
+  auto mux(uint32_t rendition) -> common::Data32 {
+    Output& output = outputs[rendition];
+    const auto start = Clock::now();
+    auto data = output.muxer();
+    output.mux_counter->busy_us += elapsed_us(start);
+    return data;
+  }
+
+  auto stream(uint32_t rendition, const common::Writer& writer) -> uint64_t {
+    Output& output = outputs[rendition];
+    THROW_IF(!output.streamer, Unsupported, "only regular MP4 and WebM files can be streamed");
+    const auto start = Clock::now();
+    const uint64_t size = output.streamer(writer);
+    output.mux_counter->busy_us += elapsed_us(start);
+    return size;
+  }
+
+  auto stats() const -> vector<Stats> {
+    vector<Stats> stats;
+    for (const auto& counter: counters) {
+      // the busy time of a stage includes the time it spent waiting on its inputs
+      uint64_t busy_us = counter->busy_us;
+      for (const auto& upstream: counter->upstream) {
+        busy_us -= min(busy_us, (uint64_t)upstream->wait_us);
+      }
+      stats.push_back({ counter->type, counter->stage, counter->count, busy_us, counter->wait_us, counter->queue_depth(), counter->rendition });
+    }
+    return stats;
+  }
+};
+
+static auto rendition(const Params& params) -> Rendition {
+  Rendition rendition;
+  rendition.file_type = params.file_type;
+  rendition.height = params.height;
+  rendition.square = params.square;
+  rendition.h264_computation = params.h264_computation;
+  rendition.h264_rc = params.h264_rc;
+  rendition.h264_profile = params.h264_profile;
+  return rendition;
+}
+
+Transcoder::Transcoder(const demux::Movie& movie, const Params& params) : _this(new _Transcoder(params, { rendition(params) })) {
+  _this->setup(movie);
+  *static_cast<std::function<common::Data32(void)>*>(this) = [_this = _this]() -> common::Data32 {
+    THROW_IF(_this->started.exchange(true), Invalid, "a transcoder can only run once");
+    return _this->mux(0);
+  };
+}
+
+Transcoder::Transcoder(const Transcoder& transcoder)
+  : functional::Function<common::Data32>(*static_cast<const functional::Function<common::Data32>*>(&transcoder)), _this(transcoder._this) {
+}
+
+auto Transcoder::operator()() -> common::Data32 {
+  return move((*static_cast<std::function<common::Data32(void)>*>(this))());
+}
+
+auto Transcoder::operator()(const common::Writer& writer) -> uint64_t {
+  THROW_IF(_this->started.exchange(true), Invalid, "a transcoder can only run once");
+  return _this->stream(0, writer);
+}
+
+auto Transcoder::video_track() const -> functional::Video<encode::Sample> {
+  return _this->outputs[0].video_track;
+}
+
+auto Transcoder::audio_track() const -> functional::Audio<encode::Sample> {
+  return _this->outputs[0].audio_track;
+}
+
+auto Transcoder::stats() const -> vector<Stats> {
+  return _this->stats();
+}
+
+static auto aligned_key_frames(const demux::Movie& movie, const Params& params) -> Params {
+  Params aligned = params;
+  aligned.h264_gop.scenecut = false;
+  if (aligned.h264_gop.keyint_max == (uint32_t)encode::kDefaultH264KeyintMax) {
+    const float fps = params.fps > 0.0f ? params.fps : movie.video_track.fps();
+    aligned.h264_gop.keyint_max = max((uint32_t)(fps * kDefaultLadderKeyframeIntervalMs / 1000.0f + 0.5f), (uint32_t)1);
+  }
+  return aligned;
+}
+
+Ladder::Ladder(const demux::Movie& movie, const Params& params, const vector<Rendition>& renditions)
+  : _this(new _Transcoder(aligned_key_frames(movie, params), renditions)) {
+  for (const auto& rendition: renditions) {
+    THROW_IF(rendition.file_type != FileType::MP4 && rendition.file_type != FileType::MP2TS, Unsupported);
+  }
+  _this->setup(movie);
+}
+
+Ladder::Ladder(const Ladder& ladder) : _this(ladder._this) {
+}
+
+auto Ladder::operator()() -> vector<common::Data32> {
+  THROW_IF(_this->started.exchange(true), Invalid, "a ladder can only run once");
+  const uint32_t count = (uint32_t)_this->outputs.size();
+  vector<common::Data32> outputs(count);
+  vector<std::exception_ptr> errors(count);
+  vector<std::thread> muxers;
+  for (uint32_t i = 0; i < count; ++i) {
+    muxers.emplace_back([_this = _this, &outputs, &errors, i]() {
+      try {
+        outputs[i] = _this->mux(i);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+      // a failed output stops consuming, so it must not hold the others back
+      for (const auto& release: _this->outputs[i].releases) {
+        release();
+      }
+    });
+  }
+  for (auto& muxer: muxers) {
+    muxer.join();
+  }
+  for (const auto& error: errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  return outputs;
+}
+
+auto Ladder::count() const -> uint32_t {
+  return (uint32_t)_this->outputs.size();
+}
+
+auto Ladder::video_track(uint32_t rendition) const -> functional::Video<encode::Sample> {
+  THROW_IF(rendition >= _this->outputs.size(), OutOfRange);
+  return _this->outputs[rendition].video_track;
+}
+
+auto Ladder::audio_track(uint32_t rendition) const -> functional::Audio<encode::Sample> {
+  THROW_IF(rendition >= _this->outputs.size(), OutOfRange);
+  return _this->outputs[rendition].audio_track;
+}
+
+auto Ladder::stats() const -> vector<Stats> {
+  return _this->stats();
+}
+
+}}
@@ -0,0 +1,130 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "vireo/base_h.h"
+#include "vireo/common/data.h"
+#include "vireo/common/writer.h"
+#include "vireo/demux/movie.h"
+#include "vireo/encode/h264.h"
+#include "vireo/encode/types.h"
+#include "vireo/encode/vp8.h"
+#include "vireo/functional/media.hpp"
+#include "vireo/settings/settings.h"
+#include "vireo/types.h"
+
+namespace vireo {
+namespace transcode {
+
+static const uint32_t kDefaultQueueSize = 4;
+static const uint32_t kDefaultLadderKeyframeIntervalMs = 2000;
+
+struct PUBLIC Params {
+  FileType file_type = FileType::MP4;
+  FileFormat file_format = FileFormat::Regular;  // MP4 only
+  uint64_t start_ms = 0;
+  uint64_t duration_ms = std::numeric_limits<uint64_t>::max();
+  bool video = true;  // transcode the video track if the movie has one
+  bool audio = true;  // transcode the audio track if the movie has one
+  uint16_t height = 0;  // 0: keep the input height
+  bool square = false;  // center crop to 1:1 aspect ratio
+  float fps = 0.0f;  // 0: input video track fps
+  uint32_t decoder_threads = 1;
+  encode::H264Params::ComputationalParams h264_computation;
+  encode::H264Params::RateControlParams h264_rc;
+  encode::H264Params::GopParams h264_gop;
+  encode::VideoProfileType h264_profile = encode::VideoProfileType::Baseline;
+  uint32_t h264_chunks = 1;  // > 1: split the video at key frames and encode the chunks on parallel H.264 encoders, requires h264_gop.num_bframes = 0
+  std::shared_ptr<encode::H264Pool> h264_pool;  // optional warm encoders, shared by the transcoders of many short clips
+  int vp8_quantizer = 25;
+  int vp8_optimization = 0;
+  int vp8_max_bitrate = 0;
+  encode::VP8Params::ComputationalParams vp8_computation;
+  uint32_t audio_bitrate = 48 * 1024;
+  uint32_t aac_threads = 1;  // > 1: split the audio into segments and encode them on parallel AAC encoders
+  uint32_t queue_size = kDefaultQueueSize;  // values each stage computes ahead of the next one
+};
+
+// Settings of a single output of a Ladder, everything else comes from the Params shared by all outputs
+struct PUBLIC Rendition {
+  FileType file_type = FileType::MP4;  // MP4 or MP2TS
+  uint16_t height = 0;  // 0: keep the input height
+  bool square = false;  // center crop to 1:1 aspect ratio
+  encode::H264Params::ComputationalParams h264_computation;
+  encode::H264Params::RateControlParams h264_rc;
+  encode::VideoProfileType h264_profile = encode::VideoProfileType::Baseline;
+};
+
+struct PUBLIC Stats {
+  enum Stage { Demux = 0, Decode = 1, Filter = 2, Encode = 3, Mux = 4 };
+  SampleType type;  // lane the stage belongs to, Unknown for the muxer
+  Stage stage;
+  uint64_t count;  // values produced
+  uint64_t busy_us;  // time spent producing them
+  uint64_t wait_us;  // time the next stage spent waiting for them
+  uint32_t queue_depth;  // values produced and not consumed yet
+  int32_t rendition;  // output the stage belongs to, -1 if shared by all outputs
+};
+
+// Transcodes a movie through demux -> decode -> filter (edit boxes, trimming, crop / scale / rotate) -> encode -> mux.
+// Every stage but the muxer runs on its own thread, one lane per track, with at most queue_size values computed
+// ahead of the next stage; the muxer runs on the calling thread. Nothing is executed until the transcoder is called.
+// With h264_chunks > 1 the video is instead split into chunks that are decoded, filtered and encoded in parallel,
+// each on its own thread without B-frames, and muxed in order as each chunk and the ones before it complete.
+class PUBLIC Transcoder final : public functional::Function<common::Data32> {
+  std::shared_ptr<struct _Transcoder> _this;
+public:
+  Transcoder(const demux::Movie& movie, const Params& params);
+  Transcoder(const Transcoder& transcoder);
+  DISALLOW_ASSIGN(Transcoder);
+  auto operator()() -> common::Data32;
+  // MP4 Regular and WebM only: streams the file into writer while transcoding (for MP4, media data first and moov
+  // last; for WebM, a cluster at a time), so the output is not bound to 4 GB nor held in memory. Returns the size of the file.
+  auto operator()(const common::Writer& writer) -> uint64_t;
+  auto video_track() const -> functional::Video<encode::Sample>;
+  auto audio_track() const -> functional::Audio<encode::Sample>;
+  auto stats() const -> vector<Stats>;  // safe to call while the transcoder runs
+};
+
+// Transcodes a movie into several renditions at once (adaptive bitrate ladder): every video frame is demuxed and
+// decoded once, then fanned out to one filter -> H.264 encode -> mux branch per rendition, all running concurrently.
+// The decoder runs at most queue_size frames ahead of the slowest branch; audio is encoded once and shared.
+// Key frames are aligned across renditions: scene cut detection is disabled and, unless params.h264_gop sets
+// keyint_max, there is a key frame every kDefaultLadderKeyframeIntervalMs. The file type, height, crop and H.264
+// settings of params are ignored in favor of the ones of each rendition.
+class PUBLIC Ladder final {
+  std::shared_ptr<struct _Transcoder> _this;
+public:
+  Ladder(const demux::Movie& movie, const Params& params, const vector<Rendition>& renditions);
+  Ladder(const Ladder& ladder);
+  DISALLOW_ASSIGN(Ladder);
+  auto operator()() -> vector<common::Data32>;  // one output per rendition, muxed on a thread each
+  auto count() const -> uint32_t;
+  auto video_track(uint32_t rendition) const -> functional::Video<encode::Sample>;
+  auto audio_track(uint32_t rendition) const -> functional::Audio<encode::Sample>;
+  auto stats() const -> vector<Stats>;  // safe to call while the ladder runs
+};
+
+}}
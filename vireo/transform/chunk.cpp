@@ -0,0 +1,102 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "vireo/base_cpp.h"
+#include "vireo/common/math.h"
+#include "vireo/error/error.h"
+#include "vireo/functional/media.hpp"
+#include "vireo/transform/chunk.h"
+
+namespace vireo {
+namespace transform {
+
+struct _Chunk {
+  functional::Audio<decode::Sample> audio;
+  functional::Video<decode::Sample> video;
+  vector<uint32_t> video_boundaries;
+  vector<uint32_t> audio_boundaries;
+
+  _Chunk(const functional::Audio<decode::Sample>& audio, const functional::Video<decode::Sample>& video)
+    : audio(audio), video(video) {}
+
+  auto end(const vector<uint32_t>& boundaries, uint32_t count, uint32_t index) const -> uint32_t {
+    return (index + 1 < boundaries.size()) ? boundaries[index + 1] : count;
+  }
+};
+
+Chunk::Chunk(const functional::Audio<decode::Sample>& audio, const functional::Video<decode::Sample>& video)
+  : _this(new _Chunk(audio, video)) {
+  THROW_IF(!video.count(), InvalidArguments);
+  THROW_IF(audio.count() && !audio.settings().timescale, InvalidArguments);
+  THROW_IF(!video.settings().timescale, InvalidArguments);
+
+  // chunk i takes the audio samples with dts in [dts of key frame i, dts of key frame i + 1): both indices only move
+  // forward, the first chunk also takes the audio preceding its key frame
+  const uint64_t audio_timescale = audio.settings().timescale;
+  const uint64_t video_timescale = video.settings().timescale;
+  uint32_t audio_index = 0;
+  for (uint32_t index = 0; index < video.count(); ++index) {
+    const auto sample = video(video.a() + index);
+    if (!sample.keyframe) {
+      continue;
+    }
+    if (!_this->video_boundaries.empty() && audio.count()) {
+      const int64_t audio_dts = common::round_divide((uint64_t)sample.dts, audio_timescale, video_timescale);
+      while (audio_index < audio.count() && audio(audio.a() + audio_index).dts < audio_dts) {
+        ++audio_index;
+      }
+    }
+    _this->video_boundaries.push_back(index);
+    _this->audio_boundaries.push_back(audio_index);
+  }
+}
+
+Chunk::Chunk(const Chunk& chunk)
+  : _this(chunk._this) {}
+
+auto Chunk::count() const -> uint32_t {
+  return (uint32_t)_this->video_boundaries.size();
+}
+
+auto Chunk::video_boundaries() const -> const vector<uint32_t>& {
+  return _this->video_boundaries;
+}
+
+auto Chunk::audio_boundaries() const -> const vector<uint32_t>& {
+  return _this->audio_boundaries;
+}
+
+auto Chunk::video_track(uint32_t index) const -> functional::Video<decode::Sample> {
+  THROW_IF(index >= count(), OutOfRange);
+  const auto& video = _this->video;
+  return video.slice(video.a() + _this->video_boundaries[index], video.a() + _this->end(_this->video_boundaries, video.count(), index));
+}
+
+auto Chunk::audio_track(uint32_t index) const -> functional::Audio<decode::Sample> {
+  THROW_IF(index >= count(), OutOfRange);
+  const auto& audio = _this->audio;
+  return audio.slice(audio.a() + _this->audio_boundaries[index], audio.a() + _this->end(_this->audio_boundaries, audio.count(), index));
+}
+
+}}
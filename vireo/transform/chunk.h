@@ -0,0 +1,52 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Twitter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "vireo/base_h.h"
+#include "vireo/decode/types.h"
+#include "vireo/functional/media.hpp"
+
+namespace vireo {
+namespace transform {
+
+// Splits a movie into chunks starting at the key frames of its video track, the audio track being split at the same
+// dts. Boundaries are found in a single pass over the samples and every chunk is a view of the input tracks.
+class PUBLIC Chunk final {
+  std::shared_ptr<struct _Chunk> _this = nullptr;
+public:
+  Chunk(const functional::Video<decode::Sample>& video) : Chunk(functional::Audio<decode::Sample>(), video) {}
+  Chunk(const functional::Audio<decode::Sample>& audio, const functional::Video<decode::Sample>& video);
+  Chunk(const Chunk& chunk);
+  DISALLOW_ASSIGN(Chunk);
+  auto count() const -> uint32_t;
+  auto video_boundaries() const -> const vector<uint32_t>&;  // index of the first video sample of each chunk
+  auto audio_boundaries() const -> const vector<uint32_t>&;  // index of the first audio sample of each chunk
+  auto video_track(uint32_t index) const -> functional::Video<decode::Sample>;
+  auto audio_track(uint32_t index) const -> functional::Audio<decode::Sample>;
+};
+
+}}
@@ -30,25 +30,50 @@ namespace transform {
 
 template <int Type>
 struct Track {
-  vector<decode::Sample> samples;
+  // An input track as it is mapped into the output: samples [start, start + count) of track, rescaled to the output
+  // timescale and shifted by offset when they are accessed
+  struct Input {
+    functional::Media<functional::Function<decode::Sample, uint32_t>, decode::Sample, uint32_t, Type> track;
+    uint32_t timescale;
+    int64_t offset;
+    uint32_t start;
+    uint32_t count;
+  };
+  vector<Input> inputs;
+  vector<uint32_t> first_indices;  // output index of the first sample of each input
+  uint32_t count = 0;
   vector<common::EditBox> edit_boxes;
   settings::Settings<Type> settings;
   uint64_t duration = 0;
   Track() : settings(settings::Settings<Type>::None) {};
+
+  auto local_sample(const Input& input, uint32_t local_index) const -> decode::Sample {
+    auto sample = input.track(input.track.a() + local_index);
+    if (input.timescale != settings.timescale) {
+      sample.pts = common::round_divide<uint64_t>(sample.pts, settings.timescale, input.timescale);
+      sample.dts = common::round_divide<uint64_t>(sample.dts, settings.timescale, input.timescale);
+    }
+    return sample;
+  }
+
+  auto sample(uint32_t index) const -> decode::Sample {
+    const auto first_index = upper_bound(first_indices.begin(), first_indices.end(), index) - 1;
+    const auto& input = inputs[first_index - first_indices.begin()];
+    CHECK(index - *first_index < input.count);
+    return local_sample(input, input.start + index - *first_index).shift(input.offset);
+  }
+
+  void append(const Input& input) {
+    first_indices.push_back(count);
+    inputs.push_back(input);
+    count += input.count;
+  }
 };
 
 struct _Stitch {
   Track<SampleType::Video> video;
   Track<SampleType::Audio> audio;
 
-  void adjust_timescale(decode::Sample& sample, const uint32_t new_timescale, const uint32_t org_timescale) {
-    THROW_IF(sample.type == SampleType::Audio, InvalidArguments, "cannot change audio timescale without changing sample rate");
-    if (org_timescale != new_timescale) {
-      sample.pts = common::round_divide<uint64_t>(sample.pts, new_timescale, org_timescale);
-      sample.dts = common::round_divide<uint64_t>(sample.dts, new_timescale, org_timescale);
-    }
-  };
-
   void adjust_timescale(common::EditBox& edit_box, const uint32_t new_timescale, const uint32_t org_timescale) {
     if (org_timescale != new_timescale) {
       edit_box.start_pts = edit_box.start_pts == EMPTY_EDIT_BOX ? EMPTY_EDIT_BOX : (int64_t)common::round_divide<uint64_t>(edit_box.start_pts, new_timescale, org_timescale);
@@ -65,15 +90,20 @@ struct _Stitch {
     }
   }
 
-  void shift_and_append_samples(vector<decode::Sample>& in_samples, vector<decode::Sample>& out_samples, int64_t offset) {
-    for (const auto& sample: in_samples) {
-      if (offset < 0 && -offset > sample.pts && -offset > sample.dts) {
-        // should only happen if very first audio sample pts < very first video sample pts - skip
+  template <int Type>
+  static uint32_t SkippedSamples(const Track<Type>& track, const typename Track<Type>::Input& input) {
+    // leading samples that would end up before 0; should only happen if very first audio sample pts < very first video sample pts
+    uint32_t skipped = 0;
+    while (input.offset < 0 && skipped < input.track.count()) {
+      const auto sample = track.local_sample(input, skipped);
+      if (-input.offset > sample.pts && -input.offset > sample.dts) {
         CHECK(sample.type == SampleType::Audio);
+        ++skipped;
       } else {
-        out_samples.push_back(sample.shift(offset));
+        break;
       }
     }
+    return skipped;
   }
 
   void shift_and_append_editboxes(vector<common::EditBox>& in_edit_boxes, vector<common::EditBox>& out_edit_boxes, int64_t offset) {
@@ -82,23 +112,19 @@ struct _Stitch {
     }
   }
 
-  static uint64_t CalculateDuration(const vector<decode::Sample>& samples) {
-    THROW_IF(!samples.size(), InvalidArguments);
+  template <int Type>
+  static uint64_t CalculateDuration(const Track<Type>& track, const typename Track<Type>::Input& input) {
+    THROW_IF(!input.track.count(), InvalidArguments);
     vector<uint64_t> dts_offsets;
     uint64_t track_duration = 0;
-    uint64_t prev_dts = 0;
-    bool first = true;
-    for (const auto& sample: samples) {
-      if (first) {
-        first = false;
-        prev_dts = sample.dts;
-        continue;
-      }
-      THROW_IF(sample.dts < prev_dts, Invalid);
-      uint64_t dts_offset = sample.dts - prev_dts;
+    int64_t prev_dts = track.local_sample(input, 0).dts;
+    for (uint32_t index = 1; index < input.track.count(); ++index) {
+      const int64_t dts = track.local_sample(input, index).dts;
+      THROW_IF(dts < prev_dts, Invalid);  // RemoveOverlappingSamples relies on it to binary search
+      uint64_t dts_offset = dts - prev_dts;
       track_duration += dts_offset;
       dts_offsets.push_back(dts_offset);
-      prev_dts = sample.dts;
+      prev_dts = dts;
     }
     uint64_t last_sample_duration = common::median(dts_offsets);
     track_duration += last_sample_duration;
@@ -124,22 +150,41 @@ struct _Stitch {
     return filtered;
   }
 
-  static vector<decode::Sample> RemoveOverlappingSamples(const vector<decode::Sample>& samples) {
-    vector<decode::Sample> filtered;
-    if (samples.size()) {
-      decode::Sample last_sample = samples.back();
-      filtered.push_back(last_sample);
-      for (auto it = samples.rbegin(); it != samples.rend(); ++it) {
-        decode::Sample sample = *it;
-        CHECK(sample.type == last_sample.type);
-        if (sample.pts < last_sample.pts && sample.dts < last_sample.dts) {
-          filtered.push_back(sample);
-          last_sample = sample;
+  template <int Type>
+  static void RemoveOverlappingSamples(Track<Type>& track) {
+    // Samples of an input that reach into the next one are dropped: going backwards, each input keeps the samples
+    // before the first one kept from the inputs that follow. Samples increase within an input, so that is a prefix.
+    bool first = true;
+    int64_t next_pts = 0;
+    int64_t next_dts = 0;
+    for (auto input = track.inputs.rbegin(); input != track.inputs.rend(); ++input) {
+      if (!first) {
+        uint32_t low = input->start;
+        uint32_t high = input->start + input->count;
+        while (low < high) {  // first sample overlapping the next inputs
+          const uint32_t mid = low + (high - low) / 2;
+          const auto sample = track.local_sample(*input, mid).shift(input->offset);
+          if (sample.pts < next_pts && sample.dts < next_dts) {
+            low = mid + 1;
+          } else {
+            high = mid;
+          }
         }
+        input->count = low - input->start;
+      }
+      if (input->count) {
+        const auto sample = track.local_sample(*input, input->start).shift(input->offset);
+        next_pts = sample.pts;
+        next_dts = sample.dts;
+        first = false;
       }
     }
-    reverse(filtered.begin(), filtered.end());
-    return filtered;
+    track.first_indices.clear();
+    track.count = 0;
+    for (const auto& input: track.inputs) {
+      track.first_indices.push_back(track.count);
+      track.count += input.count;
+    }
   };
 
   _Stitch(const vector<functional::Audio<decode::Sample>>& audio_tracks,
@@ -176,11 +221,10 @@ struct _Stitch {
       THROW_IF(video_settings.width != video.settings.width, InvalidArguments);
       THROW_IF(video_settings.height != video.settings.height, InvalidArguments);
       THROW_IF(video_settings.orientation != video.settings.orientation, InvalidArguments);
-      auto video_samples = video_track.vectorize();
-      adjust_timescale(video_samples, video.settings.timescale, video_settings.timescale);
+      auto video_input = Track<SampleType::Video>::Input{ video_track, video_settings.timescale, 0, 0, video_track.count() };
 
       // Unpack audio track (if any) - check for settings match
-      auto audio_samples = vector<decode::Sample>();
+      auto audio_input = Track<SampleType::Audio>::Input{ audio_tracks.size() ? audio_tracks[i] : functional::Audio<decode::Sample>(), audio.settings.timescale, 0, 0, 0 };
       if (input_has_audio) {
         const auto& audio_track = audio_tracks[i];
         const auto audio_settings = audio_track.settings();
@@ -188,7 +232,7 @@ struct _Stitch {
         THROW_IF(audio_settings.timescale != audio.settings.timescale, InvalidArguments);
         THROW_IF(audio_settings.sample_rate != audio.settings.sample_rate, InvalidArguments);
         THROW_IF(audio_settings.channels != audio.settings.channels, InvalidArguments);
-        audio_samples = audio_track.vectorize();
+        audio_input.count = audio_track.count();
       }
 
       // Unpack edit boxes (if any) - adjust timescale if necessary
@@ -206,35 +250,36 @@ struct _Stitch {
       }
 
       // Calculate video duration
-      THROW_IF(video_samples.size() == 0, InvalidArguments, "Every video track must contain data");
-      uint64_t video_duration = CalculateDuration(video_samples);
+      THROW_IF(video_input.count == 0, InvalidArguments, "Every video track must contain data");
+      uint64_t video_duration = CalculateDuration(video, video_input);
       if (video_duration == 0) {
         // happens if there's a single frame in track
-        THROW_IF(video_samples.size() == 1, Unsupported, "Single frame inputs are not supported");
+        THROW_IF(video_input.count == 1, Unsupported, "Single frame inputs are not supported");
       }
       CHECK(video_duration != 0);
 
       // Append video samples and edit boxes
-      auto first_video_sample = video_samples.front();
+      auto first_video_sample = video.local_sample(video_input, 0);
       int64_t video_offset = video.duration - first_video_sample.dts;
-      shift_and_append_samples(video_samples, video.samples, video_offset);
+      video_input.offset = video_offset;
+      video.append(video_input);
       if (input_has_edit_boxes) {
         if (video_edit_boxes.size()) {
           shift_and_append_editboxes(video_edit_boxes, video.edit_boxes, video_offset);
         } else {
           // add an edit box that spans the entire track if missing for current track
-          video.edit_boxes.push_back(common::EditBox(video_samples.front().shift(video_offset).dts, video_duration, 1.0f, SampleType::Video));
+          video.edit_boxes.push_back(common::EditBox(first_video_sample.shift(video_offset).dts, video_duration, 1.0f, SampleType::Video));
         }
       }
       video.duration += video_duration;
 
       if (input_has_audio) {
         // Calculate audio duration based on corresponding video track - trim the end if longer than video duration (actual trimming happens via RemoveOverlappingSamples)
-        THROW_IF(audio_samples.size() == 0, InvalidArguments, "Every audio track must contain data");
+        THROW_IF(audio_input.count == 0, InvalidArguments, "Every audio track must contain data");
         uint64_t audio_duration = 0;
         if (audio_edit_boxes.size()) {
           // audio edit boxes present - retain all input samples
-          audio_duration = CalculateDuration(audio_samples);
+          audio_duration = CalculateDuration(audio, audio_input);
         } else if (video_edit_boxes.size()) {
           // no audio edit boxes - video edit boxes present - trim audio samples beyond video duration from edit boxes
           audio_duration = common::round_divide(CalculateDuration(video_edit_boxes), (uint64_t)audio.settings.timescale, (uint64_t)video.settings.timescale);
@@ -244,23 +289,26 @@ struct _Stitch {
         }
 
         // Append audio samples and edit boxes
-        auto first_audio_sample = audio_samples.front();
+        auto first_audio_sample = audio.local_sample(audio_input, 0);
         THROW_IF(first_video_sample.dts < 0, Unsupported);
         int64_t audio_video_gap = first_audio_sample.dts - common::round_divide((uint64_t)first_video_sample.dts, (uint64_t)audio.settings.timescale, (uint64_t)video.settings.timescale);
         int64_t audio_offset = audio.duration - first_audio_sample.dts + audio_video_gap;
-        shift_and_append_samples(audio_samples, audio.samples, audio_offset);
+        audio_input.offset = audio_offset;
+        audio_input.start = SkippedSamples(audio, audio_input);
+        audio_input.count -= audio_input.start;
+        audio.append(audio_input);
         if (input_has_edit_boxes) {
           if (audio_edit_boxes.size()) {
             shift_and_append_editboxes(audio_edit_boxes, audio.edit_boxes, audio_offset);
           } else {
             // add an edit box that spans the entire track if missing for current track
-            audio.edit_boxes.push_back(common::EditBox(audio_samples.front().shift(audio_offset).dts, audio_duration, 1.0f, SampleType::Audio));
+            audio.edit_boxes.push_back(common::EditBox(first_audio_sample.shift(audio_offset).dts, audio_duration, 1.0f, SampleType::Audio));
           }
         }
         audio.duration += audio_duration;
       }
     }
-    audio.samples = RemoveOverlappingSamples(audio.samples);  // trim extra audio samples
+    RemoveOverlappingSamples(audio);  // trim extra audio samples
   }
 };
 
@@ -269,9 +317,9 @@ Stitch::Stitch(const vector<functional::Audio<decode::Sample>> audio_tracks,
                const vector<vector<common::EditBox>> edit_boxes_per_track)
   : _this(make_shared<_Stitch>(audio_tracks, video_tracks, edit_boxes_per_track)), audio_track(_this), video_track(_this) {
   audio_track._settings = _this->audio.settings;
-  audio_track.set_bounds(0, (uint32_t)_this->audio.samples.size());
+  audio_track.set_bounds(0, (uint32_t)_this->audio.count);
   video_track._settings = _this->video.settings;
-  video_track.set_bounds(0, (uint32_t)_this->video.samples.size());
+  video_track.set_bounds(0, (uint32_t)_this->video.count);
 }
 
 Stitch::Stitch(const Stitch& stitch) : _this(stitch._this), audio_track(_this), video_track(_this) {}
@@ -302,8 +350,7 @@ auto Stitch::VideoTrack::fps() const -> float {
 auto Stitch::VideoTrack::operator()(const uint32_t index) const -> decode::Sample {
   THROW_IF(index < a() || index >= b(), OutOfRange,
            "index (" << index << ") has to be in range [" << a() << ", " << b() << ")");
-  CHECK(index < _this->video.samples.size());
-  return _this->video.samples[index];
+  return _this->video.sample(index);
 }
 
 Stitch::AudioTrack::AudioTrack(const std::shared_ptr<_Stitch>& _this) : _this(_this) {}
@@ -322,8 +369,7 @@ auto Stitch::AudioTrack::edit_boxes() const -> const vector<common::EditBox>& {
 auto Stitch::AudioTrack::operator()(const uint32_t index) const -> decode::Sample {
   THROW_IF(index < a() || index >= b(), OutOfRange,
            "index (" << index << ") has to be in range [" << a() << ", " << b() << ")");
-  CHECK(index < _this->audio.samples.size());
-  return _this->audio.samples[index];
+  return _this->audio.sample(index);
 }
 
 }}
@@ -212,7 +212,7 @@ struct _Trim {
         for (uint32_t index = (uint32_t)gop.start_keyframe_index; index <= (uint32_t)gop.end_index; ++index) {
           auto& sample = in_samples[index];
           THROW_IF(sample.type != type, Invalid);
-          out_samples.push_back((decode::Sample){ sample.pts - first_dts, sample.dts - first_dts, sample.keyframe, sample.type, sample.nal });
+          out_samples.push_back(decode::Sample(sample, sample.pts - first_dts, sample.dts - first_dts));  // keeps the byte range
         }
         duration = CalculateDuration(out_samples);  // consistent with the l-smash behavior, duration is reported as the total duration of all samples, irrespective of the contained edit boxes
       }
@@ -24,10 +24,14 @@
 
 #pragma once
 
+#include <fcntl.h>
 #include <iomanip>
 #include <fstream>
+#include <unistd.h>
 
+#include "vireo/common/chain.h"
 #include "vireo/common/data.h"
+#include "vireo/error/error.h"
 
 namespace vireo {
 namespace util {
@@ -57,4 +61,16 @@ static inline void save(const string filename, const common::Data32& data) {
   ostream.close();
 }
 
+static inline void save(const string filename, const common::Chain& chain) {
+  const int file_descriptor = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  THROW_IF(file_descriptor < 0, WriterError, "cannot open " << filename);
+  __try {
+    chain.write(file_descriptor);
+  } __catch (...) {
+    close(file_descriptor);
+    __throw_exception_again;
+  }
+  close(file_descriptor);
+}
+
 }}